@@ -19,18 +19,21 @@
 // This file defines the template class Cache, which is a fixed-size generic
 // cache that stores key-value pairs. Users will need to supply methods to load
 // and free elements in child classes. It also supports asynchronous pre-emptive
-// loading with C++11 threads.
+// loading with C++11 threads. When full, the least recently used element is
+// evicted. Elements can be pinned to keep them from being evicted.
 
 #ifndef CACHE_HPP
 #define CACHE_HPP
 
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <list>
 #include <map>
 #include <mutex>
-#include <queue>
 #include <set>
 #include <thread>
+#include <utility>
 #include <vector>
 
 // A generic cache that stores <key, value> pairs. The semantics for Load() and
@@ -51,16 +54,49 @@ class Cache {
   virtual ~Cache();
   // Retrieves an item. If the item is in the cache, simply returns it. If
   // not, loads it using the Load() function defined in an implementation.
+  // Marks the item as most recently used.
   V Get(const K& key);
+  // Retrieves an item only if it is already in the cache. Returns true and
+  // stores the item in value if found, marking it as most recently used;
+  // otherwise returns false without loading anything.
+  bool TryGet(const K& key, V* value);
+  // Same as TryGet(), but does not mark the item as used, so that looking at
+  // an item does not keep it from being evicted.
+  bool Peek(const K& key, V* value);
+  // Same as Get(), but waits at most timeout_ms milliseconds for the item to
+  // be loaded. Returns true and stores the item in value if it is loaded by
+  // then; otherwise returns false, and the item goes on loading in the
+  // background.
+  bool GetFor(const K& key, V* value, int timeout_ms);
+  // Returns a snapshot of all items currently in the cache.
+  std::vector<std::pair<K, V>> GetEntries();
   // Starts a new thread to load an item into the cache. Note that this puts a
   // lock on this cache object, and calls to Get() while the asynchronous
   // loading is in progress will block.
   void Prepare(const K& key);
+  // Loads an item into the cache in the calling thread, unless it is already
+  // in the cache or being loaded by another thread. Unlike Prepare(), the item
+  // is loaded at the scheduling priority of the caller. Does not mark the item
+  // as used.
+  void Fetch(const K& key);
+  // Pins an item, so that once it is loaded it is never evicted and does not
+  // count towards the size of the cache. Does not load the item. Pins are
+  // counted, so an item pinned twice stays pinned until unpinned twice.
+  void Pin(const K& key);
+  // Undoes one call to Pin(). Once an item is no longer pinned, it becomes the
+  // most recently used item, and may be evicted as usual.
+  void Unpin(const K& key);
+  // Removes an item from the cache, if it is loaded, and calls Discard() on
+  // it, so that the next Get() loads it again. Pins are kept.
+  void Remove(const K& key);
   // Returns the size of the cache.
   int GetSize() const;
+  // Changes the size of the cache, evicting the least recently used items if
+  // it is now too large.
+  void SetSize(int size);
   // Clears the cache, calling Discard() on all existing elements. Waits for
-  // background loading threads to terminate first. MUST BE CALLED from the
-  // destructor of a child class.
+  // background loading threads, and Discard() calls on evicted elements, to
+  // terminate first. MUST BE CALLED from the destructor of a child class.
   void Clear();
 
  protected:
@@ -76,15 +112,31 @@ class Cache {
   std::mutex _mutex;
   // A map from keys to values.
   std::map<K, V> _map;
-  // A queue of loaded keys, in the order they were loaded. This is used for
-  // eviction.
-  std::queue<K> _queue;
+  // Loaded keys that are not pinned, from least to most recently used. This is
+  // used for eviction.
+  std::list<K> _queue;
+  // The position of each loaded key in _queue.
+  std::map<K, typename std::list<K>::iterator> _queue_positions;
   // Max size of this cache.
   int _size;
+  // The number of times each pinned key has been pinned.
+  std::map<K, int> _pin_counts;
   // Keys that are being loaded by some thread.
   std::set<K> _work_set;
+  // The number of evicted elements being discarded by some thread.
+  int _num_discards;
   // Condition variable used to broadcast work done.
   std::condition_variable _condition;
+
+  // Moves a loaded key to the most recently used end of _queue, unless it is
+  // pinned. Must be called with _mutex held.
+  void Touch(const K& key);
+  // Adds a loaded key to the most recently used end of _queue, and evicts
+  // entries while the cache is too large. Must be called with _mutex held.
+  void Enqueue(const K& key);
+  // Evicts the least recently used entries in separate threads while the
+  // cache is too large. Must be called with _mutex held.
+  void Evict();
 };
 
 
@@ -93,7 +145,7 @@ class Cache {
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 template <typename K, typename V>
 Cache<K, V>::Cache(int size)
-    : _size(size) {
+    : _size(size), _num_discards(0) {
 }
 
 template <typename K, typename V>
@@ -108,6 +160,7 @@ V Cache<K, V>::Get(const K& key) {
     // 1. If key is already loaded, return the corresponding value.
     auto i = _map.find(key);
     if (i != _map.end()) {
+      Touch(key);
       return i->second;
     }
 
@@ -131,59 +184,128 @@ V Cache<K, V>::Get(const K& key) {
 }
 
 template <typename K, typename V>
-void Cache<K, V>::Prepare(const K& key) {
-  std::thread thread([=] (const K& key) {
-    {
-      std::unique_lock<std::mutex> lock(_mutex);
+bool Cache<K, V>::TryGet(const K& key, V* value) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto i = _map.find(key);
+  if (i == _map.end()) {
+    return false;
+  }
+  Touch(key);
+  *value = i->second;
+  return true;
+}
+
+template <typename K, typename V>
+bool Cache<K, V>::Peek(const K& key, V* value) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto i = _map.find(key);
+  if (i == _map.end()) {
+    return false;
+  }
+  *value = i->second;
+  return true;
+}
 
-      // 1. If key is already in the cache or being loaded by another thread, no
-      // need to do extra work.
-      if (_map.count(key) || _work_set.count(key)) {
-        _condition.notify_all();
-        return;
-      }
-      // 2. Tell other threads we're going to load the key.
-      _work_set.insert(key);
+template <typename K, typename V>
+bool Cache<K, V>::GetFor(const K& key, V* value, int timeout_ms) {
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeout_ms);
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    // 1. If key is already loaded, return the corresponding value.
+    auto i = _map.find(key);
+    if (i != _map.end()) {
+      Touch(key);
+      *value = i->second;
+      return true;
     }
 
-    // 3. Do the actual loading.
-    V value = Load(key);
+    // 2. Otherwise, schedule loading unless another thread is loading it
+    // already, and wait for a notification until the deadline. See Get().
+    if (!_work_set.count(key)) {
+      Prepare(key);
+    }
+    if (_condition.wait_until(lock, deadline) == std::cv_status::timeout) {
+      return false;
+    }
+  }
+}
 
-    {
-      std::unique_lock<std::mutex> lock(_mutex);
+template <typename K, typename V>
+std::vector<std::pair<K, V>> Cache<K, V>::GetEntries() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return std::vector<std::pair<K, V>>(_map.begin(), _map.end());
+}
 
-      // 4. Tell other threads we're done.
-      assert(_work_set.count(key));
-      _work_set.erase(key);
+template <typename K, typename V>
+void Cache<K, V>::Prepare(const K& key) {
+  std::thread thread([=] (const K& key) {
+    Fetch(key);
+  }, key);
 
-      // 5. Add (key, value) to cache.
-      assert(!_map.count(key));
-      _map[key] = value;
+  thread.detach();
+}
 
-      // 6. Add key to queue.
-      _queue.push(key);
+template <typename K, typename V>
+void Cache<K, V>::Fetch(const K& key) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
 
-      // 7. If the cache size is now too large, evict some entries in separate
-      // threads.
-      while (_queue.size() >= static_cast<size_t>(_size)) {
-        K evicted_key = _queue.front();
-        V evicted_value = _map[evicted_key];
+    // 1. If key is already in the cache or being loaded by another thread, no
+    // need to do extra work.
+    if (_map.count(key) || _work_set.count(key)) {
+      _condition.notify_all();
+      return;
+    }
+    // 2. Tell other threads we're going to load the key.
+    _work_set.insert(key);
+  }
 
-        _map.erase(evicted_key);
-        _queue.pop();
+  // 3. Do the actual loading.
+  V value = Load(key);
 
-        std::thread eviction_thread([=] {
-          Discard(evicted_key, evicted_value);
-        });
-        eviction_thread.detach();
-      }
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // 4. Tell other threads we're done.
+    assert(_work_set.count(key));
+    _work_set.erase(key);
+
+    // 5. Add (key, value) to cache.
+    assert(!_map.count(key));
+    _map[key] = value;
+
+    // 6. Add key to queue as the most recently used, and if the cache size is
+    // now too large, evict the least recently used entries. Pinned keys are
+    // kept out of the queue.
+    if (!_pin_counts.count(key)) {
+      Enqueue(key);
     }
+  }
 
-    // 8. Finally, let everyone know the cache was modified.
-    _condition.notify_all();
-  }, key);
+  // 7. Finally, let everyone know the cache was modified.
+  _condition.notify_all();
+}
 
-  thread.detach();
+template <typename K, typename V>
+void Cache<K, V>::Remove(const K& key) {
+  V value;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto i = _map.find(key);
+    if (i == _map.end()) {
+      return;
+    }
+    value = i->second;
+    _map.erase(i);
+    auto j = _queue_positions.find(key);
+    if (j != _queue_positions.end()) {
+      _queue.erase(j->second);
+      _queue_positions.erase(j);
+    }
+  }
+  Discard(key, value);
 }
 
 template <typename K, typename V>
@@ -191,17 +313,24 @@ int Cache<K, V>::GetSize() const {
   return _size;
 }
 
+template <typename K, typename V>
+void Cache<K, V>::SetSize(int size) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _size = size;
+  Evict();
+}
+
 template <typename K, typename V>
 void Cache<K, V>::Clear() {
   std::vector<std::thread> discard_threads;
   {
     std::unique_lock<std::mutex> lock(_mutex);
-    // 1. Block until all ongoing loads are complete.
-    _condition.wait(lock, [=] { return _work_set.empty(); });
+    // 1. Block until all ongoing loads and evictions are complete.
+    _condition.wait(
+        lock, [=] { return _work_set.empty() && (_num_discards == 0); });
     // 2. Clear queue.
-    while (_queue.size()) {
-      _queue.pop();
-    }
+    _queue.clear();
+    _queue_positions.clear();
     // 3. Clear cache and start a thread to call Discard() on each entry.
     for (auto& i : _map) {
       K key = i.first;
@@ -217,5 +346,69 @@ void Cache<K, V>::Clear() {
   }
 }
 
+template <typename K, typename V>
+void Cache<K, V>::Pin(const K& key) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (++_pin_counts[key] > 1) {
+    return;
+  }
+  auto i = _queue_positions.find(key);
+  if (i != _queue_positions.end()) {
+    _queue.erase(i->second);
+    _queue_positions.erase(i);
+  }
+}
+
+template <typename K, typename V>
+void Cache<K, V>::Unpin(const K& key) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto i = _pin_counts.find(key);
+  assert(i != _pin_counts.end());
+  if (--i->second > 0) {
+    return;
+  }
+  _pin_counts.erase(i);
+  if (_map.count(key)) {
+    Enqueue(key);
+  }
+}
+
+template <typename K, typename V>
+void Cache<K, V>::Touch(const K& key) {
+  auto i = _queue_positions.find(key);
+  if (i != _queue_positions.end()) {
+    _queue.splice(_queue.end(), _queue, i->second);
+  }
+}
+
+template <typename K, typename V>
+void Cache<K, V>::Enqueue(const K& key) {
+  _queue_positions[key] = _queue.insert(_queue.end(), key);
+  Evict();
+}
+
+template <typename K, typename V>
+void Cache<K, V>::Evict() {
+  while (_queue.size() >= static_cast<size_t>(_size)) {
+    K evicted_key = _queue.front();
+    V evicted_value = _map[evicted_key];
+
+    _map.erase(evicted_key);
+    _queue_positions.erase(evicted_key);
+    _queue.pop_front();
+
+    ++_num_discards;
+    std::thread eviction_thread([=] {
+      Discard(evicted_key, evicted_value);
+      // Notify with the lock held, since Clear() may return and the cache may
+      // be destroyed as soon as it is released.
+      std::unique_lock<std::mutex> lock(_mutex);
+      --_num_discards;
+      _condition.notify_all();
+    });
+    eviction_thread.detach();
+  }
+}
+
 #endif
 
@@ -0,0 +1,290 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the DiskCache class.
+
+#include "disk_cache.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Creates a directory and its parents. Returns false on failure.
+bool MakeDirectories(const std::string& path) {
+  for (size_t pos = path.find('/', 1);; pos = path.find('/', pos + 1)) {
+    const std::string& dir = path.substr(0, pos);
+    if ((mkdir(dir.c_str(), 0700) != 0) && (errno != EEXIST)) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+// Adds bytes to a 64-bit FNV-1a hash.
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+DiskCache* DiskCache::Open(const std::string& dir, int64_t max_size) {
+  std::unique_ptr<DiskCache> cache(new DiskCache(dir, max_size));
+  if (!MakeDirectories(cache->_pages_dir) ||
+      !MakeDirectories(cache->_positions_dir)) {
+    return nullptr;
+  }
+  // Count the pages stored by previous sessions, and remove some if there
+  // are too many.
+  cache->CollectGarbage();
+  return cache.release();
+}
+
+std::string DiskCache::GetDefaultDir() {
+  // Find the cache directory, per the XDG base directory specification.
+  const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if ((xdg_cache_home != nullptr) && (xdg_cache_home[0] == '/')) {
+    return std::string(xdg_cache_home) + "/jfbview";
+  } else if ((home != nullptr) && (home[0] == '/')) {
+    return std::string(home) + "/.cache/jfbview";
+  }
+  return std::string();
+}
+
+std::string DiskCache::GetFingerprint(const std::string& path) {
+  // 1. Hash the size and modification time.
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return std::string();
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return std::string();
+  }
+  uint64_t hash = HashBytes(
+      0xcbf29ce484222325ull, &file_stat.st_size, sizeof(file_stat.st_size));
+  hash = HashBytes(hash, &file_stat.st_mtim, sizeof(file_stat.st_mtim));
+
+  // 2. Hash samples spread evenly over the content, or all of it if it is
+  // small.
+  const int64_t size = file_stat.st_size;
+  const int64_t num_samples = NUM_FINGERPRINT_SAMPLES;
+  const int64_t sample_size = std::min<int64_t>(
+      {FINGERPRINT_SAMPLE_SIZE, size / num_samples + 1, size});
+  std::vector<uint8_t> sample(sample_size);
+  for (int64_t i = 0; i < num_samples; ++i) {
+    const int64_t offset =
+        (size - sample_size) * i / std::max<int64_t>(num_samples - 1, 1);
+    const ssize_t n = pread(fd, sample.data(), sample_size, offset);
+    if (n < 0) {
+      close(fd);
+      return std::string();
+    }
+    hash = HashBytes(hash, sample.data(), n);
+  }
+  close(fd);
+
+  char fingerprint[17];
+  snprintf(
+      fingerprint, sizeof(fingerprint), "%016llx",
+      static_cast<unsigned long long>(hash));
+  return fingerprint;
+}
+
+bool DiskCache::Store(const std::string& key, const CompressedImage& image) {
+  std::vector<uint8_t> data;
+  image.Serialize(&data);
+  if (!WriteFile(GetPagePath(key), data.data(), data.size())) {
+    return false;
+  }
+  bool collect_garbage;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _size += data.size();
+    collect_garbage = _size > _max_size;
+  }
+  if (collect_garbage) {
+    CollectGarbage();
+  }
+  return true;
+}
+
+CompressedImage* DiskCache::Load(const std::string& key) {
+  // 1. Map the file.
+  const std::string path = GetPagePath(key);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat file_stat;
+  void* memory = MAP_FAILED;
+  if ((fstat(fd, &file_stat) == 0) && (file_stat.st_size > 0)) {
+    memory = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // Mark the page as recently used for garbage collection.
+  futimens(fd, nullptr);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // 2. Read the page in place. The mapping is released with the page.
+  const size_t size = file_stat.st_size;
+  std::shared_ptr<const void> mapping(memory, [size](const void* memory) {
+    munmap(const_cast<void*>(memory), size);
+  });
+  CompressedImage* image = CompressedImage::Deserialize(
+      static_cast<const uint8_t*>(memory), size, mapping);
+  if (image == nullptr) {
+    unlink(path.c_str());
+  }
+  return image;
+}
+
+bool DiskCache::Contains(const std::string& key) const {
+  return access(GetPagePath(key).c_str(), F_OK) == 0;
+}
+
+bool DiskCache::StorePosition(
+    const std::string& fingerprint, const std::string& position) {
+  const std::string line = position + "\n";
+  return WriteFile(
+      _positions_dir + "/" + fingerprint, line.data(), line.size());
+}
+
+bool DiskCache::LoadPosition(
+    const std::string& fingerprint, std::string* position) {
+  FILE* file = fopen((_positions_dir + "/" + fingerprint).c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char line[256];
+  const bool success = fgets(line, sizeof(line), file) != nullptr;
+  fclose(file);
+  if (success) {
+    *position = line;
+    position->erase(position->find_last_not_of('\n') + 1);
+  }
+  return success;
+}
+
+void DiskCache::CollectGarbage() {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // 1. List pages with their sizes and last use.
+  DIR* dir = opendir(_pages_dir.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  std::vector<std::pair<struct timespec, std::string>> pages;
+  std::vector<int64_t> sizes;
+  int64_t total_size = 0;
+  for (struct dirent* entry; (entry = readdir(dir)) != nullptr;) {
+    const std::string path = _pages_dir + "/" + entry->d_name;
+    struct stat file_stat;
+    if ((entry->d_name[0] == '.') || (stat(path.c_str(), &file_stat) != 0) ||
+        !S_ISREG(file_stat.st_mode)) {
+      continue;
+    }
+    pages.push_back(std::make_pair(file_stat.st_mtim, path));
+    sizes.push_back(file_stat.st_size);
+    total_size += file_stat.st_size;
+  }
+  closedir(dir);
+
+  // 2. If they take up too much space, remove the least recently used ones.
+  if (total_size > _max_size) {
+    std::vector<size_t> order(pages.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&pages](size_t a, size_t b) {
+      const struct timespec& x = pages[a].first;
+      const struct timespec& y = pages[b].first;
+      return (x.tv_sec != y.tv_sec) ? (x.tv_sec < y.tv_sec)
+                                    : (x.tv_nsec < y.tv_nsec);
+    });
+    const int64_t target_size =
+        _max_size * GARBAGE_COLLECTION_TARGET_PERCENT / 100;
+    for (size_t i = 0; (i < order.size()) && (total_size > target_size);
+         ++i) {
+      if (unlink(pages[order[i]].second.c_str()) == 0) {
+        total_size -= sizes[order[i]];
+      }
+    }
+  }
+  _size = total_size;
+}
+
+DiskCache::DiskCache(const std::string& dir, int64_t max_size)
+    : _pages_dir(dir + "/pages"),
+      _positions_dir(dir + "/positions"),
+      _max_size(max_size),
+      _size(0) {}
+
+std::string DiskCache::GetPagePath(const std::string& key) const {
+  return _pages_dir + "/" + key;
+}
+
+bool DiskCache::WriteFile(
+    const std::string& path, const void* data, size_t size) {
+  // Write to a temporary file first, and rename it over the old one, so that
+  // readers see either the old file or the new one in full.
+  std::vector<char> temp_path(path.begin(), path.end());
+  const char* const temp_suffix = ".XXXXXX";
+  temp_path.insert(temp_path.end(), temp_suffix, temp_suffix + 8);
+  const int fd = mkstemp(temp_path.data());
+  if (fd == -1) {
+    return false;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  bool success = true;
+  while (success && (size > 0)) {
+    const ssize_t n = write(fd, bytes, size);
+    success = n > 0;
+    if (success) {
+      bytes += n;
+      size -= n;
+    }
+  }
+  success = (close(fd) == 0) && success &&
+            (rename(temp_path.data(), path.c_str()) == 0);
+  if (!success) {
+    unlink(temp_path.data());
+  }
+  return success;
+}
@@ -0,0 +1,105 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the DiskCache class, which keeps rendered pages on disk
+// across sessions.
+
+#ifndef DISK_CACHE_HPP
+#define DISK_CACHE_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "image_codec.hpp"
+
+// A directory of compressed rendered pages, and of the last position read in
+// each document, shared by all sessions of the user. Pages are stored one per
+// file in the format written by CompressedImage::Serialize(), and are mapped
+// into memory and decompressed in place when loaded. Files are replaced by
+// renaming and removed by unlinking, but never modified in place, so that a
+// page mapped by one session stays valid while another one writes. Once the
+// pages take up more than the size limit, the least recently used ones are
+// removed. Thread-safe.
+class DiskCache {
+ public:
+  // Number and size of the samples of a document's content hashed into its
+  // fingerprint.
+  enum { NUM_FINGERPRINT_SAMPLES = 16, FINGERPRINT_SAMPLE_SIZE = 4096 };
+  // Garbage collection removes pages until they take up at most this share
+  // of the size limit, in percent, so that it does not run on every store.
+  enum { GARBAGE_COLLECTION_TARGET_PERCENT = 75 };
+
+  // Opens a cache directory holding at most max_size bytes of pages, creating
+  // it if needed. Returns nullptr on failure. Caller owns returned value.
+  static DiskCache* Open(const std::string& dir, int64_t max_size);
+  // Returns the default cache directory under the user's cache directory, or
+  // an empty string if there is no suitable location.
+  static std::string GetDefaultDir();
+  // Returns a string identifying the content of a file, derived from its size,
+  // modification time and a hash of samples of its content. This is cheap even
+  // for large files. Returns an empty string if the file cannot be read.
+  static std::string GetFingerprint(const std::string& path);
+
+  // Stores a page under the given key, which may contain any characters but
+  // '/'. Returns false on failure.
+  bool Store(const std::string& key, const CompressedImage& image);
+  // Loads the page stored under the given key, and marks it as recently used.
+  // Returns nullptr if there is none. Caller owns returned value.
+  CompressedImage* Load(const std::string& key);
+  // Returns whether a page is stored under the given key.
+  bool Contains(const std::string& key) const;
+
+  // Stores the position last read in a document, identified by its
+  // fingerprint. The position is an arbitrary line of text.
+  bool StorePosition(
+      const std::string& fingerprint, const std::string& position);
+  // Loads the position last read in a document. Returns false if there is
+  // none.
+  bool LoadPosition(const std::string& fingerprint, std::string* position);
+
+  // Removes the least recently used pages until the pages take up at most
+  // GARBAGE_COLLECTION_TARGET_PERCENT of the size limit.
+  void CollectGarbage();
+
+ private:
+  // Directories holding pages and positions.
+  const std::string _pages_dir;
+  const std::string _positions_dir;
+  // Maximum number of bytes of pages.
+  const int64_t _max_size;
+  // Lock on _size, and on garbage collection.
+  std::mutex _mutex;
+  // Number of bytes of pages, counted at the last garbage collection plus
+  // those stored since.
+  int64_t _size;
+
+  DiskCache(const std::string& dir, int64_t max_size);
+
+  // Returns the path of the page stored under a key.
+  std::string GetPagePath(const std::string& key) const;
+  // Writes data to path, replacing any existing file in one step. Returns
+  // false on failure.
+  static bool WriteFile(const std::string& path, const void* data, size_t size);
+
+  // Disable copy and assign.
+  DiskCache(const DiskCache&);
+  DiskCache& operator=(const DiskCache&);
+};
+
+#endif
@@ -39,6 +39,31 @@ const Document::OutlineItem* Document::OutlineItem::GetChild(int i) const {
   return _children[i].get();
 }
 
+bool Document::PixelWriter::IsGray() const { return false; }
+
+void Document::PixelWriter::WriteGray(int x, int y, uint8_t value) {
+  Write(x, y, value, value, value);
+}
+
+bool Document::IsGray(int page) { return false; }
+
+void Document::Warm(int page, float zoom, int rotation) {}
+
+void Document::SetDiskCache(
+    DiskCache* disk_cache, const std::string& document_id) {}
+
+void Document::ReleaseMemory() {}
+
+std::vector<int> Document::GetLinkedPages(int page) {
+  return std::vector<int>();
+}
+
+std::vector<Document::SearchHit> Document::SearchOnPageOf(
+    Document* doc, const std::string& search_string, int page,
+    int context_length) {
+  return doc->SearchOnPage(search_string, page, context_length);
+}
+
 Document::SearchResult Document::Search(
     const std::string& search_string,
     int start_page,
@@ -26,6 +26,8 @@
 #include <string>
 #include <vector>
 
+class DiskCache;
+
 // An abstraction for a document.
 class Document {
  public:
@@ -44,6 +46,13 @@ class Document {
     // Writes a pixel value (r, g, b) to position (x, y). It is important that
     // Write be thread-safe when called with different (x, y).
     virtual void Write(int x, int y, uint8_t r, uint8_t g, uint8_t b) = 0;
+    // Returns true if the writer only stores gray levels, in which case
+    // Render() may call WriteGray() instead of Write(). The default
+    // implementation returns false.
+    virtual bool IsGray() const;
+    // Writes a gray level to position (x, y). Same thread-safety requirements
+    // as Write(). The default implementation calls Write().
+    virtual void WriteGray(int x, int y, uint8_t value);
   };
 
   // An item in a outline. An item may contain further children items.
@@ -105,6 +114,28 @@ class Document {
   // to store that pixel value somewhere.
   virtual void Render(PixelWriter* pw, int page, float zoom, int rotation) = 0;
 
+  // Returns true if the given page has no color, so that rendering it in
+  // grayscale loses nothing. This may take as long as interpreting the page.
+  // The default implementation returns false.
+  virtual bool IsGray(int page);
+
+  // Prepares to render the given page with the given parameters without
+  // rendering it, e.g. by loading fonts and decoding images into the caches of
+  // the underlying library. This is much cheaper than Render() in both time
+  // and memory. The default implementation does nothing.
+  virtual void Warm(int page, float zoom, int rotation);
+
+  // Lets the document keep data it derives from its content across sessions
+  // in the given disk cache, under keys starting with document_id, which
+  // identifies the content. The default implementation does nothing.
+  virtual void SetDiskCache(
+      DiskCache* disk_cache, const std::string& document_id);
+
+  // Frees memory held by caches of the underlying library, such as decoded
+  // fonts and images, at the cost of slower renders until they are rebuilt.
+  // The default implementation does nothing.
+  virtual void ReleaseMemory();
+
   // Returns the outline of this document. The returned item represents the
   // top-level element in the outline, and is owned by the caller. If the
   // document does not have an outline, return nullptr.
@@ -114,9 +145,14 @@ class Document {
   // returns -1.
   virtual int Lookup(const OutlineItem* item) = 0;
 
+  // Returns the pages that links on a page point to, in the order the links
+  // appear on the page, without duplicates. The default implementation
+  // returns no pages.
+  virtual std::vector<int> GetLinkedPages(int page);
+
   // Searches the text of the document. Will return up to max_num_search_hits
   // search hits starting from the given page.
-  SearchResult Search(
+  virtual SearchResult Search(
       const std::string& search_string, int start_page, int context_length,
       int max_num_search_hits);
 
@@ -124,6 +160,10 @@ class Document {
   // Performs a text search on a given page.
   virtual std::vector<SearchHit> SearchOnPage(
       const std::string& search_string, int page, int context_length) = 0;
+  // Calls SearchOnPage() on another document, for documents that wrap one.
+  static std::vector<SearchHit> SearchOnPageOf(
+      Document* doc, const std::string& search_string, int page,
+      int context_length);
 };
 
 #endif
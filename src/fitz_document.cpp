@@ -21,21 +21,181 @@
 
 #include "fitz_document.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
 
+#include "disk_cache.hpp"
+#include "image_kernels.hpp"
 #include "multithreading.hpp"
 #include "string_utils.hpp"
 
+namespace {
+
+// How far apart the color components of a pixel may be, as a fraction of the
+// full range, for IsGray() to still consider it gray. This tolerates scans
+// with a slight tint.
+const float COLOR_THRESHOLD = 0.02f;
+
+// Writes pixels to pw, in horizontal stripes in parallel. Each pixel is
+// num_components bytes long, and starts with its gray level if gray is true,
+// or its r, g and b values otherwise.
+void WritePixels(
+    const uint8_t* pixels, int width, int height, int stride,
+    int num_components, bool gray, Document::PixelWriter* pw) {
+  ExecuteInParallel([=](int num_threads, int i) {
+    const int num_rows_per_thread = height / num_threads;
+    const int y_begin = i * num_rows_per_thread;
+    const int y_end =
+        (i == num_threads - 1) ? height : (i + 1) * num_rows_per_thread;
+    for (int y = y_begin; y < y_end; ++y) {
+      const uint8_t* p = pixels + y * stride;
+      for (int x = 0; x < width; ++x) {
+        if (gray) {
+          pw->WriteGray(x, y, p[0]);
+        } else {
+          pw->Write(x, y, p[0], p[1], p[2]);
+        }
+        p += num_components;
+      }
+    }
+  });
+}
+
+// Returns the number of clockwise quarter turns an image drawn with the given
+// matrix is rotated by, or -1 if it is skewed, flipped or rotated by another
+// angle. Image space has its origin at the top-left corner of the image.
+int GetImageQuarterTurns(const fz_matrix& ctm) {
+  auto is_zero = [](float value) { return std::fabs(value) < 0.01f; };
+  if (is_zero(ctm.b) && is_zero(ctm.c)) {
+    if ((ctm.a > 0) && (ctm.d > 0)) {
+      return 0;
+    }
+    if ((ctm.a < 0) && (ctm.d < 0)) {
+      return 2;
+    }
+  } else if (is_zero(ctm.a) && is_zero(ctm.d)) {
+    if ((ctm.b > 0) && (ctm.c < 0)) {
+      return 1;
+    }
+    if ((ctm.b < 0) && (ctm.c > 0)) {
+      return 3;
+    }
+  }
+  return -1;
+}
+
+// Runs a display list with the matrix m through a single image device. If the
+// page consists of nothing but one image covering bbox, upright or rotated by
+// quarter turns, returns the image, and stores the matrix it is drawn with in
+// ctm and its rotation in quarter_turns. Otherwise returns nullptr. Caller
+// owns returned value.
+fz_image* FindSingleImage(
+    fz_context* ctx, fz_display_list* list, const fz_matrix& m,
+    const fz_irect& bbox, fz_matrix* ctm, int* quarter_turns) {
+  FitzDeviceScopedPtr dev_ptr(ctx, NewSingleImageDevice(ctx, bbox));
+  fz_run_display_list(ctx, list, dev_ptr.get(), m, fz_infinite_rect, nullptr);
+  fz_close_device(ctx, dev_ptr.get());
+  fz_image* image = GetSingleImage(dev_ptr.get(), ctm);
+  if (image == nullptr) {
+    return nullptr;
+  }
+  *quarter_turns = GetImageQuarterTurns(*ctm);
+  const fz_irect image_bbox =
+      fz_round_rect(fz_transform_rect(fz_unit_rect, *ctm));
+  if ((*quarter_turns < 0) || (std::abs(image_bbox.x0 - bbox.x0) > 1) ||
+      (std::abs(image_bbox.y0 - bbox.y0) > 1) ||
+      (std::abs(image_bbox.x1 - bbox.x1) > 1) ||
+      (std::abs(image_bbox.y1 - bbox.y1) > 1)) {
+    return nullptr;
+  }
+  return fz_keep_image(ctx, image);
+}
+
+// Decodes an image at about the size the matrix ctm draws it at, and
+// resamples it to exactly width x height pixels of gray levels if gray is
+// true, or of r, g and b values otherwise. MuPDF picks the largest power of two
+// to subsample the image by that keeps it at least as large as drawn, which
+// JPEG images are decoded at directly. Returns false if the image cannot be
+// decoded.
+bool DecodeImage(
+    fz_context* ctx, fz_image* image, const fz_matrix& ctm, bool gray,
+    int width, int height, std::vector<uint8_t>* pixels) {
+  // 1. Decode the image, and convert it to gray or RGB without alpha.
+  fz_colorspace* const colorspace =
+      gray ? fz_device_gray(ctx) : fz_device_rgb(ctx);
+  fz_pixmap* pixmap = nullptr;
+  fz_try(ctx) {
+    fz_matrix decode_ctm = ctm;
+    int decoded_width, decoded_height;
+    pixmap = fz_get_pixmap_from_image(
+        ctx, image, nullptr, &decode_ctm, &decoded_width, &decoded_height);
+  }
+  fz_catch(ctx) { return false; }
+  FitzPixmapScopedPtr pixmap_ptr(ctx, pixmap);
+  if (fz_pixmap_alpha(ctx, pixmap_ptr.get())) {
+    return false;
+  }
+  if (fz_pixmap_colorspace(ctx, pixmap_ptr.get()) != colorspace) {
+    fz_pixmap* converted = nullptr;
+    fz_try(ctx) {
+      converted = fz_convert_pixmap(
+          ctx, pixmap_ptr.get(), colorspace, nullptr, nullptr,
+          fz_default_color_params, 0);
+    }
+    fz_catch(ctx) { return false; }
+    pixmap_ptr.reset(converted);
+  }
+
+  // 2. Resample it.
+  const int num_components = gray ? 1 : 3;
+  assert(fz_pixmap_components(ctx, pixmap_ptr.get()) == num_components);
+  pixels->resize(static_cast<size_t>(width) * height * num_components);
+  ResampleBilinear(
+      RawImage(
+          fz_pixmap_samples(ctx, pixmap_ptr.get()),
+          fz_pixmap_width(ctx, pixmap_ptr.get()),
+          fz_pixmap_height(ctx, pixmap_ptr.get()),
+          fz_pixmap_stride(ctx, pixmap_ptr.get()), num_components),
+      width, height, 0, 0,
+      RawImage(
+          pixels->data(), width, height, width * num_components,
+          num_components));
+  return true;
+}
+
+}  // namespace
+
 FitzDocument* FitzDocument::Open(
-    const std::string& path, const std::string* password) {
-  fz_context* fz_ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    const std::string& path, const std::string* password, size_t store_size) {
+  std::unique_ptr<FitzAllocator> fz_allocator(new FitzAllocator());
+  std::unique_ptr<FitzLocks> fz_locks(new FitzLocks());
+  fz_context* fz_ctx = fz_new_context(
+      fz_allocator->GetAllocContext(), fz_locks->GetLocksContext(),
+      store_size);
   fz_register_document_handlers(fz_ctx);
   // Disable warning messages in the console.
   fz_set_warning_callback(
       fz_ctx, [](void* user, const char* message) {}, nullptr);
 
   fz_document* fz_doc = nullptr;
+  bool is_image = false;
   fz_try(fz_ctx) {
+    // Image files are opened by a handler of image MIME types.
+    const fz_document_handler* handler =
+        fz_recognize_document(fz_ctx, path.c_str());
+    if ((handler != nullptr) && (handler->mimetypes != nullptr)) {
+      for (const char** mimetype = handler->mimetypes; *mimetype != nullptr;
+           ++mimetype) {
+        if (strncmp(*mimetype, "image/", 6) == 0) {
+          is_image = true;
+        }
+      }
+    }
     fz_doc = fz_open_document(fz_ctx, path.c_str());
     if ((fz_doc == nullptr) || (!fz_count_pages(fz_ctx, fz_doc))) {
       fz_throw(
@@ -67,16 +227,29 @@ FitzDocument* FitzDocument::Open(
     return nullptr;
   }
 
-  return new FitzDocument(fz_ctx, fz_doc);
+  return new FitzDocument(
+      std::move(fz_allocator), std::move(fz_locks), fz_ctx, fz_doc, is_image);
 }
 
-FitzDocument::FitzDocument(fz_context* fz_ctx, fz_document* fz_doc)
-    : _fz_ctx(fz_ctx), _fz_doc(fz_doc) {
+FitzDocument::FitzDocument(
+    std::unique_ptr<FitzAllocator> fz_allocator,
+    std::unique_ptr<FitzLocks> fz_locks, fz_context* fz_ctx,
+    fz_document* fz_doc, bool is_image)
+    : _fz_allocator(std::move(fz_allocator)),
+      _fz_locks(std::move(fz_locks)),
+      _fz_ctx(fz_ctx),
+      _fz_doc(fz_doc),
+      _is_image(is_image),
+      _pyramid_bytes(0),
+      _disk_cache(nullptr) {
   assert(_fz_ctx != nullptr);
   assert(_fz_doc != nullptr);
 }
 
 FitzDocument::~FitzDocument() {
+  // Wait for pyramids being built, which use the document, before taking the
+  // lock they need.
+  _pyramid_queue.reset();
   std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
   fz_drop_document(_fz_ctx, _fz_doc);
   fz_drop_context(_fz_ctx);
@@ -99,46 +272,305 @@ const Document::PageSize FitzDocument::GetPageSize(
 
 void FitzDocument::Render(
     Document::PixelWriter* pw, int page, float zoom, int rotation) {
-  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
-  assert((page >= 0) && (page < GetNumPages()));
-
-  // 1. Init MuPDF structures.
+  // 1. Record the page into a display list, and clone a context to draw it
+  // with. This is the only part that needs exclusive access to the document.
   const fz_matrix& m = ComputeTransformMatrix(zoom, rotation);
-  FitzPageScopedPtr page_ptr(_fz_ctx, fz_load_page(_fz_ctx, _fz_doc, page));
-  const fz_irect& bbox = GetPageBoundingBox(_fz_ctx, page_ptr.get(), m);
+  fz_irect bbox;
+  fz_context* ctx;
+  fz_display_list* list;
+  RecordPage(page, m, &bbox, &list, &ctx);
+  FitzClonedContextScopedPtr ctx_ptr(nullptr, ctx);
+  FitzDisplayListScopedPtr list_ptr(ctx, list);
+
+  // 2. Render page, in grayscale if the writer only stores gray levels. Pages
+  // consisting of a single image take a shortcut.
+  FitzAllocator::ScopedCategory category(FitzAllocator::DRAWING);
+  if (RenderSingleImagePage(page, ctx, list_ptr.get(), m, bbox, pw)) {
+    return;
+  }
+  const bool gray = pw->IsGray();
   FitzPixmapScopedPtr pixmap_ptr(
-      _fz_ctx, fz_new_pixmap_with_bbox(
-                   _fz_ctx, fz_device_rgb(_fz_ctx), bbox, nullptr, 1));
+      ctx, fz_new_pixmap_with_bbox(
+               ctx, gray ? fz_device_gray(ctx) : fz_device_rgb(ctx), bbox,
+               nullptr, 1));
   FitzDeviceScopedPtr dev_ptr(
-      _fz_ctx, fz_new_draw_device(_fz_ctx, fz_identity, pixmap_ptr.get()));
-
-  // 2. Render page.
-  fz_clear_pixmap_with_value(_fz_ctx, pixmap_ptr.get(), 0xff);
-  fz_run_page(_fz_ctx, page_ptr.get(), dev_ptr.get(), m, nullptr);
-
-  // 3. Write pixmap to buffer. The page is vertically divided into n equal
-  // stripes, each copied to pw by one thread.
-  assert(fz_pixmap_components(_fz_ctx, pixmap_ptr.get()) == 4);
-  uint8_t* buffer =
-      reinterpret_cast<uint8_t*>(fz_pixmap_samples(_fz_ctx, pixmap_ptr.get()));
-  const int num_cols = fz_pixmap_width(_fz_ctx, pixmap_ptr.get());
-  const int num_rows = fz_pixmap_height(_fz_ctx, pixmap_ptr.get());
-  ExecuteInParallel([=](int num_threads, int i) {
-    const int num_rows_per_thread = num_rows / num_threads;
-    const int y_begin = i * num_rows_per_thread;
-    const int y_end =
-        (i == num_threads - 1) ? num_rows : (i + 1) * num_rows_per_thread;
-    uint8_t* p = buffer + y_begin * num_cols * 4;
-    for (int y = y_begin; y < y_end; ++y) {
-      for (int x = 0; x < num_cols; ++x) {
-        pw->Write(x, y, p[0], p[1], p[2]);
-        p += 4;
+      ctx, fz_new_draw_device(ctx, fz_identity, pixmap_ptr.get()));
+  fz_clear_pixmap_with_value(ctx, pixmap_ptr.get(), 0xff);
+  fz_run_display_list(
+      ctx, list_ptr.get(), dev_ptr.get(), m, fz_infinite_rect, nullptr);
+
+  // 3. Write pixmap to buffer.
+  const int num_components = gray ? 2 : 4;
+  assert(fz_pixmap_components(ctx, pixmap_ptr.get()) == num_components);
+  WritePixels(
+      fz_pixmap_samples(ctx, pixmap_ptr.get()),
+      fz_pixmap_width(ctx, pixmap_ptr.get()),
+      fz_pixmap_height(ctx, pixmap_ptr.get()),
+      fz_pixmap_stride(ctx, pixmap_ptr.get()), num_components, gray, pw);
+
+  // 4. Clean up.
+  fz_close_device(ctx, dev_ptr.get());
+}
+
+bool FitzDocument::RenderSingleImagePage(
+    int page, fz_context* ctx, fz_display_list* list, const fz_matrix& m,
+    const fz_irect& bbox, PixelWriter* pw) {
+  // 1. Find the image.
+  fz_matrix ctm;
+  int quarter_turns;
+  FitzImageScopedPtr image_ptr(
+      ctx, FindSingleImage(ctx, list, m, bbox, &ctm, &quarter_turns));
+  if (image_ptr.get() == nullptr) {
+    return false;
+  }
+
+  // 2. Scale it to the size of the page before rotation, from its pyramid if
+  // it has a level large enough, and by decoding it otherwise.
+  const int width = bbox.x1 - bbox.x0, height = bbox.y1 - bbox.y0;
+  const int scaled_width = quarter_turns % 2 ? height : width,
+            scaled_height = quarter_turns % 2 ? width : height;
+  std::shared_ptr<const ImagePyramid> pyramid =
+      GetPyramid(page, image_ptr.get());
+  std::vector<uint8_t> scaled_pixels;
+  int num_components;
+  if ((pyramid != nullptr) &&
+      (pyramid->ChooseLevel(scaled_width, scaled_height) >= 0)) {
+    num_components = pyramid->GetLevel(0).GetDepth();
+    scaled_pixels.resize(
+        static_cast<size_t>(scaled_width) * scaled_height * num_components);
+    if (!pyramid->Render(RawImage(
+            scaled_pixels.data(), scaled_width, scaled_height,
+            scaled_width * num_components, num_components))) {
+      return false;
+    }
+  } else {
+    num_components = pw->IsGray() ? 1 : 3;
+    if (!DecodeImage(
+            ctx, image_ptr.get(), ctm, pw->IsGray(), scaled_width,
+            scaled_height, &scaled_pixels)) {
+      return false;
+    }
+  }
+
+  // 3. Rotate it.
+  if (quarter_turns) {
+    std::vector<uint8_t> rotated_pixels(scaled_pixels.size());
+    RotateQuarterTurns(
+        RawImage(
+            scaled_pixels.data(), scaled_width, scaled_height,
+            scaled_width * num_components, num_components),
+        quarter_turns,
+        RawImage(
+            rotated_pixels.data(), width, height, width * num_components,
+            num_components));
+    scaled_pixels.swap(rotated_pixels);
+  }
+
+  // 4. Write it to pw.
+  WritePixels(
+      scaled_pixels.data(), width, height, width * num_components,
+      num_components, num_components == 1, pw);
+  return true;
+}
+
+std::shared_ptr<const ImagePyramid> FitzDocument::GetPyramid(
+    int page, fz_image* image) {
+  if (!_is_image) {
+    return nullptr;
+  }
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  auto it = _pyramids.find(page);
+  if (it != _pyramids.end()) {
+    if (it->second != nullptr) {
+      _pyramid_lru.splice(
+          _pyramid_lru.end(), _pyramid_lru,
+          std::find(_pyramid_lru.begin(), _pyramid_lru.end(), page));
+    }
+    return it->second;
+  }
+  if (static_cast<int64_t>(image->w) * image->h < MIN_PYRAMID_PIXELS) {
+    return nullptr;
+  }
+  _pyramids[page] = nullptr;
+  if (_pyramid_queue == nullptr) {
+    _pyramid_queue.reset(new WorkQueue(1, true));
+  }
+  _pyramid_queue->Enqueue([this, page] { BuildPyramid(page); });
+  return nullptr;
+}
+
+void FitzDocument::BuildPyramid(int page) {
+  // 1. Find the image, at its own size.
+  fz_irect bbox;
+  fz_context* ctx;
+  fz_display_list* list;
+  RecordPage(page, fz_identity, &bbox, &list, &ctx);
+  FitzClonedContextScopedPtr ctx_ptr(nullptr, ctx);
+  FitzDisplayListScopedPtr list_ptr(ctx, list);
+  fz_matrix ctm;
+  int quarter_turns;
+  FitzImageScopedPtr image_ptr(
+      ctx, FindSingleImage(
+               ctx, list_ptr.get(), fz_identity, bbox, &ctm, &quarter_turns));
+  if (image_ptr.get() == nullptr) {
+    return;
+  }
+
+  // 2. Load the pyramid from the disk cache.
+  std::string key_prefix;
+  DiskCache* disk_cache;
+  {
+    std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+    disk_cache = _disk_cache;
+    key_prefix =
+        _disk_cache_key_prefix + "-pyramid-" + std::to_string(page) + "-";
+  }
+  std::shared_ptr<const ImagePyramid> pyramid;
+  if (disk_cache != nullptr) {
+    std::vector<std::unique_ptr<CompressedImage>> levels;
+    for (;;) {
+      std::unique_ptr<CompressedImage> level(
+          disk_cache->Load(key_prefix + std::to_string(levels.size())));
+      if (level == nullptr) {
+        break;
       }
+      levels.push_back(std::move(level));
     }
-  });
+    pyramid.reset(ImagePyramid::FromLevels(std::move(levels)));
+  }
 
-  // 4. Clean up.
-  fz_close_device(_fz_ctx, dev_ptr.get());
+  // 3. Otherwise build it from the image decoded at half its size, which is
+  // as large as a level needs to be to serve zoom ratios that decoding the
+  // image for each render does not serve as well, and store it.
+  if (pyramid == nullptr) {
+    fz_image* image = image_ptr.get();
+    const bool gray = (image->colorspace != nullptr) &&
+                      (fz_colorspace_n(ctx, image->colorspace) == 1);
+    const int num_components = gray ? 1 : 3;
+    const int width = (image->w + 1) / 2, height = (image->h + 1) / 2;
+    std::vector<uint8_t> pixels;
+    if (!DecodeImage(
+            ctx, image, fz_scale(width, height), gray, width, height,
+            &pixels)) {
+      return;
+    }
+    pyramid.reset(ImagePyramid::Build(RawImage(
+        pixels.data(), width, height, width * num_components,
+        num_components)));
+    if (pyramid == nullptr) {
+      return;
+    }
+    if (disk_cache != nullptr) {
+      for (int i = 0; i < pyramid->GetNumLevels(); ++i) {
+        disk_cache->Store(
+            key_prefix + std::to_string(i), pyramid->GetLevel(i));
+      }
+    }
+  }
+
+  // 4. Make it available to renders, unless it was dropped by
+  // ReleaseMemory() or built again meanwhile, and drop the least recently used
+  // pyramids beyond MAX_PYRAMID_BYTES.
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  auto it = _pyramids.find(page);
+  if ((it == _pyramids.end()) || (it->second != nullptr)) {
+    return;
+  }
+  it->second = pyramid;
+  _pyramid_lru.push_back(page);
+  _pyramid_bytes += pyramid->GetByteSize();
+  while ((_pyramid_bytes > MAX_PYRAMID_BYTES) && (_pyramid_lru.size() > 1)) {
+    auto evicted_it = _pyramids.find(_pyramid_lru.front());
+    _pyramid_bytes -= evicted_it->second->GetByteSize();
+    _pyramids.erase(evicted_it);
+    _pyramid_lru.pop_front();
+  }
+}
+
+void FitzDocument::SetDiskCache(
+    DiskCache* disk_cache, const std::string& document_id) {
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  _disk_cache = disk_cache;
+  _disk_cache_key_prefix = document_id;
+}
+
+bool FitzDocument::IsGray(int page) {
+  // 1. Return the result of an earlier test, if any.
+  {
+    std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+    auto i = _gray_pages.find(page);
+    if (i != _gray_pages.end()) {
+      return i->second;
+    }
+  }
+
+  // 2. Record the page, and run the test device over the display list without
+  // holding _fz_mutex. The test device stops as soon as it finds a color.
+  // Errors count as color, so that the page is rendered in full.
+  fz_irect bbox;
+  fz_context* ctx;
+  fz_display_list* list;
+  RecordPage(page, fz_identity, &bbox, &list, &ctx);
+  FitzClonedContextScopedPtr ctx_ptr(nullptr, ctx);
+  FitzDisplayListScopedPtr list_ptr(ctx, list);
+  FitzAllocator::ScopedCategory category(FitzAllocator::INTERPRETING);
+  int is_color = 0;
+  FitzDeviceScopedPtr dev_ptr(
+      ctx, fz_new_test_device(
+               ctx, &is_color, COLOR_THRESHOLD,
+               FZ_TEST_OPT_IMAGES | FZ_TEST_OPT_SHADINGS, nullptr));
+  fz_try(ctx) {
+    fz_run_display_list(
+        ctx, list_ptr.get(), dev_ptr.get(), fz_identity, fz_infinite_rect,
+        nullptr);
+    fz_close_device(ctx, dev_ptr.get());
+  }
+  fz_catch(ctx) { is_color = 1; }
+
+  // 3. Remember the result.
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  return _gray_pages[page] = !is_color;
+}
+
+void FitzDocument::Warm(int page, float zoom, int rotation) {
+  const fz_matrix& m = ComputeTransformMatrix(zoom, rotation);
+  fz_irect bbox;
+  fz_context* ctx;
+  fz_display_list* list;
+  RecordPage(page, m, &bbox, &list, &ctx);
+  FitzClonedContextScopedPtr ctx_ptr(nullptr, ctx);
+  FitzDisplayListScopedPtr list_ptr(ctx, list);
+
+  FitzAllocator::ScopedCategory category(FitzAllocator::DRAWING);
+  FitzDeviceScopedPtr dev_ptr(ctx, NewWarmingDevice(ctx));
+  fz_run_display_list(
+      ctx, list_ptr.get(), dev_ptr.get(), m, fz_infinite_rect, nullptr);
+  fz_close_device(ctx, dev_ptr.get());
+}
+
+void FitzDocument::ReleaseMemory() {
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  // Pyramids are loaded from the disk cache or built again when next needed.
+  if (_pyramid_queue != nullptr) {
+    _pyramid_queue->Cancel();
+  }
+  _pyramids.clear();
+  _pyramid_lru.clear();
+  _pyramid_bytes = 0;
+  fz_shrink_store(_fz_ctx, 0);
+  _fz_allocator->Trim();
+}
+
+void FitzDocument::RecordPage(
+    int page, const fz_matrix& m, fz_irect* bbox, fz_display_list** list,
+    fz_context** ctx) {
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  FitzAllocator::ScopedCategory category(FitzAllocator::INTERPRETING);
+  assert((page >= 0) && (page < GetNumPages()));
+  FitzPageScopedPtr page_ptr(_fz_ctx, fz_load_page(_fz_ctx, _fz_doc, page));
+  *bbox = GetPageBoundingBox(_fz_ctx, page_ptr.get(), m);
+  *list = fz_new_display_list_from_page(_fz_ctx, page_ptr.get());
+  *ctx = fz_clone_context(_fz_ctx);
 }
 
 const Document::OutlineItem* FitzDocument::GetOutline() {
@@ -155,6 +587,29 @@ int FitzDocument::Lookup(const OutlineItem* item) {
   return (dynamic_cast<const FitzOutlineItem*>(item))->GetDestPage();
 }
 
+std::vector<int> FitzDocument::GetLinkedPages(int page) {
+  std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
+  FitzPageScopedPtr page_ptr(_fz_ctx, fz_load_page(_fz_ctx, _fz_doc, page));
+  FitzLinkScopedPtr links_ptr(_fz_ctx, fz_load_links(_fz_ctx, page_ptr.get()));
+  std::vector<int> linked_pages;
+  for (fz_link* link = links_ptr.get(); link != nullptr; link = link->next) {
+    if ((link->uri == nullptr) || fz_is_external_link(_fz_ctx, link->uri)) {
+      continue;
+    }
+    float x, y;
+    const fz_location& location =
+        fz_resolve_link(_fz_ctx, _fz_doc, link->uri, &x, &y);
+    const int linked_page =
+        fz_page_number_from_location(_fz_ctx, _fz_doc, location);
+    if ((linked_page >= 0) &&
+        (std::find(linked_pages.begin(), linked_pages.end(), linked_page) ==
+         linked_pages.end())) {
+      linked_pages.push_back(linked_page);
+    }
+  }
+  return linked_pages;
+}
+
 std::string FitzDocument::GetPageText(int page, int line_sep) {
   std::lock_guard<std::recursive_mutex> lock(_fz_mutex);
   FitzPageScopedPtr page_ptr(_fz_ctx, fz_load_page(_fz_ctx, _fz_doc, page));
@@ -22,6 +22,8 @@
 #ifndef FITZ_DOCUMENT_HPP
 #define FITZ_DOCUMENT_HPP
 
+#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -29,27 +31,60 @@
 
 #include "document.hpp"
 #include "fitz_utils.hpp"
+#include "image_pyramid.hpp"
+#include "multithreading.hpp"
 
 // Document implementation using Fitz.
 class FitzDocument : public Document {
  public:
+  // In image documents, an image with at least this many pixels gets an
+  // ImagePyramid, so that zooming out of it is fast.
+  enum { MIN_PYRAMID_PIXELS = 4096 * 4096 };
+  // Pyramids kept in memory, in bytes. The least recently used pyramids are
+  // dropped beyond this, and loaded from the disk cache or built again when
+  // next needed.
+  enum { MAX_PYRAMID_BYTES = 256 << 20 };
+
   virtual ~FitzDocument();
   // Factory method to construct an instance of FitzDocument. path gives the
   // path to a file. password is the password to use to unlock the document;
   // specify nullptr if no password was provided. Does not take ownership of
-  // password. Returns nullptr if the file cannot be opened.
+  // password. store_size is the maximum size of the MuPDF store, which caches
+  // fonts and decoded images, in bytes, or FZ_STORE_UNLIMITED. Returns nullptr
+  // if the file cannot be opened.
   static FitzDocument* Open(
-      const std::string& path, const std::string* password);
+      const std::string& path, const std::string* password,
+      size_t store_size = FZ_STORE_DEFAULT);
   // See Document.
   int GetNumPages() override;
   // See Document.
   const PageSize GetPageSize(int page, float zoom, int rotation) override;
-  // See Document. Thread-safe.
+  // See Document. Thread-safe. Only recording the page into a display list
+  // is serialized; the page is drawn on a cloned context without holding the
+  // document lock, so several pages can be rendered at the same time. Pages
+  // consisting of a single image are scaled from the image directly, and in
+  // image documents the first render of a large one builds a pyramid of the
+  // image in the background for later renders.
   void Render(PixelWriter* pw, int page, float zoom, int rotation) override;
+  // See Document. Thread-safe. Runs the page through a MuPDF test device,
+  // which looks at the colors of images and shadings as well as of text and
+  // paths. Cached.
+  bool IsGray(int page) override;
+  // See Document. Thread-safe. Records the page into a display list, which
+  // loads its fonts, and decodes its images without drawing anything.
+  void Warm(int page, float zoom, int rotation) override;
+  // See Document. Keeps the pyramids of large images in the disk cache.
+  void SetDiskCache(
+      DiskCache* disk_cache, const std::string& document_id) override;
+  // See Document. Empties the MuPDF store, drops pyramids, and frees memory
+  // the allocator keeps for reuse.
+  void ReleaseMemory() override;
   // See Document.
   const OutlineItem* GetOutline() override;
   // See Document.
   int Lookup(const OutlineItem* item) override;
+  // See Document. External links are ignored.
+  std::vector<int> GetLinkedPages(int page) override;
   // Returns the text content of a page, using line_sep to separate lines.
   std::string GetPageText(int page, int line_sep = '\n');
 
@@ -59,14 +94,66 @@ class FitzDocument : public Document {
       const std::string& search_string, int page, int context_length) override;
 
  private:
+  // Allocation and locking callbacks used by _fz_ctx and contexts cloned from
+  // it.
+  std::unique_ptr<FitzAllocator> _fz_allocator;
+  std::unique_ptr<FitzLocks> _fz_locks;
   // MuPDF structures.
   fz_context* _fz_ctx;
   fz_document* _fz_doc;
   // Mutex guarding MuPDF structures.
   std::recursive_mutex _fz_mutex;
+  // Results of IsGray(), by page. Guarded by _fz_mutex.
+  std::map<int, bool> _gray_pages;
+  // Whether the document is an image file rather than, say, a PDF file. Only
+  // image documents get pyramids.
+  const bool _is_image;
+  // Pyramids of the images of single image pages, by page. A page maps to
+  // nullptr while its pyramid is being built, or if it could not be built.
+  // Guarded by _fz_mutex.
+  std::map<int, std::shared_ptr<const ImagePyramid>> _pyramids;
+  // Pages with a pyramid in _pyramids, from least to most recently used, and
+  // the total size of their pyramids. Guarded by _fz_mutex.
+  std::list<int> _pyramid_lru;
+  size_t _pyramid_bytes;
+  // Disk cache to keep pyramids in, or nullptr, and the prefix of their keys.
+  // Guarded by _fz_mutex.
+  DiskCache* _disk_cache;
+  std::string _disk_cache_key_prefix;
+  // Background thread that builds pyramids. Created on first use.
+  std::unique_ptr<WorkQueue> _pyramid_queue;
+
+  // Records a page into a display list, and clones a context to run the list
+  // with without holding _fz_mutex. Stores the bounding box of the page under
+  // the transformation matrix m in bbox. The caller takes ownership of the
+  // list and the context.
+  void RecordPage(
+      int page, const fz_matrix& m, fz_irect* bbox, fz_display_list** list,
+      fz_context** ctx);
+
+  // Renders a page that consists of nothing but one opaque image covering it,
+  // such as a scanned page, without drawing it into a pixmap of the whole
+  // page first. The image is scaled to the size of the page from its pyramid
+  // if it has a large enough level, or decoded at about that size otherwise,
+  // and then rotated if needed. Returns false without writing anything if
+  // the page is not such a page, or the image cannot be decoded.
+  bool RenderSingleImagePage(
+      int page, fz_context* ctx, fz_display_list* list, const fz_matrix& m,
+      const fz_irect& bbox, PixelWriter* pw);
+  // Returns the pyramid of the image that a page consists of, or nullptr if
+  // there is none yet. In image documents, if the image is large enough to get
+  // one, starts building it in the background the first time, or the first
+  // time after it has been dropped.
+  std::shared_ptr<const ImagePyramid> GetPyramid(int page, fz_image* image);
+  // Loads the pyramid of the image that a page consists of from the disk
+  // cache, or builds it and stores it there. Runs on _pyramid_queue.
+  void BuildPyramid(int page);
 
   // We disallow the constructor; use the factory method Open() instead.
-  FitzDocument(fz_context* _fz_context, fz_document* fz_document);
+  FitzDocument(
+      std::unique_ptr<FitzAllocator> fz_allocator,
+      std::unique_ptr<FitzLocks> fz_locks, fz_context* _fz_context,
+      fz_document* fz_document, bool is_image);
   // We disallow copying because we store lots of heap allocated state.
   explicit FitzDocument(const FitzDocument& other);
   FitzDocument& operator=(const FitzDocument& other);
@@ -21,7 +21,10 @@
 
 #include "fitz_utils.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 
 fz_matrix ComputeTransformMatrix(float zoom, int rotation) {
   fz_matrix transformation_matrix, scale_matrix, rotate_matrix;
@@ -37,6 +40,374 @@ fz_irect GetPageBoundingBox(
   return fz_round_rect(fz_transform_rect(fz_bound_page(ctx, page_struct), m));
 }
 
+FitzLocks::FitzLocks() {
+  _locks_context.user = this;
+  _locks_context.lock = &FitzLocks::Lock;
+  _locks_context.unlock = &FitzLocks::Unlock;
+}
+
+const fz_locks_context* FitzLocks::GetLocksContext() const {
+  return &_locks_context;
+}
+
+void FitzLocks::Lock(void* user, int lock) {
+  assert((lock >= 0) && (lock < FZ_LOCK_MAX));
+  reinterpret_cast<FitzLocks*>(user)->_mutexes[lock].lock();
+}
+
+void FitzLocks::Unlock(void* user, int lock) {
+  assert((lock >= 0) && (lock < FZ_LOCK_MAX));
+  reinterpret_cast<FitzLocks*>(user)->_mutexes[lock].unlock();
+}
+
+std::atomic<size_t> FitzAllocator::_current(0);
+std::atomic<size_t> FitzAllocator::_peak(0);
+std::atomic<size_t> FitzAllocator::_by_category[FitzAllocator::NUM_CATEGORIES];
+thread_local FitzAllocator::Category FitzAllocator::_thread_category =
+    FitzAllocator::OTHER;
+
+FitzAllocator::ScopedCategory::ScopedCategory(FitzAllocator::Category category)
+    : _previous_category(_thread_category) {
+  _thread_category = category;
+}
+
+FitzAllocator::ScopedCategory::~ScopedCategory() {
+  _thread_category = _previous_category;
+}
+
+FitzAllocator::FitzAllocator() : _pool_bytes(0) {
+  _alloc_context.user = this;
+  _alloc_context.malloc_ = &FitzAllocator::Malloc;
+  _alloc_context.realloc_ = &FitzAllocator::Realloc;
+  _alloc_context.free_ = &FitzAllocator::Free;
+}
+
+FitzAllocator::~FitzAllocator() { Trim(); }
+
+const fz_alloc_context* FitzAllocator::GetAllocContext() const {
+  return &_alloc_context;
+}
+
+void FitzAllocator::Trim() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (std::vector<Header*>& free_list : _free_lists) {
+    for (Header* header : free_list) {
+      free(header);
+    }
+    free_list.clear();
+  }
+  _pool_bytes = 0;
+}
+
+FitzAllocator::Stats FitzAllocator::GetStats() {
+  Stats stats;
+  stats.Current = _current;
+  stats.Peak = _peak;
+  for (int i = 0; i < NUM_CATEGORIES; ++i) {
+    stats.ByCategory[i] = _by_category[i];
+  }
+  return stats;
+}
+
+const char* FitzAllocator::GetCategoryName(FitzAllocator::Category category) {
+  switch (category) {
+    case INTERPRETING:
+      return "interpreting";
+    case DRAWING:
+      return "drawing";
+    default:
+      return "other";
+  }
+}
+
+FitzAllocator::Header* FitzAllocator::Allocate(
+    size_t size, FitzAllocator::Category category) {
+  // 1. Reuse a freed block of the same size class if there is one.
+  Header* header = nullptr;
+  if ((size > 0) && (size <= MAX_POOLED_SIZE)) {
+    const int size_class = (size - 1) / SIZE_CLASS_BYTES;
+    size = (size_class + 1) * SIZE_CLASS_BYTES;
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<Header*>& free_list = _free_lists[size_class];
+    if (!free_list.empty()) {
+      header = free_list.back();
+      free_list.pop_back();
+      _pool_bytes -= size;
+    }
+  }
+
+  // 2. Otherwise, allocate a new one.
+  if (header == nullptr) {
+    header = reinterpret_cast<Header*>(malloc(sizeof(Header) + size));
+    if (header == nullptr) {
+      return nullptr;
+    }
+  }
+  header->Size = size;
+  header->BlockCategory = category;
+  Account(category, size);
+  return header;
+}
+
+void FitzAllocator::Release(FitzAllocator::Header* header) {
+  Account(header->BlockCategory, -static_cast<ptrdiff_t>(header->Size));
+  if ((header->Size > 0) && (header->Size <= MAX_POOLED_SIZE)) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_pool_bytes + header->Size <= MAX_POOL_BYTES) {
+      _free_lists[(header->Size - 1) / SIZE_CLASS_BYTES].push_back(header);
+      _pool_bytes += header->Size;
+      return;
+    }
+  }
+  free(header);
+}
+
+void FitzAllocator::Account(FitzAllocator::Category category, ptrdiff_t size) {
+  const size_t current = _current += size;
+  _by_category[category] += size;
+  size_t peak = _peak;
+  while ((current > peak) && !_peak.compare_exchange_weak(peak, current)) {
+  }
+}
+
+void* FitzAllocator::Malloc(void* user, size_t size) {
+  Header* header =
+      reinterpret_cast<FitzAllocator*>(user)->Allocate(size, _thread_category);
+  return header == nullptr ? nullptr : header + 1;
+}
+
+void* FitzAllocator::Realloc(void* user, void* ptr, size_t size) {
+  FitzAllocator* allocator = reinterpret_cast<FitzAllocator*>(user);
+  if (ptr == nullptr) {
+    return Malloc(user, size);
+  }
+  Header* header = reinterpret_cast<Header*>(ptr) - 1;
+
+  // 1. A pooled block has room up to the end of its size class.
+  if ((header->Size <= MAX_POOLED_SIZE) && (size <= header->Size) &&
+      (size > 0)) {
+    return ptr;
+  }
+
+  // 2. Blocks too large to pool are resized in place if possible.
+  const Category category = header->BlockCategory;
+  const size_t old_size = header->Size;
+  if ((old_size > MAX_POOLED_SIZE) && (size > MAX_POOLED_SIZE)) {
+    Header* resized =
+        reinterpret_cast<Header*>(realloc(header, sizeof(Header) + size));
+    if (resized == nullptr) {
+      return nullptr;
+    }
+    resized->Size = size;
+    Account(
+        category, static_cast<ptrdiff_t>(size) -
+                      static_cast<ptrdiff_t>(old_size));
+    return resized + 1;
+  }
+
+  // 3. Otherwise, move the contents to a new block.
+  Header* moved = allocator->Allocate(size, category);
+  if (moved == nullptr) {
+    return nullptr;
+  }
+  memcpy(moved + 1, ptr, std::min(size, old_size));
+  allocator->Release(header);
+  return moved + 1;
+}
+
+void FitzAllocator::Free(void* user, void* ptr) {
+  if (ptr != nullptr) {
+    reinterpret_cast<FitzAllocator*>(user)->Release(
+        reinterpret_cast<Header*>(ptr) - 1);
+  }
+}
+
+void DropClonedContext(fz_context* unused, fz_context* ctx) {
+  fz_drop_context(ctx);
+}
+
+namespace {
+
+// Decodes an image as it would be drawn with the given transformation matrix,
+// and discards the result. The decoded image stays in the MuPDF store.
+void WarmImage(fz_context* ctx, fz_image* image, fz_matrix ctm) {
+  int width, height;
+  fz_pixmap* pixmap =
+      fz_get_pixmap_from_image(ctx, image, nullptr, &ctm, &width, &height);
+  fz_drop_pixmap(ctx, pixmap);
+}
+
+// Device callbacks for NewWarmingDevice().
+void WarmingDeviceFillImage(
+    fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+    float alpha, fz_color_params color_params) {
+  WarmImage(ctx, image, ctm);
+}
+void WarmingDeviceFillImageMask(
+    fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+    fz_colorspace* colorspace, const float* color, float alpha,
+    fz_color_params color_params) {
+  WarmImage(ctx, image, ctm);
+}
+
+}  // namespace
+
+fz_device* NewWarmingDevice(fz_context* ctx) {
+  fz_device* dev = fz_new_derived_device(ctx, fz_device);
+  dev->fill_image = &WarmingDeviceFillImage;
+  dev->fill_image_mask = &WarmingDeviceFillImageMask;
+  return dev;
+}
+
+namespace {
+
+// Device created by NewSingleImageDevice().
+struct SingleImageDevice {
+  fz_device Super;
+  // Bounding box of the page on the device.
+  fz_rect PageRect;
+  // The image drawn so far, if any, and its matrix.
+  fz_image* Image;
+  fz_matrix Ctm;
+  // Set once the page is known to have something other than one image on it.
+  bool Rejected;
+};
+
+// Records that the page has something other than one image on it.
+void RejectPage(fz_device* dev) {
+  reinterpret_cast<SingleImageDevice*>(dev)->Rejected = true;
+}
+
+// Device callbacks for NewSingleImageDevice().
+void SingleImageDeviceDrop(fz_context* ctx, fz_device* dev) {
+  fz_drop_image(ctx, reinterpret_cast<SingleImageDevice*>(dev)->Image);
+}
+void SingleImageDeviceFillImage(
+    fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+    float alpha, fz_color_params color_params) {
+  SingleImageDevice* single_image_dev =
+      reinterpret_cast<SingleImageDevice*>(dev);
+  if ((single_image_dev->Image != nullptr) || (image->mask != nullptr) ||
+      (alpha < 1.0f)) {
+    single_image_dev->Rejected = true;
+    return;
+  }
+  single_image_dev->Image = fz_keep_image(ctx, image);
+  single_image_dev->Ctm = ctm;
+}
+void SingleImageDeviceFillPath(
+    fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd,
+    fz_matrix ctm, fz_colorspace* colorspace, const float* color, float alpha,
+    fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceStrokePath(
+    fz_context* ctx, fz_device* dev, const fz_path* path,
+    const fz_stroke_state* stroke, fz_matrix ctm, fz_colorspace* colorspace,
+    const float* color, float alpha, fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceClipPath(
+    fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd,
+    fz_matrix ctm, fz_rect scissor) {
+  // Scanned pages are often clipped to the page itself.
+  SingleImageDevice* single_image_dev =
+      reinterpret_cast<SingleImageDevice*>(dev);
+  if (!fz_contains_rect(
+          fz_bound_path(ctx, path, nullptr, ctm),
+          single_image_dev->PageRect)) {
+    single_image_dev->Rejected = true;
+  }
+}
+void SingleImageDeviceClipStrokePath(
+    fz_context* ctx, fz_device* dev, const fz_path* path,
+    const fz_stroke_state* stroke, fz_matrix ctm, fz_rect scissor) {
+  RejectPage(dev);
+}
+void SingleImageDeviceFillText(
+    fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm,
+    fz_colorspace* colorspace, const float* color, float alpha,
+    fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceStrokeText(
+    fz_context* ctx, fz_device* dev, const fz_text* text,
+    const fz_stroke_state* stroke, fz_matrix ctm, fz_colorspace* colorspace,
+    const float* color, float alpha, fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceClipText(
+    fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm,
+    fz_rect scissor) {
+  RejectPage(dev);
+}
+void SingleImageDeviceClipStrokeText(
+    fz_context* ctx, fz_device* dev, const fz_text* text,
+    const fz_stroke_state* stroke, fz_matrix ctm, fz_rect scissor) {
+  RejectPage(dev);
+}
+void SingleImageDeviceFillShade(
+    fz_context* ctx, fz_device* dev, fz_shade* shade, fz_matrix ctm,
+    float alpha, fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceFillImageMask(
+    fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+    fz_colorspace* colorspace, const float* color, float alpha,
+    fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceClipImageMask(
+    fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm,
+    fz_rect scissor) {
+  RejectPage(dev);
+}
+void SingleImageDeviceBeginMask(
+    fz_context* ctx, fz_device* dev, fz_rect area, int luminosity,
+    fz_colorspace* colorspace, const float* bc, fz_color_params color_params) {
+  RejectPage(dev);
+}
+void SingleImageDeviceBeginGroup(
+    fz_context* ctx, fz_device* dev, fz_rect area, fz_colorspace* colorspace,
+    int isolated, int knockout, int blendmode, float alpha) {
+  RejectPage(dev);
+}
+
+}  // namespace
+
+fz_device* NewSingleImageDevice(fz_context* ctx, fz_irect page_bbox) {
+  SingleImageDevice* dev = fz_new_derived_device(ctx, SingleImageDevice);
+  dev->PageRect = fz_rect_from_irect(page_bbox);
+  dev->Image = nullptr;
+  dev->Rejected = false;
+  dev->Super.drop_device = &SingleImageDeviceDrop;
+  dev->Super.fill_path = &SingleImageDeviceFillPath;
+  dev->Super.stroke_path = &SingleImageDeviceStrokePath;
+  dev->Super.clip_path = &SingleImageDeviceClipPath;
+  dev->Super.clip_stroke_path = &SingleImageDeviceClipStrokePath;
+  dev->Super.fill_text = &SingleImageDeviceFillText;
+  dev->Super.stroke_text = &SingleImageDeviceStrokeText;
+  dev->Super.clip_text = &SingleImageDeviceClipText;
+  dev->Super.clip_stroke_text = &SingleImageDeviceClipStrokeText;
+  dev->Super.fill_shade = &SingleImageDeviceFillShade;
+  dev->Super.fill_image = &SingleImageDeviceFillImage;
+  dev->Super.fill_image_mask = &SingleImageDeviceFillImageMask;
+  dev->Super.clip_image_mask = &SingleImageDeviceClipImageMask;
+  dev->Super.begin_mask = &SingleImageDeviceBeginMask;
+  dev->Super.begin_group = &SingleImageDeviceBeginGroup;
+  return &dev->Super;
+}
+
+fz_image* GetSingleImage(fz_device* dev, fz_matrix* ctm) {
+  SingleImageDevice* single_image_dev =
+      reinterpret_cast<SingleImageDevice*>(dev);
+  if (single_image_dev->Rejected) {
+    return nullptr;
+  }
+  *ctm = single_image_dev->Ctm;
+  return single_image_dev->Image;
+}
+
 namespace {
 
 const char* const DEFAULT_ROOT_OUTLINE_ITEM_TITLE = "TABLE OF CONTENTS";
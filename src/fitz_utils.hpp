@@ -26,7 +26,11 @@ extern "C" {
 #include "mupdf/fitz.h"
 }
 
+#include <atomic>
+#include <cstddef>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "document.hpp"
 
@@ -59,6 +63,149 @@ class FitzOutlineItem : public Document::OutlineItem {
       std::vector<std::unique_ptr<OutlineItem>>* output);
 };
 
+// Mutexes implementing the locking callbacks that MuPDF requires in order to
+// use a document from several threads, each with its own context cloned with
+// fz_clone_context(). Must outlive every context created with it.
+class FitzLocks {
+ public:
+  FitzLocks();
+  // Returns the locking callbacks to pass to fz_new_context().
+  const fz_locks_context* GetLocksContext() const;
+
+ private:
+  // One mutex per MuPDF lock.
+  std::mutex _mutexes[FZ_LOCK_MAX];
+  // Locking callbacks referring to _mutexes.
+  fz_locks_context _locks_context;
+
+  // Locking callbacks. user points to the FitzLocks instance.
+  static void Lock(void* user, int lock);
+  static void Unlock(void* user, int lock);
+
+  // We disallow copying because _locks_context points to this instance.
+  FitzLocks(const FitzLocks& other);
+  FitzLocks& operator=(const FitzLocks& other);
+};
+
+// Memory allocation callbacks for MuPDF that keep track of how much memory
+// MuPDF uses, and by what, across all instances. Small allocations, of which
+// interpreting a page makes many, are served from free lists of blocks of a
+// few size classes instead of going to malloc every time. Contexts cloned with
+// fz_clone_context() share the allocator of the context they are cloned from.
+// Must outlive every context created with it. Thread-safe.
+class FitzAllocator {
+ public:
+  // Allocations of up to MAX_POOLED_SIZE bytes are rounded up to a multiple of
+  // SIZE_CLASS_BYTES, and freed blocks are kept for reuse, up to
+  // MAX_POOL_BYTES in total per allocator.
+  enum { MAX_POOLED_SIZE = 256, SIZE_CLASS_BYTES = 16 };
+  enum { MAX_POOL_BYTES = 4 << 20 };
+
+  // What memory is allocated for, as declared by ScopedCategory.
+  enum Category {
+    // Anything else, such as opening a document or extracting text.
+    OTHER,
+    // Interpreting page content into a display list, including the fonts
+    // and images it loads.
+    INTERPRETING,
+    // Drawing a display list, including decoded images and pixmaps.
+    DRAWING,
+    NUM_CATEGORIES,
+  };
+
+  // Memory usage in bytes, excluding blocks kept for reuse.
+  struct Stats {
+    size_t Current;
+    size_t Peak;
+    size_t ByCategory[NUM_CATEGORIES];
+  };
+
+  // Declares what allocations made by the calling thread are for, for the
+  // lifetime of this object.
+  class ScopedCategory {
+   public:
+    explicit ScopedCategory(Category category);
+    ~ScopedCategory();
+
+   private:
+    Category _previous_category;
+  };
+
+  FitzAllocator();
+  ~FitzAllocator();
+  // Returns the allocation callbacks to pass to fz_new_context().
+  const fz_alloc_context* GetAllocContext() const;
+  // Frees blocks kept for reuse.
+  void Trim();
+
+  // Returns the memory usage of all instances.
+  static Stats GetStats();
+  // Returns the name of a category, for logging.
+  static const char* GetCategoryName(Category category);
+
+ private:
+  // Precedes every allocation. Keeps the memory after it aligned for any type.
+  struct alignas(alignof(std::max_align_t)) Header {
+    // Requested size, or for pooled blocks, the size of the size class.
+    size_t Size;
+    Category BlockCategory;
+  };
+
+  // Guards _free_lists and _pool_bytes.
+  std::mutex _mutex;
+  // Freed blocks of each size class, including headers.
+  std::vector<Header*> _free_lists[MAX_POOLED_SIZE / SIZE_CLASS_BYTES];
+  // Bytes in _free_lists, excluding headers.
+  size_t _pool_bytes;
+  // Allocation callbacks referring to this instance.
+  fz_alloc_context _alloc_context;
+
+  // Usage of all instances.
+  static std::atomic<size_t> _current;
+  static std::atomic<size_t> _peak;
+  static std::atomic<size_t> _by_category[NUM_CATEGORIES];
+  // The category of allocations made by each thread.
+  static thread_local Category _thread_category;
+
+  // Allocates a block of the given size for the given category, with its
+  // header set up.
+  Header* Allocate(size_t size, Category category);
+  // Frees a block, or keeps it for reuse.
+  void Release(Header* header);
+  // Updates usage after size bytes were allocated, or freed if negative.
+  static void Account(Category category, ptrdiff_t size);
+
+  // Allocation callbacks. user points to the FitzAllocator instance.
+  static void* Malloc(void* user, size_t size);
+  static void* Realloc(void* user, void* ptr, size_t size);
+  static void Free(void* user, void* ptr);
+
+  // We disallow copying because _alloc_context points to this instance.
+  FitzAllocator(const FitzAllocator& other);
+  FitzAllocator& operator=(const FitzAllocator& other);
+};
+
+// Drops a context created with fz_clone_context(). The first argument is
+// ignored, and only exists so that this can be used with FitzScopedPtr.
+extern void DropClonedContext(fz_context* unused, fz_context* ctx);
+
+// Returns a new device that draws nothing, but decodes every image drawn to it
+// at the resolution it would be drawn at. Decoded images are held in the MuPDF
+// store, where a later render of the same content will find them. NOT
+// thread-safe.
+extern fz_device* NewWarmingDevice(fz_context* ctx);
+
+// Returns a new device that draws nothing, but finds out whether a page
+// consists of nothing but one opaque image, as scanned pages do. Clips whose
+// bounds contain the whole page, and invisible text, are allowed. See
+// GetSingleImage(). NOT thread-safe.
+extern fz_device* NewSingleImageDevice(fz_context* ctx, fz_irect page_bbox);
+// Returns the image that a page run through a device returned by
+// NewSingleImageDevice() consists of, and stores the matrix it is drawn with
+// in ctm. Returns nullptr if the page has anything else on it. The image
+// belongs to the device.
+extern fz_image* GetSingleImage(fz_device* dev, fz_matrix* ctm);
+
 // Returns the text content of a page, using line_sep to separate lines. NOT
 // thread-safe.
 extern std::string GetPageText(
@@ -91,16 +238,26 @@ class FitzScopedPtr {
       const FitzScopedPtr<FzT, fz_drop_fn>& other);
 };
 
+// Smart pointer for a context created with fz_clone_context().
+typedef FitzScopedPtr<fz_context, &DropClonedContext>
+    FitzClonedContextScopedPtr;
 // Smart pointer for fz_document.
 typedef FitzScopedPtr<fz_document, &fz_drop_document> FitzDocumentScopedPtr;
 // Smart pointer for fz_page.
 typedef FitzScopedPtr<fz_page, &fz_drop_page> FitzPageScopedPtr;
 // Smart pointer for fz_outline.
 typedef FitzScopedPtr<fz_outline, &fz_drop_outline> FitzOutlineScopedPtr;
+// Smart pointer for fz_link. Dropping the first link drops the whole list.
+typedef FitzScopedPtr<fz_link, &fz_drop_link> FitzLinkScopedPtr;
 // Smart pointer for fz_device.
 typedef FitzScopedPtr<fz_device, &fz_drop_device> FitzDeviceScopedPtr;
+// Smart pointer for fz_display_list.
+typedef FitzScopedPtr<fz_display_list, &fz_drop_display_list>
+    FitzDisplayListScopedPtr;
 // Smart pointer for fz_pixmap.
 typedef FitzScopedPtr<fz_pixmap, &fz_drop_pixmap> FitzPixmapScopedPtr;
+// Smart pointer for fz_image.
+typedef FitzScopedPtr<fz_image, &fz_drop_image> FitzImageScopedPtr;
 // Smart pointer for fz_stext_page.
 typedef FitzScopedPtr<fz_stext_page, &fz_drop_stext_page>
     FitzStextPageScopedPtr;
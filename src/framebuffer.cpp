@@ -32,6 +32,8 @@
 #include <sstream>
 #include <string>
 
+#include "pixel_buffer_pool.hpp"
+
 const char* const Framebuffer::DEFAULT_FRAMEBUFFER_DEVICE = "/dev/fb0";
 
 Framebuffer* Framebuffer::Open(const std::string& device) {
@@ -110,12 +112,28 @@ std::string Framebuffer::GetDebugInfoString() {
   return out.str();
 }
 
+std::string Framebuffer::GetFormatId() const {
+  std::ostringstream out;
+  out << _format->GetDepth() << std::hex << "-" << _format->Pack(255, 0, 0)
+      << "-" << _format->Pack(0, 255, 0) << "-" << _format->Pack(0, 0, 255);
+  return out.str();
+}
+
 PixelBuffer* Framebuffer::NewPixelBuffer(const PixelBuffer::Size& size) {
   return new PixelBuffer(size, _format.get());
 }
 
+std::shared_ptr<PixelBuffer> Framebuffer::NewPooledPixelBuffer(
+    const PixelBuffer::Size& size) {
+  return PixelBufferPool::Get()->NewPixelBuffer(size, _format.get());
+}
+
 int Framebuffer::GetBufferByteSize() const { return _finfo.smem_len; }
 
+const PixelBuffer::Format* Framebuffer::GetFormat() const {
+  return _format.get();
+}
+
 PixelBuffer::Size Framebuffer::GetSize() const {
   return PixelBuffer::Size(_vinfo.xres, _vinfo.yres);
 }
@@ -135,6 +153,21 @@ void Framebuffer::Render(
   src.Copy(rect, _pixel_buffer->GetRect(), _pixel_buffer.get());
 }
 
+void Framebuffer::Render(
+    const PixelBuffer& src, const PixelBuffer::Rect& src_rect,
+    const PixelBuffer::Rect& dest_rect) {
+  src.Copy(src_rect, dest_rect, _pixel_buffer.get());
+}
+
+void Framebuffer::Clear(const PixelBuffer::Rect& rect) {
+  _pixel_buffer->Clear(rect);
+}
+
+void Framebuffer::Fill(
+    const PixelBuffer::Rect& rect, uint8_t r, uint8_t g, uint8_t b) {
+  _pixel_buffer->Fill(rect, r, g, b);
+}
+
 Framebuffer::Format::Format(const fb_var_screeninfo& vinfo) : _vinfo(vinfo) {}
 
 int Framebuffer::Format::GetDepth() const {
@@ -150,3 +183,13 @@ uint32_t Framebuffer::Format::Pack(uint8_t r, uint8_t g, uint8_t b) const {
           << _vinfo.blue.offset);
 }
 
+
+bool Framebuffer::Format::HasByteAlignedChannels() const {
+  const fb_bitfield* channels[] = {&_vinfo.red, &_vinfo.green, &_vinfo.blue};
+  for (const fb_bitfield* channel : channels) {
+    if ((channel->length != 8) || (channel->offset % 8 != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -43,6 +43,13 @@ class Framebuffer {
   // Creates a new pixel buffer with the given size. The pixel buffer will have
   // the same color settings as the screen. Caller owns returned value.
   PixelBuffer* NewPixelBuffer(const PixelBuffer::Size& size);
+  // Same as NewPixelBuffer(), but the memory comes from the shared
+  // PixelBufferPool, and goes back to it once the buffer is released.
+  std::shared_ptr<PixelBuffer> NewPooledPixelBuffer(
+      const PixelBuffer::Size& size);
+
+  // Returns the color format of the screen.
+  const PixelBuffer::Format* GetFormat() const;
 
   // Retrieve the dimensions of the current display, in pixels.
   PixelBuffer::Size GetSize() const;
@@ -57,9 +64,22 @@ class Framebuffer {
   // must be equal to or smaller than the screen size. If smaller, the source
   // rect is centered on screen.
   void Render(const PixelBuffer& src, const PixelBuffer::Rect& rect);
+  // Renders a region in a pixel buffer onto a region of the framebuffer
+  // device. The destination region must be at least as large as the source
+  // region in both dimensions. If larger, the source rect is centered in it.
+  void Render(
+      const PixelBuffer& src, const PixelBuffer::Rect& src_rect,
+      const PixelBuffer::Rect& dest_rect);
+  // Sets a region of the framebuffer device to black.
+  void Clear(const PixelBuffer::Rect& rect);
+  // Sets a region of the framebuffer device to a color.
+  void Fill(const PixelBuffer::Rect& rect, uint8_t r, uint8_t g, uint8_t b);
 
   // Return debugging information as a string.
   std::string GetDebugInfoString();
+  // Returns a string identifying the pixel format of the screen. Two screens
+  // with the same format ID lay out pixels identically.
+  std::string GetFormatId() const;
 
  private:
   // Color format of the framebuffer.
@@ -73,6 +93,8 @@ class Framebuffer {
     int GetDepth() const override;
     // See PixelBuffer::Format.
     uint32_t Pack(uint8_t r, uint8_t g, uint8_t b) const override;
+    // See PixelBuffer::Format.
+    bool HasByteAlignedChannels() const override;
 
    private:
     fb_var_screeninfo _vinfo;
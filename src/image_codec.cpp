@@ -0,0 +1,412 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the CompressedImage class.
+
+#include "image_codec.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "multithreading.hpp"
+
+namespace {
+
+// Shortest match the LZ codec encodes.
+enum { MIN_MATCH_LENGTH = 4 };
+// Longest distance back to a match.
+enum { MAX_MATCH_OFFSET = 65535 };
+// Size of the table of recent positions of 4-byte sequences, in bits.
+enum { HASH_BITS = 14 };
+// After every 2^SKIP_SHIFT bytes without a match, the encoder checks one byte
+// fewer, so that data that does not compress goes by quickly.
+enum { SKIP_SHIFT = 6 };
+// Lengths of literals and matches at least this long continue in extra bytes.
+enum { EXTENDED_LENGTH = 15 };
+
+// Reads 4 bytes at p.
+uint32_t Load32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Returns the slot of a 4-byte sequence in the table of recent positions.
+uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Appends the part of a length beyond EXTENDED_LENGTH to dest, as bytes of 255
+// followed by a byte less than 255.
+void AppendExtendedLength(size_t length, std::vector<uint8_t>* dest) {
+  for (length -= EXTENDED_LENGTH; length >= 255; length -= 255) {
+    dest->push_back(255);
+  }
+  dest->push_back(static_cast<uint8_t>(length));
+}
+
+// Reads the part of a length beyond EXTENDED_LENGTH, and adds it to length.
+// Returns false if the data ends first.
+bool ReadExtendedLength(
+    const uint8_t** in, const uint8_t* end, size_t* length) {
+  uint8_t byte;
+  do {
+    if (*in == end) {
+      return false;
+    }
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Appends a sequence of literals, followed by a match unless offset is 0.
+void AppendSequence(
+    const uint8_t* literals, size_t num_literals, size_t offset,
+    size_t match_length, std::vector<uint8_t>* dest) {
+  const size_t match_code = offset ? match_length - MIN_MATCH_LENGTH : 0;
+  dest->push_back(static_cast<uint8_t>(
+      (std::min<size_t>(num_literals, EXTENDED_LENGTH) << 4) |
+      std::min<size_t>(match_code, EXTENDED_LENGTH)));
+  if (num_literals >= EXTENDED_LENGTH) {
+    AppendExtendedLength(num_literals, dest);
+  }
+  dest->insert(dest->end(), literals, literals + num_literals);
+  if (offset) {
+    dest->push_back(static_cast<uint8_t>(offset));
+    dest->push_back(static_cast<uint8_t>(offset >> 8));
+    if (match_code >= EXTENDED_LENGTH) {
+      AppendExtendedLength(match_code, dest);
+    }
+  }
+}
+
+// Sets all pixels of a row to the color at color.
+void FillRow(uint8_t* row, size_t row_size, const uint8_t* color, int depth) {
+  memcpy(row, color, depth);
+  // Double the filled part until the row is full.
+  for (size_t filled = depth; filled < row_size;) {
+    const size_t n = std::min(filled, row_size - filled);
+    memcpy(row + filled, row, n);
+    filled += n;
+  }
+}
+
+}  // namespace
+
+CompressedImage* CompressedImage::Compress(const RawImage& src) {
+  CompressedImage* image =
+      new CompressedImage(src.Width, src.Height, src.Depth);
+  const int num_bands = GetNumBands(src.Width, src.Height);
+  std::vector<std::vector<uint8_t>> bands(num_bands);
+  ExecuteInParallel(
+      [&](int num_threads, int i) {
+        for (int band = i; band < num_bands; band += num_threads) {
+          const int y = band * BAND_HEIGHT;
+          CompressBand(
+              src, y, std::min<int>(BAND_HEIGHT, src.Height - y),
+              &bands[band]);
+        }
+      },
+      std::max(1, std::min(num_bands, GetDefaultNumThreads())));
+  std::vector<uint8_t>& data = image->_own_data;
+  for (const std::vector<uint8_t>& band : bands) {
+    image->_band_offsets.push_back(data.size());
+    data.insert(data.end(), band.begin(), band.end());
+  }
+  image->_band_offsets.push_back(data.size());
+  data.shrink_to_fit();
+  image->_data = data.data();
+  return image;
+}
+
+bool CompressedImage::Decompress(const RawImage& dest) const {
+  if ((dest.Width != _width) || (dest.Height != _height) ||
+      (dest.Depth != _depth)) {
+    return false;
+  }
+  const int num_bands = static_cast<int>(_band_offsets.size()) - 1;
+  std::atomic<bool> ok(true);
+  ExecuteInParallel(
+      [&](int num_threads, int i) {
+        std::vector<uint8_t> scratch;
+        for (int band = i; band < num_bands; band += num_threads) {
+          if (!DecompressBand(band, dest, &scratch)) {
+            ok = false;
+          }
+        }
+      },
+      std::max(1, std::min(num_bands, GetDefaultNumThreads())));
+  return ok;
+}
+
+void CompressedImage::Serialize(std::vector<uint8_t>* dest) const {
+  SerializedHeader header;
+  header.Magic = SERIALIZED_MAGIC;
+  header.Width = _width;
+  header.Height = _height;
+  header.Depth = _depth;
+  header.NumBands = _band_offsets.size() - 1;
+  header.Reserved = 0;
+  const uint8_t* const header_bytes = reinterpret_cast<uint8_t*>(&header);
+  dest->insert(dest->end(), header_bytes, header_bytes + sizeof(header));
+  for (size_t offset : _band_offsets) {
+    const uint64_t offset64 = offset;
+    const uint8_t* const offset_bytes =
+        reinterpret_cast<const uint8_t*>(&offset64);
+    dest->insert(dest->end(), offset_bytes, offset_bytes + sizeof(offset64));
+  }
+  dest->insert(dest->end(), _data, _data + _band_offsets.back());
+}
+
+CompressedImage* CompressedImage::Deserialize(
+    const uint8_t* data, size_t size, std::shared_ptr<const void> owner) {
+  // 1. Check the header.
+  SerializedHeader header;
+  if (size < sizeof(header)) {
+    return nullptr;
+  }
+  memcpy(&header, data, sizeof(header));
+  if ((header.Magic != SERIALIZED_MAGIC) || (header.Depth < 1) ||
+      (header.Depth > 4) || (header.Width > INT32_MAX / 4) ||
+      (header.Height > INT32_MAX) ||
+      (static_cast<int>(header.NumBands) !=
+       GetNumBands(header.Width, header.Height))) {
+    return nullptr;
+  }
+
+  // 2. Read the band offsets, which must be in order and end with the size of
+  // the remaining data.
+  const size_t offsets_size = (header.NumBands + 1) * sizeof(uint64_t);
+  if (size - sizeof(header) < offsets_size) {
+    return nullptr;
+  }
+  std::unique_ptr<CompressedImage> image(
+      new CompressedImage(header.Width, header.Height, header.Depth));
+  const uint8_t* const bands = data + sizeof(header) + offsets_size;
+  const size_t bands_size = size - sizeof(header) - offsets_size;
+  for (uint32_t i = 0; i <= header.NumBands; ++i) {
+    uint64_t offset;
+    memcpy(
+        &offset, data + sizeof(header) + i * sizeof(offset), sizeof(offset));
+    if ((offset > bands_size) ||
+        (i && (offset < image->_band_offsets.back()))) {
+      return nullptr;
+    }
+    image->_band_offsets.push_back(offset);
+  }
+  if (image->_band_offsets.front() ||
+      (image->_band_offsets.back() != bands_size)) {
+    return nullptr;
+  }
+  image->_data = bands;
+  image->_data_owner = owner;
+  return image.release();
+}
+
+int CompressedImage::GetWidth() const { return _width; }
+
+int CompressedImage::GetHeight() const { return _height; }
+
+int CompressedImage::GetDepth() const { return _depth; }
+
+size_t CompressedImage::GetByteSize() const {
+  return _band_offsets.back() + _band_offsets.size() * sizeof(size_t);
+}
+
+void CompressedImage::LzCompress(
+    const uint8_t* src, size_t size, std::vector<uint8_t>* dest) {
+  // Positions of recent 4-byte sequences plus 1, or 0 if none.
+  std::vector<size_t> table(1 << HASH_BITS, 0);
+  size_t literal_start = 0;
+  size_t pos = 0;
+  while (pos + MIN_MATCH_LENGTH <= size) {
+    // 1. Look up the last position of the sequence at pos.
+    const uint32_t sequence = Load32(src + pos);
+    size_t& entry = table[Hash(sequence)];
+    const size_t candidate = entry - 1;
+    entry = pos + 1;
+    if ((candidate >= pos) || (pos - candidate > MAX_MATCH_OFFSET) ||
+        (Load32(src + candidate) != sequence)) {
+      pos += 1 + ((pos - literal_start) >> SKIP_SHIFT);
+      continue;
+    }
+
+    // 2. Extend the match as far as it goes, and emit it with the literals
+    // before it.
+    size_t match_length = MIN_MATCH_LENGTH;
+    while ((pos + match_length < size) &&
+           (src[candidate + match_length] == src[pos + match_length])) {
+      ++match_length;
+    }
+    AppendSequence(
+        src + literal_start, pos - literal_start, pos - candidate,
+        match_length, dest);
+    pos += match_length;
+    literal_start = pos;
+  }
+
+  // 3. Emit the remaining literals.
+  AppendSequence(src + literal_start, size - literal_start, 0, 0, dest);
+}
+
+bool CompressedImage::LzDecompress(
+    const uint8_t* src, size_t src_size, uint8_t* dest, size_t dest_size) {
+  const uint8_t* in = src;
+  const uint8_t* const in_end = src + src_size;
+  uint8_t* out = dest;
+  uint8_t* const out_end = dest + dest_size;
+  while (in < in_end) {
+    // 1. Copy literals.
+    const uint8_t token = *in++;
+    size_t num_literals = token >> 4;
+    if ((num_literals == EXTENDED_LENGTH) &&
+        !ReadExtendedLength(&in, in_end, &num_literals)) {
+      return false;
+    }
+    if ((num_literals > static_cast<size_t>(in_end - in)) ||
+        (num_literals > static_cast<size_t>(out_end - out))) {
+      return false;
+    }
+    memcpy(out, in, num_literals);
+    in += num_literals;
+    out += num_literals;
+    if (in == in_end) {
+      break;
+    }
+
+    // 2. Copy the match. It may overlap the bytes it produces, in which case
+    // it repeats the bytes between the match and out.
+    if (in_end - in < 2) {
+      return false;
+    }
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    size_t match_length = token & 0xf;
+    if ((match_length == EXTENDED_LENGTH) &&
+        !ReadExtendedLength(&in, in_end, &match_length)) {
+      return false;
+    }
+    match_length += MIN_MATCH_LENGTH;
+    if ((offset == 0) || (offset > static_cast<size_t>(out - dest)) ||
+        (match_length > static_cast<size_t>(out_end - out))) {
+      return false;
+    }
+    const uint8_t* const match = out - offset;
+    while (match_length > 0) {
+      const size_t n = std::min(match_length, static_cast<size_t>(out - match));
+      memcpy(out, match, n);
+      out += n;
+      match_length -= n;
+    }
+  }
+  return out == out_end;
+}
+
+CompressedImage::CompressedImage(int width, int height, int depth)
+    : _width(width), _height(height), _depth(depth), _data(nullptr) {}
+
+int CompressedImage::GetNumBands(int width, int height) {
+  return width ? (height + BAND_HEIGHT - 1) / BAND_HEIGHT : 0;
+}
+
+void CompressedImage::CompressBand(
+    const RawImage& src, int y, int height, std::vector<uint8_t>* dest) {
+  // 1. Tag each row, and gather the literal rows.
+  const size_t row_size = src.Width * src.Depth;
+  std::vector<uint8_t> literal_rows;
+  for (int row = y; row < y + height; ++row) {
+    const uint8_t* const pixels = src.Pixels + row * src.Stride;
+    if ((row > y) && !memcmp(pixels, pixels - src.Stride, row_size)) {
+      dest->push_back(REPEATED_ROW);
+    } else if (!memcmp(pixels, pixels + src.Depth, row_size - src.Depth)) {
+      dest->push_back(UNIFORM_ROW);
+      dest->insert(dest->end(), pixels, pixels + src.Depth);
+    } else {
+      dest->push_back(LITERAL_ROW);
+      literal_rows.insert(literal_rows.end(), pixels, pixels + row_size);
+    }
+  }
+
+  // 2. Compress the literal rows together.
+  LzCompress(literal_rows.data(), literal_rows.size(), dest);
+}
+
+bool CompressedImage::DecompressBand(
+    int i, const RawImage& dest, std::vector<uint8_t>* scratch) const {
+  const uint8_t* in = _data + _band_offsets[i];
+  const uint8_t* const in_end = _data + _band_offsets[i + 1];
+  const int y = i * BAND_HEIGHT;
+  const int height = std::min<int>(BAND_HEIGHT, _height - y);
+  const size_t row_size = _width * _depth;
+
+  // 1. Skip past the row tags, and count the literal rows.
+  const uint8_t* const tags = in;
+  size_t num_literal_rows = 0;
+  for (int row = 0; row < height; ++row) {
+    if (in == in_end) {
+      return false;
+    }
+    switch (*in++) {
+      case UNIFORM_ROW:
+        if (in_end - in < _depth) {
+          return false;
+        }
+        in += _depth;
+        break;
+      case REPEATED_ROW:
+        if (row == 0) {
+          return false;
+        }
+        break;
+      case LITERAL_ROW:
+        ++num_literal_rows;
+        break;
+      default:
+        return false;
+    }
+  }
+
+  // 2. Decompress the literal rows.
+  scratch->resize(num_literal_rows * row_size);
+  if (!LzDecompress(in, in_end - in, scratch->data(), scratch->size())) {
+    return false;
+  }
+
+  // 3. Write out the rows.
+  const uint8_t* literal_row = scratch->data();
+  in = tags;
+  for (int row = y; row < y + height; ++row) {
+    uint8_t* const pixels = dest.Pixels + row * dest.Stride;
+    switch (*in++) {
+      case UNIFORM_ROW:
+        FillRow(pixels, row_size, in, _depth);
+        in += _depth;
+        break;
+      case REPEATED_ROW:
+        memcpy(pixels, pixels - dest.Stride, row_size);
+        break;
+      case LITERAL_ROW:
+        memcpy(pixels, literal_row, row_size);
+        literal_row += row_size;
+        break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,129 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the CompressedImage class, which holds a losslessly
+// compressed copy of a block of raw pixel memory.
+
+#ifndef IMAGE_CODEC_HPP
+#define IMAGE_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image_kernels.hpp"
+
+// A losslessly compressed image, tuned for rendered document pages, which are
+// mostly runs of background color. The image is split into bands of
+// BAND_HEIGHT rows, which are compressed and decompressed independently and in
+// parallel. Within a band, rows of a single color and rows repeating the row
+// above are stored as a tag, and the remaining rows are compressed together
+// with a byte-oriented LZ77 codec in the style of LZ4, which favors speed over
+// compression ratio.
+class CompressedImage {
+ public:
+  // Number of rows in a band.
+  enum { BAND_HEIGHT = 32 };
+
+  // Compresses an image. Caller owns returned value. Multi-threaded.
+  static CompressedImage* Compress(const RawImage& src);
+
+  // Decompresses the image into dest, which must have the same size and depth.
+  // Returns false if the compressed data is corrupt. Multi-threaded.
+  bool Decompress(const RawImage& dest) const;
+
+  // Appends the image to dest in a self-contained format: a fixed header,
+  // followed by the offsets of the bands and the compressed bands themselves,
+  // so that it can be mapped from a file and used in place by Deserialize().
+  void Serialize(std::vector<uint8_t>* dest) const;
+  // Reads an image written by Serialize() in place, without copying the
+  // compressed bands. The memory must stay valid for as long as the image;
+  // owner, if given, is released once the image is destroyed. Returns nullptr
+  // if the data is not a valid image. Caller owns returned value.
+  static CompressedImage* Deserialize(
+      const uint8_t* data, size_t size, std::shared_ptr<const void> owner);
+
+  // Size of the original image.
+  int GetWidth() const;
+  int GetHeight() const;
+  int GetDepth() const;
+  // Returns the number of bytes used by the compressed data.
+  size_t GetByteSize() const;
+
+  // Compresses size bytes at src with the LZ codec, and appends the result to
+  // dest.
+  static void LzCompress(
+      const uint8_t* src, size_t size, std::vector<uint8_t>* dest);
+  // Decompresses src_size bytes at src produced by LzCompress() into exactly
+  // dest_size bytes at dest. Returns false if the data is corrupt or does not
+  // decompress to dest_size bytes.
+  static bool LzDecompress(
+      const uint8_t* src, size_t src_size, uint8_t* dest, size_t dest_size);
+
+ private:
+  // How a row is stored.
+  enum RowTag {
+    // All pixels have the color that follows the tag.
+    UNIFORM_ROW,
+    // Same as the row above, which is in the same band.
+    REPEATED_ROW,
+    // Stored in the compressed data of the band.
+    LITERAL_ROW,
+  };
+
+  // Identifies the serialized format, including its version and byte order.
+  enum { SERIALIZED_MAGIC = 0x3143424a };
+  // Header of the serialized format. It is followed by (NumBands + 1) 64-bit
+  // band offsets, and the compressed bands.
+  struct SerializedHeader {
+    uint32_t Magic;
+    uint32_t Width, Height, Depth;
+    uint32_t NumBands;
+    uint32_t Reserved;
+  };
+
+  // Size of the original image.
+  int _width, _height, _depth;
+  // Compressed bands, one after another. Points into _own_data, or into
+  // memory kept alive by _data_owner.
+  const uint8_t* _data;
+  std::vector<uint8_t> _own_data;
+  std::shared_ptr<const void> _data_owner;
+  // Offsets of each band in _data, followed by the size of _data.
+  std::vector<size_t> _band_offsets;
+
+  CompressedImage(int width, int height, int depth);
+
+  // Returns the number of bands in an image of the given size.
+  static int GetNumBands(int width, int height);
+
+  // Compresses rows [y, y + height) of src and appends the result to dest.
+  static void CompressBand(
+      const RawImage& src, int y, int height, std::vector<uint8_t>* dest);
+  // Decompresses band i into dest, using scratch to hold its literal rows.
+  // Returns false if it is corrupt.
+  bool DecompressBand(
+      int i, const RawImage& dest, std::vector<uint8_t>* scratch) const;
+
+  // Disable copy and assign.
+  CompressedImage(const CompressedImage&);
+  CompressedImage& operator=(const CompressedImage&);
+};
+
+#endif
@@ -0,0 +1,450 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file implements low-level kernels that transform blocks of raw pixel
+// memory.
+
+#include "image_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "multithreading.hpp"
+
+namespace {
+
+// Interpolation weights are fixed-point numbers with this many fractional
+// bits.
+enum { WEIGHT_BITS = 8, WEIGHT_ONE = 1 << WEIGHT_BITS };
+
+// Where a scaled pixel falls in the source image along one axis. The scaled
+// pixel is a blend of the source pixels at Index0 and Index1, where Weight is
+// the weight of Index1.
+struct SamplePosition {
+  int Index0;
+  int Index1;
+  int Weight;
+};
+
+// Maps the center of pixel scaled_pos in a scaled axis of length scaled_len
+// onto a source axis of length src_len.
+SamplePosition MapToSource(int scaled_pos, int scaled_len, int src_len) {
+  // Position in the source axis, in 16.16 fixed point.
+  const int64_t pos =
+      ((2 * static_cast<int64_t>(scaled_pos) + 1) * src_len << 16) /
+          (2 * static_cast<int64_t>(scaled_len)) -
+      (1 << 15);
+  SamplePosition r;
+  if (pos <= 0) {
+    r.Index0 = r.Index1 = 0;
+    r.Weight = 0;
+  } else if ((pos >> 16) >= src_len - 1) {
+    r.Index0 = r.Index1 = src_len - 1;
+    r.Weight = 0;
+  } else {
+    r.Index0 = static_cast<int>(pos >> 16);
+    r.Index1 = r.Index0 + 1;
+    r.Weight = static_cast<int>((pos & 0xffff) >> (16 - WEIGHT_BITS));
+  }
+  return r;
+}
+
+// Blends two rows of bytes. Kept free of data-dependent indexing so that the
+// compiler can vectorize it.
+void BlendRows(
+    const uint8_t* row0, const uint8_t* row1, int weight, int length,
+    uint8_t* out) {
+  const unsigned int w1 = weight, w0 = WEIGHT_ONE - weight;
+  for (int i = 0; i < length; ++i) {
+    out[i] = static_cast<uint8_t>(
+        (row0[i] * w0 + row1[i] * w1 + WEIGHT_ONE / 2) >> WEIGHT_BITS);
+  }
+}
+
+// Horizontally interpolates a row of pixels. Specialized on depth so that the
+// per-channel loop is unrolled.
+template <int Depth>
+void BlendColumns(
+    const uint8_t* row, const SamplePosition* xs, int width, uint8_t* out) {
+  for (int x = 0; x < width; ++x) {
+    const uint8_t* p0 = row + xs[x].Index0 * Depth;
+    const uint8_t* p1 = row + xs[x].Index1 * Depth;
+    const unsigned int w1 = xs[x].Weight, w0 = WEIGHT_ONE - xs[x].Weight;
+    for (int c = 0; c < Depth; ++c) {
+      out[c] = static_cast<uint8_t>(
+          (p0[c] * w0 + p1[c] * w1 + WEIGHT_ONE / 2) >> WEIGHT_BITS);
+    }
+    out += Depth;
+  }
+}
+
+void BlendColumns(
+    int depth, const uint8_t* row, const SamplePosition* xs, int width,
+    uint8_t* out) {
+  switch (depth) {
+    case 1:
+      BlendColumns<1>(row, xs, width, out);
+      break;
+    case 2:
+      BlendColumns<2>(row, xs, width, out);
+      break;
+    case 3:
+      BlendColumns<3>(row, xs, width, out);
+      break;
+    case 4:
+      BlendColumns<4>(row, xs, width, out);
+      break;
+    default:
+      fprintf(stderr, "Unsupported color depth %d", depth);
+      abort();
+  }
+}
+
+// Side length in pixels of the square blocks processed by RotateQuarterTurns.
+// A block of the source and destination at depth 4 fits comfortably in L1.
+enum { ROTATE_BLOCK_SIZE = 32 };
+
+// Rotates the block of dest with top-left corner (x_begin, y_begin). Each
+// destination pixel is read from the source pixel it maps back to. Specialized
+// on depth and quarter turns so that the inner loop is a fixed-size copy with
+// a constant stride.
+template <int Depth, int QuarterTurns>
+void RotateBlock(
+    const RawImage& src, const RawImage& dest, int x_begin, int y_begin) {
+  const int x_end = std::min(dest.Width, x_begin + ROTATE_BLOCK_SIZE);
+  const int y_end = std::min(dest.Height, y_begin + ROTATE_BLOCK_SIZE);
+  for (int y = y_begin; y < y_end; ++y) {
+    uint8_t* dest_pixel = dest.Pixels + y * dest.Stride + x_begin * Depth;
+    for (int x = x_begin; x < x_end; ++x) {
+      int src_x, src_y;
+      switch (QuarterTurns) {
+        case 1:
+          src_x = y;
+          src_y = src.Height - 1 - x;
+          break;
+        case 2:
+          src_x = src.Width - 1 - x;
+          src_y = src.Height - 1 - y;
+          break;
+        case 3:
+          src_x = src.Width - 1 - y;
+          src_y = x;
+          break;
+        default:
+          src_x = x;
+          src_y = y;
+          break;
+      }
+      memcpy(
+          dest_pixel, src.Pixels + src_y * src.Stride + src_x * Depth, Depth);
+      dest_pixel += Depth;
+    }
+  }
+}
+
+// Rotates all blocks of dest in the given block rows.
+template <int Depth, int QuarterTurns>
+void RotateBlockRows(
+    const RawImage& src, const RawImage& dest, int block_row_begin,
+    int block_row_end) {
+  for (int block_row = block_row_begin; block_row < block_row_end;
+       ++block_row) {
+    for (int x = 0; x < dest.Width; x += ROTATE_BLOCK_SIZE) {
+      RotateBlock<Depth, QuarterTurns>(
+          src, dest, x, block_row * ROTATE_BLOCK_SIZE);
+    }
+  }
+}
+
+template <int Depth>
+void RotateBlockRows(
+    const RawImage& src, int quarter_turns, const RawImage& dest,
+    int block_row_begin, int block_row_end) {
+  switch (quarter_turns) {
+    case 0:
+      RotateBlockRows<Depth, 0>(src, dest, block_row_begin, block_row_end);
+      break;
+    case 1:
+      RotateBlockRows<Depth, 1>(src, dest, block_row_begin, block_row_end);
+      break;
+    case 2:
+      RotateBlockRows<Depth, 2>(src, dest, block_row_begin, block_row_end);
+      break;
+    case 3:
+      RotateBlockRows<Depth, 3>(src, dest, block_row_begin, block_row_end);
+      break;
+  }
+}
+
+// Expands the gray levels in the given rows of src to dest through lut.
+template <int Depth>
+void ExpandGrayRows(
+    const RawImage& src, const uint8_t* lut, const RawImage& dest,
+    int y_begin, int y_end) {
+  for (int y = y_begin; y < y_end; ++y) {
+    const uint8_t* src_row = src.Pixels + y * src.Stride;
+    uint8_t* dest_pixel = dest.Pixels + y * dest.Stride;
+    for (int x = 0; x < src.Width; ++x) {
+      memcpy(dest_pixel, lut + src_row[x] * Depth, Depth);
+      dest_pixel += Depth;
+    }
+  }
+}
+
+// Same as ExpandGrayRows<4>, for a lut where gray level v becomes the pixel
+// value base + v * step. Free of table lookups, so the compiler vectorizes it.
+void ExpandGrayRowsLinear(
+    const RawImage& src, uint32_t base, uint32_t step, const RawImage& dest,
+    int y_begin, int y_end) {
+  for (int y = y_begin; y < y_end; ++y) {
+    const uint8_t* src_row = src.Pixels + y * src.Stride;
+    uint32_t* dest_row =
+        reinterpret_cast<uint32_t*>(dest.Pixels + y * dest.Stride);
+    for (int x = 0; x < src.Width; ++x) {
+      dest_row[x] = base + src_row[x] * step;
+    }
+  }
+}
+
+// Averages 2x2 blocks of src in the given rows of dest.
+template <int Depth>
+void DownsampleHalfRows(
+    const RawImage& src, const RawImage& dest, int y_begin, int y_end) {
+  for (int y = y_begin; y < y_end; ++y) {
+    const uint8_t* src_row0 = src.Pixels + (2 * y) * src.Stride;
+    const uint8_t* src_row1 =
+        (2 * y + 1 < src.Height) ? src_row0 + src.Stride : src_row0;
+    uint8_t* dest_pixel = dest.Pixels + y * dest.Stride;
+    for (int x = 0; x < dest.Width; ++x) {
+      const int x0 = 2 * x * Depth;
+      const int x1 = (2 * x + 1 < src.Width) ? x0 + Depth : x0;
+      for (int c = 0; c < Depth; ++c) {
+        dest_pixel[c] =
+            (src_row0[x0 + c] + src_row0[x1 + c] + src_row1[x0 + c] +
+             src_row1[x1 + c] + 2) >>
+            2;
+      }
+      dest_pixel += Depth;
+    }
+  }
+}
+
+// Runs f(y_begin, y_end) over horizontal stripes of a region of the given
+// height in parallel.
+void ForEachStripe(int height, const std::function<void(int, int)>& f) {
+  ExecuteInParallel([=](int num_threads, int i) {
+    const int num_rows_per_thread = height / num_threads;
+    const int y_begin = i * num_rows_per_thread;
+    const int y_end =
+        (i == num_threads - 1) ? height : (i + 1) * num_rows_per_thread;
+    if (y_begin < y_end) {
+      f(y_begin, y_end);
+    }
+  });
+}
+
+}  // namespace
+
+void ResampleBilinear(
+    const RawImage& src, int scaled_width, int scaled_height, int x, int y,
+    const RawImage& dest) {
+  assert(src.Depth == dest.Depth);
+  assert((src.Width > 0) && (src.Height > 0));
+  assert((x >= 0) && (x + dest.Width <= scaled_width));
+  assert((y >= 0) && (y + dest.Height <= scaled_height));
+  if ((dest.Width <= 0) || (dest.Height <= 0)) {
+    return;
+  }
+  const int depth = src.Depth;
+
+  // 1. Precompute horizontal sample positions. These are shared by all rows,
+  // and are made relative to the leftmost source column we need so that the
+  // vertical pass only blends the columns that are actually used.
+  std::vector<SamplePosition> xs(dest.Width);
+  for (int i = 0; i < dest.Width; ++i) {
+    xs[i] = MapToSource(x + i, scaled_width, src.Width);
+  }
+  const int src_x_begin = xs.front().Index0;
+  const int src_x_end = xs.back().Index1 + 1;
+  for (SamplePosition& p : xs) {
+    p.Index0 -= src_x_begin;
+    p.Index1 -= src_x_begin;
+  }
+  const int span_length = (src_x_end - src_x_begin) * depth;
+
+  // 2. For every output row, blend the two source rows vertically, then blend
+  // adjacent pixels of the result horizontally.
+  ForEachStripe(dest.Height, [&](int y_begin, int y_end) {
+    std::vector<uint8_t> blended_row(span_length);
+    for (int dest_y = y_begin; dest_y < y_end; ++dest_y) {
+      const SamplePosition sy =
+          MapToSource(y + dest_y, scaled_height, src.Height);
+      const uint8_t* row0 =
+          src.Pixels + sy.Index0 * src.Stride + src_x_begin * depth;
+      const uint8_t* row1 =
+          src.Pixels + sy.Index1 * src.Stride + src_x_begin * depth;
+      BlendRows(row0, row1, sy.Weight, span_length, blended_row.data());
+      BlendColumns(
+          depth, blended_row.data(), xs.data(), dest.Width,
+          dest.Pixels + dest_y * dest.Stride);
+    }
+  });
+}
+
+void ResampleNearest(
+    const RawImage& src, int scaled_width, int scaled_height, int x, int y,
+    const RawImage& dest) {
+  assert(src.Depth == dest.Depth);
+  assert((src.Width > 0) && (src.Height > 0));
+  assert((x >= 0) && (x + dest.Width <= scaled_width));
+  assert((y >= 0) && (y + dest.Height <= scaled_height));
+  if ((dest.Width <= 0) || (dest.Height <= 0)) {
+    return;
+  }
+  const int depth = src.Depth;
+
+  std::vector<int> src_offsets(dest.Width);
+  for (int i = 0; i < dest.Width; ++i) {
+    src_offsets[i] = static_cast<int>(
+        (2 * static_cast<int64_t>(x + i) + 1) * src.Width /
+        (2 * static_cast<int64_t>(scaled_width)));
+    src_offsets[i] *= depth;
+  }
+  ForEachStripe(dest.Height, [&](int y_begin, int y_end) {
+    for (int dest_y = y_begin; dest_y < y_end; ++dest_y) {
+      const int src_y = static_cast<int>(
+          (2 * static_cast<int64_t>(y + dest_y) + 1) * src.Height /
+          (2 * static_cast<int64_t>(scaled_height)));
+      const uint8_t* src_row = src.Pixels + src_y * src.Stride;
+      uint8_t* dest_pixel = dest.Pixels + dest_y * dest.Stride;
+      for (int i = 0; i < dest.Width; ++i) {
+        memcpy(dest_pixel, src_row + src_offsets[i], depth);
+        dest_pixel += depth;
+      }
+    }
+  });
+}
+
+void RotateQuarterTurns(
+    const RawImage& src, int quarter_turns, const RawImage& dest) {
+  assert(src.Depth == dest.Depth);
+  quarter_turns = ((quarter_turns % 4) + 4) % 4;
+  if (quarter_turns % 2) {
+    assert((dest.Width == src.Height) && (dest.Height == src.Width));
+  } else {
+    assert((dest.Width == src.Width) && (dest.Height == src.Height));
+  }
+  const int num_block_rows =
+      (dest.Height + ROTATE_BLOCK_SIZE - 1) / ROTATE_BLOCK_SIZE;
+  ForEachStripe(num_block_rows, [&](int block_row_begin, int block_row_end) {
+    switch (src.Depth) {
+      case 1:
+        RotateBlockRows<1>(
+            src, quarter_turns, dest, block_row_begin, block_row_end);
+        break;
+      case 2:
+        RotateBlockRows<2>(
+            src, quarter_turns, dest, block_row_begin, block_row_end);
+        break;
+      case 3:
+        RotateBlockRows<3>(
+            src, quarter_turns, dest, block_row_begin, block_row_end);
+        break;
+      case 4:
+        RotateBlockRows<4>(
+            src, quarter_turns, dest, block_row_begin, block_row_end);
+        break;
+      default:
+        fprintf(stderr, "Unsupported color depth %d", src.Depth);
+        abort();
+    }
+  });
+}
+
+void ExpandGray(
+    const RawImage& src, const uint8_t* lut, const RawImage& dest) {
+  assert(src.Depth == 1);
+  assert((dest.Width == src.Width) && (dest.Height == src.Height));
+
+  // 1. Check whether the lut is linear.
+  uint32_t base = 0, step = 0;
+  bool linear = dest.Depth == 4;
+  if (linear) {
+    uint32_t values[256];
+    memcpy(values, lut, sizeof(values));
+    base = values[0];
+    step = values[1] - values[0];
+    for (uint32_t v = 0; linear && (v < 256); ++v) {
+      linear = values[v] == base + v * step;
+    }
+  }
+
+  // 2. Expand.
+  ForEachStripe(src.Height, [&](int y_begin, int y_end) {
+    if (linear) {
+      ExpandGrayRowsLinear(src, base, step, dest, y_begin, y_end);
+      return;
+    }
+    switch (dest.Depth) {
+      case 1:
+        ExpandGrayRows<1>(src, lut, dest, y_begin, y_end);
+        break;
+      case 2:
+        ExpandGrayRows<2>(src, lut, dest, y_begin, y_end);
+        break;
+      case 3:
+        ExpandGrayRows<3>(src, lut, dest, y_begin, y_end);
+        break;
+      case 4:
+        ExpandGrayRows<4>(src, lut, dest, y_begin, y_end);
+        break;
+      default:
+        fprintf(stderr, "Unsupported color depth %d", dest.Depth);
+        abort();
+    }
+  });
+}
+
+void DownsampleHalf(const RawImage& src, const RawImage& dest) {
+  assert(src.Depth == dest.Depth);
+  assert(dest.Width == (src.Width + 1) / 2);
+  assert(dest.Height == (src.Height + 1) / 2);
+  ForEachStripe(dest.Height, [&](int y_begin, int y_end) {
+    switch (dest.Depth) {
+      case 1:
+        DownsampleHalfRows<1>(src, dest, y_begin, y_end);
+        break;
+      case 2:
+        DownsampleHalfRows<2>(src, dest, y_begin, y_end);
+        break;
+      case 3:
+        DownsampleHalfRows<3>(src, dest, y_begin, y_end);
+        break;
+      case 4:
+        DownsampleHalfRows<4>(src, dest, y_begin, y_end);
+        break;
+      default:
+        fprintf(stderr, "Unsupported color depth %d", dest.Depth);
+        abort();
+    }
+  });
+}
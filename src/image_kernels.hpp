@@ -0,0 +1,85 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares low-level kernels that transform blocks of raw pixel
+// memory. They know nothing about color formats beyond the number of bytes per
+// pixel, so they can be shared by documents and pixel buffers alike.
+
+#ifndef IMAGE_KERNELS_HPP
+#define IMAGE_KERNELS_HPP
+
+#include <cstdint>
+
+// A window onto raw pixel memory. Each pixel is Depth bytes long, and rows
+// start Stride bytes apart. Does not own the memory.
+struct RawImage {
+  uint8_t* Pixels;
+  int Width;
+  int Height;
+  int Stride;
+  int Depth;
+
+  RawImage(uint8_t* pixels, int width, int height, int stride, int depth)
+      : Pixels(pixels),
+        Width(width),
+        Height(height),
+        Stride(stride),
+        Depth(depth) {}
+};
+
+// Scales src to scaled_width x scaled_height using bilinear interpolation, and
+// writes the region of the scaled image whose top-left corner is at (x, y) to
+// dest. The size of the region is the size of dest. Every byte of a pixel is
+// interpolated independently, so this is only correct for formats where each
+// color channel occupies a whole byte. Multi-threaded.
+extern void ResampleBilinear(
+    const RawImage& src, int scaled_width, int scaled_height, int x, int y,
+    const RawImage& dest);
+
+// Same as ResampleBilinear, but picks the nearest source pixel instead of
+// interpolating. This is correct for any pixel format. Multi-threaded.
+extern void ResampleNearest(
+    const RawImage& src, int scaled_width, int scaled_height, int x, int y,
+    const RawImage& dest);
+
+// Rotates src clockwise by the given number of quarter turns, and writes the
+// result to dest. dest must have the same depth as src, and its width and
+// height must be swapped relative to src for an odd number of quarter turns.
+// Works through the image in square blocks so that the column-wise accesses
+// of a transpose stay in cache. Multi-threaded.
+extern void RotateQuarterTurns(
+    const RawImage& src, int quarter_turns, const RawImage& dest);
+
+// Converts src, which holds one gray level per byte, to dest, which may have
+// any depth. lut holds the 256 pixels that gray levels 0 to 255 become, laid
+// out in memory as in dest. src and dest must be the same size. If lut maps
+// gray levels linearly to 4 byte pixels, as it does for common RGB formats,
+// pixels are computed rather than looked up, so that the loop vectorizes.
+// Multi-threaded.
+extern void ExpandGray(
+    const RawImage& src, const uint8_t* lut, const RawImage& dest);
+
+// Halves the size of src, and writes the result to dest. Each destination
+// pixel is the average of a 2x2 block of source pixels, so the width and
+// height of dest must be those of src divided by 2 and rounded up; a block
+// that extends past the edge of an odd-sized src repeats its last row or
+// column. Like ResampleBilinear, this averages every byte of a pixel
+// independently. Multi-threaded.
+extern void DownsampleHalf(const RawImage& src, const RawImage& dest);
+
+#endif
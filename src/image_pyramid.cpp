@@ -0,0 +1,125 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the ImagePyramid class.
+
+#include "image_pyramid.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+ImagePyramid* ImagePyramid::Build(const RawImage& src) {
+  if ((src.Width <= 0) || (src.Height <= 0)) {
+    return nullptr;
+  }
+  // Each level is computed from the one above it, so only two levels are
+  // held uncompressed at any time.
+  std::vector<std::unique_ptr<CompressedImage>> levels;
+  levels.emplace_back(CompressedImage::Compress(src));
+  std::vector<uint8_t> level_pixels;
+  RawImage level = src;
+  while ((level.Width > MIN_LEVEL_SIZE) || (level.Height > MIN_LEVEL_SIZE)) {
+    const int width = (level.Width + 1) / 2, height = (level.Height + 1) / 2;
+    std::vector<uint8_t> next_level_pixels(
+        static_cast<size_t>(width) * height * src.Depth);
+    const RawImage next_level(
+        next_level_pixels.data(), width, height, width * src.Depth, src.Depth);
+    DownsampleHalf(level, next_level);
+    levels.emplace_back(CompressedImage::Compress(next_level));
+    // Swapping keeps next_level pointing to the same pixels.
+    level_pixels.swap(next_level_pixels);
+    level = next_level;
+  }
+  return new ImagePyramid(std::move(levels));
+}
+
+ImagePyramid* ImagePyramid::FromLevels(
+    std::vector<std::unique_ptr<CompressedImage>> levels) {
+  if (levels.empty()) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < levels.size(); ++i) {
+    const CompressedImage& level = *levels[i];
+    if ((level.GetWidth() <= 0) || (level.GetHeight() <= 0) ||
+        (level.GetDepth() != levels[0]->GetDepth())) {
+      return nullptr;
+    }
+    const bool is_last = i + 1 == levels.size();
+    const bool is_small = (level.GetWidth() <= MIN_LEVEL_SIZE) &&
+                          (level.GetHeight() <= MIN_LEVEL_SIZE);
+    if (is_last != is_small) {
+      return nullptr;
+    }
+    if (!is_last &&
+        ((levels[i + 1]->GetWidth() != (level.GetWidth() + 1) / 2) ||
+         (levels[i + 1]->GetHeight() != (level.GetHeight() + 1) / 2))) {
+      return nullptr;
+    }
+  }
+  return new ImagePyramid(std::move(levels));
+}
+
+ImagePyramid::ImagePyramid(std::vector<std::unique_ptr<CompressedImage>> levels)
+    : _levels(std::move(levels)) {}
+
+int ImagePyramid::GetNumLevels() const { return _levels.size(); }
+
+const CompressedImage& ImagePyramid::GetLevel(int level) const {
+  assert((level >= 0) && (level < GetNumLevels()));
+  return *_levels[level];
+}
+
+size_t ImagePyramid::GetByteSize() const {
+  size_t byte_size = 0;
+  for (const auto& level : _levels) {
+    byte_size += level->GetByteSize();
+  }
+  return byte_size;
+}
+
+int ImagePyramid::ChooseLevel(int width, int height) const {
+  int chosen = -1;
+  for (int i = 0; i < GetNumLevels(); ++i) {
+    if ((_levels[i]->GetWidth() < width) ||
+        (_levels[i]->GetHeight() < height)) {
+      break;
+    }
+    chosen = i;
+  }
+  return chosen;
+}
+
+bool ImagePyramid::Render(const RawImage& dest) const {
+  const int chosen = ChooseLevel(dest.Width, dest.Height);
+  if (chosen < 0) {
+    return false;
+  }
+  const CompressedImage& level = *_levels[chosen];
+  assert(level.GetDepth() == dest.Depth);
+  const int width = level.GetWidth(), height = level.GetHeight();
+  std::vector<uint8_t> level_pixels(
+      static_cast<size_t>(width) * height * dest.Depth);
+  const RawImage src(
+      level_pixels.data(), width, height, width * dest.Depth, dest.Depth);
+  if (!level.Decompress(src)) {
+    return false;
+  }
+  ResampleBilinear(src, dest.Width, dest.Height, 0, 0, dest);
+  return true;
+}
@@ -0,0 +1,77 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the ImagePyramid class, which keeps an image at several
+// resolutions so that it can be scaled down quickly.
+
+#ifndef IMAGE_PYRAMID_HPP
+#define IMAGE_PYRAMID_HPP
+
+#include <memory>
+#include <vector>
+
+#include "image_codec.hpp"
+#include "image_kernels.hpp"
+
+// An image at successively halved resolutions, from a base level down to one
+// that fits in MIN_LEVEL_SIZE x MIN_LEVEL_SIZE. Levels are kept compressed,
+// and are decompressed one at a time to scale them to a requested size, so
+// that scaling a very large image costs about as much as the result rather
+// than the original. Thread-safe once built.
+class ImagePyramid {
+ public:
+  // Levels are halved until both their width and height are at most this.
+  enum { MIN_LEVEL_SIZE = 256 };
+
+  // Builds a pyramid whose base level is src. Returns nullptr if src is
+  // empty. Caller owns returned value. Multi-threaded.
+  static ImagePyramid* Build(const RawImage& src);
+  // Assembles a pyramid from levels previously returned by GetLevel(), e.g.
+  // after loading them from disk. Returns nullptr if they do not form a
+  // complete pyramid. Caller owns returned value.
+  static ImagePyramid* FromLevels(
+      std::vector<std::unique_ptr<CompressedImage>> levels);
+
+  // Returns the number of levels. Level 0 is the base level.
+  int GetNumLevels() const;
+  // Returns a level.
+  const CompressedImage& GetLevel(int level) const;
+  // Returns the memory taken up by the compressed levels, in bytes.
+  size_t GetByteSize() const;
+  // Returns the smallest level at least width x height in size, or -1 if the
+  // base level is smaller than that.
+  int ChooseLevel(int width, int height) const;
+
+  // Scales the image to the size of dest from the level chosen by
+  // ChooseLevel(), and writes it to dest, which must have the depth of the
+  // pyramid. Returns false if the base level is smaller than dest, or if the
+  // level is corrupt. Multi-threaded.
+  bool Render(const RawImage& dest) const;
+
+ private:
+  // Levels, from the largest to the smallest.
+  std::vector<std::unique_ptr<CompressedImage>> _levels;
+
+  explicit ImagePyramid(std::vector<std::unique_ptr<CompressedImage>> levels);
+
+  // Disable copy and assign.
+  ImagePyramid(const ImagePyramid&);
+  ImagePyramid& operator=(const ImagePyramid&);
+};
+
+#endif
@@ -43,6 +43,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cctype>
 #include <climits>
@@ -50,20 +51,67 @@
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "command.hpp"
 #include "cpp_compat.hpp"
+#include "disk_cache.hpp"
 #include "fitz_document.hpp"
 #include "framebuffer.hpp"
 #include "image_document.hpp"
+#include "memory_governor.hpp"
+#include "multithreading.hpp"
 #include "outline_view.hpp"
 #include "pdf_document.hpp"
+#include "pixel_buffer_pool.hpp"
+#include "render_cost_model.hpp"
+#include "renderd_document.hpp"
 #include "search_view.hpp"
+#include "thumbnail_view.hpp"
 #include "viewer.hpp"
 
+// An open document that is not displayed: one the user has switched away
+// from, or in slideshow mode, the next one in the playlist. It keeps its
+// viewer, and with it the pages it has rendered.
+struct OpenedDocument {
+  // Input file.
+  std::string FilePath;
+  // Document instance.
+  std::unique_ptr<Document> DocumentInst;
+  // Render costs of the document, and where they are saved.
+  std::unique_ptr<RenderCostModel> RenderCostModelInst;
+  std::string RenderCostModelPath;
+  // Viewer instance. Declared after DocumentInst so that it is destroyed
+  // first.
+  std::unique_ptr<Viewer> ViewerInst;
+  // Position and settings to restore when the document is displayed again.
+  Viewer::State ViewerState;
+  // When the document was last displayed, as a count of document switches.
+  int LastDisplayed;
+
+  OpenedDocument() : LastDisplayed(0) {}
+  // Saves render costs recorded for the document.
+  ~OpenedDocument() {
+    ViewerInst.reset();
+    if (RenderCostModelInst && !RenderCostModelPath.empty()) {
+      RenderCostModelInst->Save(RenderCostModelPath);
+    }
+  }
+};
+
+// Default number of rendered pages to keep while another virtual terminal is
+// active.
+enum { DEFAULT_INACTIVE_RENDER_CACHE_SIZE = 2 };
+
+// Render cache size below which the memory governor does not shrink the render
+// cache. This holds a two-page spread.
+enum { MIN_GOVERNED_RENDER_CACHE_SIZE = 3 };
+
 // Main program state.
 struct State : public Viewer::State {
   // If true, just print debugging info and exit.
@@ -83,6 +131,23 @@ struct State : public Viewer::State {
   } DocumentType;
   // Viewer render cache size.
   int RenderCacheSize;
+  // Viewer render cache size while another virtual terminal is active.
+  int InactiveRenderCacheSize;
+  // Maximum size of the MuPDF store of each document in bytes, or
+  // FZ_STORE_UNLIMITED.
+  size_t MupdfStoreSize;
+  // Whether to render pages in color in grayscale too.
+  bool ForceGray;
+  // Maximum size of the disk cache in bytes, or 0 if it is disabled.
+  int64_t DiskCacheSize;
+  // Whether a page to start at was given on the command line. Otherwise, the
+  // position last read is restored from the disk cache.
+  bool HasInitialPage;
+  // Whether the virtual terminal jfbview runs on is active.
+  bool VTActive;
+  // Read end of a pipe on which the VT watcher process reports whether the
+  // virtual terminal is active, or -1.
+  int VTEventFd;
   // Input file.
   std::string FilePath;
   // Password for the input file. If no password is provided, this will be
@@ -92,17 +157,63 @@ struct State : public Viewer::State {
   std::string FramebufferDevice;
   // Output file to append to when rendering is complete.
   std::string StatusFile;
+  // Keeps rendered pages and positions across sessions, or nullptr. Declared
+  // before the documents and viewers so that it is destroyed after them.
+  std::unique_ptr<DiskCache> DiskCacheInst;
+  // Prefetches pages for the viewers of all documents. Declared before the
+  // documents and viewers so that it is destroyed after them.
+  WorkQueue PrefetchQueue;
   // Document instance.
   std::unique_ptr<Document> DocumentInst;
+  // Render costs of the document, and where they are saved. The path is empty
+  // if they are not saved.
+  std::unique_ptr<RenderCostModel> RenderCostModelInst;
+  std::string RenderCostModelPath;
   // Outline view instance.
   std::unique_ptr<OutlineView> OutlineViewInst;
   // Search view instance.
   std::unique_ptr<SearchView> SearchViewInst;
   // Framebuffer instance.
   std::unique_ptr<Framebuffer> FramebufferInst;
+  // Thumbnail view instance. Declared after FramebufferInst so that it is
+  // destroyed first.
+  std::unique_ptr<ThumbnailView> ThumbnailViewInst;
   // Viewer instance.
   std::unique_ptr<Viewer> ViewerInst;
 
+  // Seconds to display each slide for in slideshow mode, or 0 if not in
+  // slideshow mode.
+  float SlideshowInterval;
+  // Input files given on the command line, including FilePath. In slideshow
+  // mode, these are cycled through.
+  std::vector<std::string> FilePaths;
+  // Index of FilePath in FilePaths.
+  int FileIndex;
+  // Documents other than the current one that have been opened, by index in
+  // FilePaths.
+  std::map<int, std::unique_ptr<OpenedDocument>> OpenedDocuments;
+  // The number of times the displayed document has been switched.
+  int NumDocumentSwitches;
+  // When the next slide is due.
+  std::chrono::steady_clock::time_point SlideDeadline;
+  // The number of slides shown on a timer, and how many of them had not been
+  // rendered by the time they were due.
+  int NumSlides;
+  int NumMissedSlides;
+  // Whether the slide due last is still waiting for its document to open.
+  bool SlideOverdue;
+  // The number of documents after FilePath in FilePaths that have failed to
+  // open as the next slide, and are skipped.
+  int NumSkippedSlideFiles;
+  // The next document in FilePaths, being opened in the background.
+  std::future<std::unique_ptr<OpenedDocument>> NextDocument;
+
+  // Shrinks caches under memory pressure, or nullptr if jfbview does not run
+  // under a cgroup memory limit.
+  std::unique_ptr<MemoryGovernor> MemoryGovernorInst;
+  // When to check memory pressure next.
+  std::chrono::steady_clock::time_point NextMemoryCheck;
+
   // Default state.
   State()
       : Viewer::State(),
@@ -111,14 +222,33 @@ struct State : public Viewer::State {
         Render(true),
         DocumentType(AUTO_DETECT),
         RenderCacheSize(Viewer::DEFAULT_RENDER_CACHE_SIZE),
+        InactiveRenderCacheSize(DEFAULT_INACTIVE_RENDER_CACHE_SIZE + 1),
+        MupdfStoreSize(FZ_STORE_DEFAULT),
+        ForceGray(false),
+        DiskCacheSize(0),
+        HasInitialPage(false),
+        VTActive(true),
+        VTEventFd(-1),
         FilePath(""),
         FilePassword(),
         FramebufferDevice(Framebuffer::DEFAULT_FRAMEBUFFER_DEVICE),
         StatusFile(""),
+        DiskCacheInst(nullptr),
+        PrefetchQueue(1, true),
+        RenderCostModelInst(nullptr),
+        RenderCostModelPath(""),
         OutlineViewInst(nullptr),
         SearchViewInst(nullptr),
         FramebufferInst(nullptr),
-        ViewerInst(nullptr) {}
+        ThumbnailViewInst(nullptr),
+        ViewerInst(nullptr),
+        SlideshowInterval(0.0f),
+        FileIndex(0),
+        NumDocumentSwitches(0),
+        NumSlides(0),
+        NumMissedSlides(0),
+        SlideOverdue(false),
+        NumSkippedSlideFiles(0) {}
 };
 
 // Returns the all lowercase version of a string.
@@ -138,47 +268,49 @@ static std::string GetFileExtension(const std::string& path) {
   return std::string();
 }
 
-// Loads the file specified in a state. Returns true if the file has been
-// loaded.
-static bool LoadFile(State* state) {
+// Opens a document with the given password, which may be nullptr, treating it
+// as the given type of file. MuPDF documents cache at most mupdf_store_size
+// bytes of fonts and images. Prints an error and returns nullptr on failure.
+static Document* OpenDocument(
+    const std::string& path, const std::string* password, int document_type,
+    size_t mupdf_store_size) {
 #if !defined(JFBVIEW_ENABLE_LEGACY_PDF_IMPL) && \
     !defined(JFBVIEW_ENABLE_LEGACY_IMAGE_IMPL)
-  Document* doc =
-      FitzDocument::Open(state->FilePath, state->FilePassword.get());
+  Document* doc = FitzDocument::Open(path, password, mupdf_store_size);
 #else
-  if (state->DocumentType == State::AUTO_DETECT) {
-    if (GetFileExtension(state->FilePath) == "pdf") {
-      state->DocumentType = State::PDF;
+  if (document_type == State::AUTO_DETECT) {
+    if (GetFileExtension(path) == "pdf") {
+      document_type = State::PDF;
     } else {
 #ifndef JFBVIEW_NO_IMLIB2
-      state->DocumentType = State::IMAGE;
+      document_type = State::IMAGE;
 #else
       fprintf(
           stderr,
           "Cannot detect file format. Plase specify a file format "
           "with --format. Try --help for help.\n");
-      return false;
+      return nullptr;
 #endif
     }
   }
   Document* doc = nullptr;
-  switch (state->DocumentType) {
+  switch (document_type) {
     case State::PDF:
 #ifdef JFBVIEW_ENABLE_LEGACY_PDF_IMPL
-      doc = PDFDocument::Open(state->FilePath, state->FilePassword.get());
+      doc = PDFDocument::Open(path, password);
 #else
-      doc = FitzDocument::Open(state->FilePath, state->FilePassword.get());
+      doc = FitzDocument::Open(path, password, mupdf_store_size);
 #endif
       break;
 #ifdef JFBVIEW_ENABLE_LEGACY_IMAGE_IMPL
 #ifndef JFBVIEW_NO_IMLIB2
     case State::IMAGE:
-      doc = ImageDocument::Open(state->FilePath);
+      doc = ImageDocument::Open(path);
       break;
 #endif
 #else
     case State::IMAGE:
-      doc = FitzDocument::Open(state->FilePath, state->FilePassword.get());
+      doc = FitzDocument::Open(path, password, mupdf_store_size);
       break;
 #endif
     default:
@@ -186,11 +318,318 @@ static bool LoadFile(State* state) {
   }
 #endif
   if (doc == nullptr) {
-    fprintf(
-        stderr, "Failed to open document \"%s\".\n", state->FilePath.c_str());
+    fprintf(stderr, "Failed to open document \"%s\".\n", path.c_str());
+    return nullptr;
+  }
+  // Render pages through jfbview-renderd if it is running.
+  return RenderdDocument::Open(doc, path, password);
+}
+
+// Loads render costs recorded for a file in previous sessions, and stores
+// where they are saved in model_path.
+static std::unique_ptr<RenderCostModel> LoadRenderCosts(
+    const std::string& path, std::string* model_path) {
+  std::unique_ptr<RenderCostModel> model = std::make_unique<RenderCostModel>();
+  *model_path = RenderCostModel::GetDefaultPath(path);
+  if (!model_path->empty()) {
+    model->Load(*model_path);
+  }
+  return model;
+}
+
+// Loads the file specified in a state. Returns true if the file has been
+// loaded.
+static bool LoadFile(State* state) {
+  Document* doc = OpenDocument(
+      state->FilePath, state->FilePassword.get(), state->DocumentType,
+      state->MupdfStoreSize);
+  if (doc == nullptr) {
     return false;
   }
   state->DocumentInst.reset(doc);
+  state->RenderCostModelInst =
+      LoadRenderCosts(state->FilePath, &state->RenderCostModelPath);
+  return true;
+}
+
+// Saves render costs recorded for the current document, if any.
+static void SaveRenderCosts(State* state) {
+  if (state->RenderCostModelInst && !state->RenderCostModelPath.empty()) {
+    state->RenderCostModelInst->Save(state->RenderCostModelPath);
+  }
+}
+
+// Opens the disk cache if enabled. Returns false if it is enabled but cannot be
+// opened. The cache stays closed when a password is given, so that pages of
+// encrypted documents are never written to disk unencrypted.
+static bool OpenDiskCache(State* state) {
+  if ((state->DiskCacheSize <= 0) || state->FilePassword) {
+    return true;
+  }
+  const std::string dir = DiskCache::GetDefaultDir();
+  if (!dir.empty()) {
+    state->DiskCacheInst.reset(DiskCache::Open(dir, state->DiskCacheSize));
+  }
+  return state->DiskCacheInst != nullptr;
+}
+
+// Applies the settings a new viewer of a file takes after construction: whether
+// to render all pages in grayscale, and the disk cache to keep pages in, if
+// any.
+static void ConfigureViewer(
+    bool force_gray, DiskCache* disk_cache, const std::string& path,
+    Viewer* viewer) {
+  viewer->SetForceGray(force_gray);
+  if (disk_cache == nullptr) {
+    return;
+  }
+  const std::string fingerprint = DiskCache::GetFingerprint(path);
+  if (!fingerprint.empty()) {
+    viewer->SetDiskCache(disk_cache, fingerprint);
+  }
+}
+
+// Saves the position in a file to the disk cache, if any, so that the next
+// session opening the same content starts there.
+static void SavePosition(
+    DiskCache* disk_cache, const std::string& path,
+    const Viewer::State& viewer_state) {
+  if (disk_cache == nullptr) {
+    return;
+  }
+  const std::string fingerprint = DiskCache::GetFingerprint(path);
+  if (fingerprint.empty()) {
+    return;
+  }
+  char position[128];
+  snprintf(
+      position, sizeof(position), "%d %.9g %d %d %d", viewer_state.Page,
+      viewer_state.Zoom, viewer_state.Rotation, viewer_state.XOffset,
+      viewer_state.YOffset);
+  disk_cache->StorePosition(fingerprint, position);
+}
+
+// Moves a viewer state to the position last saved for a file, if any. Offsets
+// are only restored if the zoom ratio and rotation are unchanged.
+static void RestorePosition(
+    DiskCache* disk_cache, const std::string& path,
+    Viewer::State* viewer_state) {
+  if (disk_cache == nullptr) {
+    return;
+  }
+  const std::string fingerprint = DiskCache::GetFingerprint(path);
+  std::string position;
+  if (fingerprint.empty() ||
+      !disk_cache->LoadPosition(fingerprint, &position)) {
+    return;
+  }
+  int page, rotation, x_offset, y_offset;
+  float zoom;
+  if ((sscanf(
+           position.c_str(), "%d %f %d %d %d", &page, &zoom, &rotation,
+           &x_offset, &y_offset) < 5) ||
+      (page < 0)) {
+    return;
+  }
+  viewer_state->Page = page;
+  viewer_state->XOffset = viewer_state->YOffset = 0;
+  if ((std::fabs(zoom - viewer_state->Zoom) < 1e-4f) &&
+      (rotation == viewer_state->Rotation)) {
+    viewer_state->XOffset = x_offset;
+    viewer_state->YOffset = y_offset;
+  }
+}
+
+// Appends an event to the status file, if any, on a line of its own.
+static void WriteStatus(const State* state, const char* event) {
+  if (state->StatusFile.empty()) {
+    return;
+  }
+  FILE* status_file = fopen(state->StatusFile.c_str(), "a");
+  if (status_file) {
+    fprintf(status_file, "%s\n", event);
+    fclose(status_file);
+  }
+}
+
+// Appends the memory usage of MuPDF across all documents to the status file.
+static void WriteMupdfMemoryStatus(const State* state) {
+  const FitzAllocator::Stats& stats = FitzAllocator::GetStats();
+  char status[256];
+  int length = snprintf(
+      status, sizeof(status), "mupdf_memory current=%zu peak=%zu",
+      stats.Current, stats.Peak);
+  for (int i = 0; i < FitzAllocator::NUM_CATEGORIES; ++i) {
+    length += snprintf(
+        status + length, sizeof(status) - length, " %s=%zu",
+        FitzAllocator::GetCategoryName(static_cast<FitzAllocator::Category>(i)),
+        stats.ByCategory[i]);
+  }
+  WriteStatus(state, status);
+}
+
+// Creates the outline, search and thumbnail views for the current document.
+static void CreateDocumentViews(State* state) {
+  state->OutlineViewInst = std::make_unique<OutlineView>(
+      state->DocumentInst->GetOutline(), state->StatusFile);
+  state->SearchViewInst = std::make_unique<SearchView>(
+      state->DocumentInst.get(), state->StatusFile);
+  state->ThumbnailViewInst = std::make_unique<ThumbnailView>(
+      state->DocumentInst.get(), state->FramebufferInst.get(),
+      state->StatusFile);
+  // Start rendering the targets of highlighted outline items and search hits,
+  // so that they are ready when the user jumps to them.
+  state->OutlineViewInst->SetHighlightHandler(
+      [state](const Document::OutlineItem* item) {
+        state->ViewerInst->Warm({state->DocumentInst->Lookup(item)});
+      });
+  state->SearchViewInst->SetHighlightHandler(
+      [state](int page) { state->ViewerInst->Warm({page}); });
+}
+
+// Destroys the outline, search and thumbnail views of the current document.
+// The thumbnail view renders the document in the background, so it must be
+// stopped before the document is replaced.
+static void DestroyDocumentViews(State* state) {
+  state->OutlineViewInst.reset();
+  state->SearchViewInst.reset();
+  state->ThumbnailViewInst.reset();
+}
+
+// Opens a file together with a viewer for it at the given settings, and loads
+// its render costs, and configures the viewer with ConfigureViewer(). Returns
+// nullptr on failure. Does not touch the program state, so that it can be
+// called in the background.
+static std::unique_ptr<OpenedDocument> LoadDocument(
+    const std::string& path, const std::string* password, int document_type,
+    size_t mupdf_store_size, Framebuffer* fb, const Viewer::State& viewer_state,
+    int render_cache_size, WorkQueue* prefetch_queue, bool force_gray,
+    DiskCache* disk_cache) {
+  std::unique_ptr<OpenedDocument> doc = std::make_unique<OpenedDocument>();
+  doc->FilePath = path;
+  doc->DocumentInst.reset(
+      OpenDocument(path, password, document_type, mupdf_store_size));
+  if (doc->DocumentInst == nullptr) {
+    return nullptr;
+  }
+  doc->RenderCostModelInst = LoadRenderCosts(path, &doc->RenderCostModelPath);
+  doc->ViewerState = viewer_state;
+  doc->ViewerInst = std::make_unique<Viewer>(
+      doc->DocumentInst.get(), fb, viewer_state, render_cache_size,
+      doc->RenderCostModelInst.get(), prefetch_queue);
+  ConfigureViewer(force_gray, disk_cache, path, doc->ViewerInst.get());
+  return doc;
+}
+
+// Displays an open document in place of the current one, at its saved
+// position. Returns the previously current document, with its viewer and
+// position.
+static std::unique_ptr<OpenedDocument> SwitchDocument(
+    State* state, std::unique_ptr<OpenedDocument> next) {
+  state->ViewerInst->PauseDrawing();
+  DestroyDocumentViews(state);
+  std::unique_ptr<OpenedDocument> previous =
+      std::make_unique<OpenedDocument>();
+  previous->FilePath = state->FilePath;
+  previous->DocumentInst = std::move(state->DocumentInst);
+  previous->RenderCostModelInst = std::move(state->RenderCostModelInst);
+  previous->RenderCostModelPath = state->RenderCostModelPath;
+  previous->ViewerInst = std::move(state->ViewerInst);
+  previous->ViewerState = *state;
+  SavePosition(state->DiskCacheInst.get(), state->FilePath, *state);
+  previous->LastDisplayed = ++state->NumDocumentSwitches;
+
+  state->FilePath = next->FilePath;
+  state->DocumentInst = std::move(next->DocumentInst);
+  state->RenderCostModelInst = std::move(next->RenderCostModelInst);
+  state->RenderCostModelPath = next->RenderCostModelPath;
+  state->ViewerInst = std::move(next->ViewerInst);
+  static_cast<Viewer::State&>(*state) = next->ViewerState;
+  CreateDocumentViews(state);
+  return previous;
+}
+
+// Number of rendered pages each document that is not displayed keeps, so that
+// switching back to it shows its page at once.
+enum { NUM_BACKGROUND_CACHED_PAGES = 1 };
+
+// Divides the render cache budget between open documents. Documents that are
+// not displayed keep NUM_BACKGROUND_CACHED_PAGES each, as long as the displayed
+// document is left with at least half of the budget; the ones displayed least
+// recently lose their share first. The displayed document gets the rest. Under
+// memory pressure, the budget is reduced, and pages pinned for marks and slides
+// count towards it.
+static void DistributeRenderCache(State* state) {
+  // 1. Order documents that are not displayed from most to least recently
+  // displayed.
+  std::vector<OpenedDocument*> docs;
+  for (const auto& entry : state->OpenedDocuments) {
+    docs.push_back(entry.second.get());
+  }
+  std::sort(
+      docs.begin(), docs.end(),
+      [](const OpenedDocument* a, const OpenedDocument* b) {
+        return a->LastDisplayed > b->LastDisplayed;
+      });
+
+  // 2. Hand out shares. A render cache of size n holds n - 1 pages.
+  int budget = state->RenderCacheSize;
+  if (state->MemoryGovernorInst) {
+    int num_pinned_pages = state->ViewerInst->GetNumPinnedPages();
+    for (const OpenedDocument* doc : docs) {
+      num_pinned_pages += doc->ViewerInst->GetNumPinnedPages();
+    }
+    budget = std::max<int>(
+        std::min<int>(MIN_GOVERNED_RENDER_CACHE_SIZE, state->RenderCacheSize),
+        state->MemoryGovernorInst->GetCacheSize(
+            state->RenderCacheSize, MIN_GOVERNED_RENDER_CACHE_SIZE) -
+            num_pinned_pages);
+  }
+  --budget;
+  int num_pages = budget;
+  for (OpenedDocument* doc : docs) {
+    int share = 0;
+    if (num_pages - NUM_BACKGROUND_CACHED_PAGES >= (budget + 1) / 2) {
+      share = NUM_BACKGROUND_CACHED_PAGES;
+      num_pages -= share;
+    }
+    doc->ViewerInst->CancelPrefetch();
+    doc->ViewerInst->SetRenderCacheSize(share + 1);
+  }
+  state->ViewerInst->SetRenderCacheSize(num_pages + 1);
+}
+
+// Displays the file at the given index in FilePaths, opening it if needed.
+// Returns false if it fails to open.
+static bool SwitchToFile(State* state, int index) {
+  if (index == state->FileIndex) {
+    return true;
+  }
+  std::unique_ptr<OpenedDocument> next =
+      std::move(state->OpenedDocuments[index]);
+  state->OpenedDocuments.erase(index);
+  if (next == nullptr) {
+    // Open new documents at the current settings, but from the start, or
+    // from where they were last read.
+    Viewer::State viewer_state = *state;
+    viewer_state.Page = 0;
+    viewer_state.XOffset = viewer_state.YOffset = 0;
+    RestorePosition(
+        state->DiskCacheInst.get(), state->FilePaths[index], &viewer_state);
+    next = LoadDocument(
+        state->FilePaths[index], state->FilePassword.get(),
+        state->DocumentType, state->MupdfStoreSize,
+        state->FramebufferInst.get(), viewer_state, state->RenderCacheSize,
+        &state->PrefetchQueue, state->ForceGray, state->DiskCacheInst.get());
+    if (next == nullptr) {
+      return false;
+    }
+  }
+  state->OpenedDocuments[state->FileIndex] =
+      SwitchDocument(state, std::move(next));
+  state->FileIndex = index;
+  state->NumSkippedSlideFiles = 0;
+  DistributeRenderCache(state);
   return true;
 }
 
@@ -198,6 +637,17 @@ static bool LoadFile(State* state) {
  *                                 COMMANDS                                  *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+// Returns the page n pages after the current page, or in spread layout, the
+// first page of the spread n spreads after the current spread. The result may
+// be out of range.
+static int AdvancePage(const State* state, int n) {
+  if (state->Layout != Viewer::SPREAD) {
+    return state->Page + n;
+  }
+  const int spread = Viewer::GetSpread(state->Page) + n;
+  return spread < 0 ? spread : Viewer::GetSpreadStart(spread);
+}
+
 class ExitCommand : public Command {
  public:
   void Execute(int repeat, State* state) override { state->Exit = true; }
@@ -206,6 +656,12 @@ class ExitCommand : public Command {
 // Base class for move commands.
 class MoveCommand : public Command {
  protected:
+  // Whether moving past the top or bottom of a page should snap to the
+  // adjacent page. In continuous layout, the viewer scrolls across pages by
+  // itself.
+  static bool SnapToPages(const State* state) {
+    return state->Layout != Viewer::CONTINUOUS;
+  }
   // Returns how much to move by in a direction.
   int GetMoveSize(const State* state, bool horizontal) const {
     if (horizontal) {
@@ -219,9 +675,10 @@ class MoveDownCommand : public MoveCommand {
  public:
   void Execute(int repeat, State* state) override {
     state->YOffset += RepeatOrDefault(repeat, 1) * GetMoveSize(state, false);
-    if (state->YOffset + state->ScreenHeight >=
-        state->PageHeight - 1 + GetMoveSize(state, false)) {
-      if (++(state->Page) < state->NumPages) {
+    if (SnapToPages(state) &&
+        (state->YOffset + state->ScreenHeight >=
+         state->PageHeight - 1 + GetMoveSize(state, false))) {
+      if ((state->Page = AdvancePage(state, 1)) < state->NumPages) {
         state->YOffset = 0;
       }
     }
@@ -232,8 +689,9 @@ class MoveUpCommand : public MoveCommand {
  public:
   void Execute(int repeat, State* state) override {
     state->YOffset -= RepeatOrDefault(repeat, 1) * GetMoveSize(state, false);
-    if (state->YOffset <= -GetMoveSize(state, false)) {
-      if (--(state->Page) >= 0) {
+    if (SnapToPages(state) &&
+        (state->YOffset <= -GetMoveSize(state, false))) {
+      if ((state->Page = AdvancePage(state, -1)) >= 0) {
         state->YOffset = INT_MAX;
       }
     }
@@ -254,25 +712,26 @@ class MoveRightCommand : public MoveCommand {
   }
 };
 
-class ScreenDownCommand : public Command {
+class ScreenDownCommand : public MoveCommand {
  public:
   void Execute(int repeat, State* state) override {
     state->YOffset += RepeatOrDefault(repeat, 1) * state->ScreenHeight;
-    if (state->YOffset + state->ScreenHeight >=
-        state->PageHeight - 1 + state->ScreenHeight) {
-      if (++(state->Page) < state->NumPages) {
+    if (SnapToPages(state) &&
+        (state->YOffset + state->ScreenHeight >=
+         state->PageHeight - 1 + state->ScreenHeight)) {
+      if ((state->Page = AdvancePage(state, 1)) < state->NumPages) {
         state->YOffset = 0;
       }
     }
   }
 };
 
-class ScreenUpCommand : public Command {
+class ScreenUpCommand : public MoveCommand {
  public:
   void Execute(int repeat, State* state) override {
     state->YOffset -= RepeatOrDefault(repeat, 1) * state->ScreenHeight;
-    if (state->YOffset <= -state->ScreenHeight) {
-      if (--(state->Page) >= 0) {
+    if (SnapToPages(state) && (state->YOffset <= -state->ScreenHeight)) {
+      if ((state->Page = AdvancePage(state, -1)) >= 0) {
         state->YOffset = INT_MAX;
       }
     }
@@ -282,14 +741,14 @@ class ScreenUpCommand : public Command {
 class PageDownCommand : public Command {
  public:
   void Execute(int repeat, State* state) override {
-    state->Page += RepeatOrDefault(repeat, 1);
+    state->Page = AdvancePage(state, RepeatOrDefault(repeat, 1));
   }
 };
 
 class PageUpCommand : public Command {
  public:
   void Execute(int repeat, State* state) override {
-    state->Page -= RepeatOrDefault(repeat, 1);
+    state->Page = AdvancePage(state, -RepeatOrDefault(repeat, 1));
   }
 };
 
@@ -407,6 +866,12 @@ class GoToPageCommand : public Command {
       state->Page = page;
       state->XOffset = 0;
       state->YOffset = 0;
+      // A page number typed by the user is not known to be a page to go to
+      // until this command, but keys queued behind it may still delay the
+      // render of the page.
+      if (repeat != NO_REPEAT) {
+        state->ViewerInst->Warm({page});
+      }
     }
   }
 
@@ -417,6 +882,7 @@ class GoToPageCommand : public Command {
 class ShowOutlineViewCommand : public Command {
  public:
   void Execute(int repeat, State* state) override {
+    state->ViewerInst->PauseDrawing();
     const Document::OutlineItem* dest = state->OutlineViewInst->Run();
     if (dest == nullptr) {
       return;
@@ -432,6 +898,7 @@ class ShowOutlineViewCommand : public Command {
 class ShowSearchViewCommand : public Command {
  public:
   void Execute(int repeat, State* state) override {
+    state->ViewerInst->PauseDrawing();
     const int dest_page = state->SearchViewInst->Run();
     if (dest_page >= 0) {
       GoToPageCommand c(0);
@@ -440,6 +907,18 @@ class ShowSearchViewCommand : public Command {
   }
 };
 
+class ShowThumbnailViewCommand : public Command {
+ public:
+  void Execute(int repeat, State* state) override {
+    state->ViewerInst->PauseDrawing();
+    const int dest_page = state->ThumbnailViewInst->Run(state->Page);
+    if (dest_page >= 0) {
+      GoToPageCommand c(0);
+      c.Execute(dest_page + 1, state);
+    }
+  }
+};
+
 // Base class for SaveStateCommand and RestoreStateCommand.
 class StateCommand : public Command {
  protected:
@@ -451,7 +930,15 @@ std::map<int, Viewer::State> StateCommand::_saved_states;
 class SaveStateCommand : public StateCommand {
  public:
   void Execute(int repeat, State* state) override {
-    state->ViewerInst->GetState(&(_saved_states[RepeatOrDefault(repeat, 0)]));
+    const int n = RepeatOrDefault(repeat, 0);
+    // Commands for keys queued up before this one have only changed state,
+    // so lay out the screen they lead to first. That is the position to save,
+    // and it determines the pages to pin.
+    state->ViewerInst->SetState(*state);
+    state->ViewerInst->Render();
+    state->ViewerInst->GetState(state);
+    state->ViewerInst->GetState(&(_saved_states[n]));
+    state->ViewerInst->PinMark(n);
     state->Render = false;
   }
 };
@@ -470,16 +957,48 @@ class RestoreStateCommand : public StateCommand {
 class ReloadCommand : public StateCommand {
  public:
   void Execute(int repeat, State* state) override {
+    // The viewer also renders the document in the background.
+    DestroyDocumentViews(state);
+    state->ViewerInst.reset();
+    SaveRenderCosts(state);
     if (LoadFile(state)) {
       state->ViewerInst = std::make_unique<Viewer>(
           state->DocumentInst.get(), state->FramebufferInst.get(), *state,
-          state->RenderCacheSize);
+          state->RenderCacheSize, state->RenderCostModelInst.get(),
+          &state->PrefetchQueue);
+      ConfigureViewer(
+          state->ForceGray, state->DiskCacheInst.get(), state->FilePath,
+          state->ViewerInst.get());
+      CreateDocumentViews(state);
+      DistributeRenderCache(state);
     } else {
       state->Exit = true;
     }
   }
 };
 
+class SwitchDocumentCommand : public Command {
+ public:
+  // Switches to the next file given on the command line if direction is 1, or
+  // the previous one if it is -1.
+  explicit SwitchDocumentCommand(int direction) : _direction(direction) {}
+
+  void Execute(int repeat, State* state) override {
+    // In slideshow mode, files are switched on a timer instead.
+    const int num_files = state->FilePaths.size();
+    if ((num_files <= 1) || (state->SlideshowInterval > 0.0f)) {
+      state->Render = false;
+      return;
+    }
+    const int n = RepeatOrDefault(repeat, 1) % num_files;
+    SwitchToFile(
+        state, (state->FileIndex + _direction * n + num_files) % num_files);
+  }
+
+ private:
+  int _direction;
+};
+
 class ToggleInvertedColorModeCommand : public Command {
  public:
   void Execute(int repeat, State* state) override {
@@ -498,17 +1017,250 @@ class ToggleSepiaColorModeCommand : public Command {
   }
 };
 
+class ToggleLayoutCommand : public Command {
+ public:
+  explicit ToggleLayoutCommand(Viewer::Layout layout) : _layout(layout) {}
+
+  void Execute(int repeat, State* state) override {
+    state->Layout = state->Layout == _layout ? Viewer::SINGLE_PAGE : _layout;
+  }
+
+ private:
+  Viewer::Layout _layout;
+};
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  *                               END COMMANDS                                *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                 SLIDESHOW                                 *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// Returns the page to show after the current page in slideshow mode, or -1 if
+// the current page is the last one.
+static int GetNextSlide(const State* state) {
+  const int page = AdvancePage(state, 1);
+  return page < state->NumPages ? page : -1;
+}
+
+// Returns the index in FilePaths of the document that the slide after the last
+// page comes from in slideshow mode, skipping documents that failed to open.
+static int GetNextSlideFile(const State* state) {
+  return (state->FileIndex + 1 + state->NumSkippedSlideFiles) %
+         state->FilePaths.size();
+}
+
+// Starts preparing the slide after the current one in slideshow mode, so that
+// it is ready by the time it is due. This is the next page, or after the last
+// page, the first page of the next document in the playlist, which is opened
+// in the background. Called whenever the screen has been rendered.
+static void PrepareNextSlide(State* state) {
+  const int page = GetNextSlide(state);
+  if ((page >= 0) || (state->FilePaths.size() <= 1)) {
+    state->ViewerInst->PrepareSlide(std::max(0, page));
+    return;
+  }
+  if (state->NextDocument.valid()) {
+    return;
+  }
+  // The background task must not touch state, so it is given copies of what
+  // it needs.
+  const std::string path = state->FilePaths[GetNextSlideFile(state)];
+  const std::shared_ptr<std::string> password =
+      state->FilePassword ? std::make_shared<std::string>(*state->FilePassword)
+                          : nullptr;
+  const int document_type = state->DocumentType;
+  const size_t mupdf_store_size = state->MupdfStoreSize;
+  Framebuffer* const fb = state->FramebufferInst.get();
+  Viewer::State viewer_state = *state;
+  viewer_state.Page = 0;
+  viewer_state.XOffset = viewer_state.YOffset = 0;
+  const int render_cache_size = state->RenderCacheSize;
+  WorkQueue* const prefetch_queue = &state->PrefetchQueue;
+  const bool force_gray = state->ForceGray;
+  DiskCache* const disk_cache = state->DiskCacheInst.get();
+  state->NextDocument = std::async(std::launch::async, [=] {
+    std::unique_ptr<OpenedDocument> next = LoadDocument(
+        path, password.get(), document_type, mupdf_store_size, fb,
+        viewer_state, render_cache_size, prefetch_queue, force_gray,
+        disk_cache);
+    if (next != nullptr) {
+      next->ViewerInst->PrepareSlide(0);
+    }
+    return next;
+  });
+}
+
+// How often to check whether the next document in the playlist has opened,
+// once its first slide is due.
+static const int SLIDE_RETRY_INTERVAL_MS = 50;
+
+// Moves to the next slide in slideshow mode once it is due. If it has not been
+// rendered yet, it is counted as missed; it is still only displayed once it
+// has been rendered in full, since Render() never draws part of a screen. If it
+// is in a document that has not finished opening, the current slide stays up,
+// and this is called again shortly. Documents that fail to open are skipped.
+static void AdvanceSlide(State* state) {
+  // 1. Move to the next page, or the next document in the playlist once it
+  // has opened.
+  const auto now = std::chrono::steady_clock::now();
+  // Keeps the current slide up, and tries again shortly.
+  auto retry_later = [state, now] {
+    if (!state->SlideOverdue) {
+      state->SlideOverdue = true;
+      ++state->NumSlides;
+      ++state->NumMissedSlides;
+      WriteStatus(state, "slide_deadline_missed");
+    }
+    state->SlideDeadline =
+        now + std::chrono::milliseconds(SLIDE_RETRY_INTERVAL_MS);
+  };
+  bool ready = !state->SlideOverdue;
+  const int page = GetNextSlide(state);
+  if ((page >= 0) || (state->FilePaths.size() <= 1)) {
+    ready = ready && state->ViewerInst->IsSlideReady(std::max(0, page));
+    state->Page = std::max(0, page);
+    state->XOffset = state->YOffset = 0;
+  } else {
+    PrepareNextSlide(state);
+    if (state->NextDocument.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      retry_later();
+      return;
+    }
+    std::unique_ptr<OpenedDocument> next = state->NextDocument.get();
+    if (next != nullptr) {
+      // The previous document is closed rather than kept.
+      ready = ready && next->ViewerInst->IsSlideReady(0);
+      state->FileIndex = GetNextSlideFile(state);
+      state->NumSkippedSlideFiles = 0;
+      SwitchDocument(state, std::move(next));
+    } else if (
+        ++state->NumSkippedSlideFiles <
+        static_cast<int>(state->FilePaths.size()) - 1) {
+      // Skip a document that fails to open, and open the one after it.
+      WriteStatus(state, "slide_document_skipped");
+      PrepareNextSlide(state);
+      retry_later();
+      return;
+    } else {
+      // If no other document opens, start this one over.
+      WriteStatus(state, "slide_document_skipped");
+      state->NumSkippedSlideFiles = 0;
+      state->Page = 0;
+      state->XOffset = state->YOffset = 0;
+    }
+  }
+
+  // 2. Report a missed deadline, unless it was reported while waiting for the
+  // document to open.
+  if (!state->SlideOverdue) {
+    ++state->NumSlides;
+    if (!ready) {
+      ++state->NumMissedSlides;
+      WriteStatus(state, "slide_deadline_missed");
+    }
+  }
+  state->SlideOverdue = false;
+
+  // 3. Set the next deadline relative to this one, so that slow slides do not
+  // delay the ones after them. If more than a whole slide behind, start over
+  // from now rather than rushing through slides.
+  const auto interval = std::chrono::milliseconds(
+      static_cast<int>(state->SlideshowInterval * 1000.0f));
+  state->SlideDeadline += interval;
+  if (state->SlideDeadline < now) {
+    state->SlideDeadline = now + interval;
+  }
+}
+
+// Returns the number of milliseconds until the next slide is due in slideshow
+// mode, or -1 if not in slideshow mode.
+static int GetTimeToNextSlide(const State* state) {
+  if (state->SlideshowInterval <= 0.0f) {
+    return -1;
+  }
+  return std::max<int>(
+      0, std::chrono::duration_cast<std::chrono::milliseconds>(
+             state->SlideDeadline - std::chrono::steady_clock::now())
+             .count());
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                              MEMORY PRESSURE                              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// Checks memory pressure if it is time to, and when the pressure level
+// changes, resizes render caches accordingly. When the level rises, also
+// empties the MuPDF stores of all open documents, which hold fonts and
+// decoded images. Decisions, and the memory used by MuPDF at every check, are
+// logged to the status file.
+static void CheckMemory(State* state) {
+  // 1. Read memory usage.
+  MemoryGovernor* const governor = state->MemoryGovernorInst.get();
+  const auto now = std::chrono::steady_clock::now();
+  if ((governor == nullptr) || (now < state->NextMemoryCheck)) {
+    return;
+  }
+  state->NextMemoryCheck =
+      now + std::chrono::milliseconds(MemoryGovernor::CHECK_INTERVAL_MS);
+  MemoryGovernor::Reading reading;
+  const MemoryGovernor::Level previous_level = governor->GetLevel();
+  if (!governor->Read(&reading)) {
+    return;
+  }
+  WriteMupdfMemoryStatus(state);
+  if (!governor->Update(reading)) {
+    return;
+  }
+
+  // 2. Resize caches. While another virtual terminal is active, caches are
+  // kept at their minimum anyway, and are resized on return.
+  if (state->VTActive) {
+    DistributeRenderCache(state);
+  }
+  if (governor->GetLevel() > previous_level) {
+    state->ThumbnailViewInst->ReleaseMemory();
+    state->DocumentInst->ReleaseMemory();
+    for (const auto& entry : state->OpenedDocuments) {
+      entry.second->DocumentInst->ReleaseMemory();
+    }
+    PixelBufferPool::Get()->Trim();
+  }
+
+  // 3. Log the decision.
+  char status[128];
+  snprintf(
+      status, sizeof(status),
+      "memory_pressure %s current=%lld max=%lld psi=%.2f",
+      MemoryGovernor::GetLevelName(governor->GetLevel()),
+      static_cast<long long>(reading.Current),
+      static_cast<long long>(reading.Max), reading.Pressure);
+  WriteStatus(state, status);
+}
+
+// Returns the number of milliseconds until memory pressure is due to be
+// checked, or -1 if it is not checked.
+static int GetTimeToMemoryCheck(const State* state) {
+  if (state->MemoryGovernorInst == nullptr) {
+    return -1;
+  }
+  return std::max<int>(
+      0, std::chrono::duration_cast<std::chrono::milliseconds>(
+             state->NextMemoryCheck - std::chrono::steady_clock::now())
+             .count());
+}
+
 // Help text printed by --help or -h.
 static const char* HELP_STRING =
     "\n" JFBVIEW_PROGRAM_NAME " " JFBVIEW_VERSION
     "\n"
     "\n"
     "Usage: " JFBVIEW_BINARY_NAME
-    " [OPTIONS] FILE\n"
+    " [OPTIONS] FILE...\n"
+    "       " JFBVIEW_BINARY_NAME
+    " --slideshow=N [OPTIONS] FILE...\n"
     "\n"
     "Options:\n"
     "\t--help, -h            Show this message.\n"
@@ -524,6 +1276,17 @@ static const char* HELP_STRING =
     "\t                      Start in inverted color mode.\n"
     "\t--color_mode=sepia, -c sepia\n"
     "\t                      Start in sepia color mode.\n"
+    "\t--gray                Render all pages in grayscale, which takes a\n"
+    "\t                      quarter of the memory on most screens. Pages\n"
+    "\t                      without color are rendered this way anyway.\n"
+    "\t--layout=continuous   Start in continuous layout, with pages displayed\n"
+    "\t                      one below the other.\n"
+    "\t--layout=spread       Start in spread layout, with facing pages\n"
+    "\t                      displayed side by side.\n"
+    "\t--page_gap=N          In continuous and spread layout, leave N pixels\n"
+    "\t                      between pages.\n"
+    "\t--slideshow=N         Advance to the next page every N seconds, and\n"
+    "\t                      after the last page, to the next file.\n"
 #if defined(JFBVIEW_ENABLE_LEGACY_IMAGE_IMPL) && \
     defined(JFBVIEW_ENABLE_LEGACY_PDF_IMPL) && !defined(JFBVIEW_NO_IMLIB2)
     "\t--format=image, -f image\n"
@@ -538,6 +1301,17 @@ static const char* HELP_STRING =
     "\t                      huge documents, or if you just want to reduce\n"
     "\t                      memory usage, you might want to set this to a\n"
     "\t                      smaller number.\n"
+    "\t--inactive_cache_size=N\n"
+    "\t                      While another virtual terminal is active, cache\n"
+    "\t                      at most N pages, and free other memory. The\n"
+    "\t                      default is 2.\n"
+    "\t--mupdf_store=N       Cache at most N MB of fonts and images per\n"
+    "\t                      document, or without limit if N is 0. The\n"
+    "\t                      default is 256.\n"
+    "\t--disk_cache=N        Keep at most N MB of rendered pages on disk\n"
+    "\t                      across sessions, and reopen files where they\n"
+    "\t                      were last read. Ignored with --password.\n"
+    "\t                      Disabled by default.\n"
     "\n"
     "jfbview home page: https://github.com/jichu4n/jfbview\n"
     "Bug reports & suggestions: https://github.com/jichu4n/jfbview/issues\n"
@@ -554,6 +1328,13 @@ static void ParseCommandLine(int argc, char* argv[], State* state) {
     FB,
     STATUS_FILE,
     PRINT_FB_DEBUG_INFO_AND_EXIT,
+    LAYOUT,
+    PAGE_GAP,
+    SLIDESHOW,
+    INACTIVE_CACHE_SIZE,
+    MUPDF_STORE,
+    DISK_CACHE,
+    GRAY,
   };
   // Command line options.
   static const option LongFlags[] = {
@@ -567,8 +1348,15 @@ static void ParseCommandLine(int argc, char* argv[], State* state) {
       {"zoom_to_fit", false, nullptr, ZOOM_TO_FIT},
       {"rotation", true, nullptr, 'r'},
       {"color_mode", true, nullptr, 'c'},
+      {"gray", false, nullptr, GRAY},
+      {"layout", true, nullptr, LAYOUT},
+      {"page_gap", true, nullptr, PAGE_GAP},
+      {"slideshow", true, nullptr, SLIDESHOW},
       {"format", true, nullptr, 'f'},
       {"cache_size", true, nullptr, RENDER_CACHE_SIZE},
+      {"inactive_cache_size", true, nullptr, INACTIVE_CACHE_SIZE},
+      {"mupdf_store", true, nullptr, MUPDF_STORE},
+      {"disk_cache", true, nullptr, DISK_CACHE},
       {"fb_debug_info", false, nullptr, PRINT_FB_DEBUG_INFO_AND_EXIT},
       {0, 0, 0, 0},
   };
@@ -611,12 +1399,43 @@ static void ParseCommandLine(int argc, char* argv[], State* state) {
         }
         state->RenderCacheSize = std::max(1, state->RenderCacheSize + 1);
         break;
+      case INACTIVE_CACHE_SIZE:
+        if (sscanf(optarg, "%d", &(state->InactiveRenderCacheSize)) < 1) {
+          fprintf(stderr, "Invalid inactive cache size \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        state->InactiveRenderCacheSize =
+            std::max(1, state->InactiveRenderCacheSize + 1);
+        break;
+      case MUPDF_STORE: {
+        int store_mb;
+        if ((sscanf(optarg, "%d", &store_mb) < 1) || (store_mb < 0)) {
+          fprintf(stderr, "Invalid MuPDF store size \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        state->MupdfStoreSize = static_cast<size_t>(store_mb) << 20;
+        break;
+      }
+      case GRAY:
+        state->ForceGray = true;
+        break;
+      case DISK_CACHE: {
+        int disk_cache_mb;
+        if ((sscanf(optarg, "%d", &disk_cache_mb) < 1) ||
+            (disk_cache_mb < 0)) {
+          fprintf(stderr, "Invalid disk cache size \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        state->DiskCacheSize = static_cast<int64_t>(disk_cache_mb) << 20;
+        break;
+      }
       case 'p':
         if (sscanf(optarg, "%d", &(state->Page)) < 1) {
           fprintf(stderr, "Invalid page number \"%s\"\n", optarg);
           exit(EXIT_FAILURE);
         }
         --(state->Page);
+        state->HasInitialPage = true;
         break;
       case 'z':
         if (sscanf(optarg, "%f", &(state->Zoom)) < 1) {
@@ -651,6 +1470,34 @@ static void ParseCommandLine(int argc, char* argv[], State* state) {
         }
         break;
       }
+      case LAYOUT: {
+        const std::string arg = ToLower(optarg);
+        if (arg == "single") {
+          state->Layout = Viewer::SINGLE_PAGE;
+        } else if (arg == "continuous") {
+          state->Layout = Viewer::CONTINUOUS;
+        } else if (arg == "spread") {
+          state->Layout = Viewer::SPREAD;
+        } else {
+          fprintf(stderr, "Invalid layout \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case PAGE_GAP:
+        if ((sscanf(optarg, "%d", &(state->PageGap)) < 1) ||
+            (state->PageGap < 0)) {
+          fprintf(stderr, "Invalid page gap \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case SLIDESHOW:
+        if ((sscanf(optarg, "%f", &(state->SlideshowInterval)) < 1) ||
+            (state->SlideshowInterval <= 0.0f)) {
+          fprintf(stderr, "Invalid slideshow interval \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
       case PRINT_FB_DEBUG_INFO_AND_EXIT:
         state->PrintFBDebugInfoAndExit = true;
         break;
@@ -664,14 +1511,9 @@ static void ParseCommandLine(int argc, char* argv[], State* state) {
       fprintf(stderr, "No file specified. Try \"-h\" for help.\n");
       exit(EXIT_FAILURE);
     }
-  } else if (optind < argc - 1) {
-    fprintf(
-        stderr,
-        "Please specify exactly one input file. Try \"-h\" for "
-        "help.\n");
-    exit(EXIT_FAILURE);
   } else {
-    state->FilePath = argv[optind];
+    state->FilePaths.assign(argv + optind, argv + argc);
+    state->FilePath = state->FilePaths.front();
   }
 }
 
@@ -723,19 +1565,31 @@ std::unique_ptr<Registry> BuildRegistry() {
   registry->Register(
       '\t', std::move(std::make_unique<ShowOutlineViewCommand>()));
   registry->Register('/', std::move(std::make_unique<ShowSearchViewCommand>()));
+  registry->Register(
+      't', std::move(std::make_unique<ShowThumbnailViewCommand>()));
 
   registry->Register('m', std::move(std::make_unique<SaveStateCommand>()));
   registry->Register('`', std::move(std::make_unique<RestoreStateCommand>()));
 
   registry->Register('e', std::move(std::make_unique<ReloadCommand>()));
+  registry->Register('n', std::make_unique<SwitchDocumentCommand>(1));
+  registry->Register('N', std::make_unique<SwitchDocumentCommand>(-1));
 
   registry->Register('I', std::make_unique<ToggleInvertedColorModeCommand>());
   registry->Register('S', std::make_unique<ToggleSepiaColorModeCommand>());
 
+  registry->Register(
+      'c', std::make_unique<ToggleLayoutCommand>(Viewer::CONTINUOUS));
+  registry->Register(
+      'd', std::make_unique<ToggleLayoutCommand>(Viewer::SPREAD));
+
   return registry;
 }
 
-static void DetectVTChange(pid_t parent) {
+// Watches for switches between virtual terminals. Runs in a child process.
+// Whenever the virtual terminal jfbview runs on becomes active or inactive,
+// writes '1' or '0' respectively to event_fd, and interrupts the parent.
+static void DetectVTChange(pid_t parent, int event_fd) {
   struct vt_event e;
   struct vt_stat s;
 
@@ -748,20 +1602,26 @@ static void DetectVTChange(pid_t parent) {
     goto out;
   }
   for (;;) {
+    memset(&e, 0, sizeof(e));
+    e.event = VT_EVENT_SWITCH;
     if (ioctl(fd, VT_WAITEVENT, &e) == -1) {
       goto out;
     }
-    if (e.newev == s.v_active) {
+    const char active = e.newev == s.v_active ? '1' : '0';
+    if (active == '1') {
       if (ioctl(fd, VT_WAITACTIVE, static_cast<int>(s.v_active)) == -1) {
         goto out;
       }
-      if (kill(parent, SIGWINCH)) {
-        goto out;
-        // I wanted to use SIGRTMIN, but getch was not interrupted.
-        // So instead, I choiced SIGWINCH because getch already
-        // recognises this (and returns KEY_RESIZE), and the program
-        // should support SIGWINCH and perform the same action anyways.
-      }
+    }
+    if (write(event_fd, &active, 1) != 1) {
+      goto out;
+    }
+    if (kill(parent, SIGWINCH)) {
+      goto out;
+      // I wanted to use SIGRTMIN, but getch was not interrupted.
+      // So instead, I choiced SIGWINCH because getch already
+      // recognises this (and returns KEY_RESIZE), and the program
+      // should support SIGWINCH and perform the same action anyways.
     }
   }
 
@@ -769,6 +1629,51 @@ out:
   close(fd);
 }
 
+// Frees memory and stops background work while another virtual terminal is
+// active. The displayed document keeps InactiveRenderCacheSize rendered pages,
+// and the others none. Thumbnails are discarded.
+static void SuspendDocuments(State* state) {
+  state->ThumbnailViewInst->ReleaseMemory();
+  state->ViewerInst->Suspend(state->InactiveRenderCacheSize);
+  for (const auto& entry : state->OpenedDocuments) {
+    entry.second->ViewerInst->Suspend(1);
+  }
+}
+
+// Undoes SuspendDocuments(). Rendering the screen afterwards renders the
+// visible pages first, and then prefetches the pages around them as usual.
+static void ResumeDocuments(State* state) {
+  DistributeRenderCache(state);
+  // Slides are not advanced while suspended; give the current one its full
+  // time again.
+  state->SlideDeadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(
+          static_cast<int>(state->SlideshowInterval * 1000.0f));
+}
+
+// Reads the reports of DetectVTChange(), and suspends or resumes documents
+// accordingly. Called when getch() is interrupted.
+static void HandleVTChange(State* state) {
+  // 1. Only the latest report matters.
+  bool vt_active = state->VTActive;
+  char event;
+  while ((state->VTEventFd != -1) && (read(state->VTEventFd, &event, 1) == 1)) {
+    vt_active = event == '1';
+  }
+  if (vt_active == state->VTActive) {
+    return;
+  }
+
+  // 2. Suspend or resume.
+  state->VTActive = vt_active;
+  if (vt_active) {
+    ResumeDocuments(state);
+  } else {
+    SuspendDocuments(state);
+  }
+}
+
 void PrintFBDebugInfo(Framebuffer* fb) {
   assert(fb != nullptr);
   fprintf(stdout, "%s", fb->GetDebugInfoString().c_str());
@@ -791,8 +1696,13 @@ Troubleshooting tips:
    device with "--fb=<path to device>".
 )";
 
+// While the viewer is displaying a preview, how often to check whether the
+// exact render is ready, in milliseconds.
+static const int PENDING_RENDER_POLL_INTERVAL_MS = 50;
+
 extern int JpdfgrepMain(int argc, char* argv[]);
 extern int JpdfcatMain(int argc, char* argv[]);
+extern int RenderdMain(int argc, char* argv[]);
 
 int main(int argc, char* argv[]) {
   // Dispatch to jpdfgrep and jpdfcat.
@@ -802,6 +1712,8 @@ int main(int argc, char* argv[]) {
     return JpdfgrepMain(argc, argv);
   } else if (basename == "jpdfcat") {
     return JpdfcatMain(argc, argv);
+  } else if (basename == "jfbview-renderd") {
+    return RenderdMain(argc, argv);
   }
 
   // Main program state.
@@ -823,6 +1735,13 @@ int main(int argc, char* argv[]) {
   if (!LoadFile(&state)) {
     exit(EXIT_FAILURE);
   }
+  if (!OpenDiskCache(&state)) {
+    fprintf(stderr, "Cannot open disk cache, continuing without it\n");
+  }
+  if (!state.HasInitialPage && (state.SlideshowInterval <= 0.0f)) {
+    RestorePosition(state.DiskCacheInst.get(), state.FilePath, &state);
+  }
+  state.MemoryGovernorInst.reset(MemoryGovernor::Create());
 
   setlocale(LC_ALL, "");
   initscr();
@@ -838,14 +1757,20 @@ int main(int argc, char* argv[]) {
 
   state.ViewerInst = std::make_unique<Viewer>(
       state.DocumentInst.get(), state.FramebufferInst.get(), state,
-      state.RenderCacheSize);
+      state.RenderCacheSize, state.RenderCostModelInst.get(),
+      &state.PrefetchQueue);
+  ConfigureViewer(
+      state.ForceGray, state.DiskCacheInst.get(), state.FilePath,
+      state.ViewerInst.get());
   std::unique_ptr<Registry> registry(BuildRegistry());
+  CreateDocumentViews(&state);
 
-  state.OutlineViewInst = std::make_unique<OutlineView>(
-      state.DocumentInst->GetOutline(), state.StatusFile);
-  state.SearchViewInst =
-      std::make_unique<SearchView>(state.DocumentInst.get(), state.StatusFile);
-
+  // Watch for virtual terminal switches in a child process, which reports them
+  // through a pipe.
+  int vt_event_pipe[2];
+  if (pipe(vt_event_pipe) == -1) {
+    vt_event_pipe[0] = vt_event_pipe[1] = -1;
+  }
   pid_t parent = getpid();
   if (!fork()) {
     if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1) {
@@ -858,50 +1783,120 @@ int main(int argc, char* argv[]) {
     if (getppid() != parent) {
       exit(EXIT_SUCCESS);
     }
-    DetectVTChange(parent);
+    close(vt_event_pipe[0]);
+    DetectVTChange(parent, vt_event_pipe[1]);
     exit(EXIT_FAILURE);
   }
+  if (vt_event_pipe[0] != -1) {
+    close(vt_event_pipe[1]);
+    fcntl(vt_event_pipe[0], F_SETFL, O_NONBLOCK);
+    state.VTEventFd = vt_event_pipe[0];
+  }
 
   // 2. Main event loop.
   state.Render = true;
+  state.SlideDeadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(
+          static_cast<int>(state.SlideshowInterval * 1000.0f));
   int repeat = Command::NO_REPEAT;
+  bool draw_pending = false;
   do {
-    // 2.1 Render.
-    if (state.Render) {
+    // 2.1 Render. Nothing is drawn while another virtual terminal is active.
+    // This only lays out the screen; the viewer draws it in the background,
+    // so that input is handled while pages are rendering.
+    if (state.Render && state.VTActive) {
       state.ViewerInst->SetState(state);
       state.ViewerInst->Render();
       state.ViewerInst->GetState(&state);
-
-      if (!state.StatusFile.empty()) {
-        FILE* status_file = fopen(state.StatusFile.c_str(), "a");
-        if (status_file) {
-          fprintf(status_file, "render_complete\n");
-          fclose(status_file);
-        }
+      draw_pending = true;
+      if (state.SlideshowInterval > 0.0f) {
+        PrepareNextSlide(&state);
       }
     }
     state.Render = true;
+    if (draw_pending && !state.ViewerInst->IsDrawPending()) {
+      WriteStatus(&state, "render_complete");
+      draw_pending = false;
+    }
 
-    // 2.2. Grab input.
-    int c;
-    while (isdigit(c = getch())) {
-      if (repeat == Command::NO_REPEAT) {
-        repeat = c - '0';
+    // 2.2. Grab input. If a preview is displayed, wake up periodically to
+    // replace it with the exact render once that is ready. Likewise, wake up
+    // to report when the screen has been drawn. In slideshow mode, also wake
+    // up when the next slide is due, and under a memory limit, when memory
+    // pressure is due to be checked.
+    CheckMemory(&state);
+    int timeout_ms = state.VTActive ? GetTimeToNextSlide(&state) : -1;
+    const int memory_check_ms = GetTimeToMemoryCheck(&state);
+    if ((memory_check_ms >= 0) &&
+        ((timeout_ms < 0) || (timeout_ms > memory_check_ms))) {
+      timeout_ms = memory_check_ms;
+    }
+    const bool render_pending =
+        state.VTActive && state.ViewerInst->IsRenderPending();
+    if ((render_pending || (draw_pending && !state.StatusFile.empty())) &&
+        ((timeout_ms < 0) || (timeout_ms > PENDING_RENDER_POLL_INTERVAL_MS))) {
+      timeout_ms = PENDING_RENDER_POLL_INTERVAL_MS;
+    }
+    timeout(timeout_ms);
+    int c = getch();
+    if (c == ERR) {
+      if (GetTimeToNextSlide(&state) == 0) {
+        AdvanceSlide(&state);
       } else {
-        repeat = repeat * 10 + c - '0';
+        state.Render = render_pending && !state.ViewerInst->IsRenderPending();
       }
-    }
-    if (c == KEY_RESIZE) {
       continue;
     }
 
-    // 2.3. Run command.
-    registry->Dispatch(c, repeat, &state);
-    repeat = Command::NO_REPEAT;
+    // 2.3. Run commands for this key and any keys queued up behind it, such as
+    // from key auto-repeat during a slow render, and only render the final
+    // state. Each command that would have rendered an intermediate state
+    // counts as a skipped render, and lays it out instead, so that the next
+    // command starts from the corrected position, zoom ratio and page size.
+    bool render = false;
+    int num_renders = 0;
+    do {
+      if (isdigit(c)) {
+        if (repeat == Command::NO_REPEAT) {
+          repeat = c - '0';
+        } else {
+          repeat = repeat * 10 + c - '0';
+        }
+      } else if (c == KEY_RESIZE) {
+        HandleVTChange(&state);
+        render = true;
+      } else {
+        state.Render = true;
+        registry->Dispatch(c, repeat, &state);
+        repeat = Command::NO_REPEAT;
+        if (state.Render) {
+          render = true;
+          ++num_renders;
+          if (!state.Exit && state.ViewerInst) {
+            state.ViewerInst->LayOut(&state);
+          }
+        }
+      }
+      // Commands that open a view may have changed the input timeout.
+      timeout(0);
+    } while (!state.Exit && ((c = getch()) != ERR));
+    state.Render = render;
+    for (int i = 1; i < num_renders; ++i) {
+      WriteStatus(&state, "render_skipped");
+    }
   } while (!state.Exit);
 
   // 3. Clean up.
-  state.OutlineViewInst.reset();
+  WriteMupdfMemoryStatus(&state);
+  if (state.NextDocument.valid()) {
+    state.NextDocument.get();
+  }
+  state.OpenedDocuments.clear();
+  DestroyDocumentViews(&state);
+  SavePosition(state.DiskCacheInst.get(), state.FilePath, state);
+  state.ViewerInst.reset();
+  SaveRenderCosts(&state);
   // Hack alert: Calling endwin() immediately after the framebuffer destructor
   // (which clears the screen) appears to cause a race condition where the next
   // shell prompt after this program exits would also get erased. Adding a
@@ -910,6 +1905,12 @@ int main(int argc, char* argv[]) {
   usleep(100 * 1000);
   endwin();
 
+  if (state.SlideshowInterval > 0.0f) {
+    fprintf(
+        stdout, "%d of %d slides were not ready when due.\n",
+        state.NumMissedSlides, state.NumSlides);
+  }
+
   return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,194 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the MemoryGovernor class.
+
+#include "memory_governor.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Where the cgroup v2 hierarchy is mounted.
+const char* const CGROUP_ROOT = "/sys/fs/cgroup";
+// System-wide memory PSI, used if the cgroup does not have its own.
+const char* const SYSTEM_PSI_PATH = "/proc/pressure/memory";
+
+// Reads a small file into text. Returns false on failure.
+bool ReadFile(const std::string& path, std::string* text) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char buffer[1024];
+  const size_t size = fread(buffer, 1, sizeof(buffer), file);
+  fclose(file);
+  text->assign(buffer, size);
+  return true;
+}
+
+// Returns the path of the cgroup v2 cgroup of this process relative to
+// CGROUP_ROOT, such as "/user.slice/session-1.scope", or an empty string if
+// there is none.
+std::string GetCgroupPath() {
+  std::string text;
+  if (!ReadFile("/proc/self/cgroup", &text)) {
+    return "";
+  }
+  // The cgroup v2 entry has hierarchy ID 0 and no controllers.
+  const char* const prefix = "0::";
+  for (size_t begin = 0; begin < text.size();) {
+    size_t end = text.find('\n', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    if (text.compare(begin, strlen(prefix), prefix) == 0) {
+      const size_t path_begin = begin + strlen(prefix);
+      const std::string path = text.substr(path_begin, end - path_begin);
+      return path == "/" ? "" : path;
+    }
+    begin = end + 1;
+  }
+  return "";
+}
+
+}  // namespace
+
+MemoryGovernor* MemoryGovernor::Create() {
+  // 1. Find the nearest cgroup with a memory limit, starting from our own. A
+  // limit on an ancestor applies to us as well.
+  std::string path = GetCgroupPath();
+  std::string cgroup_dir;
+  for (;;) {
+    const std::string dir = CGROUP_ROOT + path;
+    std::string text;
+    int64_t max;
+    if (ReadFile(dir + "/memory.max", &text) && ParseMemoryValue(text, &max) &&
+        (max >= 0)) {
+      cgroup_dir = dir;
+      break;
+    }
+    if (path.empty()) {
+      return nullptr;
+    }
+    path = path.substr(0, path.rfind('/'));
+  }
+
+  // 2. Prefer the PSI of that cgroup over the system-wide PSI.
+  const std::string cgroup_psi_path = cgroup_dir + "/memory.pressure";
+  return new MemoryGovernor(
+      cgroup_dir,
+      access(cgroup_psi_path.c_str(), R_OK) == 0 ? cgroup_psi_path
+                                                 : SYSTEM_PSI_PATH);
+}
+
+MemoryGovernor::MemoryGovernor(
+    const std::string& cgroup_dir, const std::string& psi_path)
+    : _cgroup_dir(cgroup_dir), _psi_path(psi_path), _level(NORMAL) {}
+
+bool MemoryGovernor::Read(MemoryGovernor::Reading* reading) const {
+  std::string text;
+  if (!ReadFile(_cgroup_dir + "/memory.current", &text) ||
+      !ParseMemoryValue(text, &reading->Current) ||
+      !ReadFile(_cgroup_dir + "/memory.max", &text) ||
+      !ParseMemoryValue(text, &reading->Max)) {
+    return false;
+  }
+  if (!ReadFile(_psi_path, &text) || !ParsePressure(text, &reading->Pressure)) {
+    reading->Pressure = -1.0f;
+  }
+  return true;
+}
+
+bool MemoryGovernor::Update(const MemoryGovernor::Reading& reading) {
+  const Level previous_level = _level;
+  const Level level = GetLevelForReading(reading, false);
+  if (level > _level) {
+    _level = level;
+  } else if (GetLevelForReading(reading, true) < _level) {
+    _level = static_cast<Level>(_level - 1);
+  }
+  return _level != previous_level;
+}
+
+MemoryGovernor::Level MemoryGovernor::GetLevel() const { return _level; }
+
+const char* MemoryGovernor::GetLevelName(MemoryGovernor::Level level) {
+  switch (level) {
+    case MODERATE:
+      return "moderate";
+    case CRITICAL:
+      return "critical";
+    default:
+      return "normal";
+  }
+}
+
+int MemoryGovernor::GetCacheSize(int size, int min_size) const {
+  switch (_level) {
+    case MODERATE:
+      return std::min(size, std::max(min_size, size / 2));
+    case CRITICAL:
+      return std::min(size, min_size);
+    default:
+      return size;
+  }
+}
+
+bool MemoryGovernor::ParseMemoryValue(const std::string& text, int64_t* value) {
+  if (text.compare(0, 3, "max") == 0) {
+    *value = -1;
+    return true;
+  }
+  char* end;
+  const long long parsed = strtoll(text.c_str(), &end, 10);
+  if ((end == text.c_str()) || (parsed < 0)) {
+    return false;
+  }
+  *value = parsed;
+  return true;
+}
+
+bool MemoryGovernor::ParsePressure(const std::string& text, float* pressure) {
+  // The first line looks like "some avg10=1.23 avg60=0.50 avg300=0.10
+  // total=12345".
+  return sscanf(text.c_str(), "some avg10=%f", pressure) == 1;
+}
+
+MemoryGovernor::Level MemoryGovernor::GetLevelForReading(
+    const MemoryGovernor::Reading& reading, bool lowering) {
+  const float usage_percent =
+      reading.Max > 0 ? 100.0f * reading.Current / reading.Max : 0.0f;
+  const float usage_margin = lowering ? USAGE_HYSTERESIS_PERCENT : 0.0f;
+  const float pressure_scale =
+      lowering ? 1.0f / PRESSURE_HYSTERESIS_FACTOR : 1.0f;
+  if ((usage_percent >= CRITICAL_USAGE_PERCENT - usage_margin) ||
+      (reading.Pressure >= CRITICAL_PRESSURE_PERCENT * pressure_scale)) {
+    return CRITICAL;
+  }
+  if ((usage_percent >= MODERATE_USAGE_PERCENT - usage_margin) ||
+      (reading.Pressure >= MODERATE_PRESSURE_PERCENT * pressure_scale)) {
+    return MODERATE;
+  }
+  return NORMAL;
+}
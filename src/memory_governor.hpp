@@ -0,0 +1,110 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the MemoryGovernor class, which watches the memory usage
+// of the cgroup jfbview runs in, and decides how much to cache.
+
+#ifndef MEMORY_GOVERNOR_HPP
+#define MEMORY_GOVERNOR_HPP
+
+#include <cstdint>
+#include <string>
+
+// Reads the memory usage and limit of a cgroup v2 cgroup, and the pressure
+// stall information (PSI) for memory, and derives a pressure level from them.
+// The level goes up as soon as usage or stalls cross a threshold, and only
+// goes back down one level at a time once both are well below it, so that
+// caches do not swing back and forth around a threshold.
+class MemoryGovernor {
+ public:
+  // How often to check memory usage.
+  enum { CHECK_INTERVAL_MS = 1000 };
+  // Usage of the memory limit, in percent, at or above which to raise the
+  // pressure level. The level is lowered again once usage is
+  // USAGE_HYSTERESIS_PERCENT below the threshold.
+  enum { MODERATE_USAGE_PERCENT = 80, CRITICAL_USAGE_PERCENT = 90 };
+  enum { USAGE_HYSTERESIS_PERCENT = 10 };
+  // Likewise for the share of the last 10 seconds in which some tasks stalled
+  // on memory, in percent. The level is lowered again once stalls are below
+  // the threshold divided by PRESSURE_HYSTERESIS_FACTOR.
+  enum { MODERATE_PRESSURE_PERCENT = 10, CRITICAL_PRESSURE_PERCENT = 40 };
+  enum { PRESSURE_HYSTERESIS_FACTOR = 4 };
+
+  // Pressure levels.
+  enum Level {
+    // Caches are kept at their configured size.
+    NORMAL,
+    // Caches are halved.
+    MODERATE,
+    // Caches only keep what is on screen.
+    CRITICAL,
+  };
+
+  // A snapshot of memory usage.
+  struct Reading {
+    // Bytes used by the cgroup.
+    int64_t Current;
+    // The memory limit of the cgroup in bytes, or -1 if unlimited.
+    int64_t Max;
+    // The "some avg10" PSI value in percent, or -1 if unavailable.
+    float Pressure;
+
+    Reading() : Current(0), Max(-1), Pressure(-1.0f) {}
+  };
+
+  // Creates a governor for the cgroup of this process. Returns nullptr if
+  // cgroup v2 is not mounted, or the cgroup has no memory limit.
+  static MemoryGovernor* Create();
+  // Creates a governor reading memory.current and memory.max in the given
+  // cgroup directory, and PSI from the given file.
+  MemoryGovernor(const std::string& cgroup_dir, const std::string& psi_path);
+
+  // Reads current memory usage. Returns false on failure.
+  bool Read(Reading* reading) const;
+  // Updates the pressure level from a reading. Returns true if it changed.
+  bool Update(const Reading& reading);
+  // Returns the current pressure level.
+  Level GetLevel() const;
+  // Returns the name of a pressure level, for logging.
+  static const char* GetLevelName(Level level);
+  // Returns how many entries to allow in a cache configured with the given
+  // size at the current pressure level. Never less than min_size, unless the
+  // configured size is less.
+  int GetCacheSize(int size, int min_size) const;
+
+  // Parses the contents of a cgroup memory file such as memory.max, which is
+  // either a number of bytes or "max". Stores -1 for "max". Returns false if
+  // neither.
+  static bool ParseMemoryValue(const std::string& text, int64_t* value);
+  // Parses the "some avg10" value in percent from the contents of a PSI file.
+  // Returns false if there is none.
+  static bool ParsePressure(const std::string& text, float* pressure);
+
+ private:
+  // Files to read.
+  std::string _cgroup_dir;
+  std::string _psi_path;
+  // The current pressure level.
+  Level _level;
+
+  // Returns the level a reading calls for, ignoring the current level. If
+  // lowering is true, the thresholds for lowering the level are used.
+  static Level GetLevelForReading(const Reading& reading, bool lowering);
+};
+
+#endif
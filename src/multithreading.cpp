@@ -17,6 +17,8 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include "multithreading.hpp"
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cassert>
@@ -46,3 +48,109 @@ void ExecuteInParallel(
     thread.join();
   }
 }
+
+WorkQueue::WorkQueue(int num_threads, bool low_priority) : _exit(false) {
+  assert(num_threads >= 0);
+  if (num_threads <= 0) {
+    num_threads = GetDefaultNumThreads();
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    _threads.push_back(std::thread(&WorkQueue::Work, this, low_priority));
+  }
+}
+
+WorkQueue::~WorkQueue() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto& jobs : _jobs) {
+      jobs.clear();
+    }
+    _exit = true;
+    _condition.notify_all();
+  }
+  for (std::thread& thread : _threads) {
+    thread.join();
+  }
+}
+
+void WorkQueue::Enqueue(
+    const std::function<void()>& job, const void* owner, Priority priority) {
+  assert((priority >= 0) && (priority < NUM_PRIORITIES));
+  std::unique_lock<std::mutex> lock(_mutex);
+  _jobs[priority].emplace_back(job, owner);
+  _condition.notify_one();
+}
+
+void WorkQueue::Cancel() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (auto& jobs : _jobs) {
+    jobs.clear();
+  }
+}
+
+void WorkQueue::Cancel(const void* owner) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (auto& jobs : _jobs) {
+    jobs.erase(
+        std::remove_if(
+            jobs.begin(), jobs.end(),
+            [owner](const std::pair<std::function<void()>, const void*>& job) {
+              return job.second == owner;
+            }),
+        jobs.end());
+  }
+}
+
+void WorkQueue::Wait(const void* owner) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done_condition.wait(lock, [=] { return !_running_owners.count(owner); });
+}
+
+void WorkQueue::Work(bool low_priority) {
+  // 1. Lower the priority of this thread by raising its nice value, which on
+  // Linux can be set independently of the rest of the process using the
+  // thread ID. SCHED_IDLE is not used: jobs take the document lock and
+  // MuPDF's locks, and a SCHED_IDLE thread holding them may not get to run
+  // again for as long as the CPUs are busy, stalling foreground renders.
+  if (low_priority) {
+    const id_t tid = syscall(SYS_gettid);
+    setpriority(
+        PRIO_PROCESS, tid,
+        getpriority(PRIO_PROCESS, tid) + LOW_PRIORITY_NICE_INCREMENT);
+  }
+
+  // 2. Run jobs, taking the oldest job of the highest priority each time.
+  for (;;) {
+    std::pair<std::function<void()>, const void*> job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _condition.wait(lock, [this] { return _exit || HasJobs(); });
+      if (_exit) {
+        return;
+      }
+      for (auto& jobs : _jobs) {
+        if (!jobs.empty()) {
+          job = jobs.front();
+          jobs.pop_front();
+          break;
+        }
+      }
+      _running_owners.insert(job.second);
+    }
+    job.first();
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _running_owners.erase(_running_owners.find(job.second));
+      _done_condition.notify_all();
+    }
+  }
+}
+
+bool WorkQueue::HasJobs() const {
+  for (const auto& jobs : _jobs) {
+    if (!jobs.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
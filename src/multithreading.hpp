@@ -21,7 +21,16 @@
 #ifndef MULTITHREADING_HPP
 #define MULTITHREADING_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
 
 // Returns the sane default number of threads.
 extern int GetDefaultNumThreads();
@@ -33,4 +42,111 @@ extern int GetDefaultNumThreads();
 extern void ExecuteInParallel(
     const std::function<void(int, int)> &f, int num_threads = 0);
 
+// A queue of jobs executed by a fixed pool of background threads. Jobs are
+// run in order of priority, and in the order they were added within the same
+// priority. A running job is never interrupted, but a job of higher priority
+// runs as soon as a worker finishes its current job. Jobs may be tagged with
+// an owner, so that a queue can be shared by several objects that each cancel
+// only their own jobs.
+class WorkQueue {
+ public:
+  // How much to raise the nice value of low priority worker threads by.
+  enum { LOW_PRIORITY_NICE_INCREMENT = 10 };
+
+  // Priority classes of jobs, from highest to lowest.
+  enum Priority {
+    // Work whose result is on screen, and that the user is waiting for.
+    VISIBLE,
+    // Work whose result is likely to be shown next, such as the page after
+    // the current one.
+    IMMINENT,
+    // Work whose result may be shown later, such as pages further ahead.
+    PREFETCH,
+    // Work that only speeds up other work, such as loading the fonts and
+    // images of a page without rendering it.
+    INDEXING,
+    NUM_PRIORITIES,
+  };
+
+  // Starts num_threads worker threads, defaulting to the number of CPU cores.
+  // If low_priority is true, the workers run at a raised nice value, so that
+  // they mostly use CPU time the rest of the system does not need.
+  explicit WorkQueue(int num_threads = 0, bool low_priority = false);
+  // Discards jobs that have not started yet, and waits for running jobs to
+  // finish.
+  ~WorkQueue();
+
+  // Adds a job to the end of the queue for its priority, on behalf of the
+  // given owner.
+  void Enqueue(
+      const std::function<void()> &job, const void *owner = nullptr,
+      Priority priority = PREFETCH);
+  // Discards all jobs that have not started yet.
+  void Cancel();
+  // Discards the jobs of the given owner that have not started yet.
+  void Cancel(const void *owner);
+  // Waits for running jobs of the given owner to finish. An owner should
+  // call this after Cancel() before it is destroyed.
+  void Wait(const void *owner);
+
+ private:
+  // Main loop of a worker thread.
+  void Work(bool low_priority);
+  // Returns whether any job has not started yet. Requires _mutex.
+  bool HasJobs() const;
+
+  // A lock on this object.
+  std::mutex _mutex;
+  // Signaled when a job is added or the queue is shutting down. Only workers
+  // wait on it, so that notifying one worker of a new job never wakes up a
+  // Wait() instead.
+  std::condition_variable _condition;
+  // Signaled when a job finishes, for Wait().
+  std::condition_variable _done_condition;
+  // Jobs that have not started yet, and their owners, indexed by priority.
+  std::deque<std::pair<std::function<void()>, const void *>>
+      _jobs[NUM_PRIORITIES];
+  // Owners of running jobs.
+  std::multiset<const void *> _running_owners;
+  // Whether worker threads should exit.
+  bool _exit;
+  // Worker threads.
+  std::vector<std::thread> _threads;
+
+  // No copying is allowed.
+  WorkQueue(const WorkQueue &);
+  WorkQueue &operator=(const WorkQueue &);
+};
+
+// A slot holding at most one value, passed from one thread to another. A new
+// value replaces one that has not been taken yet, so the receiver only ever
+// sees the latest. Neither side ever blocks.
+template <typename T>
+class Mailbox {
+ public:
+  Mailbox() : _slot(nullptr) {}
+  ~Mailbox() { delete _slot.load(); }
+
+  // Puts a value in the slot. Returns true if it replaced one that had not
+  // been taken yet.
+  bool Post(std::unique_ptr<T> value) {
+    std::unique_ptr<T> replaced(_slot.exchange(value.release()));
+    return replaced != nullptr;
+  }
+  // Takes the value out of the slot, or returns nullptr if it is empty.
+  std::unique_ptr<T> Take() {
+    return std::unique_ptr<T>(_slot.exchange(nullptr));
+  }
+  // Returns whether the slot is empty.
+  bool IsEmpty() const { return _slot.load() == nullptr; }
+
+ private:
+  // The value in the slot, or nullptr.
+  std::atomic<T *> _slot;
+
+  // No copying is allowed.
+  Mailbox(const Mailbox &);
+  Mailbox &operator=(const Mailbox &);
+};
+
 #endif
@@ -57,6 +57,7 @@ const Document::OutlineItem* OutlineView::Run() {
   wclear(window);
 
   _selected_item = nullptr;
+  UpdateForSelectedIndex();
 
   EventLoop(REGULAR_MODE);
 
@@ -217,4 +218,12 @@ void OutlineView::UpdateForSelectedIndex() {
   } else if (_selected_index >= _first_index + getmaxy(window)) {
     _first_index = _selected_index - getmaxy(window) + 1;
   }
+  if (_highlight_handler) {
+    _highlight_handler(_lines[_selected_index].OutlineItem);
+  }
+}
+
+void OutlineView::SetHighlightHandler(
+    const std::function<void(const Document::OutlineItem*)>& handler) {
+  _highlight_handler = handler;
 }
@@ -21,6 +21,7 @@
 #ifndef OUTLINE_VIEWER_HPP
 #define OUTLINE_VIEWER_HPP
 
+#include <functional>
 #include <memory>
 #include <set>
 #include <string>
@@ -42,6 +43,11 @@ class OutlineView : public UIView {
   // page to jump to, returns the selected outline item. Otherwise returns
   // nullptr.
   const Document::OutlineItem* Run();
+  // Sets a function to call with the highlighted outline item whenever the
+  // highlight moves, so that its page can be prepared before the user jumps to
+  // it.
+  void SetHighlightHandler(
+      const std::function<void(const Document::OutlineItem*)>& handler);
 
  protected:
   // See UIView.
@@ -71,6 +77,8 @@ class OutlineView : public UIView {
   int _first_index;
   // The selected outline item.
   const Document::OutlineItem* _selected_item;
+  // See SetHighlightHandler().
+  std::function<void(const Document::OutlineItem*)> _highlight_handler;
 
   // Key processing modes.
   enum KeyProcessingMode {
@@ -28,8 +28,28 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "image_codec.hpp"
+#include "image_kernels.hpp"
 #include "multithreading.hpp"
 
+namespace {
+
+// See PixelBuffer::GetGrayFormat().
+class GrayFormat : public PixelBuffer::Format {
+ public:
+  // See PixelBuffer::Format.
+  int GetDepth() const override { return 1; }
+  // See PixelBuffer::Format. Uses the Rec. 601 luma weights, scaled to add up
+  // to 256 so that gray stays exactly the same.
+  uint32_t Pack(uint8_t r, uint8_t g, uint8_t b) const override {
+    return (r * 77 + g * 150 + b * 29) >> 8;
+  }
+  // See PixelBuffer::Format.
+  bool HasByteAlignedChannels() const override { return true; }
+};
+
+}  // namespace
+
 PixelBuffer::PixelBuffer(
     const PixelBuffer::Size& size, const PixelBuffer::Format* format)
     : _size(size),
@@ -65,12 +85,19 @@ PixelBuffer::~PixelBuffer() {
   }
 }
 
+const PixelBuffer::Format* PixelBuffer::GetGrayFormat() {
+  static const GrayFormat gray_format;
+  return &gray_format;
+}
+
 PixelBuffer::Size PixelBuffer::GetSize() const { return _size; }
 
 PixelBuffer::Rect PixelBuffer::GetRect() const {
   return Rect(0, 0, _size.Width, _size.Height);
 }
 
+const PixelBuffer::Format* PixelBuffer::GetFormat() const { return _format; }
+
 void PixelBuffer::WritePixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   _pixel_writer_impl->WritePixel(_format->Pack(r, g, b), GetPixelAddress(x, y));
 }
@@ -80,7 +107,9 @@ void PixelBuffer::Copy(
     PixelBuffer* dest) const {
   assert(dest_rect.Width >= src_rect.Width);
   assert(dest_rect.Height >= src_rect.Height);
-  assert(_format->GetDepth() == dest->_format->GetDepth());
+  const bool expand_gray =
+      (_format == GetGrayFormat()) && (dest->_format != _format);
+  assert(expand_gray || (_format->GetDepth() == dest->_format->GetDepth()));
   assert(_size.Width >= src_rect.X + src_rect.Width);
   assert(_size.Height >= src_rect.Y + src_rect.Height);
   assert(dest->_size.Width >= dest_rect.X + dest_rect.Width);
@@ -129,12 +158,108 @@ void PixelBuffer::Copy(
                 dest_rect.X + margin_left + src_rect.Width, dest_y),
             0, margin_right * dest->_format->GetDepth());
       }
-      // 2. Copy row content.
-      void* src_row = GetPixelAddress(src_rect.X, src_y);
-      void* dest_row = dest->GetPixelAddress(dest_rect.X + margin_left, dest_y);
-      memcpy(dest_row, src_row, src_row_size);
+      // 2. Copy row content. Gray rows are expanded below instead.
+      if (!expand_gray) {
+        void* src_row = GetPixelAddress(src_rect.X, src_y);
+        void* dest_row =
+            dest->GetPixelAddress(dest_rect.X + margin_left, dest_y);
+        memcpy(dest_row, src_row, src_row_size);
+      }
     }
   });
+  if (!expand_gray || (src_rect.Width <= 0) || (src_rect.Height <= 0)) {
+    return;
+  }
+
+  // Convert gray levels to the format of dest through a lookup table, which
+  // holds each gray level as a pixel of dest.
+  PixelBuffer lut(Size(256, 1), dest->_format);
+  for (int v = 0; v < 256; ++v) {
+    lut.WritePixel(v, 0, v, v, v);
+  }
+  ExpandGray(
+      RawImage(
+          GetPixelAddress(src_rect.X, src_rect.Y), src_rect.Width,
+          src_rect.Height, GetStride(), 1),
+      lut.GetPixelAddress(0, 0),
+      RawImage(
+          dest->GetPixelAddress(
+              dest_rect.X + margin_left, dest_rect.Y + margin_top),
+          src_rect.Width, src_rect.Height, dest->GetStride(),
+          dest->_format->GetDepth()));
+}
+
+void PixelBuffer::Clear(const PixelBuffer::Rect& rect) {
+  assert(_size.Width >= rect.X + rect.Width);
+  assert(_size.Height >= rect.Y + rect.Height);
+  for (int y = 0; y < rect.Height; ++y) {
+    memset(
+        GetPixelAddress(rect.X, rect.Y + y), 0,
+        rect.Width * _format->GetDepth());
+  }
+}
+
+void PixelBuffer::Fill(
+    const PixelBuffer::Rect& rect, uint8_t r, uint8_t g, uint8_t b) {
+  assert(_size.Width >= rect.X + rect.Width);
+  assert(_size.Height >= rect.Y + rect.Height);
+  const uint32_t value = _format->Pack(r, g, b);
+  for (int y = rect.Y; y < rect.Y + rect.Height; ++y) {
+    for (int x = rect.X; x < rect.X + rect.Width; ++x) {
+      _pixel_writer_impl->WritePixel(value, GetPixelAddress(x, y));
+    }
+  }
+}
+
+void PixelBuffer::Resample(
+    const PixelBuffer::Size& scaled_size, const PixelBuffer::Rect& scaled_rect,
+    PixelBuffer* dest) const {
+  assert(_format->GetDepth() == dest->_format->GetDepth());
+  assert(dest->_size.Width == scaled_rect.Width);
+  assert(dest->_size.Height == scaled_rect.Height);
+  if ((scaled_rect.Width <= 0) || (scaled_rect.Height <= 0)) {
+    return;
+  }
+
+  const RawImage src_image(
+      GetPixelAddress(0, 0), _size.Width, _size.Height, GetStride(),
+      _format->GetDepth());
+  const RawImage dest_image(
+      dest->GetPixelAddress(0, 0), dest->_size.Width, dest->_size.Height,
+      dest->GetStride(), dest->_format->GetDepth());
+  if (_format->HasByteAlignedChannels()) {
+    ResampleBilinear(
+        src_image, scaled_size.Width, scaled_size.Height, scaled_rect.X,
+        scaled_rect.Y, dest_image);
+  } else {
+    ResampleNearest(
+        src_image, scaled_size.Width, scaled_size.Height, scaled_rect.X,
+        scaled_rect.Y, dest_image);
+  }
+}
+
+void PixelBuffer::Rotate(int quarter_turns, PixelBuffer* dest) const {
+  assert(_format->GetDepth() == dest->_format->GetDepth());
+  RotateQuarterTurns(
+      RawImage(
+          GetPixelAddress(0, 0), _size.Width, _size.Height, GetStride(),
+          _format->GetDepth()),
+      quarter_turns,
+      RawImage(
+          dest->GetPixelAddress(0, 0), dest->_size.Width, dest->_size.Height,
+          dest->GetStride(), dest->_format->GetDepth()));
+}
+
+CompressedImage* PixelBuffer::Compress() const {
+  return CompressedImage::Compress(RawImage(
+      GetPixelAddress(0, 0), _size.Width, _size.Height, GetStride(),
+      _format->GetDepth()));
+}
+
+bool PixelBuffer::Decompress(const CompressedImage& image) {
+  return image.Decompress(RawImage(
+      GetPixelAddress(0, 0), _size.Width, _size.Height, GetStride(),
+      _format->GetDepth()));
 }
 
 void PixelBuffer::Init() {
@@ -193,6 +318,10 @@ int PixelBuffer::GetBufferByteSize() const {
   return _size.Width * _size.Height * _format->GetDepth();
 }
 
+int PixelBuffer::GetStride() const {
+  return _allocated_size.Width * _format->GetDepth();
+}
+
 uint8_t* PixelBuffer::GetPixelAddress(int x, int y) const {
   assert((x >= 0) && (x < _size.Width));
   assert((y >= 0) && (y < _size.Height));
@@ -24,6 +24,8 @@
 
 #include <cstdint>
 
+class CompressedImage;
+
 // A class that represents a rectangular matrix of pixels.
 class PixelBuffer {
  public:
@@ -41,6 +43,9 @@ class PixelBuffer {
     virtual int GetDepth() const = 0;
     // Method to pack an RGB tuple into a pixel value.
     virtual uint32_t Pack(uint8_t r, uint8_t g, uint8_t b) const = 0;
+    // Whether every color channel occupies exactly one whole byte of a pixel.
+    // Pixels in such formats can be interpolated byte by byte.
+    virtual bool HasByteAlignedChannels() const { return false; }
     // This is required to keep C++ happy.
     virtual ~Format() {}
   };
@@ -66,10 +71,16 @@ class PixelBuffer {
   // Will free buffer if _has_ownship is true.
   ~PixelBuffer();
 
+  // Returns the format of buffers that hold a gray level per pixel, in one
+  // byte. Such buffers can be copied to buffers of any format. See Copy().
+  static const Format* GetGrayFormat();
+
   // Returns the size of this buffer in pixels.
   Size GetSize() const;
   // Returns a rect covering the buffer exactly.
   Rect GetRect() const;
+  // Returns the color format of this buffer.
+  const Format* GetFormat() const;
 
   // Writes a pixel value to a location in the buffer.
   void WritePixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
@@ -77,9 +88,33 @@ class PixelBuffer {
   // Copies a region in the current pixel buffer to another pixel buffer. The
   // destination region must be at least as large in both dimensions than the
   // source region. The source region is centered if the destination region is
-  // larger, and the unaffected areas are set to black. This is multi-threaded.
+  // larger, and the unaffected areas are set to black. Both buffers must have
+  // the same depth, unless this buffer has the gray format, in which case gray
+  // levels are converted to the format of dest. This is multi-threaded.
   void Copy(
       const Rect& src_rect, const Rect& dest_rect, PixelBuffer* dest) const;
+  // Sets all pixels in a region to black.
+  void Clear(const Rect& rect);
+  // Sets all pixels in a region to a color.
+  void Fill(const Rect& rect, uint8_t r, uint8_t g, uint8_t b);
+  // Scales this buffer to scaled_size, and writes the region scaled_rect of the
+  // result to dest, which must be exactly as large as scaled_rect. Uses
+  // bilinear interpolation if the format allows it, or nearest neighbor
+  // otherwise. This is multi-threaded.
+  void Resample(
+      const Size& scaled_size, const Rect& scaled_rect,
+      PixelBuffer* dest) const;
+  // Rotates this buffer clockwise by the given number of quarter turns, and
+  // writes the result to dest. dest must be exactly as large as the rotated
+  // buffer. This is multi-threaded.
+  void Rotate(int quarter_turns, PixelBuffer* dest) const;
+  // Compresses this buffer losslessly. Caller owns returned value. This is
+  // multi-threaded.
+  CompressedImage* Compress() const;
+  // Replaces this buffer with an image compressed by Compress() from a buffer
+  // of the same size and format. Returns false if it cannot be decompressed.
+  // This is multi-threaded.
+  bool Decompress(const CompressedImage& image);
 
  private:
   // Prototype for a method that writes a pixel value to a location.
@@ -141,6 +176,8 @@ class PixelBuffer {
   int GetBufferByteSize() const;
   // Returns the address in memory corresponding to the pixel (x, y).
   uint8_t* GetPixelAddress(int x, int y) const;
+  // Returns the distance in bytes between the starts of two adjacent rows.
+  int GetStride() const;
 
   // Disable copy and assign.
   PixelBuffer(const PixelBuffer&);
@@ -0,0 +1,299 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the PixelBufferPool class.
+
+#include "pixel_buffer_pool.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+
+// Size of a regular page.
+const size_t PAGE_BYTES = 4096;
+
+// Returns size rounded up to a multiple of unit.
+size_t RoundUp(size_t size, size_t unit) {
+  return (size + unit - 1) / unit * unit;
+}
+
+}  // namespace
+
+PixelBufferPool* PixelBufferPool::Get() {
+  static PixelBufferPool* const pool = new PixelBufferPool();
+  return pool;
+}
+
+PixelBufferPool::PixelBufferPool() {}
+
+PixelBufferPool::~PixelBufferPool() {
+  for (const auto& entry : _free_blocks) {
+    if (entry.first > MAX_SLAB_BLOCK_BYTES) {
+      for (uint8_t* block : entry.second) {
+        Unmap(block, entry.first);
+      }
+    }
+  }
+  for (const auto& entry : _slabs) {
+    Unmap(entry.first, GetSlabSize(entry.second.BlockSize));
+  }
+}
+
+std::shared_ptr<PixelBuffer> PixelBufferPool::NewPixelBuffer(
+    const PixelBuffer::Size& size, const PixelBuffer::Format* format) {
+  const int depth = format->GetDepth();
+  const int aligned_width = GetAlignedWidth(size.Width, depth);
+  const size_t byte_size =
+      static_cast<size_t>(aligned_width) * size.Height * depth;
+  uint8_t* const block = Allocate(byte_size);
+  if (block == nullptr) {
+    // Fall back to the heap.
+    return std::shared_ptr<PixelBuffer>(new PixelBuffer(size, format));
+  }
+  return std::shared_ptr<PixelBuffer>(
+      new PixelBuffer(
+          size, format, block, PixelBuffer::Size(aligned_width, size.Height),
+          PixelBuffer::Size(0, 0)),
+      [this, block, byte_size](PixelBuffer* buffer) {
+        delete buffer;
+        Release(block, byte_size);
+      });
+}
+
+uint8_t* PixelBufferPool::Allocate(size_t size) {
+  const size_t block_size = GetBlockSize(size);
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // 1. Reuse a free block of the same size class.
+  auto free_blocks_it = _free_blocks.find(block_size);
+  if ((free_blocks_it != _free_blocks.end()) &&
+      !free_blocks_it->second.empty()) {
+    uint8_t* const block = free_blocks_it->second.back();
+    free_blocks_it->second.pop_back();
+    if (block_size <= MAX_SLAB_BLOCK_BYTES) {
+      ++FindSlab(block)->second.NumUsed;
+    }
+    _stats.FreeBytes -= block_size;
+    ++_stats.NumReused;
+    return block;
+  }
+
+  // 2. Otherwise, carve out a new block, or map it on its own if it is large.
+  if (block_size <= MAX_SLAB_BLOCK_BYTES) {
+    return CarveBlock(block_size);
+  }
+  uint8_t* const block = Map(block_size);
+  if (block != nullptr) {
+    _stats.MappedBytes += block_size;
+  }
+  return block;
+}
+
+void PixelBufferPool::Release(uint8_t* block, size_t size) {
+  const size_t block_size = GetBlockSize(size);
+  std::unique_lock<std::mutex> lock(_mutex);
+  const bool over_limit = _stats.FreeBytes + block_size > MAX_FREE_BYTES;
+  if (block_size > MAX_SLAB_BLOCK_BYTES) {
+    if (over_limit) {
+      Unmap(block, block_size);
+      _stats.MappedBytes -= block_size;
+      return;
+    }
+  } else {
+    auto slab_it = FindSlab(block);
+    if ((--slab_it->second.NumUsed == 0) && over_limit) {
+      UnmapSlab(slab_it);
+      return;
+    }
+  }
+  _free_blocks[block_size].push_back(block);
+  _stats.FreeBytes += block_size;
+}
+
+void PixelBufferPool::Trim() {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // 1. Unmap free blocks of their own.
+  for (auto it = _free_blocks.begin(); it != _free_blocks.end();) {
+    const size_t block_size = it->first;
+    if (block_size <= MAX_SLAB_BLOCK_BYTES) {
+      ++it;
+      continue;
+    }
+    for (uint8_t* block : it->second) {
+      Unmap(block, block_size);
+    }
+    _stats.MappedBytes -= it->second.size() * block_size;
+    _stats.FreeBytes -= it->second.size() * block_size;
+    it = _free_blocks.erase(it);
+  }
+
+  // 2. Unmap slabs with no blocks in use.
+  for (auto it = _slabs.begin(); it != _slabs.end();) {
+    if (it->second.NumUsed == 0) {
+      UnmapSlab(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+PixelBufferPool::Stats PixelBufferPool::GetStats() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+size_t PixelBufferPool::GetBlockSize(size_t size) {
+  // Size classes are spaced an eighth of a power of two apart, so that at
+  // most about an eighth of a block is wasted.
+  const size_t page_rounded_size =
+      RoundUp(std::max<size_t>(size, 1), PAGE_BYTES);
+  size_t power_of_two = PAGE_BYTES;
+  while (power_of_two * 2 <= page_rounded_size) {
+    power_of_two *= 2;
+  }
+  return RoundUp(
+      page_rounded_size, std::max<size_t>(power_of_two / 8, PAGE_BYTES));
+}
+
+size_t PixelBufferPool::GetSlabSize(size_t block_size) {
+  return block_size * BLOCKS_PER_SLAB;
+}
+
+int PixelBufferPool::GetAlignedWidth(int width, int depth) {
+  // A row is a multiple of ROW_ALIGNMENT bytes long if the number of pixels in
+  // it is a multiple of ROW_ALIGNMENT / gcd(ROW_ALIGNMENT, depth).
+  int gcd = ROW_ALIGNMENT;
+  for (int a = depth; a != 0;) {
+    const int r = gcd % a;
+    gcd = a;
+    a = r;
+  }
+  return static_cast<int>(RoundUp(width, ROW_ALIGNMENT / gcd));
+}
+
+uint8_t* PixelBufferPool::Map(size_t size) {
+  // 1. Try to map explicitly reserved huge pages.
+#ifdef MAP_HUGETLB
+  if (size % HUGE_PAGE_BYTES == 0) {
+    void* const memory = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+      return static_cast<uint8_t*>(memory);
+    }
+  }
+#endif
+
+  // 2. Otherwise, map regular pages. If the mapping can hold a huge page,
+  // align it to one and ask for transparent huge pages.
+  if (size < HUGE_PAGE_BYTES) {
+    void* const memory = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+        0);
+    return memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+  }
+  const size_t padded_size = size + HUGE_PAGE_BYTES;
+  void* const padded_memory = mmap(
+      nullptr, padded_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (padded_memory == MAP_FAILED) {
+    return nullptr;
+  }
+  uint8_t* const padded_start = static_cast<uint8_t*>(padded_memory);
+  uint8_t* const start = reinterpret_cast<uint8_t*>(
+      RoundUp(reinterpret_cast<uintptr_t>(padded_start), HUGE_PAGE_BYTES));
+  if (start > padded_start) {
+    munmap(padded_start, start - padded_start);
+  }
+  const size_t tail_size = padded_start + padded_size - (start + size);
+  if (tail_size > 0) {
+    munmap(start + size, tail_size);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(start, size, MADV_HUGEPAGE);
+#endif
+  return start;
+}
+
+void PixelBufferPool::Unmap(uint8_t* memory, size_t size) {
+  munmap(memory, size);
+}
+
+uint8_t* PixelBufferPool::CarveBlock(size_t block_size) {
+  // 1. Carve the block out of a slab of the same size class with room left.
+  for (auto& entry : _slabs) {
+    Slab& slab = entry.second;
+    if ((slab.BlockSize == block_size) &&
+        (slab.NumCarved < BLOCKS_PER_SLAB)) {
+      ++slab.NumUsed;
+      return entry.first + block_size * slab.NumCarved++;
+    }
+  }
+
+  // 2. Otherwise, map a new slab.
+  const size_t slab_size = GetSlabSize(block_size);
+  uint8_t* const memory = Map(slab_size);
+  if (memory == nullptr) {
+    return nullptr;
+  }
+  _stats.MappedBytes += slab_size;
+  Slab& slab = _slabs[memory];
+  slab.BlockSize = block_size;
+  slab.NumCarved = 1;
+  slab.NumUsed = 1;
+  return memory;
+}
+
+std::map<uint8_t*, PixelBufferPool::Slab>::iterator PixelBufferPool::FindSlab(
+    uint8_t* block) {
+  auto it = _slabs.upper_bound(block);
+  assert(it != _slabs.begin());
+  --it;
+  assert(block < it->first + GetSlabSize(it->second.BlockSize));
+  return it;
+}
+
+void PixelBufferPool::UnmapSlab(std::map<uint8_t*, Slab>::iterator it) {
+  assert(it->second.NumUsed == 0);
+  const size_t block_size = it->second.BlockSize;
+  const size_t slab_size = GetSlabSize(block_size);
+  uint8_t* const start = it->first;
+  auto free_blocks_it = _free_blocks.find(block_size);
+  if (free_blocks_it != _free_blocks.end()) {
+    std::vector<uint8_t*>& blocks = free_blocks_it->second;
+    const size_t num_blocks = blocks.size();
+    blocks.erase(
+        std::remove_if(
+            blocks.begin(), blocks.end(),
+            [=](uint8_t* block) {
+              return (block >= start) && (block < start + slab_size);
+            }),
+        blocks.end());
+    _stats.FreeBytes -= (num_blocks - blocks.size()) * block_size;
+    if (blocks.empty()) {
+      _free_blocks.erase(free_blocks_it);
+    }
+  }
+  Unmap(start, slab_size);
+  _stats.MappedBytes -= slab_size;
+  _slabs.erase(it);
+}
@@ -0,0 +1,138 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the PixelBufferPool class, which recycles the memory of
+// pixel buffers.
+
+#ifndef PIXEL_BUFFER_POOL_HPP
+#define PIXEL_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pixel_buffer.hpp"
+
+// Hands out memory for pixel buffers, and keeps it for reuse once they are
+// released, so that rendering page after page at the same zoom does not map
+// and fault in several megabytes each time. Requested sizes are rounded up to
+// size classes, and freed blocks are reused for any request in the same
+// class. Blocks of up to MAX_SLAB_BLOCK_BYTES are carved out of slabs of
+// BLOCKS_PER_SLAB blocks of the same class, and larger blocks are mapped on
+// their own. Memory is backed by huge pages where the kernel allows it.
+// Thread-safe.
+class PixelBufferPool {
+ public:
+  // Rows of pooled pixel buffers start at multiples of this many bytes.
+  enum { ROW_ALIGNMENT = 64 };
+  // Size of a huge page. Mappings at least this large are aligned to it.
+  enum { HUGE_PAGE_BYTES = 2 << 20 };
+  // Number of blocks in a slab, and the largest block carved out of one.
+  enum { BLOCKS_PER_SLAB = 4, MAX_SLAB_BLOCK_BYTES = 8 << 20 };
+  // Free bytes kept for reuse. Once free blocks take up more than this, blocks
+  // mapped on their own are unmapped as they are released, and so are slabs
+  // whose last block in use is released.
+  enum { MAX_FREE_BYTES = 128 << 20 };
+
+  // Memory usage of a pool.
+  struct Stats {
+    // Bytes mapped, in slabs and blocks of their own.
+    size_t MappedBytes;
+    // Bytes in free blocks.
+    size_t FreeBytes;
+    // Number of blocks handed out that were reused.
+    int NumReused;
+
+    Stats() : MappedBytes(0), FreeBytes(0), NumReused(0) {}
+  };
+
+  // Returns the pool shared by all viewers. It is never destroyed, so that
+  // buffers may be released at any time.
+  static PixelBufferPool* Get();
+
+  PixelBufferPool();
+  // Unmaps all memory. All blocks must have been released.
+  ~PixelBufferPool();
+
+  // Creates a pixel buffer backed by pooled memory, with rows aligned to
+  // ROW_ALIGNMENT. Its memory is returned to the pool once the last reference
+  // to it is released. Does NOT take ownership of format.
+  std::shared_ptr<PixelBuffer> NewPixelBuffer(
+      const PixelBuffer::Size& size, const PixelBuffer::Format* format);
+
+  // Returns a block of at least the given size, aligned to ROW_ALIGNMENT, or
+  // nullptr if out of memory.
+  uint8_t* Allocate(size_t size);
+  // Returns a block obtained from Allocate() with the same size to the pool.
+  void Release(uint8_t* block, size_t size);
+  // Unmaps free blocks of their own, and slabs with no blocks in use.
+  void Trim();
+  // Returns current memory usage.
+  Stats GetStats();
+
+  // Returns the size of the block handed out for a request of the given size.
+  static size_t GetBlockSize(size_t size);
+  // Returns the size of a slab holding blocks of the given size.
+  static size_t GetSlabSize(size_t block_size);
+  // Returns the number of pixels in a row of the given width whose length is
+  // a multiple of ROW_ALIGNMENT.
+  static int GetAlignedWidth(int width, int depth);
+
+ private:
+  // A mapping carved into blocks of the same size.
+  struct Slab {
+    // Size of blocks in this slab.
+    size_t BlockSize;
+    // Number of blocks carved out so far.
+    int NumCarved;
+    // Number of blocks handed out and not yet released.
+    int NumUsed;
+  };
+
+  // Protects all members below.
+  std::mutex _mutex;
+  // Free blocks, by block size.
+  std::map<size_t, std::vector<uint8_t*>> _free_blocks;
+  // Slabs by start address.
+  std::map<uint8_t*, Slab> _slabs;
+  // Current memory usage.
+  Stats _stats;
+
+  // Maps the given number of bytes, preferring huge pages. Returns nullptr on
+  // failure.
+  static uint8_t* Map(size_t size);
+  // Unmaps memory obtained from Map().
+  static void Unmap(uint8_t* memory, size_t size);
+  // Carves a block of the given size out of a slab, mapping a new slab if
+  // needed. Must be called with _mutex held. Returns nullptr on failure.
+  uint8_t* CarveBlock(size_t block_size);
+  // Returns the slab containing a block. Must be called with _mutex held.
+  std::map<uint8_t*, Slab>::iterator FindSlab(uint8_t* block);
+  // Unmaps a slab with no blocks in use, and forgets its free blocks. Must be
+  // called with _mutex held.
+  void UnmapSlab(std::map<uint8_t*, Slab>::iterator it);
+
+  // Disable copy and assign.
+  PixelBufferPool(const PixelBufferPool&);
+  PixelBufferPool& operator=(const PixelBufferPool&);
+};
+
+#endif
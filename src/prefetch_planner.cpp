@@ -0,0 +1,92 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the PrefetchPlanner class.
+
+#include "prefetch_planner.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+PrefetchPlanner::PrefetchPlanner(int page, int offset)
+    : _position(page, offset), _moving_backward(false) {}
+
+bool PrefetchPlanner::Record(int page, int offset, Clock::time_point time) {
+  const std::pair<int, int> position(page, offset);
+  if (position == _position) {
+    return false;
+  }
+  const bool was_moving_backward = _moving_backward;
+  _moving_backward = position < _position;
+  if (page != _position.first) {
+    _history.emplace_back(time, std::abs(page - _position.first));
+  }
+  _position = position;
+
+  // Forget moves that no longer count towards the speed, as well as all moves
+  // in the other direction.
+  if (_moving_backward != was_moving_backward) {
+    _history.clear();
+    return true;
+  }
+  while (!_history.empty() &&
+         (time - _history.front().first >
+          std::chrono::milliseconds(HISTORY_MS))) {
+    _history.pop_front();
+  }
+  return false;
+}
+
+bool PrefetchPlanner::IsMovingBackward() const { return _moving_backward; }
+
+float PrefetchPlanner::GetSpeed(Clock::time_point time) const {
+  int distance = 0;
+  for (const auto& move : _history) {
+    if (time - move.first <= std::chrono::milliseconds(HISTORY_MS)) {
+      distance += move.second;
+    }
+  }
+  return distance * 1000.0f / HISTORY_MS;
+}
+
+void PrefetchPlanner::Plan(
+    int budget, Clock::time_point time, int* num_ahead,
+    int* num_behind) const {
+  // 1. Pages ahead come first, as they are the most likely to be needed.
+  const int wanted_ahead =
+      MIN_NUM_AHEAD +
+      static_cast<int>(std::ceil(GetSpeed(time) * LOOKAHEAD_MS / 1000.0f));
+  *num_ahead = std::max(0, std::min(budget, wanted_ahead));
+  // 2. Leave any remaining budget to pages behind, in case the user goes back.
+  *num_behind = std::max(0, std::min<int>(MAX_NUM_BEHIND, budget - *num_ahead));
+}
+
+bool PrefetchPlanner::ShouldPrefetch(
+    int distance, float render_ms, Clock::time_point time) const {
+  if (render_ms < CHEAP_RENDER_MS) {
+    return false;
+  }
+  if (distance <= 1) {
+    return true;
+  }
+  // When the view is not moving, there is no telling when the next move will
+  // be, so leave pages further ahead to later moves.
+  const float speed = GetSpeed(time);
+  return (speed > 0.0f) && (render_ms > (distance - 1) * 1000.0f / speed);
+}
@@ -0,0 +1,82 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the PrefetchPlanner class, which predicts where the user
+// is going next from recent navigation.
+
+#ifndef PREFETCH_PLANNER_HPP
+#define PREFETCH_PLANNER_HPP
+
+#include <chrono>
+#include <deque>
+#include <utility>
+
+// Tracks the direction and speed of recent navigation, and decides how many
+// pages to prefetch ahead of and behind the view. Positions are measured in
+// pages, or in any other unit such as spreads, as long as the caller is
+// consistent.
+class PrefetchPlanner {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Number of pages to prefetch ahead when not moving, and the maximum number
+  // of pages to prefetch behind.
+  enum { MIN_NUM_AHEAD = 1, MAX_NUM_BEHIND = 1 };
+  // How far ahead to prefetch, as the time it would take to get there at the
+  // current speed.
+  enum { LOOKAHEAD_MS = 2000 };
+  // How far back to look when estimating speed.
+  enum { HISTORY_MS = 3000 };
+  // Pages predicted to render faster than this are not worth prefetching.
+  enum { CHEAP_RENDER_MS = 15 };
+
+  // Creates a planner with the view at the given position.
+  PrefetchPlanner(int page, int offset);
+
+  // Records that the view is at a position at the given time. offset breaks
+  // ties within a page, e.g. the vertical offset in continuous layout, and
+  // only affects the direction. Returns true if the direction reversed.
+  bool Record(int page, int offset, Clock::time_point time);
+  // Returns whether the view last moved towards the start of the document.
+  bool IsMovingBackward() const;
+  // Returns the average speed over the last HISTORY_MS, in pages per second.
+  float GetSpeed(Clock::time_point time) const;
+  // Splits a budget of pages to prefetch into pages ahead of the view in the
+  // direction of travel and pages behind it. Prefetches further ahead the
+  // faster the view is moving, and never more than the budget in total.
+  void Plan(
+      int budget, Clock::time_point time, int* num_ahead,
+      int* num_behind) const;
+  // Returns whether a page the given number of pages ahead, predicted to take
+  // render_ms to render, should be prefetched now. This is the case if it
+  // could not be rendered in time if started on the next move instead, going
+  // by the current speed. The next page is always due unless it is cheap.
+  bool ShouldPrefetch(
+      int distance, float render_ms, Clock::time_point time) const;
+
+ private:
+  // The last recorded position.
+  std::pair<int, int> _position;
+  // Whether the view last moved towards the start of the document.
+  bool _moving_backward;
+  // Times when the page changed, and the number of pages moved, from oldest to
+  // newest.
+  std::deque<std::pair<Clock::time_point, int>> _history;
+};
+
+#endif
@@ -0,0 +1,175 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the RenderCostModel class.
+
+#include "render_cost_model.hpp"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <sstream>
+
+namespace {
+
+// Weight of a new render against the recorded cost of the page. Averaging
+// smooths out renders slowed by other work, or sped up by cached resources.
+const float NEW_RENDER_WEIGHT = 0.5f;
+
+// Returns the number of megapixels in an image of the given size.
+float GetMegapixels(int width, int height) {
+  return static_cast<float>(width) * static_cast<float>(height) / 1000000.0f;
+}
+
+// Creates a directory and its parents. Returns false on failure.
+bool MakeDirectories(const std::string& path) {
+  for (size_t pos = path.find('/', 1);; pos = path.find('/', pos + 1)) {
+    const std::string& dir = path.substr(0, pos);
+    if ((mkdir(dir.c_str(), 0700) != 0) && (errno != EEXIST)) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+const char* const RenderCostModel::FILE_HEADER = "jfbview-render-costs-1";
+
+RenderCostModel::RenderCostModel()
+    : _total_ms_per_megapixel(0.0f), _modified(false) {}
+
+void RenderCostModel::Record(int page, int width, int height, float ms) {
+  const float megapixels = GetMegapixels(width, height);
+  if (megapixels <= 0.0f) {
+    return;
+  }
+  const float sample = ms / megapixels;
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto i = _ms_per_megapixel.find(page);
+  if (i == _ms_per_megapixel.end()) {
+    _ms_per_megapixel[page] = sample;
+    _total_ms_per_megapixel += sample;
+  } else {
+    const float updated =
+        (1.0f - NEW_RENDER_WEIGHT) * i->second + NEW_RENDER_WEIGHT * sample;
+    _total_ms_per_megapixel += updated - i->second;
+    i->second = updated;
+  }
+  _modified = true;
+}
+
+float RenderCostModel::Predict(int page, int width, int height) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  float ms_per_megapixel = DEFAULT_MS_PER_MEGAPIXEL;
+  auto i = _ms_per_megapixel.find(page);
+  if (i != _ms_per_megapixel.end()) {
+    ms_per_megapixel = i->second;
+  } else if (!_ms_per_megapixel.empty()) {
+    ms_per_megapixel = _total_ms_per_megapixel / _ms_per_megapixel.size();
+  }
+  return ms_per_megapixel * GetMegapixels(width, height);
+}
+
+bool RenderCostModel::Load(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char header[64];
+  std::map<int, float> ms_per_megapixel;
+  float total_ms_per_megapixel = 0.0f;
+  bool valid = (fscanf(file, "%63s", header) == 1) &&
+               (std::string(header) == FILE_HEADER);
+  int page;
+  float cost;
+  while (valid && (fscanf(file, "%d %f", &page, &cost) == 2)) {
+    ms_per_megapixel[page] = cost;
+    total_ms_per_megapixel += cost;
+  }
+  fclose(file);
+  if (!valid) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _ms_per_megapixel.swap(ms_per_megapixel);
+  _total_ms_per_megapixel = total_ms_per_megapixel;
+  _modified = false;
+  return true;
+}
+
+bool RenderCostModel::Save(const std::string& path) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_modified) {
+    return true;
+  }
+  const size_t dir_end = path.find_last_of('/');
+  if ((dir_end != std::string::npos) && (dir_end > 0) &&
+      !MakeDirectories(path.substr(0, dir_end))) {
+    return false;
+  }
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fprintf(file, "%s\n", FILE_HEADER);
+  for (const auto& entry : _ms_per_megapixel) {
+    fprintf(file, "%d %g\n", entry.first, entry.second);
+  }
+  const bool success = fclose(file) == 0;
+  _modified = !success;
+  return success;
+}
+
+std::string RenderCostModel::GetDefaultPath(const std::string& document_path) {
+  // 1. Identify the document.
+  char real_path[PATH_MAX];
+  struct stat document_stat;
+  if ((realpath(document_path.c_str(), real_path) == nullptr) ||
+      (stat(real_path, &document_stat) != 0)) {
+    return std::string();
+  }
+  std::ostringstream id;
+  id << real_path << ':' << document_stat.st_size << ':'
+     << document_stat.st_mtime;
+
+  // 2. Find the cache directory, per the XDG base directory specification.
+  std::string cache_dir;
+  const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if ((xdg_cache_home != nullptr) && (xdg_cache_home[0] == '/')) {
+    cache_dir = xdg_cache_home;
+  } else if ((home != nullptr) && (home[0] == '/')) {
+    cache_dir = std::string(home) + "/.cache";
+  } else {
+    return std::string();
+  }
+
+  std::ostringstream path;
+  path << cache_dir << "/jfbview/render_costs/" << std::hex
+       << std::hash<std::string>()(id.str());
+  return path.str();
+}
@@ -0,0 +1,76 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the RenderCostModel class, which predicts how long pages
+// take to render from past renders.
+
+#ifndef RENDER_COST_MODEL_HPP
+#define RENDER_COST_MODEL_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+
+// Records how long pages of a document take to render, and predicts how long
+// they will take in future. Costs are stored per page in milliseconds per
+// megapixel, so that they carry over between zoom ratios, and can be saved
+// and loaded with the document. Thread-safe.
+class RenderCostModel {
+ public:
+  // Predicted cost of pages when nothing has been recorded yet.
+  enum { DEFAULT_MS_PER_MEGAPIXEL = 100 };
+
+  RenderCostModel();
+
+  // Records that rendering a page at the given size took the given time.
+  void Record(int page, int width, int height, float ms);
+  // Returns the predicted time to render a page at the given size, in
+  // milliseconds. Pages that have not been recorded are predicted from the
+  // average of those that have.
+  float Predict(int page, int width, int height);
+
+  // Replaces recorded costs with those stored in a file. Returns false if the
+  // file cannot be read.
+  bool Load(const std::string& path);
+  // Stores recorded costs in a file, creating parent directories as needed.
+  // Does nothing if nothing has been recorded since the last Load() or Save().
+  // Returns false if the file cannot be written.
+  bool Save(const std::string& path);
+
+  // Returns where to store the costs of a document by default: a file under
+  // the user's cache directory named after the document's path, size and
+  // modification time, so that a modified document starts afresh. Returns an
+  // empty string if there is no suitable location.
+  static std::string GetDefaultPath(const std::string& document_path);
+
+ private:
+  // File header, including the format version.
+  static const char* const FILE_HEADER;
+
+  // Lock on all fields.
+  std::mutex _mutex;
+  // Recorded cost of each page, in milliseconds per megapixel.
+  std::map<int, float> _ms_per_megapixel;
+  // Sum of _ms_per_megapixel, used to predict pages that have not been
+  // recorded.
+  float _total_ms_per_megapixel;
+  // Whether costs have been recorded since the last Load() or Save().
+  bool _modified;
+};
+
+#endif
@@ -0,0 +1,409 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// jfbview-renderd, a daemon that renders pages for all jfbview instances of a
+// user, so that a page displayed by several of them is rendered only once. See
+// renderd_protocol.hpp.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "cache.hpp"
+#include "fitz_document.hpp"
+#include "pdf_document.hpp"
+#include "renderd_protocol.hpp"
+
+namespace {
+
+// Default number of rendered pages to keep.
+const int DEFAULT_CACHE_SIZE = 64;
+// Number of documents to keep open.
+const int NUM_OPEN_DOCUMENTS = 16;
+// Largest page to render, in pixels, to bound the memory a request can use.
+const int64_t MAX_PAGE_PIXELS = 1 << 28;
+
+struct Options {
+  // Number of rendered pages to keep.
+  int CacheSize;
+
+  Options() : CacheSize(DEFAULT_CACHE_SIZE) {}
+};
+
+// Help text printed by --help or -h.
+const char* HELP_STRING =
+    "Render pages for all running instances of jfbview, so that pages\n"
+    "displayed by several of them are rendered only once.\n"
+    "\n"
+    "Usage: jfbview-renderd [OPTIONS]\n"
+    "\n"
+    "Options:\n"
+    "\t--help, -h            Show this message.\n"
+    "\t--cache_size=N        Keep at most N rendered pages.\n";
+
+void ParseCommandLine(int argc, char* argv[], Options* options) {
+  // Command line options.
+  static const option LongFlags[] = {
+      {"help", false, nullptr, 'h'},
+      {"cache_size", true, nullptr, 'c'},
+      {0, 0, 0, 0},
+  };
+  static const char* ShortFlags = "h";
+
+  for (;;) {
+    int opt_char = getopt_long(argc, argv, ShortFlags, LongFlags, nullptr);
+    if (opt_char == -1) {
+      break;
+    }
+    switch (opt_char) {
+      case 'h':
+        fprintf(stdout, "%s", HELP_STRING);
+        exit(EXIT_FAILURE);
+        break;
+      case 'c':
+        if ((sscanf(optarg, "%d", &(options->CacheSize)) < 1) ||
+            (options->CacheSize < 1)) {
+          fprintf(stderr, "Invalid cache size \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        fprintf(stderr, "Try \"-h\" for help.\n");
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind < argc) {
+    fprintf(stderr, "Unexpected argument \"%s\"\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Identifies a version of a document. A document that has been modified since
+// it was opened has a different size or modification time, and is reopened.
+struct DocumentKey {
+  std::string Path;
+  std::string Password;
+  off_t Size;
+  time_t ModificationTime;
+
+  bool operator<(const DocumentKey& other) const {
+    return std::tie(Path, Password, Size, ModificationTime) <
+           std::tie(
+               other.Path, other.Password, other.Size,
+               other.ModificationTime);
+  }
+};
+
+// Open documents. Documents that fail to open are cached as nullptr, until the
+// file or the password changes.
+class DocumentCache : public Cache<DocumentKey, std::shared_ptr<Document>> {
+ public:
+  explicit DocumentCache(int size)
+      : Cache<DocumentKey, std::shared_ptr<Document>>(size) {}
+  ~DocumentCache() override { Clear(); }
+
+ protected:
+  std::shared_ptr<Document> Load(const DocumentKey& key) override {
+    const std::string* password =
+        key.Password.empty() ? nullptr : &key.Password;
+#ifdef JFBVIEW_ENABLE_LEGACY_PDF_IMPL
+    return std::shared_ptr<Document>(PDFDocument::Open(key.Path, password));
+#else
+    return std::shared_ptr<Document>(FitzDocument::Open(key.Path, password));
+#endif
+  }
+  void Discard(
+      const DocumentKey& key,
+      const std::shared_ptr<Document>& value) override {
+    // The document is closed when the last page being rendered from it is
+    // done.
+  }
+};
+
+// A page rendered into a sealed memfd, which can be handed to any number of
+// clients, or the error that kept the daemon from rendering it.
+struct RenderedPage {
+  int Fd;
+  int Width;
+  int Height;
+  // 0, or an errno value if the page could not be rendered for lack of
+  // resources, in which case Fd is -1.
+  int Error;
+
+  RenderedPage(int fd, int width, int height)
+      : Fd(fd), Width(width), Height(height), Error(0) {}
+  explicit RenderedPage(int error)
+      : Fd(-1), Width(0), Height(0), Error(error) {}
+  ~RenderedPage() {
+    if (Fd != -1) {
+      close(Fd);
+    }
+  }
+};
+
+// Key to the page cache.
+struct PageKey {
+  DocumentKey Document;
+  int Page;
+  float Zoom;
+  int Rotation;
+
+  bool operator<(const PageKey& other) const {
+    return std::tie(Document, Page, Zoom, Rotation) <
+           std::tie(other.Document, other.Page, other.Zoom, other.Rotation);
+  }
+};
+
+// Stores pixels as R, G, B in a mapped memfd.
+class RGBPixelWriter : public Document::PixelWriter {
+ public:
+  RGBPixelWriter(uint8_t* pixels, int width) : _pixels(pixels), _width(width) {}
+
+  void Write(int x, int y, uint8_t r, uint8_t g, uint8_t b) override {
+    uint8_t* pixel =
+        _pixels + (static_cast<size_t>(y) * _width + x) * RENDERD_PIXEL_SIZE;
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+  }
+
+ private:
+  uint8_t* _pixels;
+  int _width;
+};
+
+// Rendered pages. Pages the document fails to render are cached as nullptr.
+// Pages that cannot be rendered for lack of resources are cached with their
+// error, and must be removed once the error has been reported, so that the
+// next request tries again.
+class PageCache : public Cache<PageKey, std::shared_ptr<RenderedPage>> {
+ public:
+  PageCache(int size, DocumentCache* documents)
+      : Cache<PageKey, std::shared_ptr<RenderedPage>>(size),
+        _documents(documents) {}
+  ~PageCache() override { Clear(); }
+
+ protected:
+  std::shared_ptr<RenderedPage> Load(const PageKey& key) override {
+    // 1. Check the request against the document.
+    const std::shared_ptr<Document> doc = _documents->Get(key.Document);
+    if ((doc == nullptr) || (key.Page < 0) ||
+        (key.Page >= doc->GetNumPages()) || !(key.Zoom > 0.0f)) {
+      return nullptr;
+    }
+    const Document::PageSize size =
+        doc->GetPageSize(key.Page, key.Zoom, key.Rotation);
+    const int64_t num_pixels = static_cast<int64_t>(size.Width) * size.Height;
+    if ((size.Width <= 0) || (size.Height <= 0) ||
+        (num_pixels > MAX_PAGE_PIXELS)) {
+      return nullptr;
+    }
+
+    // 2. Render into a memfd.
+    const size_t buffer_size = num_pixels * RENDERD_PIXEL_SIZE;
+    const int fd =
+        memfd_create("jfbview-renderd-page", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+      return std::make_shared<RenderedPage>(errno);
+    }
+    std::shared_ptr<RenderedPage> page =
+        std::make_shared<RenderedPage>(fd, size.Width, size.Height);
+    if (ftruncate(fd, buffer_size) == -1) {
+      return std::make_shared<RenderedPage>(errno);
+    }
+    void* buffer =
+        mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+      return std::make_shared<RenderedPage>(errno);
+    }
+    RGBPixelWriter writer(reinterpret_cast<uint8_t*>(buffer), size.Width);
+    doc->Render(&writer, key.Page, key.Zoom, key.Rotation);
+    munmap(buffer, buffer_size);
+
+    // 3. Seal it, so that clients cannot modify what other clients see.
+    if (fcntl(
+            fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+      return std::make_shared<RenderedPage>(errno);
+    }
+    return page;
+  }
+  void Discard(
+      const PageKey& key, const std::shared_ptr<RenderedPage>& value) override {
+    // The memfd is closed once no client is being sent the page.
+  }
+
+ private:
+  DocumentCache* _documents;
+};
+
+// Answers requests on a client connection until the client disconnects.
+void ServeClient(int socket, DocumentCache* documents, PageCache* pages) {
+  if (!IsRenderdPeerTrusted(socket)) {
+    close(socket);
+    return;
+  }
+  for (;;) {
+    // 1. Read a request.
+    RenderdRequest request;
+    int fd;
+    if (!ReceiveRenderdMessage(socket, &request, sizeof(request), &fd)) {
+      break;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+    request.Path[sizeof(request.Path) - 1] = '\0';
+    request.Password[sizeof(request.Password) - 1] = '\0';
+
+    // 2. Test the page for color, which documents cache, or look up the
+    // page, rendering it if needed. Errors due to a lack of resources are
+    // reported but not kept.
+    RenderdReply reply;
+    memset(&reply, 0, sizeof(reply));
+    std::shared_ptr<RenderedPage> page;
+    struct stat file_stat;
+    if ((request.Version != RENDERD_PROTOCOL_VERSION) ||
+        ((request.Type != RENDERD_RENDER_PAGE) &&
+         (request.Type != RENDERD_TEST_GRAY))) {
+      reply.Status = EPROTO;
+    } else if (stat(request.Path, &file_stat) == -1) {
+      reply.Status = errno;
+    } else {
+      PageKey key;
+      key.Document.Path = request.Path;
+      key.Document.Password = request.Password;
+      key.Document.Size = file_stat.st_size;
+      key.Document.ModificationTime = file_stat.st_mtime;
+      key.Page = request.Page;
+      key.Zoom = request.Zoom;
+      key.Rotation = request.Rotation;
+      if (request.Type == RENDERD_TEST_GRAY) {
+        const std::shared_ptr<Document> doc = documents->Get(key.Document);
+        if ((doc == nullptr) || (key.Page < 0) ||
+            (key.Page >= doc->GetNumPages())) {
+          reply.Status = EINVAL;
+        } else {
+          reply.Gray = doc->IsGray(key.Page) ? 1 : 0;
+        }
+      } else {
+        page = pages->Get(key);
+        if (page == nullptr) {
+          reply.Status = EINVAL;
+        } else if (page->Error != 0) {
+          reply.Status = page->Error;
+          pages->Remove(key);
+          page.reset();
+        } else {
+          reply.Width = page->Width;
+          reply.Height = page->Height;
+        }
+      }
+    }
+
+    // 3. Send the reply.
+    if (!SendRenderdMessage(
+            socket, &reply, sizeof(reply), page ? page->Fd : -1)) {
+      break;
+    }
+  }
+  close(socket);
+}
+
+// Creates the listening socket. Returns -1 on failure.
+int Listen(const std::string& socket_path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long\n", socket_path.c_str());
+    return -1;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+  const int socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (socket == -1) {
+    perror("socket");
+    return -1;
+  }
+
+  // 1. Replace the socket of a previous instance, unless it is still running.
+  if (connect(
+          socket, reinterpret_cast<const struct sockaddr*>(&address),
+          sizeof(address)) == 0) {
+    fprintf(stderr, "jfbview-renderd is already running\n");
+    close(socket);
+    return -1;
+  }
+  unlink(socket_path.c_str());
+
+  // 2. Create the socket accessible only to the current user.
+  const mode_t old_umask = umask(0077);
+  const int result = bind(
+      socket, reinterpret_cast<const struct sockaddr*>(&address),
+      sizeof(address));
+  umask(old_umask);
+  if ((result == -1) || (listen(socket, SOMAXCONN) == -1)) {
+    perror(socket_path.c_str());
+    close(socket);
+    return -1;
+  }
+  return socket;
+}
+
+}  // namespace
+
+int RenderdMain(int argc, char* argv[]) {
+  Options options;
+  ParseCommandLine(argc, argv, &options);
+  // Clients that disconnect early must not kill the daemon.
+  signal(SIGPIPE, SIG_IGN);
+
+  const int socket = Listen(GetRenderdSocketPath());
+  if (socket == -1) {
+    return EXIT_FAILURE;
+  }
+  // A cache of size n holds n - 1 items.
+  DocumentCache documents(NUM_OPEN_DOCUMENTS + 1);
+  PageCache pages(options.CacheSize + 1, &documents);
+  for (;;) {
+    const int client = accept4(socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      perror("accept");
+      return EXIT_FAILURE;
+    }
+    std::thread(ServeClient, client, &documents, &pages).detach();
+  }
+}
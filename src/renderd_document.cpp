@@ -0,0 +1,227 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines RenderdDocument.
+
+#include "renderd_document.hpp"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include "multithreading.hpp"
+#include "renderd_protocol.hpp"
+
+Document* RenderdDocument::Open(
+    Document* local, const std::string& path, const std::string* password) {
+  // 1. Check that the daemon is running, and that the request can be sent.
+  const int socket = Connect();
+  if (socket == -1) {
+    return local;
+  }
+  close(socket);
+  char absolute_path[PATH_MAX];
+  if ((realpath(path.c_str(), absolute_path) == nullptr) ||
+      ((password != nullptr) &&
+       (password->size() >= RENDERD_MAX_PASSWORD_SIZE))) {
+    return local;
+  }
+
+  // 2. Wrap the local copy.
+  return new RenderdDocument(
+      local, absolute_path, password == nullptr ? "" : *password);
+}
+
+RenderdDocument::RenderdDocument(
+    Document* local, const std::string& path, const std::string& password)
+    : _local(local), _path(path), _password(password) {}
+
+int RenderdDocument::GetNumPages() { return _local->GetNumPages(); }
+
+const Document::PageSize RenderdDocument::GetPageSize(
+    int page, float zoom, int rotation) {
+  return _local->GetPageSize(page, zoom, rotation);
+}
+
+void RenderdDocument::Render(
+    PixelWriter* pw, int page, float zoom, int rotation) {
+  const PageSize size = _local->GetPageSize(page, zoom, rotation);
+  if (!RenderRemotely(pw, page, zoom, rotation, size)) {
+    _local->Render(pw, page, zoom, rotation);
+  }
+}
+
+bool RenderdDocument::IsGray(int page) {
+  {
+    std::lock_guard<std::mutex> lock(_gray_pages_mutex);
+    auto i = _gray_pages.find(page);
+    if (i != _gray_pages.end()) {
+      return i->second;
+    }
+  }
+  RenderdReply reply;
+  int fd;
+  const bool gray =
+      Request(RENDERD_TEST_GRAY, page, 1.0f, 0, &reply, &fd)
+          ? reply.Gray != 0
+          : _local->IsGray(page);
+  std::lock_guard<std::mutex> lock(_gray_pages_mutex);
+  return _gray_pages[page] = gray;
+}
+
+void RenderdDocument::Warm(int page, float zoom, int rotation) {
+  _local->Warm(page, zoom, rotation);
+}
+
+void RenderdDocument::SetDiskCache(
+    DiskCache* disk_cache, const std::string& document_id) {
+  _local->SetDiskCache(disk_cache, document_id);
+}
+
+void RenderdDocument::ReleaseMemory() { _local->ReleaseMemory(); }
+
+const Document::OutlineItem* RenderdDocument::GetOutline() {
+  return _local->GetOutline();
+}
+
+int RenderdDocument::Lookup(const OutlineItem* item) {
+  return _local->Lookup(item);
+}
+
+std::vector<int> RenderdDocument::GetLinkedPages(int page) {
+  return _local->GetLinkedPages(page);
+}
+
+Document::SearchResult RenderdDocument::Search(
+    const std::string& search_string, int start_page, int context_length,
+    int max_num_search_hits) {
+  return _local->Search(
+      search_string, start_page, context_length, max_num_search_hits);
+}
+
+std::vector<Document::SearchHit> RenderdDocument::SearchOnPage(
+    const std::string& search_string, int page, int context_length) {
+  return SearchOnPageOf(_local.get(), search_string, page, context_length);
+}
+
+int RenderdDocument::Connect() {
+  const std::string& socket_path = GetRenderdSocketPath();
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+
+  const int socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (socket == -1) {
+    return -1;
+  }
+  // Do not send passwords to a daemon run by someone else.
+  if ((connect(
+           socket, reinterpret_cast<const struct sockaddr*>(&address),
+           sizeof(address)) == -1) ||
+      !IsRenderdPeerTrusted(socket)) {
+    close(socket);
+    return -1;
+  }
+  return socket;
+}
+
+bool RenderdDocument::Request(
+    int type, int page, float zoom, int rotation, RenderdReply* reply,
+    int* fd) {
+  // Each request uses a connection of its own, so that pages rendered
+  // concurrently are rendered concurrently by the daemon too.
+  const int socket = Connect();
+  if (socket == -1) {
+    return false;
+  }
+  RenderdRequest request;
+  memset(&request, 0, sizeof(request));
+  request.Version = RENDERD_PROTOCOL_VERSION;
+  request.Type = type;
+  request.Page = page;
+  request.Zoom = zoom;
+  request.Rotation = rotation;
+  strncpy(request.Path, _path.c_str(), sizeof(request.Path) - 1);
+  strncpy(request.Password, _password.c_str(), sizeof(request.Password) - 1);
+  *fd = -1;
+  const bool ok =
+      SendRenderdMessage(socket, &request, sizeof(request)) &&
+      ReceiveRenderdMessage(socket, reply, sizeof(*reply), fd);
+  close(socket);
+  if (!ok || (reply->Status != 0)) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool RenderdDocument::RenderRemotely(
+    PixelWriter* pw, int page, float zoom, int rotation, const PageSize& size) {
+  // 1. Send the request.
+  RenderdReply reply;
+  int fd;
+  if (!Request(RENDERD_RENDER_PAGE, page, zoom, rotation, &reply, &fd)) {
+    return false;
+  }
+  if ((fd == -1) || (reply.Width != size.Width) ||
+      (reply.Height != size.Height)) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+
+  // 2. Map the rendered page, and copy it out.
+  const size_t buffer_size =
+      static_cast<size_t>(reply.Width) * reply.Height * RENDERD_PIXEL_SIZE;
+  void* buffer = buffer_size == 0
+                     ? nullptr
+                     : mmap(nullptr, buffer_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED) {
+    return false;
+  }
+  const uint8_t* pixels = reinterpret_cast<const uint8_t*>(buffer);
+  const int width = reply.Width, height = reply.Height;
+  ExecuteInParallel([=](int num_threads, int i) {
+    for (int y = i; y < height; y += num_threads) {
+      const uint8_t* row = pixels + static_cast<size_t>(y) * width *
+                                        RENDERD_PIXEL_SIZE;
+      for (int x = 0; x < width; ++x) {
+        const uint8_t* pixel = row + x * RENDERD_PIXEL_SIZE;
+        pw->Write(x, y, pixel[0], pixel[1], pixel[2]);
+      }
+    }
+  });
+  if (buffer != nullptr) {
+    munmap(buffer, buffer_size);
+  }
+  return true;
+}
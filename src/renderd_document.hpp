@@ -0,0 +1,100 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares RenderdDocument, which renders pages through
+// jfbview-renderd.
+
+#ifndef RENDERD_DOCUMENT_HPP
+#define RENDERD_DOCUMENT_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+
+struct RenderdReply;
+
+// A document whose pages are rendered by jfbview-renderd, so that a page
+// displayed by several jfbview instances is rendered once per machine, and a
+// document the daemon has rendered before displays at once. Everything else,
+// including rendering while the daemon is unavailable, is handled by a local
+// copy of the document.
+class RenderdDocument : public Document {
+ public:
+  // If jfbview-renderd is running, returns a RenderdDocument for the document
+  // at the given path, backed by the given local copy. Otherwise returns the
+  // local copy itself. Takes ownership of local. password may be nullptr.
+  static Document* Open(
+      Document* local, const std::string& path, const std::string* password);
+
+  int GetNumPages() override;
+  const PageSize GetPageSize(int page, float zoom, int rotation) override;
+  void Render(PixelWriter* pw, int page, float zoom, int rotation) override;
+  // See Document. Asks jfbview-renderd, which tests each page once for all
+  // instances. Cached.
+  bool IsGray(int page) override;
+  void Warm(int page, float zoom, int rotation) override;
+  void SetDiskCache(
+      DiskCache* disk_cache, const std::string& document_id) override;
+  void ReleaseMemory() override;
+  const OutlineItem* GetOutline() override;
+  int Lookup(const OutlineItem* item) override;
+  std::vector<int> GetLinkedPages(int page) override;
+  SearchResult Search(
+      const std::string& search_string, int start_page, int context_length,
+      int max_num_search_hits) override;
+
+ protected:
+  // Searches the local copy.
+  std::vector<SearchHit> SearchOnPage(
+      const std::string& search_string, int page, int context_length) override;
+
+ private:
+  // The local copy of the document.
+  std::unique_ptr<Document> _local;
+  // Absolute path of the document.
+  std::string _path;
+  // Password of the document, or an empty string.
+  std::string _password;
+  // Results of IsGray(), by page, and a mutex guarding them.
+  std::map<int, bool> _gray_pages;
+  std::mutex _gray_pages_mutex;
+
+  // Use the factory method Open() instead.
+  RenderdDocument(
+      Document* local, const std::string& path, const std::string& password);
+
+  // Connects to jfbview-renderd. Returns the socket, or -1 on failure.
+  static int Connect();
+  // Sends a request of the given type about a page to jfbview-renderd, and
+  // receives the reply and its attached file descriptor, or -1. Returns false
+  // on failure, or if the daemon reported an error.
+  bool Request(
+      int type, int page, float zoom, int rotation, RenderdReply* reply,
+      int* fd);
+  // Renders a page through jfbview-renderd. The rendered page must have the
+  // given size. Returns false on failure, without writing any pixels.
+  bool RenderRemotely(
+      PixelWriter* pw, int page, float zoom, int rotation,
+      const PageSize& size);
+};
+
+#endif
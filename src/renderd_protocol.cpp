@@ -0,0 +1,119 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines helpers for the jfbview-renderd protocol.
+
+#include "renderd_protocol.hpp"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+std::string GetRenderdSocketPath() {
+  const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if ((runtime_dir != nullptr) && (runtime_dir[0] != '\0')) {
+    return std::string(runtime_dir) + "/jfbview-renderd.sock";
+  }
+  return "/tmp/jfbview-renderd-" + std::to_string(getuid()) + ".sock";
+}
+
+bool IsRenderdPeerTrusted(int socket) {
+  struct ucred credentials;
+  socklen_t size = sizeof(credentials);
+  if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) ==
+      -1) {
+    return false;
+  }
+  return credentials.uid == getuid();
+}
+
+bool SendRenderdMessage(
+    int socket, const void* message, size_t size, int fd) {
+  struct iovec iov;
+  iov.iov_base = const_cast<void*>(message);
+  iov.iov_len = size;
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+
+  // Attach the file descriptor as ancillary data.
+  union {
+    char Buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr Align;
+  } control;
+  if (fd != -1) {
+    memset(&control, 0, sizeof(control));
+    header.msg_control = control.Buffer;
+    header.msg_controllen = sizeof(control.Buffer);
+    struct cmsghdr* control_header = CMSG_FIRSTHDR(&header);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type = SCM_RIGHTS;
+    control_header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_header), &fd, sizeof(int));
+  }
+
+  ssize_t num_sent;
+  do {
+    num_sent = sendmsg(socket, &header, MSG_NOSIGNAL);
+  } while ((num_sent == -1) && (errno == EINTR));
+  return num_sent == static_cast<ssize_t>(size);
+}
+
+bool ReceiveRenderdMessage(
+    int socket, void* message, size_t size, int* fd) {
+  struct iovec iov;
+  iov.iov_base = message;
+  iov.iov_len = size;
+  union {
+    char Buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr Align;
+  } control;
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+  header.msg_control = control.Buffer;
+  header.msg_controllen = sizeof(control.Buffer);
+
+  ssize_t num_received;
+  do {
+    num_received = recvmsg(socket, &header, MSG_CMSG_CLOEXEC);
+  } while ((num_received == -1) && (errno == EINTR));
+
+  *fd = -1;
+  struct cmsghdr* control_header = CMSG_FIRSTHDR(&header);
+  if ((control_header != nullptr) &&
+      (control_header->cmsg_level == SOL_SOCKET) &&
+      (control_header->cmsg_type == SCM_RIGHTS)) {
+    memcpy(fd, CMSG_DATA(control_header), sizeof(int));
+  }
+  // Messages are never split, as the socket preserves message boundaries.
+  if (num_received != static_cast<ssize_t>(size)) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the protocol spoken between jfbview and jfbview-renderd,
+// the daemon that renders pages once for all jfbview instances on a machine.
+//
+// Clients connect to a Unix socket, and send one RenderdRequest per page. The
+// daemon answers each with a RenderdReply, and on success attaches a sealed
+// memfd holding the rendered page, or for a color test, says whether the page
+// is gray. Both ends only talk to processes of the
+// same user.
+
+#ifndef RENDERD_PROTOCOL_HPP
+#define RENDERD_PROTOCOL_HPP
+
+#include <linux/limits.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Version of the protocol, bumped on incompatible changes.
+enum { RENDERD_PROTOCOL_VERSION = 2 };
+// Kinds of requests: render a page, or test whether it only has gray levels.
+enum { RENDERD_RENDER_PAGE = 0, RENDERD_TEST_GRAY = 1 };
+// Maximum length of a document password, including the terminating NUL.
+enum { RENDERD_MAX_PASSWORD_SIZE = 256 };
+// Number of bytes per pixel of rendered pages, which are stored as R, G, B.
+enum { RENDERD_PIXEL_SIZE = 3 };
+
+// A request to render a page.
+struct RenderdRequest {
+  // RENDERD_PROTOCOL_VERSION.
+  int32_t Version;
+  // RENDERD_RENDER_PAGE or RENDERD_TEST_GRAY.
+  int32_t Type;
+  // Page number, starting from 0.
+  int32_t Page;
+  // Zoom ratio as a fraction. Ignored by color tests.
+  float Zoom;
+  // Rotation in clockwise degrees. Ignored by color tests.
+  int32_t Rotation;
+  // Absolute path of the document, NUL terminated.
+  char Path[PATH_MAX];
+  // Password of the document, NUL terminated. Empty if there is none.
+  char Password[RENDERD_MAX_PASSWORD_SIZE];
+};
+
+// The answer to a RenderdRequest. On success, a render is answered with a
+// memfd that holds Width * Height pixels of RENDERD_PIXEL_SIZE bytes, row by
+// row.
+struct RenderdReply {
+  // 0 on success, or an errno value.
+  int32_t Status;
+  // Size of the rendered page.
+  int32_t Width;
+  int32_t Height;
+  // Answer to a color test: 1 if the page only has gray levels, 0 otherwise.
+  int32_t Gray;
+};
+
+// Returns the path of the daemon's socket: jfbview-renderd.sock under
+// $XDG_RUNTIME_DIR, or if that is not set, a per-user path under /tmp.
+extern std::string GetRenderdSocketPath();
+
+// Returns true if the process at the other end of a connected socket belongs
+// to the current user.
+extern bool IsRenderdPeerTrusted(int socket);
+
+// Sends a message, with a file descriptor attached unless fd is -1. Returns
+// false on failure.
+extern bool SendRenderdMessage(
+    int socket, const void* message, size_t size, int fd = -1);
+// Receives a message of exactly the given size. Stores an attached file
+// descriptor in fd, or -1 if there is none. Returns false on failure, or if
+// the other end has closed the connection.
+extern bool ReceiveRenderdMessage(
+    int socket, void* message, size_t size, int* fd);
+
+#endif
@@ -119,6 +119,7 @@ int SearchView::Run() {
   SwitchToSearchStringField();
 
   _selected_page = -1;
+  NotifyHighlight();
 
   EventLoop(SEARCH_STRING_FIELD_MODE);
 
@@ -236,6 +237,7 @@ void SearchView::ProcessKeySearchStringFieldMode(int key) {
     case '\r':
     case KEY_ENTER:
       Search();
+      NotifyHighlight();
       break;
     case KEY_BACKSPACE:
     case 127:
@@ -271,6 +273,7 @@ void SearchView::ProcessKeySearchStringFieldMode(int key) {
     case KEY_NPAGE:
       if (_result && !_result->SearchHits.empty()) {
         SwitchToSearchResult();
+        NotifyHighlight();
       }
       break;
     default:
@@ -350,6 +353,18 @@ void SearchView::ProcessKeyRegularMode(int key) {
   } else if (_selected_index >= _first_index + result_window_height) {
     _first_index = _selected_index - result_window_height + 1;
   }
+  NotifyHighlight();
+}
+
+void SearchView::SetHighlightHandler(
+    const std::function<void(int)>& handler) {
+  _highlight_handler = handler;
+}
+
+void SearchView::NotifyHighlight() {
+  if (_highlight_handler && _result && !_result->SearchHits.empty()) {
+    _highlight_handler(_result->SearchHits[_selected_index].Page);
+  }
 }
 
 void SearchView::SwitchToSearchStringField() {
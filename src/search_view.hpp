@@ -22,6 +22,7 @@
 #define SEARCH_VIEW_HPP
 
 #include <form.h>
+#include <functional>
 #include <string>
 #include <vector>
 #include "document.hpp"
@@ -41,6 +42,10 @@ class SearchView : public UIView {
   // page to jump to, returns the selected page. Otherwise, returns a negative
   // number.
   int Run();
+  // Sets a function to call with the page of the highlighted search hit
+  // whenever the highlight moves, so that the page can be prepared before the
+  // user jumps to it.
+  void SetHighlightHandler(const std::function<void(int)>& handler);
 
  protected:
   // See UIView.
@@ -99,6 +104,8 @@ class SearchView : public UIView {
 
   // The page the user desires to go to.
   int _selected_page;
+  // See SetHighlightHandler().
+  std::function<void(int)> _highlight_handler;
 
   // Key processing modes.
   enum KeyProcessingMode {
@@ -120,6 +127,10 @@ class SearchView : public UIView {
   // The maximum search hit index value.
   int GetMaxIndex() { return _result ? _result->SearchHits.size() - 1 : 0; }
 
+  // Calls _highlight_handler with the page of the highlighted search hit, if
+  // any.
+  void NotifyHighlight();
+
   // Returns the current text in the search string field.
   std::string GetSearchString();
 };
@@ -0,0 +1,349 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file defines the thumbnail view.
+
+#include "thumbnail_view.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+
+using std::placeholders::_1;
+
+namespace {
+
+// A PixelWriter that writes pixels to a PixelBuffer as is.
+class ThumbnailWriter : public Document::PixelWriter {
+ public:
+  explicit ThumbnailWriter(PixelBuffer* buffer) : _buffer(buffer) {}
+  // See PixelWriter.
+  void Write(int x, int y, uint8_t r, uint8_t g, uint8_t b) override {
+    _buffer->WritePixel(x, y, r, g, b);
+  }
+
+ private:
+  // The destination buffer.
+  PixelBuffer* _buffer;
+};
+
+}  // namespace
+
+ThumbnailView::ThumbnailView(
+    Document* document, Framebuffer* framebuffer,
+    const std::string& status_file)
+    : UIView(
+          {{
+              REGULAR_MODE,
+              std::bind(&ThumbnailView::ProcessKey, this, _1),
+          }},
+          status_file),
+      _document(document),
+      _framebuffer(framebuffer),
+      _selected_page(0),
+      _chosen_page(-1),
+      _first_row(0),
+      _scheduled_first_row(-1),
+      _focus_page(0),
+      _work_queue(0, true) {
+  assert(_document != nullptr);
+  assert(_framebuffer != nullptr);
+}
+
+ThumbnailView::~ThumbnailView() {}
+
+int ThumbnailView::Run(int page) {
+  // Clear the console, so that it does not draw over the grid.
+  WINDOW* const window = GetWindow();
+  wclear(window);
+  wrefresh(window);
+
+  _selected_page = page;
+  _chosen_page = -1;
+  UpdateForSelectedPage();
+
+  EventLoop(REGULAR_MODE);
+
+  // Stop rendering thumbnails while the view is not displayed. They will be
+  // rescheduled on the next invocation.
+  _work_queue.Cancel();
+  _scheduled_first_row = -1;
+
+  return _chosen_page;
+}
+
+void ThumbnailView::ReleaseMemory() {
+  _work_queue.Cancel();
+  _work_queue.Wait(nullptr);
+  _scheduled_first_row = -1;
+  std::lock_guard<std::mutex> lock(_mutex);
+  _thumbnails.clear();
+}
+
+void ThumbnailView::Render() {
+  const PixelBuffer::Size& screen_size = _framebuffer->GetSize();
+  const int num_pages = _document->GetNumPages();
+  const int num_columns = GetNumColumns(), num_rows = GetNumVisibleRows();
+
+  // 1. Clear the area around the grid.
+  const PixelBuffer::Rect& top_left = GetCellRect(0, 0);
+  const PixelBuffer::Rect& bottom_right =
+      GetCellRect(num_rows - 1, num_columns - 1);
+  const int grid_right = bottom_right.X + bottom_right.Width;
+  const int grid_bottom = bottom_right.Y + bottom_right.Height;
+  _framebuffer->Clear(PixelBuffer::Rect(0, 0, screen_size.Width, top_left.Y));
+  _framebuffer->Clear(PixelBuffer::Rect(
+      0, grid_bottom, screen_size.Width, screen_size.Height - grid_bottom));
+  _framebuffer->Clear(
+      PixelBuffer::Rect(0, top_left.Y, top_left.X, grid_bottom - top_left.Y));
+  _framebuffer->Clear(PixelBuffer::Rect(
+      grid_right, top_left.Y, screen_size.Width - grid_right,
+      grid_bottom - top_left.Y));
+
+  // 2. Draw cells. Thumbnails that have not been rendered yet are drawn as gray
+  // placeholders.
+  for (int row = 0; row < num_rows; ++row) {
+    for (int column = 0; column < num_columns; ++column) {
+      const int page = (_first_row + row) * num_columns + column;
+      const PixelBuffer::Rect& cell_rect = GetCellRect(row, column);
+      if (page >= num_pages) {
+        _framebuffer->Clear(cell_rect);
+        continue;
+      }
+
+      // 2.1. Margin.
+      const uint8_t margin_value = page == _selected_page ? UINT8_MAX : 0;
+      const PixelBuffer::Rect margin_rects[] = {
+          PixelBuffer::Rect(
+              cell_rect.X, cell_rect.Y, cell_rect.Width, CELL_MARGIN),
+          PixelBuffer::Rect(
+              cell_rect.X, cell_rect.Y + cell_rect.Height - CELL_MARGIN,
+              cell_rect.Width, CELL_MARGIN),
+          PixelBuffer::Rect(
+              cell_rect.X, cell_rect.Y + CELL_MARGIN, CELL_MARGIN,
+              cell_rect.Height - 2 * CELL_MARGIN),
+          PixelBuffer::Rect(
+              cell_rect.X + cell_rect.Width - CELL_MARGIN,
+              cell_rect.Y + CELL_MARGIN, CELL_MARGIN,
+              cell_rect.Height - 2 * CELL_MARGIN),
+      };
+      for (const PixelBuffer::Rect& rect : margin_rects) {
+        _framebuffer->Fill(rect, margin_value, margin_value, margin_value);
+      }
+
+      // 2.2. Thumbnail.
+      const PixelBuffer::Rect thumbnail_rect(
+          cell_rect.X + CELL_MARGIN, cell_rect.Y + CELL_MARGIN,
+          cell_rect.Width - 2 * CELL_MARGIN,
+          cell_rect.Height - 2 * CELL_MARGIN);
+      const std::shared_ptr<PixelBuffer> thumbnail = GetThumbnail(page);
+      if (thumbnail) {
+        const PixelBuffer::Size& thumbnail_size = thumbnail->GetSize();
+        _framebuffer->Render(
+            *thumbnail,
+            PixelBuffer::Rect(
+                0, 0, std::min(thumbnail_size.Width, thumbnail_rect.Width),
+                std::min(thumbnail_size.Height, thumbnail_rect.Height)),
+            thumbnail_rect);
+      } else {
+        _framebuffer->Fill(thumbnail_rect, 64, 64, 64);
+      }
+    }
+  }
+}
+
+int ThumbnailView::GetRefreshIntervalMs() {
+  const int num_pages = _document->GetNumPages();
+  const int first_page = _first_row * GetNumColumns();
+  const int last_page = std::min(
+      num_pages, first_page + GetNumVisibleRows() * GetNumColumns());
+  for (int page = first_page; page < last_page; ++page) {
+    if (!GetThumbnail(page)) {
+      return REFRESH_INTERVAL_MS;
+    }
+  }
+  return -1;
+}
+
+int ThumbnailView::GetNumColumns() const {
+  return std::max(1, _framebuffer->GetSize().Width / CELL_WIDTH);
+}
+
+int ThumbnailView::GetNumVisibleRows() const {
+  return std::max(1, _framebuffer->GetSize().Height / CELL_HEIGHT);
+}
+
+PixelBuffer::Rect ThumbnailView::GetCellRect(int row, int column) const {
+  // The grid is centered on screen.
+  const PixelBuffer::Size& screen_size = _framebuffer->GetSize();
+  const int grid_x = (screen_size.Width - GetNumColumns() * CELL_WIDTH) / 2;
+  const int grid_y =
+      (screen_size.Height - GetNumVisibleRows() * CELL_HEIGHT) / 2;
+  return PixelBuffer::Rect(
+      grid_x + column * CELL_WIDTH, grid_y + row * CELL_HEIGHT, CELL_WIDTH,
+      CELL_HEIGHT);
+}
+
+void ThumbnailView::UpdateForSelectedPage() {
+  const int num_pages = _document->GetNumPages();
+  const int num_columns = GetNumColumns();
+  const int num_visible_rows = GetNumVisibleRows();
+  const int num_rows = (num_pages + num_columns - 1) / num_columns;
+
+  // 1. Scroll so that the selected page is visible.
+  _selected_page = std::max(0, std::min(num_pages - 1, _selected_page));
+  const int selected_row = _selected_page / num_columns;
+  if (selected_row < _first_row) {
+    _first_row = selected_row;
+  } else if (selected_row >= _first_row + num_visible_rows) {
+    _first_row = selected_row - num_visible_rows + 1;
+  }
+  if (_first_row == _scheduled_first_row) {
+    return;
+  }
+  _scheduled_first_row = _first_row;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _focus_page = _first_row * num_columns;
+  }
+
+  // 2. Reschedule thumbnails, starting with visible rows and then alternating
+  // between the rows below and above them, up to what the cache can hold.
+  _work_queue.Cancel();
+  int num_scheduled = 0;
+  auto schedule_row = [&](int row, WorkQueue::Priority priority) {
+    const int end_page = std::min(num_pages, (row + 1) * num_columns);
+    for (int page = row * num_columns;
+         (page < end_page) && (num_scheduled < MAX_NUM_THUMBNAILS);
+         ++page, ++num_scheduled) {
+      _work_queue.Enqueue(
+          [this, page] { RenderThumbnail(page); }, nullptr, priority);
+    }
+  };
+  const int last_row = std::min(num_rows, _first_row + num_visible_rows) - 1;
+  for (int row = _first_row; row <= last_row; ++row) {
+    schedule_row(row, WorkQueue::VISIBLE);
+  }
+  for (int distance = 1; (num_scheduled < MAX_NUM_THUMBNAILS) &&
+                         ((last_row + distance < num_rows) ||
+                          (_first_row - distance >= 0));
+       ++distance) {
+    const WorkQueue::Priority priority =
+        distance == 1 ? WorkQueue::IMMINENT : WorkQueue::PREFETCH;
+    if (last_row + distance < num_rows) {
+      schedule_row(last_row + distance, priority);
+    }
+    if (_first_row - distance >= 0) {
+      schedule_row(_first_row - distance, priority);
+    }
+  }
+}
+
+void ThumbnailView::RenderThumbnail(int page) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_thumbnails.count(page) || _pages_in_progress.count(page)) {
+      return;
+    }
+    _pages_in_progress.insert(page);
+  }
+
+  // 1. Render the page to fit within a cell.
+  const Document::PageSize& page_size = _document->GetPageSize(page);
+  const float zoom = std::min(
+      static_cast<float>(CELL_WIDTH - 2 * CELL_MARGIN) /
+          static_cast<float>(page_size.Width),
+      static_cast<float>(CELL_HEIGHT - 2 * CELL_MARGIN) /
+          static_cast<float>(page_size.Height));
+  const Document::PageSize& thumbnail_size =
+      _document->GetPageSize(page, zoom);
+  std::shared_ptr<PixelBuffer> thumbnail(_framebuffer->NewPooledPixelBuffer(
+      PixelBuffer::Size(thumbnail_size.Width, thumbnail_size.Height)));
+  ThumbnailWriter writer(thumbnail.get());
+  _document->Render(&writer, page, zoom, 0);
+
+  // 2. Store it. If the cache is full, evict the thumbnail farthest from the
+  // focus page, which is either the first or the last one.
+  std::unique_lock<std::mutex> lock(_mutex);
+  _pages_in_progress.erase(page);
+  _thumbnails[page] = thumbnail;
+  while (_thumbnails.size() > MAX_NUM_THUMBNAILS) {
+    const int first_page = _thumbnails.begin()->first;
+    const int last_page = _thumbnails.rbegin()->first;
+    _thumbnails.erase(
+        std::abs(first_page - _focus_page) > std::abs(last_page - _focus_page)
+            ? first_page
+            : last_page);
+  }
+}
+
+std::shared_ptr<PixelBuffer> ThumbnailView::GetThumbnail(int page) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto i = _thumbnails.find(page);
+  return i == _thumbnails.end() ? nullptr : i->second;
+}
+
+void ThumbnailView::ProcessKey(int key) {
+  const int num_columns = GetNumColumns();
+  switch (key) {
+    case 't':
+    case 'q':
+    case 27:
+      ExitEventLoop();
+      break;
+    case 'h':
+    case KEY_LEFT:
+      --_selected_page;
+      break;
+    case 'l':
+    case KEY_RIGHT:
+      ++_selected_page;
+      break;
+    case 'k':
+    case KEY_UP:
+      _selected_page -= num_columns;
+      break;
+    case 'j':
+    case KEY_DOWN:
+      _selected_page += num_columns;
+      break;
+    case KEY_PPAGE:
+      _selected_page -= num_columns * GetNumVisibleRows();
+      break;
+    case KEY_NPAGE:
+      _selected_page += num_columns * GetNumVisibleRows();
+      break;
+    case KEY_HOME:
+      _selected_page = 0;
+      break;
+    case KEY_END:
+      _selected_page = _document->GetNumPages() - 1;
+      break;
+    case '\n':
+    case '\r':
+    case KEY_ENTER:
+    case 'g':
+      _chosen_page = _selected_page;
+      ExitEventLoop();
+      break;
+    default:
+      break;
+  }
+  UpdateForSelectedPage();
+}
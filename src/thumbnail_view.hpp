@@ -0,0 +1,127 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                           *
+ *  Copyright (C) 2012-2020 Chuan Ji                                         *
+ *                                                                           *
+ *  Licensed under the Apache License, Version 2.0 (the "License");          *
+ *  you may not use this file except in compliance with the License.         *
+ *  You may obtain a copy of the License at                                  *
+ *                                                                           *
+ *   http://www.apache.org/licenses/LICENSE-2.0                              *
+ *                                                                           *
+ *  Unless required by applicable law or agreed to in writing, software      *
+ *  distributed under the License is distributed on an "AS IS" BASIS,        *
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+ *  See the License for the specific language governing permissions and      *
+ *  limitations under the License.                                           *
+ *                                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// This file declares the thumbnail view, a grid overview of document pages.
+
+#ifndef THUMBNAIL_VIEW_HPP
+#define THUMBNAIL_VIEW_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "document.hpp"
+#include "framebuffer.hpp"
+#include "multithreading.hpp"
+#include "ui_view.hpp"
+
+// Thumbnail view class. Displays a grid of page thumbnails on the framebuffer.
+// Thumbnails are rendered by a pool of low priority background threads,
+// starting with visible cells and spreading outward, and are kept in a small
+// cache between invocations.
+class ThumbnailView : public UIView {
+ public:
+  // Maximum number of thumbnails to keep in memory.
+  enum { MAX_NUM_THUMBNAILS = 256 };
+
+  // Constructs an instance of ThumbnailView for a document. Does not take
+  // ownership of the document or the framebuffer.
+  ThumbnailView(
+      Document* document, Framebuffer* framebuffer,
+      const std::string& status_file = "");
+  // Waits for thumbnails being rendered.
+  virtual ~ThumbnailView();
+  // Displays the thumbnail view with the given page selected, and enters the
+  // event loop. If the user selected a page to jump to, returns the page.
+  // Otherwise returns -1.
+  int Run(int page);
+  // Stops rendering thumbnails, waiting for the ones being rendered, and
+  // discards rendered thumbnails. They are rendered again on the next call to
+  // Run(). Must not be called while the view is displayed.
+  void ReleaseMemory();
+
+ protected:
+  // See UIView.
+  void Render() override;
+  // See UIView. Refreshes periodically while visible thumbnails are being
+  // rendered.
+  int GetRefreshIntervalMs() override;
+
+ private:
+  // Size of a grid cell in pixels, including the margin around the thumbnail.
+  // The margin of the selected cell is highlighted.
+  enum { CELL_WIDTH = 180, CELL_HEIGHT = 240, CELL_MARGIN = 6 };
+  // How often to refresh while visible thumbnails are being rendered, in
+  // milliseconds.
+  enum { REFRESH_INTERVAL_MS = 100 };
+
+  // The document.
+  Document* const _document;
+  // The framebuffer.
+  Framebuffer* const _framebuffer;
+
+  // Index of the selected page.
+  int _selected_page;
+  // The page the user chose to jump to, or -1.
+  int _chosen_page;
+  // Index of the first displayed row of the grid.
+  int _first_row;
+  // The value of _first_row when thumbnails were last scheduled, or -1.
+  int _scheduled_first_row;
+
+  // Lock on _thumbnails, _pages_in_progress and _focus_page.
+  std::mutex _mutex;
+  // Rendered thumbnails, keyed by page.
+  std::map<int, std::shared_ptr<PixelBuffer>> _thumbnails;
+  // Pages whose thumbnails are being rendered.
+  std::set<int> _pages_in_progress;
+  // The first visible page when thumbnails were last scheduled. When the
+  // cache is full, thumbnails farthest from this page are evicted first.
+  int _focus_page;
+  // Background threads rendering thumbnails. This is declared last so that it
+  // is destroyed first, while the state its jobs use is still valid.
+  WorkQueue _work_queue;
+
+  // Returns the number of columns and rows of cells that fit on screen.
+  int GetNumColumns() const;
+  int GetNumVisibleRows() const;
+  // Returns the screen rect of the cell at the given position in the visible
+  // part of the grid.
+  PixelBuffer::Rect GetCellRect(int row, int column) const;
+
+  // Scrolls the grid so that the selected page is visible, and if it has
+  // scrolled, cancels pending thumbnails and schedules thumbnails in order of
+  // distance from the visible cells.
+  void UpdateForSelectedPage();
+  // Renders the thumbnail of a page, unless it has been rendered already or is
+  // being rendered. Called by worker threads.
+  void RenderThumbnail(int page);
+  // Returns the thumbnail of a page, or nullptr if it has not been rendered.
+  std::shared_ptr<PixelBuffer> GetThumbnail(int page);
+
+  // Key processor.
+  void ProcessKey(int key);
+  // Key processing mode. There is only one.
+  enum KeyProcessingMode {
+    REGULAR_MODE,
+  };
+};
+
+#endif
@@ -68,9 +68,14 @@ void UIView::EventLoop(int initial_key_processing_mode) {
       }
     }
 
+    wtimeout(_window, GetRefreshIntervalMs());
+    const int key = wgetch(_window);
+    if (key == ERR) {
+      continue;
+    }
     const KeyProcessor& key_processor =
         _key_processing_mode_map.at(_key_processing_mode);
-    key_processor(wgetch(_window));
+    key_processor(key);
   } while (!_exit_event_loop);
 }
 
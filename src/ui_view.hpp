@@ -54,6 +54,11 @@ class UIView {
  protected:
   // Renders the current UI. This should be implemented by derived classes.
   virtual void Render() = 0;
+  // Returns how long the event loop should wait for a key before calling
+  // Render() again, in milliseconds, or -1 to wait indefinitely. Derived
+  // classes that display content loaded in the background can override this
+  // to refresh periodically until loading is done.
+  virtual int GetRefreshIntervalMs() { return -1; }
 
   // Starts the event loop. This will repeatedly call fetch the next keyboard
   // event, invoke ProcessKey(), and Render(). Will exit the loop when
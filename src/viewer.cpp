@@ -25,10 +25,13 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <limits>
 
 #include "document.hpp"
 #include "framebuffer.hpp"
+#include "pixel_buffer_pool.hpp"
 
 const float Viewer::MAX_ZOOM = 10.0f;
 const float Viewer::MIN_ZOOM = 0.1f;
@@ -71,6 +74,10 @@ class PixelBufferWriter : public Document::PixelWriter {
     }
     _buffer->WritePixel(x, y, r, g, b);
   }
+  // See PixelWriter.
+  bool IsGray() const override {
+    return _buffer->GetFormat() == PixelBuffer::GetGrayFormat();
+  }
 
  private:
   // The destination buffer.
@@ -83,75 +90,783 @@ class PixelBufferWriter : public Document::PixelWriter {
 
 Viewer::Viewer(
     Document* doc, Framebuffer* fb, const Viewer::State& state,
-    int render_cache_size)
+    int render_cache_size, RenderCostModel* render_cost_model,
+    WorkQueue* prefetch_queue)
     : _doc(doc),
       _fb(fb),
       _state(state),
-      _render_cache(this, render_cache_size) {
+      _render_cost_model(render_cost_model),
+      _disk_cache(nullptr),
+      _force_gray(false),
+      _render_cache(this, render_cache_size),
+      _own_prefetch_queue(
+          prefetch_queue == nullptr ? new WorkQueue(1, true) : nullptr),
+      _prefetch_queue(
+          prefetch_queue == nullptr ? _own_prefetch_queue.get()
+                                    : prefetch_queue),
+      _prefetch_planner(state.Page, state.YOffset),
+      _num_frames(0),
+      _last_drawn_frame(0),
+      _exit_drawing(false),
+      _drawing_paused(false) {
   assert(_doc != nullptr);
   assert(_fb != nullptr);
+  _draw_thread = std::thread(&Viewer::Draw, this);
 }
 
-Viewer::~Viewer() {}
+Viewer::~Viewer() {
+  // The draw thread may be waiting for a page to render. It does not draw
+  // anything once it is done.
+  {
+    std::unique_lock<std::mutex> lock(_draw_mutex);
+    _exit_drawing = true;
+    _drawing_paused = true;
+    _draw_condition.notify_all();
+  }
+  _draw_thread.join();
+  // Prefetch jobs refer to this viewer, and may outlive it in a shared queue.
+  _prefetch_queue->Cancel(this);
+  _prefetch_queue->Wait(this);
+}
 
 void Viewer::Render() {
-  // 1. Process state.
-  int page = std::max(0, std::min(_doc->GetNumPages() - 1, _state.Page));
-  float zoom = _state.Zoom;
-  if (zoom == ZOOM_TO_WIDTH) {
-    zoom = static_cast<float>(_fb->GetSize().Width) /
-           static_cast<float>(
-               _doc->GetPageSize(page, 1.0f, _state.Rotation).Width);
-  } else if (zoom == ZOOM_TO_FIT) {
-    const PixelBuffer::Size& screen_size = _fb->GetSize();
-    const Document::PageSize& page_size =
-        _doc->GetPageSize(page, 1.0f, _state.Rotation);
-    zoom = std::min(
-        static_cast<float>(screen_size.Width) /
-            static_cast<float>(page_size.Width),
-        static_cast<float>(screen_size.Height) /
-            static_cast<float>(page_size.Height));
+  // 1. Lay out visible pages, and correct the state.
+  std::vector<PageView> views;
+  LayOutPages(&views);
+
+  // 2. Hand them to the draw thread, replacing a frame it has not started
+  // drawing yet.
+  std::unique_ptr<Frame> frame = PrepareFrame(views);
+  frame->Id = ++_num_frames;
+  _drawing_paused = false;
+  _frames.Post(std::move(frame));
+  {
+    // Locking makes sure the draw thread is either waiting, or checks the
+    // mailbox after the frame has been posted.
+    std::unique_lock<std::mutex> lock(_draw_mutex);
+    _draw_condition.notify_one();
   }
-  assert(zoom >= 0.0f);
-  zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, zoom));
-
-  // 2. Render page to buffer.
-  PixelBuffer* buffer = _render_cache.Get(
-      RenderCacheKey(page, zoom, _state.Rotation, _state.ColorMode));
-
-  // 3. Compute the area actually visible on screen.
-  const PixelBuffer::Size &screen_size = _fb->GetSize(),
-                          &page_size = buffer->GetSize();
-  PixelBuffer::Rect src_rect;
-  src_rect.X = std::max(
-      0, std::min(page_size.Width - screen_size.Width - 1, _state.XOffset));
-  src_rect.Y = std::max(
-      0, std::min(page_size.Height - screen_size.Height - 1, _state.YOffset));
-  src_rect.Width = std::min(screen_size.Width, page_size.Width - src_rect.X);
-  src_rect.Height = std::min(screen_size.Height, page_size.Height - src_rect.Y);
-
-  // 4. Blit visible area to framebuffer.
-  _fb->Render(*buffer, src_rect);
-
-  // 5. Store corrected state.
-  _state.Page = page;
+
+  // 3. Prefetch pages around the view and link targets. Pending prefetches are
+  // replanned every time, so that predictions made before a change of
+  // direction or settings are dropped. While exact renders of visible pages
+  // are pending, leave the document to them.
+  _prefetch_planner.Record(
+      _state.Layout == SPREAD ? GetSpread(_state.Page) : _state.Page,
+      _state.YOffset, PrefetchPlanner::Clock::now());
+  _prefetch_queue->Cancel(this);
+  _visible_keys.clear();
+  for (const PageView& view : views) {
+    _visible_keys.push_back(view.Key);
+  }
+  if (_pending_render_keys.empty() && !views.empty()) {
+    Prefetch(views);
+  }
+}
+
+void Viewer::LayOut(State* state) {
+  SetState(*state);
+  std::vector<PageView> views;
+  LayOutPages(&views);
+  GetState(state);
+}
+
+void Viewer::LayOutPages(std::vector<PageView>* views) {
+  // 1. Lay out visible pages. This stores the position.
+  const int page =
+      std::max(0, std::min(_doc->GetNumPages() - 1, _state.Page));
+  switch (_state.Layout) {
+    case CONTINUOUS:
+      LayOutContinuous(page, views);
+      break;
+    case SPREAD:
+      LayOutSpread(page, views);
+      break;
+    default:
+      LayOutSinglePage(page, views);
+      break;
+  }
+
+  // 2. Store the rest of the corrected state.
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
   _state.NumPages = _doc->GetNumPages();
   if ((_state.Zoom != ZOOM_TO_WIDTH) && (_state.Zoom != ZOOM_TO_FIT)) {
-    _state.Zoom = zoom;
+    _state.Zoom = _state.ActualZoom;
   }
-  _state.ActualZoom = zoom;
+  _state.ScreenWidth = screen_size.Width;
+  _state.ScreenHeight = screen_size.Height;
+}
+
+bool Viewer::IsRenderPending() {
+  std::shared_ptr<PixelBuffer> buffer;
+  for (const RenderCacheKey& key : _pending_render_keys) {
+    if (!_render_cache.TryGet(key, &buffer)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Viewer::IsDrawPending() {
+  std::unique_lock<std::mutex> lock(_draw_mutex);
+  return _last_drawn_frame < _num_frames;
+}
+
+void Viewer::PauseDrawing() {
+  _drawing_paused = true;
+  // Wait for a frame being drawn to finish.
+  std::unique_lock<std::mutex> lock(_present_mutex);
+}
+
+void Viewer::LayOutSinglePage(int page, std::vector<PageView>* views) {
+  const RenderCacheKey key(
+      page, GetZoom(page), _state.Rotation, _state.ColorMode);
+  const PixelBuffer::Size& page_size = GetPageSize(key);
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
+  const PixelBuffer::Rect& src_rect =
+      GetVisibleRect(page_size, _state.XOffset, _state.YOffset);
+  views->emplace_back(
+      key, page_size, src_rect,
+      PixelBuffer::Rect(0, 0, screen_size.Width, screen_size.Height));
+
+  _state.Page = page;
+  _state.ActualZoom = key.Zoom;
   _state.XOffset = src_rect.X;
   _state.YOffset = src_rect.Y;
   _state.PageWidth = page_size.Width;
   _state.PageHeight = page_size.Height;
-  _state.ScreenWidth = screen_size.Width;
-  _state.ScreenHeight = screen_size.Height;
+}
+
+void Viewer::LayOutContinuous(int page, std::vector<PageView>* views) {
+  const int num_pages = _doc->GetNumPages();
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
+  const int gap = std::max(0, _state.PageGap);
+  auto get_key = [this](int page) {
+    return RenderCacheKey(
+        page, GetZoom(page), _state.Rotation, _state.ColorMode);
+  };
+  // Height of a page plus the gap below it.
+  auto get_extent = [&](int page) {
+    return GetPageSize(get_key(page)).Height + gap;
+  };
+
+  // 1. Find the page at the top of the view.
+  int y_offset = _state.YOffset;
+  while ((y_offset < 0) && (page > 0)) {
+    y_offset += get_extent(--page);
+  }
+  while ((page < num_pages - 1) && (y_offset >= get_extent(page))) {
+    y_offset -= get_extent(page++);
+  }
+
+  // 2. Do not scroll past the bottom of the last page.
+  int remaining_height = -y_offset;
+  for (int i = page; (i < num_pages) && (remaining_height < screen_size.Height);
+       ++i) {
+    remaining_height += get_extent(i) - (i == num_pages - 1 ? gap : 0);
+  }
+  if (remaining_height < screen_size.Height) {
+    y_offset -= screen_size.Height - remaining_height;
+    while ((y_offset < 0) && (page > 0)) {
+      y_offset += get_extent(--page);
+    }
+  }
+  y_offset = std::max(0, y_offset);
+
+  // 3. Collect visible pages. The horizontal offset is shared, and bounded by
+  // the widest of them.
+  std::vector<std::pair<RenderCacheKey, PixelBuffer::Size>> pages;
+  int max_page_width = 0;
+  for (int i = page, top = -y_offset;
+       (i < num_pages) && (top < screen_size.Height); ++i) {
+    const RenderCacheKey& key = get_key(i);
+    const PixelBuffer::Size& page_size = GetPageSize(key);
+    pages.emplace_back(key, page_size);
+    max_page_width = std::max(max_page_width, page_size.Width);
+    top += page_size.Height + gap;
+  }
+  const int x_offset = std::max(
+      0, std::min(max_page_width - screen_size.Width, _state.XOffset));
+
+  // 4. Compute the area of each page visible on screen, and where it goes.
+  int top = -y_offset;
+  for (const auto& entry : pages) {
+    const PixelBuffer::Size& page_size = entry.second;
+    PixelBuffer::Rect src_rect;
+    src_rect.X =
+        std::max(0, std::min(page_size.Width - screen_size.Width, x_offset));
+    src_rect.Y = std::max(0, -top);
+    src_rect.Width = std::min(screen_size.Width, page_size.Width - src_rect.X);
+    src_rect.Height =
+        std::min(page_size.Height, screen_size.Height - top) - src_rect.Y;
+    if (src_rect.Height > 0) {
+      views->emplace_back(
+          entry.first, page_size, src_rect,
+          PixelBuffer::Rect(
+              0, top + src_rect.Y, screen_size.Width, src_rect.Height));
+    }
+    top += page_size.Height + gap;
+  }
+
+  const PixelBuffer::Size& page_size = pages.front().second;
+  _state.Page = page;
+  _state.ActualZoom = pages.front().first.Zoom;
+  _state.XOffset = x_offset;
+  _state.YOffset = y_offset;
+  _state.PageWidth = page_size.Width;
+  _state.PageHeight = page_size.Height;
+}
+
+void Viewer::LayOutSpread(int page, std::vector<PageView>* views) {
+  // 1. Compute the size of the spread. Pages are vertically centered.
+  int first_page, num_pages;
+  GetSpreadPages(page, &first_page, &num_pages);
+  const float zoom = GetZoom(first_page);
+  const int gap = num_pages > 1 ? std::max(0, _state.PageGap) : 0;
+  std::vector<RenderCacheKey> keys;
+  std::vector<PixelBuffer::Size> page_sizes;
+  PixelBuffer::Size spread_size(gap, 0);
+  for (int i = first_page; i < first_page + num_pages; ++i) {
+    keys.emplace_back(i, zoom, _state.Rotation, _state.ColorMode);
+    page_sizes.push_back(GetPageSize(keys.back()));
+    spread_size.Width += page_sizes.back().Width;
+    spread_size.Height = std::max(spread_size.Height, page_sizes.back().Height);
+  }
+
+  // 2. Compute the area of the spread visible on screen, and where the spread
+  // goes. It is centered if smaller than the screen.
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
+  const PixelBuffer::Rect& spread_rect =
+      GetVisibleRect(spread_size, _state.XOffset, _state.YOffset);
+  const int spread_x =
+      (screen_size.Width - spread_rect.Width) / 2 - spread_rect.X;
+  const int spread_y =
+      (screen_size.Height - spread_rect.Height) / 2 - spread_rect.Y;
+
+  // 3. Compute the area of each page visible on screen.
+  for (int i = 0, page_x = spread_x; i < num_pages; ++i) {
+    const PixelBuffer::Size& page_size = page_sizes[i];
+    const int page_y =
+        spread_y + (spread_size.Height - page_size.Height) / 2;
+    PixelBuffer::Rect dest_rect;
+    dest_rect.X = std::max(0, page_x);
+    dest_rect.Y = std::max(0, page_y);
+    dest_rect.Width =
+        std::min(screen_size.Width, page_x + page_size.Width) - dest_rect.X;
+    dest_rect.Height =
+        std::min(screen_size.Height, page_y + page_size.Height) - dest_rect.Y;
+    if ((dest_rect.Width > 0) && (dest_rect.Height > 0)) {
+      views->emplace_back(
+          keys[i], page_size,
+          PixelBuffer::Rect(
+              dest_rect.X - page_x, dest_rect.Y - page_y, dest_rect.Width,
+              dest_rect.Height),
+          dest_rect);
+    }
+    page_x += page_size.Width + gap;
+  }
+
+  _state.Page = first_page;
+  _state.ActualZoom = zoom;
+  _state.XOffset = spread_rect.X;
+  _state.YOffset = spread_rect.Y;
+  _state.PageWidth = spread_size.Width;
+  _state.PageHeight = spread_size.Height;
+}
+
+PixelBuffer::Rect Viewer::GetVisibleRect(
+    const PixelBuffer::Size& page_size, int x_offset, int y_offset) const {
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
+  PixelBuffer::Rect rect;
+  rect.X = std::max(
+      0, std::min(page_size.Width - screen_size.Width - 1, x_offset));
+  rect.Y = std::max(
+      0, std::min(page_size.Height - screen_size.Height - 1, y_offset));
+  rect.Width = std::min(screen_size.Width, page_size.Width - rect.X);
+  rect.Height = std::min(screen_size.Height, page_size.Height - rect.Y);
+  return rect;
+}
+
+int Viewer::GetSpread(int page) { return (page + 1) / 2; }
+
+int Viewer::GetSpreadStart(int spread) {
+  return spread > 0 ? spread * 2 - 1 : 0;
+}
+
+void Viewer::GetSpreadPages(int page, int* first_page, int* num_pages) {
+  *first_page = GetSpreadStart(GetSpread(page));
+  *num_pages = *first_page == 0
+                   ? 1
+                   : std::min(2, _doc->GetNumPages() - *first_page);
+}
+
+std::unique_ptr<Viewer::Frame> Viewer::PrepareFrame(
+    const std::vector<PageView>& views) {
+  std::unique_ptr<Frame> frame(new Frame());
+  frame->Views = views;
+  frame->Buffers.resize(views.size());
+  frame->PreviewSources.resize(views.size());
+  frame->PreviewQuarterTurns.resize(views.size());
+  _pending_render_keys.clear();
+  for (size_t i = 0; i < views.size(); ++i) {
+    const PageView& view = views[i];
+    float preview_source_zoom;
+    int quarter_turns;
+    if (_render_cache.TryGet(view.Key, &frame->Buffers[i])) {
+      continue;
+    }
+    if (!FindRotationSource(view.Key, &quarter_turns)) {
+      frame->PreviewSources[i] = FindPreviewSource(
+          view.Key, &preview_source_zoom, &frame->PreviewQuarterTurns[i]);
+    }
+    _render_cache.Prepare(view.Key);
+    if (frame->PreviewSources[i]) {
+      _pending_render_keys.push_back(view.Key);
+    }
+  }
+  return frame;
+}
+
+void Viewer::Draw() {
+  for (;;) {
+    // 1. Wait for a frame.
+    std::unique_ptr<Frame> frame;
+    {
+      std::unique_lock<std::mutex> lock(_draw_mutex);
+      _draw_condition.wait(
+          lock, [this] { return _exit_drawing || !_frames.IsEmpty(); });
+      if (_exit_drawing) {
+        return;
+      }
+      frame = _frames.Take();
+    }
+
+    // 2. Draw it.
+    DrawFrame(*frame);
+    {
+      std::unique_lock<std::mutex> lock(_draw_mutex);
+      _last_drawn_frame = frame->Id;
+    }
+  }
+}
+
+void Viewer::DrawFrame(const Frame& frame) {
+  // 1. Resample the visible areas of previews, and wait for pages being
+  // rendered now. They render concurrently.
+  const std::vector<PageView>& views = frame.Views;
+  std::vector<std::shared_ptr<PixelBuffer>> buffers = frame.Buffers;
+  std::vector<PixelBuffer::Rect> src_rects;
+  for (size_t i = 0; i < views.size(); ++i) {
+    const PageView& view = views[i];
+    if (frame.PreviewSources[i]) {
+      std::shared_ptr<PixelBuffer> preview_source = frame.PreviewSources[i];
+      const int quarter_turns = frame.PreviewQuarterTurns[i];
+      if (quarter_turns) {
+        const PixelBuffer::Size& source_size = preview_source->GetSize();
+        std::shared_ptr<PixelBuffer> rotated =
+            PixelBufferPool::Get()->NewPixelBuffer(
+                quarter_turns % 2
+                    ? PixelBuffer::Size(source_size.Height, source_size.Width)
+                    : source_size,
+                preview_source->GetFormat());
+        preview_source->Rotate(quarter_turns, rotated.get());
+        preview_source = rotated;
+      }
+      buffers[i] = PixelBufferPool::Get()->NewPixelBuffer(
+          PixelBuffer::Size(view.SrcRect.Width, view.SrcRect.Height),
+          preview_source->GetFormat());
+      preview_source->Resample(view.PageSize, view.SrcRect, buffers[i].get());
+      src_rects.push_back(buffers[i]->GetRect());
+      continue;
+    }
+    // Wait for the render, but drop the frame as soon as a newer one has been
+    // laid out, rather than keep the newer one waiting for a page the user
+    // has moved past.
+    while (!buffers[i] &&
+           !_render_cache.GetFor(view.Key, &buffers[i], DRAW_POLL_MS)) {
+      if (!_frames.IsEmpty()) {
+        return;
+      }
+    }
+    // The layout may have used an estimated page size.
+    const PixelBuffer::Size& buffer_size = buffers[i]->GetSize();
+    PixelBuffer::Rect src_rect = views[i].SrcRect;
+    src_rect.X = std::min(src_rect.X, buffer_size.Width);
+    src_rect.Y = std::min(src_rect.Y, buffer_size.Height);
+    src_rect.Width = std::min(src_rect.Width, buffer_size.Width - src_rect.X);
+    src_rect.Height =
+        std::min(src_rect.Height, buffer_size.Height - src_rect.Y);
+    src_rects.push_back(src_rect);
+  }
+
+  // 2. If a newer frame has been laid out in the meantime, drop this one, so
+  // that the screen never goes back to a page the user has moved past.
+  if (!_frames.IsEmpty()) {
+    return;
+  }
+
+  // 3. Blit visible areas to framebuffer.
+  std::unique_lock<std::mutex> lock(_present_mutex);
+  if (_drawing_paused) {
+    return;
+  }
+  for (size_t i = 0; i < views.size(); ++i) {
+    _fb->Render(*buffers[i], src_rects[i], views[i].DestRect);
+  }
+  for (const PixelBuffer::Rect& rect : GetUncoveredRects(views)) {
+    _fb->Clear(rect);
+  }
+}
+
+std::vector<PixelBuffer::Rect> Viewer::GetUncoveredRects(
+    const std::vector<PageView>& views) const {
+  // Split the screen into horizontal bands at the top and bottom edges of
+  // views, and find the uncovered spans within each band.
+  const PixelBuffer::Size& screen_size = _fb->GetSize();
+  std::vector<int> edges = {0, screen_size.Height};
+  for (const PageView& view : views) {
+    edges.push_back(view.DestRect.Y);
+    edges.push_back(view.DestRect.Y + view.DestRect.Height);
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  std::vector<PixelBuffer::Rect> rects;
+  for (size_t i = 0; i + 1 < edges.size(); ++i) {
+    const int top = edges[i], bottom = edges[i + 1];
+    std::vector<std::pair<int, int>> spans;
+    for (const PageView& view : views) {
+      const PixelBuffer::Rect& r = view.DestRect;
+      if ((r.Y < bottom) && (r.Y + r.Height > top)) {
+        spans.emplace_back(r.X, r.X + r.Width);
+      }
+    }
+    std::sort(spans.begin(), spans.end());
+    int x = 0;
+    for (const auto& span : spans) {
+      if (span.first > x) {
+        rects.emplace_back(x, top, span.first - x, bottom - top);
+      }
+      x = std::max(x, span.second);
+    }
+    if (x < screen_size.Width) {
+      rects.emplace_back(x, top, screen_size.Width - x, bottom - top);
+    }
+  }
+  return rects;
+}
+
+void Viewer::Prefetch(const std::vector<PageView>& views) {
+  // 1. Plan how many pages or spreads to prefetch, counting those that will
+  // only be warmed.
+  const int pages_per_unit = _state.Layout == SPREAD ? 2 : 1;
+  const int budget = (_render_cache.GetSize() - 1 -
+                      static_cast<int>(views.size()) + NUM_WARMED_PAGES) /
+                     pages_per_unit;
+  const PrefetchPlanner::Clock::time_point now = PrefetchPlanner::Clock::now();
+  int num_ahead, num_behind;
+  _prefetch_planner.Plan(budget, now, &num_ahead, &num_behind);
+
+  // 2. List them from nearest to farthest, alternating between ahead and
+  // behind. Ahead, skip pages that will render in time even if started on a
+  // later move, and look further for expensive pages instead.
+  const int direction = _prefetch_planner.IsMovingBackward() ? -1 : 1;
+  const int first = _state.Layout == SPREAD ? GetSpread(_state.Page)
+                                            : views.front().Key.Page;
+  const int last = _state.Layout == SPREAD ? first : views.back().Key.Page;
+  const int ahead = direction > 0 ? last : first;
+  const int behind = direction > 0 ? first : last;
+  std::vector<RenderCacheKey> keys;
+  int num_listed_ahead = 0;
+  for (int i = 1; ((num_listed_ahead < num_ahead) &&
+                   (i <= MAX_PREFETCH_DISTANCE)) ||
+                  (i <= num_behind);
+       ++i) {
+    if ((num_listed_ahead < num_ahead) && (i <= MAX_PREFETCH_DISTANCE)) {
+      std::vector<RenderCacheKey> unit_keys;
+      AddPrefetchKeys(ahead + direction * i, views, &unit_keys);
+      if (!unit_keys.empty() &&
+          _prefetch_planner.ShouldPrefetch(
+              i, PredictRenderCost(unit_keys), now)) {
+        keys.insert(keys.end(), unit_keys.begin(), unit_keys.end());
+        ++num_listed_ahead;
+      }
+    }
+    if (i <= num_behind) {
+      AddPrefetchKeys(behind - direction * i, views, &keys);
+    }
+  }
+
+  // 3. Follow with link targets, which are less likely to be visited.
+  for (const PageView& view : views) {
+    for (int page : GetLinkedPages(view.Key.Page)) {
+      AddPrefetchKeys(
+          _state.Layout == SPREAD ? GetSpread(page) : page, views, &keys);
+    }
+  }
+
+  EnqueuePrefetchKeys(keys, views.size());
+}
+
+float Viewer::PredictRenderCost(const std::vector<RenderCacheKey>& keys) {
+  if (_render_cost_model == nullptr) {
+    return std::numeric_limits<float>::infinity();
+  }
+  float render_ms = 0.0f;
+  for (const RenderCacheKey& key : keys) {
+    const PixelBuffer::Size& size = GetPageSize(key);
+    render_ms +=
+        _render_cost_model->Predict(key.Page, size.Width, size.Height);
+  }
+  return render_ms;
+}
+
+void Viewer::Warm(const std::vector<int>& pages) {
+  _prefetch_queue->Cancel(this);
+  std::vector<RenderCacheKey> keys;
+  for (int page : pages) {
+    AddPrefetchKeys(
+        _state.Layout == SPREAD ? GetSpread(page) : page,
+        std::vector<PageView>(), &keys);
+  }
+  EnqueuePrefetchKeys(keys, _visible_keys.size());
+}
+
+void Viewer::PinMark(int mark) {
+  // 1. Pin the new keys before unpinning the old ones, so that keys in both
+  // are not evicted in between.
+  for (const RenderCacheKey& key : _visible_keys) {
+    _render_cache.Pin(key);
+  }
+  UnpinMark(mark);
+  _pinned_keys[mark] = _visible_keys;
+  _pinned_marks.push_back(mark);
+
+  // 2. Enforce the limit, keeping at least the new mark.
+  int num_pinned_pages = 0;
+  for (const auto& entry : _pinned_keys) {
+    num_pinned_pages += entry.second.size();
+  }
+  while ((num_pinned_pages > MAX_NUM_PINNED_PAGES) &&
+         (_pinned_marks.size() > 1)) {
+    const int oldest_mark = _pinned_marks.front();
+    num_pinned_pages -= _pinned_keys[oldest_mark].size();
+    UnpinMark(oldest_mark);
+  }
+}
+
+void Viewer::UnpinMark(int mark) {
+  auto i = _pinned_keys.find(mark);
+  if (i == _pinned_keys.end()) {
+    return;
+  }
+  for (const RenderCacheKey& key : i->second) {
+    _render_cache.Unpin(key);
+  }
+  _pinned_keys.erase(i);
+  _pinned_marks.erase(
+      std::find(_pinned_marks.begin(), _pinned_marks.end(), mark));
+}
+
+void Viewer::SetRenderCacheSize(int render_cache_size) {
+  _render_cache.Resize(render_cache_size);
+}
+
+int Viewer::GetNumPinnedPages() const {
+  int num_pinned_pages = _slide_keys.size();
+  for (const auto& entry : _pinned_keys) {
+    num_pinned_pages += entry.second.size();
+  }
+  return num_pinned_pages;
+}
+
+void Viewer::SetDiskCache(
+    DiskCache* disk_cache, const std::string& document_id) {
+  _disk_cache = disk_cache;
+  _disk_cache_key_prefix = document_id + "-" + _fb->GetFormatId();
+  _doc->SetDiskCache(disk_cache, document_id);
+}
+
+void Viewer::SetForceGray(bool force_gray) { _force_gray = force_gray; }
+
+bool Viewer::IsGrayPage(const RenderCacheKey& key) {
+  if ((key.ColorMode == SEPIA) || (_fb->GetFormat()->GetDepth() == 1)) {
+    return false;
+  }
+  return _force_gray || _doc->IsGray(key.Page);
+}
+
+void Viewer::CancelPrefetch() { _prefetch_queue->Cancel(this); }
+
+void Viewer::Suspend(int render_cache_size) {
+  PauseDrawing();
+  CancelPrefetch();
+  _render_cache.Resize(render_cache_size);
+  _doc->ReleaseMemory();
+  PixelBufferPool::Get()->Trim();
+  // Pages warmed so far are cold again. _warmed_keys belongs to the prefetch
+  // worker, which is idle now that its jobs have been cancelled.
+  _prefetch_queue->Enqueue([this] { _warmed_keys.clear(); }, this);
+}
+
+void Viewer::PrepareSlide(int page) {
+  const std::vector<RenderCacheKey> keys = GetSlideKeys(page);
+  // As in PinMark(), pin the new keys before unpinning the old ones.
+  for (const RenderCacheKey& key : keys) {
+    _render_cache.Pin(key);
+    _render_cache.Prepare(key);
+  }
+  for (const RenderCacheKey& key : _slide_keys) {
+    _render_cache.Unpin(key);
+  }
+  _slide_keys = keys;
+}
+
+bool Viewer::IsSlideReady(int page) {
+  const std::vector<RenderCacheKey> keys = GetSlideKeys(page);
+  std::shared_ptr<PixelBuffer> buffer;
+  return std::all_of(keys.begin(), keys.end(), [&](const RenderCacheKey& key) {
+    return _render_cache.Peek(key, &buffer);
+  });
+}
+
+std::vector<Viewer::RenderCacheKey> Viewer::GetSlideKeys(int page) {
+  std::vector<RenderCacheKey> keys;
+  AddPrefetchKeys(
+      _state.Layout == SPREAD ? GetSpread(page) : page,
+      std::vector<PageView>(), &keys);
+  return keys;
+}
+
+void Viewer::EnqueuePrefetchKeys(
+    const std::vector<RenderCacheKey>& keys, int num_visible_pages) {
+  // The render cache evicts when it reaches its size, so it holds one entry
+  // fewer. Keys are fetched in the worker thread rather than with Prepare(),
+  // so that they are rendered at its low priority. The nearest keys, about
+  // a screenful, are likely to be shown next, so they go ahead of the jobs of
+  // other viewers sharing the queue.
+  const int budget = _render_cache.GetSize() - 1 - num_visible_pages;
+  const int num_keys = std::min(
+      budget + NUM_WARMED_PAGES, static_cast<int>(keys.size()));
+  for (int i = 0; i < num_keys; ++i) {
+    const RenderCacheKey key = keys[i];
+    if (i < budget) {
+      _prefetch_queue->Enqueue(
+          [this, key] { _render_cache.Fetch(key); }, this,
+          i < num_visible_pages ? WorkQueue::IMMINENT : WorkQueue::PREFETCH);
+    } else {
+      _prefetch_queue->Enqueue(
+          [this, key] { WarmPage(key); }, this, WorkQueue::INDEXING);
+    }
+  }
+}
+
+void Viewer::WarmPage(const RenderCacheKey& key) {
+  // _warmed_keys is only accessed by the prefetch worker.
+  auto equals_key = [&](const RenderCacheKey& other) {
+    return !(other < key) && !(key < other);
+  };
+  if (std::any_of(_warmed_keys.begin(), _warmed_keys.end(), equals_key)) {
+    return;
+  }
+  _warmed_keys.push_back(key);
+  if (_warmed_keys.size() > WARMED_HISTORY_SIZE) {
+    _warmed_keys.pop_front();
+  }
+  _doc->Warm(key.Page, key.Zoom, key.Rotation);
+}
+
+const std::vector<int>& Viewer::GetLinkedPages(int page) {
+  auto i = _linked_pages.find(page);
+  if (i == _linked_pages.end()) {
+    i = _linked_pages.emplace(page, _doc->GetLinkedPages(page)).first;
+  }
+  return i->second;
+}
+
+void Viewer::AddPrefetchKeys(
+    int page_or_spread, const std::vector<PageView>& views,
+    std::vector<RenderCacheKey>* keys) {
+  int first_page = page_or_spread, num_pages = 1;
+  if (_state.Layout == SPREAD) {
+    if (page_or_spread < 0) {
+      return;
+    }
+    first_page = GetSpreadStart(page_or_spread);
+  }
+  if ((first_page < 0) || (first_page >= _doc->GetNumPages())) {
+    return;
+  }
+  if (_state.Layout == SPREAD) {
+    GetSpreadPages(first_page, &first_page, &num_pages);
+  }
+  for (int page = first_page; page < first_page + num_pages; ++page) {
+    const RenderCacheKey key(
+        page, GetZoom(page), _state.Rotation, _state.ColorMode);
+    auto equals_key = [&](const RenderCacheKey& other) {
+      return !(other < key) && !(key < other);
+    };
+    if (std::none_of(
+            views.begin(), views.end(),
+            [&](const PageView& view) { return equals_key(view.Key); }) &&
+        std::none_of(keys->begin(), keys->end(), equals_key)) {
+      keys->push_back(key);
+    }
+  }
+}
+
+float Viewer::GetZoom(int page) {
+  float zoom = _state.Zoom;
+  if ((zoom == ZOOM_TO_WIDTH) || (zoom == ZOOM_TO_FIT)) {
+    // In spread layout, fit the whole spread.
+    int first_page = page, num_pages = 1;
+    if (_state.Layout == SPREAD) {
+      GetSpreadPages(page, &first_page, &num_pages);
+    }
+    const PixelBuffer::Size& screen_size = _fb->GetSize();
+    PixelBuffer::Size unit_size(0, 0);
+    for (int i = first_page; i < first_page + num_pages; ++i) {
+      const Document::PageSize& page_size =
+          GetUnitPageSize(i, _state.Rotation);
+      unit_size.Width += page_size.Width;
+      unit_size.Height = std::max(unit_size.Height, page_size.Height);
+    }
+    const int gap = num_pages > 1 ? std::max(0, _state.PageGap) : 0;
+    zoom = static_cast<float>(std::max(1, screen_size.Width - gap)) /
+           static_cast<float>(unit_size.Width);
+    if (_state.Zoom == ZOOM_TO_FIT) {
+      zoom = std::min(
+          zoom, static_cast<float>(screen_size.Height) /
+                    static_cast<float>(unit_size.Height));
+    }
+  } else {
+    zoom = QuantizeZoom(zoom);
+  }
+  assert(zoom >= 0.0f);
+  return std::max(MIN_ZOOM, std::min(MAX_ZOOM, zoom));
+}
 
-  // 6. Preload.
-  if ((_render_cache.GetSize() > 1) && (page < _doc->GetNumPages() - 1)) {
-    _render_cache.Prepare(
-        RenderCacheKey(page + 1, zoom, _state.Rotation, _state.ColorMode));
+PixelBuffer::Size Viewer::GetPageSize(const RenderCacheKey& key) {
+  std::shared_ptr<PixelBuffer> buffer;
+  if (_render_cache.Peek(key, &buffer)) {
+    return buffer->GetSize();
   }
+  const Document::PageSize& unit_size =
+      GetUnitPageSize(key.Page, key.Rotation);
+  return PixelBuffer::Size(
+      std::max(1, static_cast<int>(std::lround(unit_size.Width * key.Zoom))),
+      std::max(1, static_cast<int>(std::lround(unit_size.Height * key.Zoom))));
+}
+
+const Document::PageSize& Viewer::GetUnitPageSize(int page, int rotation) {
+  const std::pair<int, int> unit_key(page, NormalizeRotation(rotation));
+  auto i = _unit_page_sizes.find(unit_key);
+  if (i == _unit_page_sizes.end()) {
+    i = _unit_page_sizes
+            .emplace(unit_key, _doc->GetPageSize(page, 1.0f, unit_key.second))
+            .first;
+  }
+  return i->second;
 }
 
 void Viewer::GetState(Viewer::State* state) const {
@@ -167,22 +882,83 @@ void Viewer::GetState(Viewer::State* state) const {
   state->ScreenWidth = _state.ScreenWidth;
   state->ScreenHeight = _state.ScreenHeight;
   state->ColorMode = _state.ColorMode;
+  state->Layout = _state.Layout;
+  state->PageGap = _state.PageGap;
 }
 
 void Viewer::SetState(const State& state) { _state = state; }
 
+std::shared_ptr<PixelBuffer> Viewer::FindPreviewSource(
+    const Viewer::RenderCacheKey& key, float* zoom, int* quarter_turns) {
+  const int zoom_step = GetZoomStep(key.Zoom);
+  std::shared_ptr<PixelBuffer> best_buffer;
+  int best_distance = 0;
+  for (const auto& entry : _render_cache.GetEntries()) {
+    const RenderCacheKey& other = entry.first;
+    const int rotation_delta =
+        NormalizeRotation(key.Rotation - other.Rotation);
+    if ((other.Page != key.Page) || (rotation_delta % 90 != 0) ||
+        (other.ColorMode != key.ColorMode)) {
+      continue;
+    }
+    // Prefer the same rotation, then the nearest zoom ratio, and on a tie the
+    // larger one, as downsampling looks better than upsampling.
+    const int distance = (rotation_delta ? 1 << 16 : 0) +
+                         2 * std::abs(GetZoomStep(other.Zoom) - zoom_step) -
+                         (other.Zoom > key.Zoom ? 1 : 0);
+    if (!best_buffer || distance < best_distance) {
+      best_buffer = entry.second;
+      best_distance = distance;
+      *zoom = other.Zoom;
+      *quarter_turns = rotation_delta / 90;
+    }
+  }
+  return best_buffer;
+}
+
+std::shared_ptr<PixelBuffer> Viewer::FindRotationSource(
+    const Viewer::RenderCacheKey& key, int* quarter_turns) {
+  const int zoom_step = GetZoomStep(key.Zoom);
+  for (const auto& entry : _render_cache.GetEntries()) {
+    const RenderCacheKey& other = entry.first;
+    const int rotation_delta =
+        NormalizeRotation(key.Rotation - other.Rotation);
+    if ((other.Page == key.Page) && (GetZoomStep(other.Zoom) == zoom_step) &&
+        (other.ColorMode == key.ColorMode) && (rotation_delta % 90 == 0)) {
+      *quarter_turns = rotation_delta / 90;
+      return entry.second;
+    }
+  }
+  return nullptr;
+}
+
+int Viewer::NormalizeRotation(int rotation) {
+  return ((rotation % 360) + 360) % 360;
+}
+
+float Viewer::QuantizeZoom(float zoom) {
+  return std::exp2(
+      static_cast<float>(GetZoomStep(zoom)) / ZOOM_STEPS_PER_OCTAVE);
+}
+
+int Viewer::GetZoomStep(float zoom) {
+  return static_cast<int>(std::lround(std::log2(zoom) * ZOOM_STEPS_PER_OCTAVE));
+}
+
 bool Viewer::RenderCacheKey::operator<(
     const Viewer::RenderCacheKey& other) const {
   if (Page != other.Page) {
     return Page < other.Page;
   }
-  const int rotation_mod = Rotation % 360,
-            other_rotation_mod = other.Rotation % 360;
+  const int rotation_mod = NormalizeRotation(Rotation),
+            other_rotation_mod = NormalizeRotation(other.Rotation);
   if (rotation_mod != other_rotation_mod) {
     return rotation_mod < other_rotation_mod;
   }
-  if (fabs(Zoom / other.Zoom - 1.0f) >= 0.1f) {
-    return Zoom < other.Zoom;
+  const int zoom_step = GetZoomStep(Zoom),
+            other_zoom_step = GetZoomStep(other.Zoom);
+  if (zoom_step != other_zoom_step) {
+    return zoom_step < other_zoom_step;
   }
   if (ColorMode != other.ColorMode) {
     return ColorMode < other.ColorMode;
@@ -191,23 +967,165 @@ bool Viewer::RenderCacheKey::operator<(
 }
 
 Viewer::RenderCache::RenderCache(Viewer* parent, int size)
-    : Cache<RenderCacheKey, PixelBuffer*>(size), _parent(parent) {}
+    : Cache<RenderCacheKey, std::shared_ptr<PixelBuffer>>(size),
+      _parent(parent),
+      _closing(false) {}
 
-Viewer::RenderCache::~RenderCache() { Clear(); }
+Viewer::RenderCache::~RenderCache() {
+  _closing = true;
+  Clear();
+}
+
+void Viewer::RenderCache::Resize(int size) {
+  SetSize(size);
+  std::unique_lock<std::mutex> lock(_compressed_mutex);
+  TrimCompressedPages();
+}
 
-PixelBuffer* Viewer::RenderCache::Load(const RenderCacheKey& key) {
+std::shared_ptr<PixelBuffer> Viewer::RenderCache::Load(
+    const RenderCacheKey& key) {
+  // 1. If the page was evicted before, decompress it.
+  const std::shared_ptr<CompressedImage> compressed_page =
+      FindCompressedPage(key);
+  if (compressed_page) {
+    std::shared_ptr<PixelBuffer> buffer(NewPageBuffer(
+        PixelBuffer::Size(
+            compressed_page->GetWidth(), compressed_page->GetHeight()),
+        compressed_page->GetDepth()));
+    if (buffer->Decompress(*compressed_page)) {
+      return buffer;
+    }
+  }
+
+  // 2. If the page was rendered in an earlier session, decompress that.
+  if (_parent->_disk_cache != nullptr) {
+    const std::unique_ptr<CompressedImage> disk_page(
+        _parent->_disk_cache->Load(GetDiskCacheKey(key)));
+    if (disk_page != nullptr) {
+      std::shared_ptr<PixelBuffer> buffer(NewPageBuffer(
+          PixelBuffer::Size(disk_page->GetWidth(), disk_page->GetHeight()),
+          disk_page->GetDepth()));
+      if (buffer->Decompress(*disk_page)) {
+        return buffer;
+      }
+    }
+  }
+
+  // 3. If the page is cached in another orientation, rotate that.
+  int quarter_turns;
+  const std::shared_ptr<PixelBuffer> rotation_source =
+      _parent->FindRotationSource(key, &quarter_turns);
+  if (rotation_source) {
+    const PixelBuffer::Size& source_size = rotation_source->GetSize();
+    std::shared_ptr<PixelBuffer> buffer(NewPageBuffer(
+        quarter_turns % 2
+            ? PixelBuffer::Size(source_size.Height, source_size.Width)
+            : source_size,
+        rotation_source->GetFormat()->GetDepth()));
+    rotation_source->Rotate(quarter_turns, buffer.get());
+    return buffer;
+  }
+
+  // 4. Otherwise, render it, in grayscale if it has no color.
   const Document::PageSize& page_size =
       _parent->_doc->GetPageSize(key.Page, key.Zoom, key.Rotation);
 
-  PixelBuffer* buffer = _parent->_fb->NewPixelBuffer(
-      PixelBuffer::Size(page_size.Width, page_size.Height));
-  PixelBufferWriter writer(buffer, key.ColorMode);
+  std::shared_ptr<PixelBuffer> buffer(NewPageBuffer(
+      PixelBuffer::Size(page_size.Width, page_size.Height),
+      _parent->IsGrayPage(key) ? 1
+                               : _parent->_fb->GetFormat()->GetDepth()));
+  PixelBufferWriter writer(buffer.get(), key.ColorMode);
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
   _parent->_doc->Render(&writer, key.Page, key.Zoom, key.Rotation);
+  if (_parent->_render_cost_model != nullptr) {
+    const std::chrono::duration<float, std::milli> render_time =
+        std::chrono::steady_clock::now() - start;
+    _parent->_render_cost_model->Record(
+        key.Page, page_size.Width, page_size.Height, render_time.count());
+  }
 
   return buffer;
 }
 
 void Viewer::RenderCache::Discard(
-    const RenderCacheKey& key, PixelBuffer* const& value) {
-  delete value;
+    const RenderCacheKey& key, const std::shared_ptr<PixelBuffer>& value) {
+  // The buffer is freed when the last reference to it is released.
+
+  // 1. Keep the page in the compressed tier, unless it is there already, and
+  // in the disk cache, unless it is there already. Pages evicted while the
+  // cache is being destroyed only go to the disk cache, so that the pages
+  // displayed last are there for the next session.
+  const bool store_in_memory = !_closing && !FindCompressedPage(key);
+  const std::string disk_cache_key =
+      _parent->_disk_cache == nullptr ? "" : GetDiskCacheKey(key);
+  const bool store_on_disk = _parent->_disk_cache != nullptr &&
+                             !_parent->_disk_cache->Contains(disk_cache_key);
+  if (!store_in_memory && !store_on_disk) {
+    return;
+  }
+
+  // 2. Compress it, and write it to disk.
+  std::shared_ptr<CompressedImage> image(value->Compress());
+  if (store_on_disk) {
+    _parent->_disk_cache->Store(disk_cache_key, *image);
+  }
+
+  // 3. Drop it if it does not compress well.
+  const size_t size = static_cast<size_t>(image->GetWidth()) *
+                      image->GetHeight() * image->GetDepth();
+  if (!store_in_memory ||
+      image->GetByteSize() * COMPRESSED_CACHE_FACTOR > size) {
+    return;
+  }
+
+  // 4. Store it as the most recently used page.
+  std::unique_lock<std::mutex> lock(_compressed_mutex);
+  if (_compressed_pages.count(key)) {
+    return;
+  }
+  CompressedPage& page = _compressed_pages[key];
+  page.Image = image;
+  page.QueuePosition =
+      _compressed_queue.insert(_compressed_queue.end(), key);
+  TrimCompressedPages();
+}
+
+std::shared_ptr<CompressedImage> Viewer::RenderCache::FindCompressedPage(
+    const RenderCacheKey& key) {
+  std::unique_lock<std::mutex> lock(_compressed_mutex);
+  auto i = _compressed_pages.find(key);
+  if (i == _compressed_pages.end()) {
+    return nullptr;
+  }
+  _compressed_queue.splice(
+      _compressed_queue.end(), _compressed_queue, i->second.QueuePosition);
+  return i->second.Image;
+}
+
+std::string Viewer::RenderCache::GetDiskCacheKey(
+    const RenderCacheKey& key) const {
+  // Zoom ratios are compared by zoom step, as in RenderCacheKey.
+  return _parent->_disk_cache_key_prefix + "-" + std::to_string(key.Page) +
+         "-" + std::to_string(GetZoomStep(key.Zoom)) + "-" +
+         std::to_string(NormalizeRotation(key.Rotation)) + "-" +
+         std::to_string(key.ColorMode) + (_parent->_force_gray ? "-gray" : "");
+}
+
+std::shared_ptr<PixelBuffer> Viewer::RenderCache::NewPageBuffer(
+    const PixelBuffer::Size& size, int depth) {
+  const PixelBuffer::Format* format = _parent->_fb->GetFormat();
+  if (depth != format->GetDepth()) {
+    format = PixelBuffer::GetGrayFormat();
+  }
+  return PixelBufferPool::Get()->NewPixelBuffer(size, format);
+}
+
+void Viewer::RenderCache::TrimCompressedPages() {
+  const size_t max_num_pages =
+      std::max(GetSize(), 0) * static_cast<size_t>(COMPRESSED_CACHE_FACTOR);
+  while (_compressed_queue.size() > max_num_pages) {
+    _compressed_pages.erase(_compressed_queue.front());
+    _compressed_queue.pop_front();
+  }
 }
@@ -22,16 +22,43 @@
 #ifndef VIEWER_HPP
 #define VIEWER_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "cache.hpp"
+#include "disk_cache.hpp"
+#include "document.hpp"
+#include "image_codec.hpp"
+#include "multithreading.hpp"
+#include "pixel_buffer.hpp"
+#include "prefetch_planner.hpp"
+#include "render_cost_model.hpp"
 
-class Document;
 class Framebuffer;
-class PixelBuffer;
 
 class Viewer {
  public:
   // Default number of rendered pages to keep in cache.
   enum { DEFAULT_RENDER_CACHE_SIZE = 8 };
+  // Default number of screen pixels between pages in continuous layout.
+  enum { DEFAULT_PAGE_GAP = 8 };
+  // Maximum number of rendered pages to keep for marks, in addition to the
+  // render cache. See PinMark().
+  enum { MAX_NUM_PINNED_PAGES = 8 };
+  // Number of pages to warm beyond those the render cache has room to
+  // prefetch. See Document::Warm().
+  enum { NUM_WARMED_PAGES = 4 };
+  // How many pages or spreads ahead to look for pages worth prefetching.
+  enum { MAX_PREFETCH_DISTANCE = 16 };
 
   // Zoom modes.
   enum {
@@ -48,6 +75,18 @@ class Viewer {
     SEPIA,
   };
 
+  // Page layout.
+  enum Layout {
+    // Display one page at a time.
+    SINGLE_PAGE,
+    // Display pages one below the other, so that the view can span the bottom
+    // of one page and the top of the next.
+    CONTINUOUS,
+    // Display facing pages side by side, like an open book. The first page is
+    // displayed alone, like a book cover.
+    SPREAD,
+  };
+
   // Maximum zoom ratio.
   static const float MAX_ZOOM;
   // Minimum zoom ratio.
@@ -69,16 +108,21 @@ class Viewer {
     // Rotation of the document, in clockwise degrees.
     int Rotation;
 
-    // Number of screen pixels from top of page to top of displayed view.
-    int XOffset;
     // Number of screen pixels from left of page to left of displayed view.
+    int XOffset;
+    // Number of screen pixels from top of page to top of displayed view. In
+    // continuous layout, this may be negative or exceed the page height, and
+    // is measured across following or preceding pages and the gaps between
+    // them; Render() moves Page to the page actually at the top of the view.
     int YOffset;
 
-    // Width of current page (after zoom and rotation). This is written by
-    // Render(), and is ignored by Render() itself.
+    // Width of current page (after zoom and rotation), or of the current
+    // spread in spread layout. This is written by Render(), and is ignored by
+    // Render() itself.
     int PageWidth;
-    // Height of current page (after zoom and rotation). This is written by
-    // Render(), and is ignored by Render() itself.
+    // Height of current page (after zoom and rotation), or of the current
+    // spread in spread layout. This is written by Render(), and is ignored by
+    // Render() itself.
     int PageHeight;
     // Width of framebuffer. This is written by Render(), and is ignored by
     // Render() itself.
@@ -90,6 +134,11 @@ class Viewer {
     // Current color mode.
     enum ColorMode ColorMode;
 
+    // Current page layout.
+    enum Layout Layout;
+    // Number of screen pixels between pages in continuous and spread layout.
+    int PageGap;
+
     State(
         int page = 0, float zoom = ZOOM_TO_WIDTH, int rotation = 0,
         int x_offset = 0, int y_offset = 0)
@@ -98,26 +147,117 @@ class Viewer {
           Rotation(rotation),
           XOffset(x_offset),
           YOffset(y_offset),
-          ColorMode(NORMAL) {}
+          ColorMode(NORMAL),
+          Layout(SINGLE_PAGE),
+          PageGap(DEFAULT_PAGE_GAP) {}
   };
 
-  // Constructs a new Viewer object. Does not take ownership of the document or
-  // the framebuffer object.
+  // Constructs a new Viewer object. Does not take ownership of the document,
+  // the framebuffer object, the render cost model or the prefetch queue. If a
+  // render cost model is given, render times are recorded to it, and used to
+  // decide which pages are worth prefetching. Pages are prefetched by the given
+  // work queue, which may be shared with other viewers, or if none is given,
+  // by a low priority work queue of the viewer's own.
   Viewer(
       Document* doc, Framebuffer* fb, const State& state = State(),
-      int render_cache_size = DEFAULT_RENDER_CACHE_SIZE);
+      int render_cache_size = DEFAULT_RENDER_CACHE_SIZE,
+      RenderCostModel* render_cost_model = nullptr,
+      WorkQueue* prefetch_queue = nullptr);
   virtual ~Viewer();
 
-  // Renders the present view to the framebuffer.
+  // Renders the present view to the framebuffer. If a visible page has not
+  // been rendered at the current zoom ratio yet, but has been at a different
+  // one, this displays a quick resampled preview of that render instead and
+  // renders the exact page in the background. See IsRenderPending().
+  //
+  // Only lays out the visible pages and corrects the state before returning.
+  // The pages are drawn by a draw thread once they have been rendered, so the
+  // caller can handle input in the meantime. If Render() is called again
+  // before then, the newer view replaces the older one, which is never drawn.
+  // See IsDrawPending().
   void Render();
+  // Lays out the view for the given state, and stores the corrected state in
+  // it, as Render() would, without drawing anything or starting renders. Lets
+  // the caller apply several commands in a row, each to the position, zoom
+  // ratio and page size the one before it led to, and render only once.
+  void LayOut(State* state);
+  // Returns true if the last call to Render() displayed a preview, and an
+  // exact render it is waiting for is not yet ready. Once this returns false,
+  // calling Render() again will display the exact renders.
+  bool IsRenderPending();
+  // Returns true if the view laid out by the last call to Render() has not
+  // been drawn to the framebuffer yet.
+  bool IsDrawPending();
+  // Stops the draw thread from drawing to the framebuffer until the next call
+  // to Render(), so that something else can draw on the screen. Waits for a
+  // view being drawn at the time to finish.
+  void PauseDrawing();
 
   // Stores the current state in the given pointer. Must be called AFTER at
-  // least one call to Render().
+  // least one call to Render() or LayOut().
   void GetState(State* state) const;
   // Sets the current settings. Will use minimum and maximum legal values to
   // replace illegal values. Has no effect until Render() is called.
   void SetState(const State& state);
 
+  // Starts rendering pages the user may be about to jump to, such as the
+  // target of a highlighted outline item, at low priority and the current
+  // settings. Replaces pending prefetches until the next call to Render().
+  void Warm(const std::vector<int>& pages);
+
+  // Keeps the pages displayed by the last call to Render() in the render cache
+  // for as long as they belong to the given mark, so that returning to the
+  // mark never waits for a render. Replaces pages previously pinned for the
+  // mark. If more than MAX_NUM_PINNED_PAGES pages are pinned, releases the
+  // pages of the least recently pinned marks.
+  void PinMark(int mark);
+
+  // Changes the number of rendered pages to keep in cache, evicting the least
+  // recently displayed pages if needed. Pages pinned for marks and slides are
+  // not affected.
+  void SetRenderCacheSize(int render_cache_size);
+  // Returns the number of pages pinned for marks and slides, which the render
+  // cache keeps on top of its size.
+  int GetNumPinnedPages() const;
+  // Discards pending prefetches until the next call to Render(), for example
+  // when the viewer's document is no longer displayed.
+  void CancelPrefetch();
+  // Frees memory while the viewer is not displayed for a while: discards
+  // pending prefetches, shrinks the render cache to the given size, keeping
+  // the most recently displayed pages, and releases memory cached by the
+  // document. Pages pinned for marks and slides are kept. Call
+  // SetRenderCacheSize() and Render() to resume.
+  void Suspend(int render_cache_size);
+
+  // Starts rendering the given page, or the spread containing it, at the
+  // current settings in the background, and keeps it in the render cache until
+  // the next call. Unlike prefetches, this is rendered at normal priority and
+  // is not cancelled by Render(), so that a timed transition to the page, as
+  // in a slideshow, can be drawn without waiting.
+  void PrepareSlide(int page);
+  // Returns true if the given page, or the spread containing it, has been
+  // rendered at the current settings, so that Render() would draw it without
+  // waiting.
+  bool IsSlideReady(int page);
+
+  // Keeps rendered pages of the document in the given disk cache, shared with
+  // later sessions, under the given document ID, which must identify the
+  // document's content. Pages evicted from the render cache are stored, and
+  // pages found there are loaded instead of being rendered. The document may
+  // keep data of its own there as well. Does not take ownership of the disk
+  // cache. Must be called before the first call to Render().
+  void SetDiskCache(DiskCache* disk_cache, const std::string& document_id);
+  // Renders pages in grayscale even if they have color, at a quarter of the
+  // memory of 32-bit pages, if force_gray is true. Pages without color are
+  // rendered in grayscale regardless, unless the color mode tints them or the
+  // screen has 8-bit pixels. Must be called before the first call to Render().
+  void SetForceGray(bool force_gray);
+
+  // Returns the index of the spread containing a page in spread layout.
+  static int GetSpread(int page);
+  // Returns the first page of a spread in spread layout.
+  static int GetSpreadStart(int spread);
+
  private:
   // The current document.
   Document* _doc;
@@ -125,6 +265,22 @@ class Viewer {
   Framebuffer* _fb;
   // Settings.
   State _state;
+  // Render cost model, or nullptr.
+  RenderCostModel* const _render_cost_model;
+  // Disk cache, or nullptr, and the IDs of the document and of the screen's
+  // pixel format that keys to it start with.
+  DiskCache* _disk_cache;
+  std::string _disk_cache_key_prefix;
+  // See SetForceGray().
+  bool _force_gray;
+
+  // Explicit zoom ratios are rounded to one of this many steps per doubling,
+  // so that zooming in and out again lands on previously rendered pages.
+  enum { ZOOM_STEPS_PER_OCTAVE = 16 };
+  // Rounds a zoom ratio to the nearest zoom step.
+  static float QuantizeZoom(float zoom);
+  // Returns the index of the zoom step nearest to a zoom ratio.
+  static int GetZoomStep(float zoom);
 
   // Key to the render cache.
   struct RenderCacheKey {
@@ -142,24 +298,260 @@ class Viewer {
         int page, float zoom, int rotation, enum ColorMode color_mode)
         : Page(page), Zoom(zoom), Rotation(rotation), ColorMode(color_mode) {}
 
-    // This is required as this class will be inserted into a map.
+    // This is required as this class will be inserted into a map. Zoom ratios
+    // are compared by zoom step.
     bool operator<(const RenderCacheKey& other) const;
   };
-  // Render cache class.
-  class RenderCache : public Cache<RenderCacheKey, PixelBuffer*> {
+  // The compressed tier of the render cache holds up to this many times as
+  // many pages as the render cache, and only pages that compress to at most
+  // 1 / COMPRESSED_CACHE_FACTOR of their size, so that it never takes more
+  // memory than the render cache itself.
+  enum { COMPRESSED_CACHE_FACTOR = 4 };
+  // Render cache class. Buffers are shared so that a buffer being displayed
+  // stays valid even if it is evicted by a concurrent background load.
+  //
+  // Pages without color are kept in the gray format, and are converted to the
+  // screen's format as they are drawn.
+  //
+  // Evicted pages are compressed into a second tier, so that loading them
+  // again takes a decompression rather than a render. If the viewer has a disk
+  // cache, they are also stored there, including those evicted when the cache
+  // is destroyed, and pages missing from both tiers are looked up there.
+  class RenderCache
+      : public Cache<RenderCacheKey, std::shared_ptr<PixelBuffer>> {
    public:
     RenderCache(Viewer* parent, int size);
     virtual ~RenderCache();
 
+    // Changes the size of the cache, and of the compressed tier with it.
+    void Resize(int size);
+
    protected:
-    PixelBuffer* Load(const RenderCacheKey& key) override;
-    void Discard(const RenderCacheKey& key, PixelBuffer* const& value) override;
+    std::shared_ptr<PixelBuffer> Load(const RenderCacheKey& key) override;
+    void Discard(
+        const RenderCacheKey& key,
+        const std::shared_ptr<PixelBuffer>& value) override;
 
    private:
+    // A page in the compressed tier.
+    struct CompressedPage {
+      std::shared_ptr<CompressedImage> Image;
+      // Position of the page in _compressed_queue.
+      std::list<RenderCacheKey>::iterator QueuePosition;
+    };
+
     Viewer* _parent;
+    // Set once the cache is being destroyed, and evicted pages are no longer
+    // worth compressing.
+    std::atomic<bool> _closing;
+    // Protects the members below.
+    std::mutex _compressed_mutex;
+    // The compressed tier.
+    std::map<RenderCacheKey, CompressedPage> _compressed_pages;
+    // Keys of compressed pages, from least to most recently used.
+    std::list<RenderCacheKey> _compressed_queue;
+
+    // Returns a page from the compressed tier, and marks it as most recently
+    // used. Returns nullptr if it is not there.
+    std::shared_ptr<CompressedImage> FindCompressedPage(
+        const RenderCacheKey& key);
+    // Evicts the least recently used compressed pages while the compressed
+    // tier is too large. Must be called with _compressed_mutex held.
+    void TrimCompressedPages();
+    // Returns the key of a page in the parent's disk cache.
+    std::string GetDiskCacheKey(const RenderCacheKey& key) const;
+    // Returns a new buffer for a page of the given size with pixels of the
+    // given depth: in the screen's format if it has that depth, or in the
+    // gray format otherwise.
+    std::shared_ptr<PixelBuffer> NewPageBuffer(
+        const PixelBuffer::Size& size, int depth);
   };
   // Render cache.
   RenderCache _render_cache;
+  // The work queue owned by this viewer, if no shared one is given. This is
+  // declared after _render_cache so that it is destroyed first.
+  std::unique_ptr<WorkQueue> _own_prefetch_queue;
+  // Prefetches pages into the render cache one at a time at low priority,
+  // nearest first. Jobs are tagged with this viewer as the owner.
+  WorkQueue* const _prefetch_queue;
+  // Predicts which pages to prefetch from recent navigation.
+  PrefetchPlanner _prefetch_planner;
+  // Keys of the exact renders being waited for by previews displayed in the
+  // last call to Render().
+  std::vector<RenderCacheKey> _pending_render_keys;
+
+  // A visible region of a page, and where to draw it on screen.
+  struct PageView {
+    // The page and the parameters it is rendered with.
+    RenderCacheKey Key;
+    // Size of the rendered page.
+    PixelBuffer::Size PageSize;
+    // The visible region of the rendered page.
+    PixelBuffer::Rect SrcRect;
+    // The region of the screen to draw to. SrcRect is centered within it.
+    PixelBuffer::Rect DestRect;
+
+    PageView(
+        const RenderCacheKey& key, const PixelBuffer::Size& page_size,
+        const PixelBuffer::Rect& src_rect, const PixelBuffer::Rect& dest_rect)
+        : Key(key),
+          PageSize(page_size),
+          SrcRect(src_rect),
+          DestRect(dest_rect) {}
+  };
+  // Lays out the visible pages in the current layout, and corrects _state.
+  void LayOutPages(std::vector<PageView>* views);
+  // Lays out the given page alone on screen. Corrects the position in _state.
+  void LayOutSinglePage(int page, std::vector<PageView>* views);
+  // Lays out pages one below the other, starting from the given page and the
+  // vertical offset in _state. Corrects the position in _state.
+  void LayOutContinuous(int page, std::vector<PageView>* views);
+  // Lays out the spread containing the given page. Corrects the position in
+  // _state.
+  void LayOutSpread(int page, std::vector<PageView>* views);
+  // Returns the region of a page or spread of the given size that is visible
+  // on screen at the given offsets, after bounding the offsets.
+  PixelBuffer::Rect GetVisibleRect(
+      const PixelBuffer::Size& page_size, int x_offset, int y_offset) const;
+  // Returns the first page and the number of pages of the spread containing
+  // a page in spread layout.
+  void GetSpreadPages(int page, int* first_page, int* num_pages);
+  // A screen laid out by Render(), passed to the draw thread.
+  struct Frame {
+    // Sequence number of the call to Render() that laid out this frame.
+    int Id;
+    // Visible pages.
+    std::vector<PageView> Views;
+    // For each view, the page if it was already in the render cache.
+    std::vector<std::shared_ptr<PixelBuffer>> Buffers;
+    // For each view, a render at another zoom ratio to resample as a preview
+    // instead of waiting for the exact render, or nullptr.
+    std::vector<std::shared_ptr<PixelBuffer>> PreviewSources;
+    // For each preview source, how many clockwise quarter turns to rotate it
+    // by before resampling it.
+    std::vector<int> PreviewQuarterTurns;
+  };
+  // Looks up page views in the render cache, and starts rendering pages that
+  // are not there. If a page has not been rendered at this zoom ratio yet but
+  // has been at another, the frame uses that as a preview, and the exact page
+  // is rendered in the background. Otherwise the page is rendered now, which
+  // is fast if it can be derived by rotating a cached render.
+  std::unique_ptr<Frame> PrepareFrame(const std::vector<PageView>& views);
+  // How often the draw thread checks for a newer frame while it waits for
+  // pages being rendered, in milliseconds.
+  enum { DRAW_POLL_MS = 10 };
+  // Draws a frame to the framebuffer, and clears the rest of the screen.
+  // Pages being rendered are waited for before anything is drawn, so that the
+  // screen is updated in one go, unless a newer frame is laid out meanwhile.
+  // Called by the draw thread.
+  void DrawFrame(const Frame& frame);
+  // Main loop of the draw thread.
+  void Draw();
+  // Returns screen regions not covered by the destination of any view.
+  std::vector<PixelBuffer::Rect> GetUncoveredRects(
+      const std::vector<PageView>& views) const;
+  // Replaces pending prefetches with pages ahead of and behind the given
+  // visible pages, as planned by _prefetch_planner, followed by pages that
+  // links on the visible pages point to, at the current settings. In spread
+  // layout, whole spreads are prefetched.
+  void Prefetch(const std::vector<PageView>& views);
+  // Returns the predicted time to render the given pages, in milliseconds, or
+  // infinity if there is no render cost model.
+  float PredictRenderCost(const std::vector<RenderCacheKey>& keys);
+  // Queues keys to prefetch, nearest first. Renders as many as the render
+  // cache can hold alongside the given number of visible pages, and warms up
+  // to NUM_WARMED_PAGES more at the lowest priority.
+  void EnqueuePrefetchKeys(
+      const std::vector<RenderCacheKey>& keys, int num_visible_pages);
+  // Warms a page unless it has been warmed recently. Called by the prefetch
+  // worker.
+  void WarmPage(const RenderCacheKey& key);
+  // Recently warmed pages, oldest first, up to WARMED_HISTORY_SIZE.
+  enum { WARMED_HISTORY_SIZE = 32 };
+  std::deque<RenderCacheKey> _warmed_keys;
+  // Returns the pages that links on a page point to. Cached.
+  const std::vector<int>& GetLinkedPages(int page);
+  // Cache of GetLinkedPages().
+  std::map<int, std::vector<int>> _linked_pages;
+  // Keys of the pages displayed by the last call to Render().
+  std::vector<RenderCacheKey> _visible_keys;
+
+  // The latest frame laid out by Render() that the draw thread has not
+  // started drawing yet.
+  Mailbox<Frame> _frames;
+  // The number of frames laid out by Render().
+  int _num_frames;
+  // Guards the fields below, and wakes up the draw thread. Never held while
+  // waiting for a render or drawing.
+  std::mutex _draw_mutex;
+  std::condition_variable _draw_condition;
+  // The ID of the last frame the draw thread has finished with, whether it
+  // was drawn or replaced by a newer one.
+  int _last_drawn_frame;
+  // Whether the draw thread should exit.
+  bool _exit_drawing;
+  // Held by the draw thread while drawing to the framebuffer.
+  std::mutex _present_mutex;
+  // Whether the draw thread must not draw to the framebuffer.
+  std::atomic<bool> _drawing_paused;
+  // Draws frames laid out by Render(). Started last in the constructor, and
+  // stopped first in the destructor.
+  std::thread _draw_thread;
+
+  // Keys pinned in the render cache for each mark.
+  std::map<int, std::vector<RenderCacheKey>> _pinned_keys;
+  // Marks with pinned keys, from least to most recently pinned.
+  std::vector<int> _pinned_marks;
+  // Keys pinned by the last call to PrepareSlide().
+  std::vector<RenderCacheKey> _slide_keys;
+  // Returns the keys of the given page, or the spread containing it, at the
+  // current settings.
+  std::vector<RenderCacheKey> GetSlideKeys(int page);
+  // Unpins the keys pinned for a mark, if any.
+  void UnpinMark(int mark);
+  // Adds the pages of the given page or spread that are neither visible nor
+  // listed already to a list of keys to prefetch. Does nothing if it does not
+  // exist.
+  void AddPrefetchKeys(
+      int page_or_spread, const std::vector<PageView>& views,
+      std::vector<RenderCacheKey>* keys);
+
+  // Returns the zoom ratio to render a page at under the current settings.
+  float GetZoom(int page);
+  // Returns the size of a page rendered with the given parameters. This is
+  // exact if the page is in the render cache, and otherwise estimated from the
+  // page size at 100% so that laying out pages never waits for the document
+  // while it is rendering in the background. Does not mark cached renders as
+  // used.
+  PixelBuffer::Size GetPageSize(const RenderCacheKey& key);
+  // Returns the size of a page at 100% in the given rotation, as reported by
+  // the document. Cached.
+  const Document::PageSize& GetUnitPageSize(int page, int rotation);
+  // Page sizes at 100%, keyed by page and rotation.
+  std::map<std::pair<int, int>, Document::PageSize> _unit_page_sizes;
+
+  // Looks for a cached render of the same page and color mode as key but at a
+  // different zoom ratio, preferring the same rotation and then the nearest
+  // zoom ratio. A render whose rotation differs by a multiple of 90 degrees
+  // is found too, which is what rotating a page in a fit mode, which also
+  // changes the zoom ratio, leaves in the cache. Returns nullptr if there is
+  // none. Otherwise returns the buffer, and stores the zoom ratio it was
+  // rendered at in zoom and how many clockwise quarter turns to rotate it by
+  // in quarter_turns.
+  std::shared_ptr<PixelBuffer> FindPreviewSource(
+      const RenderCacheKey& key, float* zoom, int* quarter_turns);
+  // Looks for a cached render of the same page, zoom ratio and color mode as
+  // key whose rotation differs by a multiple of 90 degrees, so that key can be
+  // derived by rotating it instead of rendering. Returns nullptr if there is
+  // none. Otherwise returns the buffer, and stores how many clockwise quarter
+  // turns to rotate it by in quarter_turns.
+  std::shared_ptr<PixelBuffer> FindRotationSource(
+      const RenderCacheKey& key, int* quarter_turns);
+  // Returns a rotation in degrees normalized to [0, 360).
+  static int NormalizeRotation(int rotation);
+  // Returns true if a page is to be rendered in grayscale. See
+  // SetForceGray().
+  bool IsGrayPage(const RenderCacheKey& key);
 };
 
 #endif
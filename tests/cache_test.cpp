@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../src/cache.hpp"
+
+namespace {
+
+// A cache of integers whose values are their keys, counting loads and
+// discards.
+class CountingCache : public Cache<int, int> {
+ public:
+  explicit CountingCache(int size)
+      : Cache<int, int>(size),
+        NumLoads(0),
+        NumDiscards(0),
+        LoadDelayMs(0),
+        DiscardDelayMs(0) {}
+  ~CountingCache() override { Clear(); }
+
+  std::atomic<int> NumLoads;
+  std::atomic<int> NumDiscards;
+  // How long each call to Load() takes.
+  std::atomic<int> LoadDelayMs;
+  // How long each call to Discard() takes.
+  std::atomic<int> DiscardDelayMs;
+
+ protected:
+  int Load(const int& key) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(LoadDelayMs));
+    ++NumLoads;
+    return key;
+  }
+  void Discard(const int& key, const int& value) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(DiscardDelayMs));
+    ++NumDiscards;
+  }
+};
+
+}  // namespace
+
+TEST(Cache, EvictsLeastRecentlyUsed) {
+  // A cache of size 4 holds 3 items.
+  CountingCache cache(4);
+  cache.Get(1);
+  cache.Get(2);
+  cache.Get(3);
+  cache.Get(1);
+  cache.Get(4);
+  int value;
+  EXPECT_TRUE(cache.TryGet(1, &value));
+  EXPECT_FALSE(cache.TryGet(2, &value));
+  EXPECT_TRUE(cache.TryGet(3, &value));
+  EXPECT_TRUE(cache.TryGet(4, &value));
+}
+
+TEST(Cache, PeekDoesNotMarkAsUsed) {
+  // A cache of size 3 holds 2 items.
+  CountingCache cache(3);
+  cache.Get(1);
+  cache.Get(2);
+  int value;
+  EXPECT_TRUE(cache.Peek(1, &value));
+  EXPECT_EQ(value, 1);
+  EXPECT_FALSE(cache.Peek(3, &value));
+  cache.Get(3);
+  EXPECT_FALSE(cache.TryGet(1, &value));
+  EXPECT_TRUE(cache.TryGet(2, &value));
+  EXPECT_EQ(cache.NumLoads, 3);
+}
+
+TEST(Cache, RemoveLoadsAgain) {
+  CountingCache cache(3);
+  cache.Get(1);
+  cache.Remove(1);
+  cache.Remove(2);
+  EXPECT_EQ(cache.NumDiscards, 1);
+  int value;
+  EXPECT_FALSE(cache.TryGet(1, &value));
+  EXPECT_EQ(cache.Get(1), 1);
+  EXPECT_EQ(cache.NumLoads, 2);
+}
+
+TEST(Cache, KeepsPinnedItems) {
+  CountingCache cache(3);
+  cache.Pin(1);
+  cache.Get(1);
+  for (int key = 2; key < 10; ++key) {
+    cache.Get(key);
+  }
+  int value;
+  EXPECT_TRUE(cache.TryGet(1, &value));
+  // Pinned items do not take space from other items.
+  EXPECT_TRUE(cache.TryGet(8, &value));
+  EXPECT_TRUE(cache.TryGet(9, &value));
+
+  // Once unpinned, the item is evicted as usual.
+  cache.Unpin(1);
+  cache.Get(10);
+  cache.Get(11);
+  EXPECT_FALSE(cache.TryGet(1, &value));
+}
+
+TEST(Cache, FetchLoadsOnce) {
+  CountingCache cache(3);
+  cache.Fetch(1);
+  cache.Fetch(1);
+  EXPECT_EQ(cache.Get(1), 1);
+  EXPECT_EQ(cache.NumLoads, 1);
+}
+
+TEST(Cache, GetForGivesUpAfterTimeout) {
+  CountingCache cache(3);
+  cache.LoadDelayMs = 200;
+  int value;
+  EXPECT_FALSE(cache.GetFor(1, &value, 10));
+  // The item goes on loading, and is only loaded once.
+  EXPECT_TRUE(cache.GetFor(1, &value, 5000));
+  EXPECT_EQ(value, 1);
+  EXPECT_EQ(cache.NumLoads, 1);
+}
+
+TEST(Cache, ShrinkingEvictsLeastRecentlyUsed) {
+  CountingCache cache(5);
+  for (int key = 1; key <= 4; ++key) {
+    cache.Get(key);
+  }
+  cache.Get(1);
+  cache.SetSize(3);
+  int value;
+  EXPECT_TRUE(cache.TryGet(1, &value));
+  EXPECT_FALSE(cache.TryGet(2, &value));
+  EXPECT_FALSE(cache.TryGet(3, &value));
+  EXPECT_TRUE(cache.TryGet(4, &value));
+}
+
+TEST(Cache, ClearWaitsForEvictions) {
+  CountingCache cache(2);
+  cache.DiscardDelayMs = 50;
+  cache.Get(1);
+  cache.Get(2);
+  cache.Get(3);
+  cache.DiscardDelayMs = 0;
+  cache.Clear();
+  // Both slowly evicted items and the remaining item have been discarded.
+  EXPECT_EQ(cache.NumDiscards, 3);
+}
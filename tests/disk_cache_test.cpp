@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/disk_cache.hpp"
+
+namespace {
+
+// Creates a temporary directory, and removes it with its content at the end of
+// a test.
+class TempDir {
+ public:
+  TempDir() {
+    char path[] = "/tmp/jfbview_disk_cache_test.XXXXXX";
+    Path = mkdtemp(path);
+  }
+  ~TempDir() { system(("rm -rf " + Path).c_str()); }
+
+  std::string Path;
+};
+
+// Returns a compressed width x height RGBA image filled with value.
+CompressedImage* MakeImage(int width, int height, uint8_t value) {
+  std::vector<uint8_t> pixels(width * height * 4, value);
+  pixels[0] = value + 1;
+  return CompressedImage::Compress(
+      RawImage(pixels.data(), width, height, width * 4, 4));
+}
+
+// Writes a file.
+void WriteFile(const std::string& path, const std::string& content) {
+  FILE* file = fopen(path.c_str(), "w");
+  fwrite(content.data(), 1, content.size(), file);
+  fclose(file);
+}
+
+// Sets the modification time of a file to the given number of seconds since
+// the epoch.
+void SetModificationTime(const std::string& path, time_t seconds) {
+  struct timespec times[2] = {{seconds, 0}, {seconds, 0}};
+  utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+}  // namespace
+
+TEST(DiskCache, StoresAndLoadsPages) {
+  TempDir dir;
+  std::unique_ptr<DiskCache> cache(DiskCache::Open(dir.Path, 1 << 20));
+  ASSERT_NE(cache, nullptr);
+  std::unique_ptr<CompressedImage> image(MakeImage(40, 50, 200));
+  EXPECT_FALSE(cache->Contains("doc-1"));
+  EXPECT_EQ(cache->Load("doc-1"), nullptr);
+  ASSERT_TRUE(cache->Store("doc-1", *image));
+  EXPECT_TRUE(cache->Contains("doc-1"));
+
+  std::unique_ptr<CompressedImage> loaded(cache->Load("doc-1"));
+  ASSERT_NE(loaded, nullptr);
+  std::vector<uint8_t> expected(40 * 50 * 4), actual(40 * 50 * 4);
+  ASSERT_TRUE(image->Decompress(RawImage(expected.data(), 40, 50, 160, 4)));
+  ASSERT_TRUE(loaded->Decompress(RawImage(actual.data(), 40, 50, 160, 4)));
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(DiskCache, RemovesLeastRecentlyUsedPages) {
+  TempDir dir;
+  std::unique_ptr<CompressedImage> image(MakeImage(40, 50, 200));
+  std::vector<uint8_t> data;
+  image->Serialize(&data);
+  // Room for two pages after garbage collection, but not for three.
+  std::unique_ptr<DiskCache> cache(
+      DiskCache::Open(dir.Path, data.size() * 14 / 5));
+  ASSERT_TRUE(cache->Store("a", *image));
+  ASSERT_TRUE(cache->Store("b", *image));
+  SetModificationTime(dir.Path + "/pages/a", 1000);
+  SetModificationTime(dir.Path + "/pages/b", 2000);
+  // Loading a marks it as the most recently used page.
+  delete cache->Load("a");
+  ASSERT_TRUE(cache->Store("c", *image));
+  EXPECT_TRUE(cache->Contains("a"));
+  EXPECT_FALSE(cache->Contains("b"));
+  EXPECT_TRUE(cache->Contains("c"));
+}
+
+TEST(DiskCache, RemovesCorruptPages) {
+  TempDir dir;
+  std::unique_ptr<DiskCache> cache(DiskCache::Open(dir.Path, 1 << 20));
+  WriteFile(dir.Path + "/pages/bad", "not an image");
+  EXPECT_EQ(cache->Load("bad"), nullptr);
+  EXPECT_FALSE(cache->Contains("bad"));
+}
+
+TEST(DiskCache, StoresPositions) {
+  TempDir dir;
+  std::unique_ptr<DiskCache> cache(DiskCache::Open(dir.Path, 1 << 20));
+  std::string position;
+  EXPECT_FALSE(cache->LoadPosition("doc", &position));
+  ASSERT_TRUE(cache->StorePosition("doc", "12 0 340"));
+  ASSERT_TRUE(cache->LoadPosition("doc", &position));
+  EXPECT_EQ(position, "12 0 340");
+}
+
+TEST(DiskCache, FingerprintsContent) {
+  TempDir dir;
+  const std::string path = dir.Path + "/document";
+  WriteFile(path, std::string(100000, 'a'));
+  SetModificationTime(path, 1000);
+  const std::string fingerprint = DiskCache::GetFingerprint(path);
+  EXPECT_FALSE(fingerprint.empty());
+  EXPECT_EQ(DiskCache::GetFingerprint(path), fingerprint);
+
+  // Same size and modification time, but different content at the start.
+  WriteFile(path, "b" + std::string(99999, 'a'));
+  SetModificationTime(path, 1000);
+  EXPECT_NE(DiskCache::GetFingerprint(path), fingerprint);
+
+  EXPECT_EQ(DiskCache::GetFingerprint(dir.Path + "/missing"), "");
+}
@@ -1,12 +1,116 @@
 #include <gtest/gtest.h>
 
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "../src/fitz_document.hpp"
+#include "../src/fitz_utils.hpp"
 
 // Fitz scales images to a DPI of 72. Our test images have DPI 96.
 inline int ScaleToFitzDpi(int x) { return x * 72 / 96; }
 
+namespace {
+
+// Stores the RGB values of pixels written to it.
+class BufferPixelWriter : public Document::PixelWriter {
+ public:
+  BufferPixelWriter(int width, int height)
+      : Width(width), Height(height), Pixels(width * height * 3) {}
+  void Write(int x, int y, uint8_t r, uint8_t g, uint8_t b) override {
+    ASSERT_TRUE((x >= 0) && (x < Width) && (y >= 0) && (y < Height));
+    uint8_t* const pixel = &Pixels[(y * Width + x) * 3];
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+  }
+
+  const int Width, Height;
+  std::vector<uint8_t> Pixels;
+};
+
+// Renders a page with FitzDocument.
+std::unique_ptr<BufferPixelWriter> RenderPage(
+    const std::string& path, int page, float zoom, int rotation) {
+  std::unique_ptr<Document> doc(FitzDocument::Open(path, nullptr));
+  EXPECT_NE(doc.get(), nullptr);
+  const Document::PageSize page_size = doc->GetPageSize(page, zoom, rotation);
+  std::unique_ptr<BufferPixelWriter> pw(
+      new BufferPixelWriter(page_size.Width, page_size.Height));
+  doc->Render(pw.get(), page, zoom, rotation);
+  return pw;
+}
+
+// Renders a page with nothing but the MuPDF draw device, as reference.
+std::unique_ptr<BufferPixelWriter> DrawPage(
+    const std::string& path, int page, float zoom, int rotation) {
+  fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+  fz_register_document_handlers(ctx);
+  std::unique_ptr<BufferPixelWriter> pw;
+  {
+    FitzDocumentScopedPtr doc_ptr(ctx, fz_open_document(ctx, path.c_str()));
+    FitzPixmapScopedPtr pixmap_ptr(
+        ctx, fz_new_pixmap_from_page_number(
+                 ctx, doc_ptr.get(), page,
+                 ComputeTransformMatrix(zoom, rotation), fz_device_rgb(ctx),
+                 0));
+    const int width = fz_pixmap_width(ctx, pixmap_ptr.get()),
+              height = fz_pixmap_height(ctx, pixmap_ptr.get()),
+              stride = fz_pixmap_stride(ctx, pixmap_ptr.get());
+    const uint8_t* samples = fz_pixmap_samples(ctx, pixmap_ptr.get());
+    pw.reset(new BufferPixelWriter(width, height));
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const uint8_t* pixel = samples + y * stride + x * 3;
+        pw->Write(x, y, pixel[0], pixel[1], pixel[2]);
+      }
+    }
+  }
+  fz_drop_context(ctx);
+  return pw;
+}
+
+// Returns the mean absolute difference between the components of two
+// renders of the same size.
+double GetMeanDifference(
+    const BufferPixelWriter& a, const BufferPixelWriter& b) {
+  EXPECT_EQ(a.Width, b.Width);
+  EXPECT_EQ(a.Height, b.Height);
+  if (a.Pixels.size() != b.Pixels.size()) {
+    return 255.0;
+  }
+  int64_t total = 0;
+  for (size_t i = 0; i < a.Pixels.size(); ++i) {
+    total += std::abs(a.Pixels[i] - b.Pixels[i]);
+  }
+  return static_cast<double>(total) / a.Pixels.size();
+}
+
+// Returns whether FitzDocument's own scan of a page finds a single image.
+bool IsSingleImagePage(const std::string& path, int page) {
+  fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+  fz_register_document_handlers(ctx);
+  bool is_single_image;
+  {
+    FitzDocumentScopedPtr doc_ptr(ctx, fz_open_document(ctx, path.c_str()));
+    FitzPageScopedPtr page_ptr(
+        ctx, fz_load_page(ctx, doc_ptr.get(), page));
+    FitzDeviceScopedPtr dev_ptr(
+        ctx, NewSingleImageDevice(
+                 ctx, GetPageBoundingBox(ctx, page_ptr.get(), fz_identity)));
+    fz_run_page(ctx, page_ptr.get(), dev_ptr.get(), fz_identity, nullptr);
+    fz_close_device(ctx, dev_ptr.get());
+    fz_matrix ctm;
+    is_single_image = GetSingleImage(dev_ptr.get(), &ctm) != nullptr;
+  }
+  fz_drop_context(ctx);
+  return is_single_image;
+}
+
+}  // namespace
+
 TEST(FitzDocumentImage, ReturnsNullptrIfLoadingEmptyImage) {
   std::unique_ptr<Document> doc(FitzDocument::Open("", nullptr));
   EXPECT_EQ(doc.get(), nullptr);
@@ -30,3 +134,39 @@ TEST(FitzDocumentImage, CanLoadJPEGImage) {
   EXPECT_EQ(doc->GetPageSize(0).Height, ScaleToFitzDpi(400));
 }
 
+
+TEST(FitzDocumentImage, RendersSingleImagePageLikeDrawDevice) {
+  // Scaling the image on its own resamples it a little differently from the
+  // draw device, but a misplaced or misrotated image is far off.
+  const double MAX_MEAN_DIFFERENCE = 8.0;
+  ASSERT_TRUE(IsSingleImagePage("testdata/panda.png", 0));
+  for (float zoom : {0.5f, 1.0f, 2.0f}) {
+    for (int rotation : {0, 90, 180, 270}) {
+      SCOPED_TRACE(
+          "zoom " + std::to_string(zoom) + ", rotation " +
+          std::to_string(rotation));
+      std::unique_ptr<BufferPixelWriter> rendered =
+          RenderPage("testdata/panda.png", 0, zoom, rotation);
+      std::unique_ptr<BufferPixelWriter> drawn =
+          DrawPage("testdata/panda.png", 0, zoom, rotation);
+      EXPECT_LT(GetMeanDifference(*rendered, *drawn), MAX_MEAN_DIFFERENCE);
+    }
+  }
+}
+
+TEST(FitzDocumentImage, RendersPagesWithTextOrPathsWithDrawDevice) {
+  // The first pages of the manual have text on them, so they must not be
+  // taken for scans, and are drawn exactly as the draw device would.
+  const double MAX_MEAN_DIFFERENCE = 0.5;
+  for (int page : {0, 1}) {
+    SCOPED_TRACE("page " + std::to_string(page));
+    EXPECT_FALSE(IsSingleImagePage("testdata/bash.pdf", page));
+    for (int rotation : {0, 90}) {
+      std::unique_ptr<BufferPixelWriter> rendered =
+          RenderPage("testdata/bash.pdf", page, 1.0f, rotation);
+      std::unique_ptr<BufferPixelWriter> drawn =
+          DrawPage("testdata/bash.pdf", page, 1.0f, rotation);
+      EXPECT_LT(GetMeanDifference(*rendered, *drawn), MAX_MEAN_DIFFERENCE);
+    }
+  }
+}
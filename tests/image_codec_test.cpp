@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../src/image_codec.hpp"
+
+namespace {
+
+// Returns a width x height RGBA image that looks like a page of text: white,
+// with a few rows of dark marks.
+std::vector<uint8_t> MakePage(int width, int height) {
+  std::vector<uint8_t> pixels(width * height * 4, 255);
+  std::mt19937 random(42);
+  for (int y = height / 4; y < height / 2; ++y) {
+    for (int x = width / 8; x < width * 7 / 8; ++x) {
+      if (random() % 5 == 0) {
+        for (int c = 0; c < 3; ++c) {
+          pixels[(y * width + x) * 4 + c] = random() % 64;
+        }
+      }
+    }
+  }
+  return pixels;
+}
+
+// Compresses and decompresses an image, and expects it to come back intact.
+void ExpectRoundTrip(
+    const std::vector<uint8_t>& pixels, int width, int height,
+    size_t* compressed_size = nullptr) {
+  std::vector<uint8_t> src_pixels = pixels;
+  std::unique_ptr<CompressedImage> image(CompressedImage::Compress(
+      RawImage(src_pixels.data(), width, height, width * 4, 4)));
+  // Decompress into a buffer with padded rows.
+  const int stride = width * 4 + 12;
+  std::vector<uint8_t> dest_pixels(stride * height, 0);
+  ASSERT_TRUE(image->Decompress(
+      RawImage(dest_pixels.data(), width, height, stride, 4)));
+  for (int y = 0; y < height; ++y) {
+    ASSERT_TRUE(std::equal(
+        pixels.begin() + y * width * 4, pixels.begin() + (y + 1) * width * 4,
+        dest_pixels.begin() + y * stride));
+  }
+  if (compressed_size != nullptr) {
+    *compressed_size = image->GetByteSize();
+  }
+}
+
+}  // namespace
+
+TEST(ImageCodec, LzRoundTrip) {
+  std::mt19937 random(1);
+  for (size_t size : {0, 1, 3, 4, 5, 100, 70000, 300000}) {
+    std::vector<uint8_t> src(size);
+    for (size_t i = 0; i < size; ++i) {
+      // Mix repetitive and random stretches.
+      src[i] = (i / 1000) % 2 ? random() % 256 : i % 7;
+    }
+    std::vector<uint8_t> compressed;
+    CompressedImage::LzCompress(src.data(), src.size(), &compressed);
+    std::vector<uint8_t> dest(size);
+    EXPECT_TRUE(CompressedImage::LzDecompress(
+        compressed.data(), compressed.size(), dest.data(), dest.size()));
+    EXPECT_EQ(src, dest);
+  }
+}
+
+TEST(ImageCodec, LzRejectsWrongSizeAndCorruptData) {
+  std::vector<uint8_t> src(1000, 7), compressed;
+  CompressedImage::LzCompress(src.data(), src.size(), &compressed);
+  std::vector<uint8_t> dest(1001);
+  EXPECT_FALSE(CompressedImage::LzDecompress(
+      compressed.data(), compressed.size(), dest.data(), 999));
+  EXPECT_FALSE(CompressedImage::LzDecompress(
+      compressed.data(), compressed.size(), dest.data(), 1001));
+  EXPECT_FALSE(CompressedImage::LzDecompress(
+      compressed.data(), compressed.size() / 2, dest.data(), 1000));
+}
+
+TEST(ImageCodec, CompressesPages) {
+  const int width = 600, height = 800;
+  size_t compressed_size;
+  ExpectRoundTrip(MakePage(width, height), width, height, &compressed_size);
+  EXPECT_LT(compressed_size, width * height * 4 / 8);
+}
+
+TEST(ImageCodec, RoundTripsNoise) {
+  const int width = 123, height = 45;
+  std::vector<uint8_t> pixels(width * height * 4);
+  std::mt19937 random(7);
+  for (uint8_t& value : pixels) {
+    value = random() % 256;
+  }
+  ExpectRoundTrip(pixels, width, height);
+}
+
+TEST(ImageCodec, RoundTripsUniformAndRepeatedRows) {
+  const int width = 50, height = 70;
+  std::vector<uint8_t> pixels(width * height * 4);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 4; ++c) {
+        // Bands of uniform rows of varying colors, and of repeated rows.
+        pixels[(y * width + x) * 4 + c] =
+            (y / 10) % 2 ? (x * 3 + c) % 256 : (y * 11 + c) % 256;
+      }
+    }
+  }
+  ExpectRoundTrip(pixels, width, height);
+}
+
+TEST(ImageCodec, RejectsMismatchedSize) {
+  std::vector<uint8_t> pixels = MakePage(10, 10);
+  std::unique_ptr<CompressedImage> image(CompressedImage::Compress(
+      RawImage(pixels.data(), 10, 10, 10 * 4, 4)));
+  EXPECT_FALSE(
+      image->Decompress(RawImage(pixels.data(), 10, 9, 10 * 4, 4)));
+}
+
+TEST(ImageCodec, SerializedImagesDecompressInPlace) {
+  const int width = 64, height = 100;
+  std::vector<uint8_t> pixels = MakePage(width, height);
+  std::unique_ptr<CompressedImage> image(CompressedImage::Compress(
+      RawImage(pixels.data(), width, height, width * 4, 4)));
+  std::shared_ptr<std::vector<uint8_t>> data =
+      std::make_shared<std::vector<uint8_t>>();
+  image->Serialize(data.get());
+  std::unique_ptr<CompressedImage> deserialized(CompressedImage::Deserialize(
+      data->data(), data->size(), data));
+  ASSERT_NE(deserialized, nullptr);
+  EXPECT_EQ(deserialized->GetWidth(), width);
+  EXPECT_EQ(deserialized->GetHeight(), height);
+  EXPECT_EQ(deserialized->GetByteSize(), image->GetByteSize());
+  std::vector<uint8_t> dest_pixels(pixels.size());
+  ASSERT_TRUE(deserialized->Decompress(
+      RawImage(dest_pixels.data(), width, height, width * 4, 4)));
+  EXPECT_EQ(pixels, dest_pixels);
+}
+
+TEST(ImageCodec, RejectsInvalidSerializedImages) {
+  std::vector<uint8_t> pixels = MakePage(10, 40);
+  std::unique_ptr<CompressedImage> image(CompressedImage::Compress(
+      RawImage(pixels.data(), 10, 40, 10 * 4, 4)));
+  std::vector<uint8_t> data;
+  image->Serialize(&data);
+  EXPECT_EQ(
+      CompressedImage::Deserialize(data.data(), data.size() - 1, nullptr),
+      nullptr);
+  EXPECT_EQ(CompressedImage::Deserialize(data.data(), 8, nullptr), nullptr);
+  data[0] ^= 1;
+  EXPECT_EQ(
+      CompressedImage::Deserialize(data.data(), data.size(), nullptr),
+      nullptr);
+}
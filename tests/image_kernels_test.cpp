@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../src/image_kernels.hpp"
+
+namespace {
+
+// Returns a width x height RGBA image where every byte of pixel (x, y) is
+// value_fn(x, y).
+template <typename F>
+std::vector<uint8_t> MakeImage(int width, int height, F value_fn) {
+  std::vector<uint8_t> pixels(width * height * 4);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 4; ++c) {
+        pixels[(y * width + x) * 4 + c] = value_fn(x, y);
+      }
+    }
+  }
+  return pixels;
+}
+
+}  // namespace
+
+TEST(ImageKernels, ResampleBilinearAtSameSizeIsIdentity) {
+  std::vector<uint8_t> src_pixels =
+      MakeImage(17, 9, [](int x, int y) { return (x * 13 + y * 7) % 256; });
+  std::vector<uint8_t> dest_pixels(src_pixels.size());
+  const RawImage src(src_pixels.data(), 17, 9, 17 * 4, 4);
+  const RawImage dest(dest_pixels.data(), 17, 9, 17 * 4, 4);
+  ResampleBilinear(src, 17, 9, 0, 0, dest);
+  EXPECT_EQ(src_pixels, dest_pixels);
+}
+
+TEST(ImageKernels, ResampleBilinearPreservesUniformColor) {
+  std::vector<uint8_t> src_pixels =
+      MakeImage(10, 10, [](int x, int y) { return 200; });
+  std::vector<uint8_t> dest_pixels(23 * 31 * 4);
+  const RawImage src(src_pixels.data(), 10, 10, 10 * 4, 4);
+  const RawImage dest(dest_pixels.data(), 23, 31, 23 * 4, 4);
+  ResampleBilinear(src, 23, 31, 0, 0, dest);
+  for (uint8_t value : dest_pixels) {
+    EXPECT_EQ(value, 200);
+  }
+}
+
+TEST(ImageKernels, ResampleBilinearInterpolatesBetweenPixels) {
+  // A 2x1 image scaled to 4x1 samples at 1/4 and 3/4 of the way between the
+  // two pixel centers.
+  std::vector<uint8_t> src_pixels =
+      MakeImage(2, 1, [](int x, int y) { return x ? 200 : 0; });
+  std::vector<uint8_t> dest_pixels(4 * 4);
+  const RawImage src(src_pixels.data(), 2, 1, 2 * 4, 4);
+  const RawImage dest(dest_pixels.data(), 4, 1, 4 * 4, 4);
+  ResampleBilinear(src, 4, 1, 0, 0, dest);
+  EXPECT_EQ(dest_pixels[0 * 4], 0);
+  EXPECT_EQ(dest_pixels[1 * 4], 50);
+  EXPECT_EQ(dest_pixels[2 * 4], 150);
+  EXPECT_EQ(dest_pixels[3 * 4], 200);
+}
+
+TEST(ImageKernels, ResampleWritesRequestedRegionOnly) {
+  std::vector<uint8_t> src_pixels =
+      MakeImage(8, 8, [](int x, int y) { return x * 10 + y; });
+  // Scale by 2x, and extract the 4x4 region at (8, 4).
+  std::vector<uint8_t> full_pixels(16 * 16 * 4), region_pixels(4 * 4 * 4);
+  const RawImage src(src_pixels.data(), 8, 8, 8 * 4, 4);
+  ResampleNearest(
+      src, 16, 16, 0, 0, RawImage(full_pixels.data(), 16, 16, 16 * 4, 4));
+  ResampleNearest(
+      src, 16, 16, 8, 4, RawImage(region_pixels.data(), 4, 4, 4 * 4, 4));
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      EXPECT_EQ(
+          region_pixels[(y * 4 + x) * 4],
+          full_pixels[((y + 4) * 16 + (x + 8)) * 4]);
+    }
+  }
+  EXPECT_EQ(region_pixels[0], src_pixels[(2 * 8 + 4) * 4]);
+}
+
+TEST(ImageKernels, RotateQuarterTurnMovesPixelsClockwise) {
+  // Large enough to span several blocks, with partial blocks at the edges.
+  const int width = 70, height = 45;
+  std::vector<uint8_t> src_pixels = MakeImage(
+      width, height, [](int x, int y) { return (x * 3 + y * 5) % 256; });
+  const RawImage src(src_pixels.data(), width, height, width * 4, 4);
+  std::vector<uint8_t> dest_pixels(src_pixels.size());
+  for (int quarter_turns = 1; quarter_turns <= 3; ++quarter_turns) {
+    const int dest_width = quarter_turns % 2 ? height : width,
+              dest_height = quarter_turns % 2 ? width : height;
+    RotateQuarterTurns(
+        src, quarter_turns,
+        RawImage(
+            dest_pixels.data(), dest_width, dest_height, dest_width * 4, 4));
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        int dest_x = x, dest_y = y;
+        switch (quarter_turns) {
+          case 1:
+            dest_x = height - 1 - y;
+            dest_y = x;
+            break;
+          case 2:
+            dest_x = width - 1 - x;
+            dest_y = height - 1 - y;
+            break;
+          case 3:
+            dest_x = y;
+            dest_y = width - 1 - x;
+            break;
+        }
+        EXPECT_EQ(
+            dest_pixels[(dest_y * dest_width + dest_x) * 4],
+            src_pixels[(y * width + x) * 4]);
+      }
+    }
+  }
+}
+
+TEST(ImageKernels, RotateFullTurnIsIdentity) {
+  std::vector<uint8_t> src_pixels =
+      MakeImage(33, 20, [](int x, int y) { return (x * 7 + y) % 256; });
+  std::vector<uint8_t> rotated_pixels(src_pixels.size()),
+      dest_pixels(src_pixels.size());
+  const RawImage src(src_pixels.data(), 33, 20, 33 * 4, 4);
+  const RawImage rotated(rotated_pixels.data(), 20, 33, 20 * 4, 4);
+  RotateQuarterTurns(src, 1, rotated);
+  RotateQuarterTurns(
+      rotated, 3, RawImage(dest_pixels.data(), 33, 20, 33 * 4, 4));
+  EXPECT_EQ(src_pixels, dest_pixels);
+}
+
+TEST(ImageKernels, ExpandGrayComputesLinearPixels) {
+  // A 32-bit format with an alpha byte, where gray level v becomes the pixel
+  // value 0xff000000 + v * 0x010101.
+  std::vector<uint32_t> lut(256);
+  for (uint32_t v = 0; v < 256; ++v) {
+    lut[v] = 0xff000000 | (v << 16) | (v << 8) | v;
+  }
+  std::vector<uint8_t> src_pixels(37 * 11), dest_pixels(37 * 11 * 4);
+  for (size_t i = 0; i < src_pixels.size(); ++i) {
+    src_pixels[i] = (i * 29) % 256;
+  }
+  ExpandGray(
+      RawImage(src_pixels.data(), 37, 11, 37, 1),
+      reinterpret_cast<const uint8_t*>(lut.data()),
+      RawImage(dest_pixels.data(), 37, 11, 37 * 4, 4));
+  for (size_t i = 0; i < src_pixels.size(); ++i) {
+    uint32_t value;
+    memcpy(&value, &dest_pixels[i * 4], 4);
+    EXPECT_EQ(value, lut[src_pixels[i]]);
+  }
+}
+
+TEST(ImageKernels, ExpandGrayLooksUpOtherPixels) {
+  // A 24-bit lut that is not linear, and a destination wider than the source
+  // region, so that row strides differ.
+  std::vector<uint8_t> lut(256 * 3);
+  for (int v = 0; v < 256; ++v) {
+    lut[v * 3] = v;
+    lut[v * 3 + 1] = v / 2;
+    lut[v * 3 + 2] = 255 - v;
+  }
+  std::vector<uint8_t> src_pixels =
+      MakeImage(20, 7, [](int x, int y) { return (x * 11 + y * 3) % 256; });
+  std::vector<uint8_t> dest_pixels(25 * 7 * 3);
+  ExpandGray(
+      RawImage(src_pixels.data(), 20, 7, 20 * 4, 1), lut.data(),
+      RawImage(dest_pixels.data(), 20, 7, 25 * 3, 3));
+  for (int y = 0; y < 7; ++y) {
+    for (int x = 0; x < 20; ++x) {
+      const uint8_t v = src_pixels[y * 20 * 4 + x];
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_EQ(dest_pixels[y * 25 * 3 + x * 3 + c], lut[v * 3 + c]);
+      }
+    }
+  }
+}
+
+TEST(ImageKernels, DownsampleHalfAveragesBlocks) {
+  // An odd-sized image, so that the last row and column of blocks are cut
+  // off.
+  std::vector<uint8_t> src_pixels =
+      MakeImage(7, 5, [](int x, int y) { return x * 20 + y * 3; });
+  std::vector<uint8_t> dest_pixels(4 * 3 * 4);
+  DownsampleHalf(
+      RawImage(src_pixels.data(), 7, 5, 7 * 4, 4),
+      RawImage(dest_pixels.data(), 4, 3, 4 * 4, 4));
+  auto src_value = [&](int x, int y) {
+    return src_pixels[(std::min(y, 4) * 7 + std::min(x, 6)) * 4];
+  };
+  for (int y = 0; y < 3; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      const int sum = src_value(2 * x, 2 * y) + src_value(2 * x + 1, 2 * y) +
+                      src_value(2 * x, 2 * y + 1) +
+                      src_value(2 * x + 1, 2 * y + 1);
+      for (int c = 0; c < 4; ++c) {
+        EXPECT_EQ(dest_pixels[(y * 4 + x) * 4 + c], (sum + 2) / 4);
+      }
+    }
+  }
+}
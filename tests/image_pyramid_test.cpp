@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "../src/image_pyramid.hpp"
+
+namespace {
+
+// Returns a width x height RGB image with a smooth gradient.
+std::vector<uint8_t> MakeGradient(int width, int height) {
+  std::vector<uint8_t> pixels(width * height * 3);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      uint8_t* p = &pixels[(y * width + x) * 3];
+      p[0] = x * 255 / width;
+      p[1] = y * 255 / height;
+      p[2] = 128;
+    }
+  }
+  return pixels;
+}
+
+}  // namespace
+
+TEST(ImagePyramid, HalvesLevelsDownToMinimumSize) {
+  std::vector<uint8_t> pixels = MakeGradient(1500, 601);
+  std::unique_ptr<ImagePyramid> pyramid(
+      ImagePyramid::Build(RawImage(pixels.data(), 1500, 601, 1500 * 3, 3)));
+  ASSERT_NE(pyramid.get(), nullptr);
+  ASSERT_EQ(pyramid->GetNumLevels(), 4);
+  EXPECT_EQ(pyramid->GetLevel(1).GetWidth(), 750);
+  EXPECT_EQ(pyramid->GetLevel(1).GetHeight(), 301);
+  EXPECT_EQ(pyramid->GetLevel(3).GetWidth(), 188);
+  EXPECT_EQ(pyramid->GetLevel(3).GetHeight(), 76);
+  EXPECT_EQ(pyramid->ChooseLevel(1500, 601), 0);
+  EXPECT_EQ(pyramid->ChooseLevel(700, 200), 1);
+  EXPECT_EQ(pyramid->ChooseLevel(100, 50), 3);
+  EXPECT_EQ(pyramid->ChooseLevel(1501, 10), -1);
+  EXPECT_EQ(
+      pyramid->GetByteSize(),
+      pyramid->GetLevel(0).GetByteSize() + pyramid->GetLevel(1).GetByteSize() +
+          pyramid->GetLevel(2).GetByteSize() +
+          pyramid->GetLevel(3).GetByteSize());
+}
+
+TEST(ImagePyramid, RendersFromNearestLevel) {
+  std::vector<uint8_t> pixels = MakeGradient(1024, 1024);
+  std::unique_ptr<ImagePyramid> pyramid(
+      ImagePyramid::Build(RawImage(pixels.data(), 1024, 1024, 1024 * 3, 3)));
+  ASSERT_NE(pyramid.get(), nullptr);
+  std::vector<uint8_t> dest_pixels(200 * 100 * 3);
+  ASSERT_TRUE(
+      pyramid->Render(RawImage(dest_pixels.data(), 200, 100, 200 * 3, 3)));
+  // A gradient scales to about the same gradient.
+  for (int y = 0; y < 100; y += 9) {
+    for (int x = 0; x < 200; x += 9) {
+      const uint8_t* p = &dest_pixels[(y * 200 + x) * 3];
+      EXPECT_NEAR(p[0], x * 255 / 200, 4);
+      EXPECT_NEAR(p[1], y * 255 / 100, 4);
+      EXPECT_EQ(p[2], 128);
+    }
+  }
+  EXPECT_FALSE(
+      pyramid->Render(RawImage(dest_pixels.data(), 2048, 1, 2048 * 3, 3)));
+}
+
+TEST(ImagePyramid, ReassemblesOnlyCompleteLevels) {
+  std::vector<uint8_t> pixels = MakeGradient(600, 300);
+  std::unique_ptr<ImagePyramid> pyramid(
+      ImagePyramid::Build(RawImage(pixels.data(), 600, 300, 600 * 3, 3)));
+  ASSERT_NE(pyramid.get(), nullptr);
+  ASSERT_EQ(pyramid->GetNumLevels(), 3);
+
+  // Round trip the levels through their serialized form.
+  auto copy_levels = [&](int num_levels) {
+    std::vector<std::unique_ptr<CompressedImage>> levels;
+    for (int i = 0; i < num_levels; ++i) {
+      auto data = std::make_shared<std::vector<uint8_t>>();
+      pyramid->GetLevel(i).Serialize(data.get());
+      levels.emplace_back(CompressedImage::Deserialize(
+          data->data(), data->size(), data));
+    }
+    return levels;
+  };
+  std::unique_ptr<ImagePyramid> copy(ImagePyramid::FromLevels(copy_levels(3)));
+  ASSERT_NE(copy.get(), nullptr);
+  EXPECT_EQ(copy->GetNumLevels(), 3);
+  std::unique_ptr<ImagePyramid> partial(
+      ImagePyramid::FromLevels(copy_levels(2)));
+  EXPECT_EQ(partial.get(), nullptr);
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "../src/memory_governor.hpp"
+
+namespace {
+
+// Returns a reading with the given usage in percent of a 1000 byte limit, and
+// PSI value.
+MemoryGovernor::Reading MakeReading(int usage_percent, float pressure) {
+  MemoryGovernor::Reading reading;
+  reading.Current = usage_percent * 10;
+  reading.Max = 1000;
+  reading.Pressure = pressure;
+  return reading;
+}
+
+}  // namespace
+
+TEST(MemoryGovernor, ParsesMemoryValues) {
+  int64_t value;
+  EXPECT_TRUE(MemoryGovernor::ParseMemoryValue("268435456\n", &value));
+  EXPECT_EQ(value, 268435456);
+  EXPECT_TRUE(MemoryGovernor::ParseMemoryValue("max\n", &value));
+  EXPECT_EQ(value, -1);
+  EXPECT_FALSE(MemoryGovernor::ParseMemoryValue("", &value));
+}
+
+TEST(MemoryGovernor, ParsesPressure) {
+  float pressure;
+  EXPECT_TRUE(MemoryGovernor::ParsePressure(
+      "some avg10=12.50 avg60=3.00 avg300=0.75 total=123456\n"
+      "full avg10=1.00 avg60=0.00 avg300=0.00 total=2345\n",
+      &pressure));
+  EXPECT_FLOAT_EQ(pressure, 12.5f);
+  EXPECT_FALSE(MemoryGovernor::ParsePressure("", &pressure));
+}
+
+TEST(MemoryGovernor, RaisesLevelWithUsageOrPressure) {
+  MemoryGovernor governor("", "");
+  EXPECT_FALSE(governor.Update(MakeReading(50, 0.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::NORMAL);
+  EXPECT_TRUE(governor.Update(MakeReading(85, 0.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::MODERATE);
+  EXPECT_TRUE(governor.Update(MakeReading(50, 45.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::CRITICAL);
+}
+
+TEST(MemoryGovernor, LowersLevelOneStepOnceWellBelowThresholds) {
+  MemoryGovernor governor("", "");
+  governor.Update(MakeReading(95, 0.0f));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::CRITICAL);
+  // Just below the critical threshold is not enough.
+  EXPECT_FALSE(governor.Update(MakeReading(85, 0.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::CRITICAL);
+  // Even far below, the level goes down one step at a time.
+  EXPECT_TRUE(governor.Update(MakeReading(10, 0.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::MODERATE);
+  EXPECT_TRUE(governor.Update(MakeReading(10, 0.0f)));
+  EXPECT_EQ(governor.GetLevel(), MemoryGovernor::NORMAL);
+}
+
+TEST(MemoryGovernor, ShrinksCachesWithLevel) {
+  MemoryGovernor governor("", "");
+  EXPECT_EQ(governor.GetCacheSize(9, 2), 9);
+  governor.Update(MakeReading(85, 0.0f));
+  EXPECT_EQ(governor.GetCacheSize(9, 2), 4);
+  EXPECT_EQ(governor.GetCacheSize(3, 2), 2);
+  governor.Update(MakeReading(95, 0.0f));
+  EXPECT_EQ(governor.GetCacheSize(9, 2), 2);
+  EXPECT_EQ(governor.GetCacheSize(1, 2), 1);
+}
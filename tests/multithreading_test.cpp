@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../src/multithreading.hpp"
+
+TEST(WorkQueue, RunsAllJobs) {
+  std::atomic<int> sum(0);
+  std::mutex mutex;
+  std::condition_variable done;
+  int num_done = 0;
+  {
+    WorkQueue queue(4);
+    for (int i = 1; i <= 100; ++i) {
+      queue.Enqueue([&, i] {
+        sum += i;
+        std::unique_lock<std::mutex> lock(mutex);
+        ++num_done;
+        done.notify_all();
+      });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return num_done == 100; });
+  }
+  EXPECT_EQ(sum, 5050);
+}
+
+TEST(WorkQueue, CancelDiscardsPendingJobs) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool started = false, unblocked = false;
+  std::atomic<int> num_run(0);
+  {
+    WorkQueue queue(1, true);
+    // Block the only worker so that later jobs stay pending.
+    queue.Enqueue([&] {
+      std::unique_lock<std::mutex> lock(mutex);
+      started = true;
+      condition.notify_all();
+      condition.wait(lock, [&] { return unblocked; });
+    });
+    for (int i = 0; i < 10; ++i) {
+      queue.Enqueue([&] { ++num_run; });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return started; });
+    queue.Cancel();
+    unblocked = true;
+    condition.notify_all();
+  }
+  EXPECT_EQ(num_run, 0);
+}
+
+TEST(WorkQueue, CancelByOwnerKeepsOtherJobs) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool started = false, unblocked = false;
+  std::atomic<int> num_run_a(0), num_run_b(0);
+  int owner_a = 0, owner_b = 0;
+  {
+    WorkQueue queue(1);
+    queue.Enqueue(
+        [&] {
+          std::unique_lock<std::mutex> lock(mutex);
+          started = true;
+          condition.notify_all();
+          condition.wait(lock, [&] { return unblocked; });
+        },
+        &owner_a);
+    for (int i = 0; i < 10; ++i) {
+      queue.Enqueue([&] { ++num_run_a; }, &owner_a);
+      queue.Enqueue([&] { ++num_run_b; }, &owner_b);
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&] { return started; });
+      queue.Cancel(&owner_a);
+      unblocked = true;
+      condition.notify_all();
+    }
+    // Once owner_a's running job is done, none of its jobs run again.
+    queue.Wait(&owner_a);
+    bool done = false;
+    queue.Enqueue(
+        [&] {
+          std::unique_lock<std::mutex> lock(mutex);
+          done = true;
+          condition.notify_all();
+        },
+        &owner_b);
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return done; });
+  }
+  EXPECT_EQ(num_run_a, 0);
+  EXPECT_EQ(num_run_b, 10);
+}
+
+TEST(WorkQueue, NewJobsWakeIdleWorkersWhileWaiting) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool started = false, unblocked = false;
+  int owner_a = 0, owner_b = 0;
+  {
+    WorkQueue queue(2);
+    queue.Enqueue(
+        [&] {
+          std::unique_lock<std::mutex> lock(mutex);
+          started = true;
+          condition.notify_all();
+          condition.wait(lock, [&] { return unblocked; });
+        },
+        &owner_a);
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&] { return started; });
+    }
+    std::thread waiter([&] { queue.Wait(&owner_a); });
+    // Jobs added while a thread waits for owner_a's blocked job are run by
+    // the idle worker, rather than left queued.
+    for (int i = 0; i < 20; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      bool done = false;
+      queue.Enqueue(
+          [&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            done = true;
+            condition.notify_all();
+          },
+          &owner_b);
+      std::unique_lock<std::mutex> lock(mutex);
+      EXPECT_TRUE(condition.wait_for(
+          lock, std::chrono::seconds(5), [&] { return done; }));
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      unblocked = true;
+      condition.notify_all();
+    }
+    waiter.join();
+  }
+}
+
+TEST(WorkQueue, RunsHigherPriorityJobsFirst) {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool started = false, unblocked = false;
+  std::vector<int> order;
+  {
+    WorkQueue queue(1);
+    queue.Enqueue([&] {
+      std::unique_lock<std::mutex> lock(mutex);
+      started = true;
+      condition.notify_all();
+      condition.wait(lock, [&] { return unblocked; });
+    });
+    // Jobs added while the worker is busy are run by priority, and in the
+    // order they were added within a priority.
+    auto record = [&](int id) {
+      std::unique_lock<std::mutex> lock(mutex);
+      order.push_back(id);
+      condition.notify_all();
+    };
+    queue.Enqueue([&] { record(0); }, nullptr, WorkQueue::INDEXING);
+    queue.Enqueue([&] { record(1); }, nullptr, WorkQueue::PREFETCH);
+    queue.Enqueue([&] { record(2); }, nullptr, WorkQueue::VISIBLE);
+    queue.Enqueue([&] { record(3); }, nullptr, WorkQueue::PREFETCH);
+    queue.Enqueue([&] { record(4); }, nullptr, WorkQueue::IMMINENT);
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&] { return started; });
+    unblocked = true;
+    condition.notify_all();
+    condition.wait(lock, [&] { return order.size() == 5; });
+  }
+  EXPECT_EQ(order, std::vector<int>({2, 4, 1, 3, 0}));
+}
+
+TEST(Mailbox, NewerValueReplacesPendingOne) {
+  Mailbox<int> mailbox;
+  EXPECT_TRUE(mailbox.IsEmpty());
+  EXPECT_EQ(mailbox.Take(), nullptr);
+  EXPECT_FALSE(mailbox.Post(std::unique_ptr<int>(new int(1))));
+  EXPECT_TRUE(mailbox.Post(std::unique_ptr<int>(new int(2))));
+  EXPECT_FALSE(mailbox.IsEmpty());
+  std::unique_ptr<int> value = mailbox.Take();
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(*value, 2);
+  EXPECT_TRUE(mailbox.IsEmpty());
+}
+
+TEST(Mailbox, ReceiverSeesLatestValue) {
+  Mailbox<int> mailbox;
+  std::atomic<bool> done(false);
+  int last_seen = 0;
+  bool in_order = true;
+  std::thread receiver([&] {
+    for (;;) {
+      const bool was_done = done;
+      std::unique_ptr<int> value = mailbox.Take();
+      if (value != nullptr) {
+        in_order = in_order && (*value > last_seen);
+        last_seen = *value;
+      } else if (was_done) {
+        return;
+      }
+    }
+  });
+  for (int i = 1; i <= 10000; ++i) {
+    mailbox.Post(std::unique_ptr<int>(new int(i)));
+  }
+  done = true;
+  receiver.join();
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(last_seen, 10000);
+}
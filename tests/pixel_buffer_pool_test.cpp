@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../src/pixel_buffer_pool.hpp"
+
+namespace {
+
+// A 24-bit pixel format.
+class RGB888Format : public PixelBuffer::Format {
+ public:
+  int GetDepth() const override { return 3; }
+  uint32_t Pack(uint8_t r, uint8_t g, uint8_t b) const override {
+    return (r << 16) | (g << 8) | b;
+  }
+};
+
+}  // namespace
+
+TEST(PixelBufferPool, RoundsSizesUpToSizeClasses) {
+  EXPECT_EQ(PixelBufferPool::GetBlockSize(0), 4096);
+  EXPECT_EQ(PixelBufferPool::GetBlockSize(4096), 4096);
+  EXPECT_EQ(PixelBufferPool::GetBlockSize(4097), 8192);
+  // Classes between 1 MB and 2 MB are 128 KB apart.
+  EXPECT_EQ(
+      PixelBufferPool::GetBlockSize((1 << 20) + 1), (1 << 20) + (1 << 17));
+  for (size_t size = 1; size < (64 << 20); size = size * 3 / 2 + 1) {
+    const size_t block_size = PixelBufferPool::GetBlockSize(size);
+    EXPECT_GE(block_size, size);
+    EXPECT_LE(block_size, size + size / 8 + 4096);
+  }
+}
+
+TEST(PixelBufferPool, AlignsRows) {
+  EXPECT_EQ(PixelBufferPool::GetAlignedWidth(100, 4), 112);
+  EXPECT_EQ(PixelBufferPool::GetAlignedWidth(100, 2), 128);
+  EXPECT_EQ(PixelBufferPool::GetAlignedWidth(100, 3), 128);
+  EXPECT_EQ(PixelBufferPool::GetAlignedWidth(64, 3), 64);
+}
+
+TEST(PixelBufferPool, ReusesReleasedBlocks) {
+  PixelBufferPool pool;
+  // Small blocks come from slabs, and large ones are mapped on their own.
+  for (size_t size : {100000, 20 << 20}) {
+    uint8_t* const block = pool.Allocate(size);
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 64, 0);
+    block[0] = block[size - 1] = 1;
+    pool.Release(block, size);
+    EXPECT_EQ(pool.Allocate(size - 10), block);
+    pool.Release(block, size - 10);
+  }
+  EXPECT_EQ(pool.GetStats().NumReused, 2);
+}
+
+TEST(PixelBufferPool, CarvesSlabsIntoBlocks) {
+  PixelBufferPool pool;
+  const size_t size = 1 << 20;
+  uint8_t* const first = pool.Allocate(size);
+  uint8_t* const second = pool.Allocate(size);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(second, first + size);
+  EXPECT_EQ(
+      pool.GetStats().MappedBytes,
+      size * PixelBufferPool::BLOCKS_PER_SLAB);
+  pool.Release(first, size);
+  pool.Release(second, size);
+}
+
+TEST(PixelBufferPool, TrimUnmapsUnusedMemory) {
+  PixelBufferPool pool;
+  const size_t small_size = 1 << 20, large_size = 20 << 20;
+  uint8_t* const small_block = pool.Allocate(small_size);
+  uint8_t* const large_block = pool.Allocate(large_size);
+  uint8_t* const used_block = pool.Allocate(2 << 20);
+  pool.Release(small_block, small_size);
+  pool.Release(large_block, large_size);
+  EXPECT_GT(pool.GetStats().FreeBytes, 0);
+
+  pool.Trim();
+  const PixelBufferPool::Stats stats = pool.GetStats();
+  EXPECT_EQ(stats.FreeBytes, 0);
+  // Only the slab holding the block still in use is left.
+  EXPECT_EQ(stats.MappedBytes, PixelBufferPool::GetSlabSize(2 << 20));
+  pool.Release(used_block, 2 << 20);
+}
+
+TEST(PixelBufferPool, UnmapsFreeSlabsBeyondLimit) {
+  PixelBufferPool pool;
+  const size_t size = 4 << 20;
+  const int num_blocks = 2 * PixelBufferPool::MAX_FREE_BYTES / size;
+  std::vector<uint8_t*> blocks;
+  for (int i = 0; i < num_blocks; ++i) {
+    blocks.push_back(pool.Allocate(size));
+    ASSERT_NE(blocks.back(), nullptr);
+  }
+  for (uint8_t* block : blocks) {
+    pool.Release(block, size);
+  }
+  // Slabs that became free once the limit was reached are unmapped, and the
+  // ones left are entirely free.
+  const PixelBufferPool::Stats stats = pool.GetStats();
+  EXPECT_LE(stats.FreeBytes, PixelBufferPool::MAX_FREE_BYTES);
+  EXPECT_EQ(stats.MappedBytes, stats.FreeBytes);
+}
+
+TEST(PixelBufferPool, CreatesPixelBuffersWithPooledMemory) {
+  PixelBufferPool pool;
+  RGB888Format format;
+  {
+    std::shared_ptr<PixelBuffer> buffer =
+        pool.NewPixelBuffer(PixelBuffer::Size(100, 50), &format);
+    buffer->Fill(buffer->GetRect(), 1, 2, 3);
+    EXPECT_EQ(buffer->GetSize().Width, 100);
+    EXPECT_EQ(buffer->GetSize().Height, 50);
+    EXPECT_EQ(pool.GetStats().FreeBytes, 0);
+  }
+  EXPECT_EQ(
+      pool.GetStats().FreeBytes, PixelBufferPool::GetBlockSize(128 * 50 * 3));
+  std::shared_ptr<PixelBuffer> buffer =
+      pool.NewPixelBuffer(PixelBuffer::Size(100, 50), &format);
+  EXPECT_EQ(pool.GetStats().NumReused, 1);
+}
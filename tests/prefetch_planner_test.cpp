@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "../src/prefetch_planner.hpp"
+
+namespace {
+
+typedef PrefetchPlanner::Clock Clock;
+
+}  // namespace
+
+TEST(PrefetchPlanner, PlansOnePageAheadWhenIdle) {
+  PrefetchPlanner planner(0, 0);
+  int num_ahead, num_behind;
+  planner.Plan(7, Clock::now(), &num_ahead, &num_behind);
+  EXPECT_FALSE(planner.IsMovingBackward());
+  EXPECT_EQ(num_ahead, PrefetchPlanner::MIN_NUM_AHEAD);
+  EXPECT_EQ(num_behind, PrefetchPlanner::MAX_NUM_BEHIND);
+}
+
+TEST(PrefetchPlanner, PlansFurtherAheadWhenMovingFast) {
+  PrefetchPlanner planner(10, 0);
+  const Clock::time_point start = Clock::now();
+  // Move 6 pages in 300ms.
+  for (int i = 1; i <= 6; ++i) {
+    planner.Record(10 + i, 0, start + std::chrono::milliseconds(50 * i));
+  }
+  const Clock::time_point now = start + std::chrono::milliseconds(300);
+  EXPECT_FLOAT_EQ(planner.GetSpeed(now), 2.0f);
+  int num_ahead, num_behind;
+  planner.Plan(100, now, &num_ahead, &num_behind);
+  EXPECT_EQ(num_ahead, 5);
+  EXPECT_EQ(num_behind, PrefetchPlanner::MAX_NUM_BEHIND);
+
+  // The budget takes precedence, and pages ahead come first.
+  planner.Plan(3, now, &num_ahead, &num_behind);
+  EXPECT_EQ(num_ahead, 3);
+  EXPECT_EQ(num_behind, 0);
+
+  // Speed decays once the moves are old enough.
+  EXPECT_FLOAT_EQ(
+      planner.GetSpeed(
+          now + std::chrono::milliseconds(PrefetchPlanner::HISTORY_MS + 1)),
+      0.0f);
+}
+
+TEST(PrefetchPlanner, ResetsWhenDirectionReverses) {
+  PrefetchPlanner planner(10, 0);
+  const Clock::time_point start = Clock::now();
+  EXPECT_FALSE(planner.Record(11, 0, start));
+  EXPECT_FALSE(planner.Record(12, 0, start));
+  // Scrolling up within a page counts as moving backward.
+  EXPECT_TRUE(planner.Record(12, -100, start));
+  EXPECT_TRUE(planner.IsMovingBackward());
+  EXPECT_FLOAT_EQ(planner.GetSpeed(start), 0.0f);
+  EXPECT_FALSE(planner.Record(11, 0, start));
+  EXPECT_TRUE(planner.IsMovingBackward());
+}
+
+TEST(PrefetchPlanner, PrefetchesExpensivePagesFurtherAhead) {
+  PrefetchPlanner planner(10, 0);
+  const Clock::time_point start = Clock::now();
+  // Idle: only the next page is due, and only if it is not cheap.
+  EXPECT_TRUE(planner.ShouldPrefetch(1, 100, start));
+  EXPECT_FALSE(planner.ShouldPrefetch(1, 1, start));
+  EXPECT_FALSE(planner.ShouldPrefetch(2, 10000, start));
+
+  // At 2 pages per second, the view moves every 500ms, so a page 3 pages ahead
+  // must start now if it takes longer than 1s.
+  for (int i = 1; i <= 6; ++i) {
+    planner.Record(10 + i, 0, start + std::chrono::milliseconds(50 * i));
+  }
+  const Clock::time_point now = start + std::chrono::milliseconds(300);
+  EXPECT_TRUE(planner.ShouldPrefetch(3, 1500, now));
+  EXPECT_FALSE(planner.ShouldPrefetch(3, 500, now));
+}
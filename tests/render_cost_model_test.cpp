@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../src/render_cost_model.hpp"
+
+TEST(RenderCostModel, PredictsFromRecordedCosts) {
+  RenderCostModel model;
+  EXPECT_FLOAT_EQ(
+      model.Predict(0, 1000, 1000),
+      RenderCostModel::DEFAULT_MS_PER_MEGAPIXEL);
+
+  // Costs scale with the number of pixels.
+  model.Record(3, 1000, 2000, 80);
+  EXPECT_FLOAT_EQ(model.Predict(3, 1000, 1000), 40);
+  model.Record(5, 1000, 1000, 20);
+  EXPECT_FLOAT_EQ(model.Predict(5, 500, 1000), 10);
+  // Unrecorded pages are predicted from the average.
+  EXPECT_FLOAT_EQ(model.Predict(4, 1000, 1000), 30);
+  // Renders are averaged.
+  model.Record(5, 1000, 1000, 40);
+  EXPECT_FLOAT_EQ(model.Predict(5, 1000, 1000), 30);
+}
+
+TEST(RenderCostModel, SavesAndLoads) {
+  char dir[] = "/tmp/render_cost_model_test.XXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  const std::string path = std::string(dir) + "/a/b/costs";
+
+  RenderCostModel model;
+  model.Record(1, 1000, 1000, 25);
+  model.Record(7, 1000, 1000, 250);
+  ASSERT_TRUE(model.Save(path));
+
+  RenderCostModel loaded_model;
+  ASSERT_TRUE(loaded_model.Load(path));
+  EXPECT_FLOAT_EQ(loaded_model.Predict(1, 1000, 1000), 25);
+  EXPECT_FLOAT_EQ(loaded_model.Predict(7, 1000, 1000), 250);
+  EXPECT_FALSE(loaded_model.Load(std::string(dir) + "/missing"));
+
+  remove(path.c_str());
+  remove((std::string(dir) + "/a/b").c_str());
+  remove((std::string(dir) + "/a").c_str());
+  remove(dir);
+}
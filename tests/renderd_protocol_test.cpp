@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include "../src/renderd_protocol.hpp"
+
+TEST(RenderdProtocol, PassesMessagesAndFileDescriptors) {
+  int sockets[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+  EXPECT_TRUE(IsRenderdPeerTrusted(sockets[0]));
+
+  // A message without a file descriptor.
+  RenderdReply reply = {0, 640, 480}, received_reply;
+  int fd;
+  ASSERT_TRUE(SendRenderdMessage(sockets[0], &reply, sizeof(reply)));
+  ASSERT_TRUE(ReceiveRenderdMessage(
+      sockets[1], &received_reply, sizeof(received_reply), &fd));
+  EXPECT_EQ(received_reply.Width, 640);
+  EXPECT_EQ(received_reply.Height, 480);
+  EXPECT_EQ(fd, -1);
+
+  // A message with a file descriptor, which refers to the same file.
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(write(fileno(file), "abc", 3), 3);
+  ASSERT_TRUE(
+      SendRenderdMessage(sockets[0], &reply, sizeof(reply), fileno(file)));
+  ASSERT_TRUE(ReceiveRenderdMessage(
+      sockets[1], &received_reply, sizeof(received_reply), &fd));
+  ASSERT_NE(fd, -1);
+  char buffer[3];
+  EXPECT_EQ(pread(fd, buffer, 3, 0), 3);
+  EXPECT_EQ(std::string(buffer, 3), "abc");
+  close(fd);
+  fclose(file);
+
+  // Messages of the wrong size are rejected.
+  ASSERT_TRUE(SendRenderdMessage(sockets[0], &reply, sizeof(reply) - 1));
+  EXPECT_FALSE(ReceiveRenderdMessage(
+      sockets[1], &received_reply, sizeof(received_reply), &fd));
+
+  close(sockets[0]);
+  close(sockets[1]);
+}
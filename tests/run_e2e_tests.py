@@ -61,6 +61,15 @@ class JfbviewE2ETester:
         for key in keys:
             self.send_key(key)
 
+    def send_keys_at_once(self, keys):
+        """Send keys without pausing, so that they queue up behind a render."""
+        print(f"Sending keys at once: {keys}")
+        for key in keys:
+            self.send_qmp_cmd({
+                "execute": "human-monitor-command",
+                "arguments": {"command-line": f"sendkey {key}"}
+            })
+
     def drain_renders(self, timeout=10, silence_duration=1.5):
         """Wait until no more renders occur for silence_duration seconds."""
         print("Waiting for renders to stabilize...")
@@ -79,15 +88,15 @@ class JfbviewE2ETester:
                     raise TimeoutError("Timeout waiting for renders to stabilize.")
                 time.sleep(0.1)
 
-    def take_screenshot_and_compare(self, golden_name):
-        screenshot_path = os.path.join(OUT_DIR, golden_name)
+    def take_screenshot(self, name):
+        screenshot_path = os.path.join(OUT_DIR, name)
         if os.path.exists(screenshot_path):
             os.remove(screenshot_path)
 
-        print(f"Taking screenshot for {golden_name}...")
+        print(f"Taking screenshot for {name}...")
         # Give QEMU VGA buffer a moment to sync
         time.sleep(1)
-        self.send_qmp_cmd({"execute": "screendump", "arguments": {"filename": golden_name}})
+        self.send_qmp_cmd({"execute": "screendump", "arguments": {"filename": name}})
         
         # Wait for file to exist and stop growing
         start_time = time.time()
@@ -101,6 +110,10 @@ class JfbviewE2ETester:
                 if current_size == last_size and current_size > 0:
                     break
                 last_size = current_size
+        return screenshot_path
+
+    def take_screenshot_and_compare(self, golden_name):
+        screenshot_path = self.take_screenshot(golden_name)
 
         golden_path = os.path.join(GOLDEN_DIR, golden_name)
         if self.update_goldens:
@@ -115,6 +128,15 @@ class JfbviewE2ETester:
             self.failures.append((golden_name, msg))
             return
 
+        self.compare(golden_name, screenshot_path, golden_path)
+
+    def take_screenshot_and_compare_with(self, name, other_name):
+        """Compare a screenshot with one taken earlier in the same run."""
+        screenshot_path = self.take_screenshot(name)
+        print(f"Comparing against {other_name}...")
+        self.compare(name, screenshot_path, os.path.join(OUT_DIR, other_name))
+
+    def compare(self, golden_name, screenshot_path, golden_path):
         diff_path = os.path.join(OUT_DIR, f"diff_{golden_name}.png")
         ret = subprocess.run(["compare", "-metric", "RMSE", screenshot_path, golden_path, diff_path], capture_output=True)
         output = ret.stderr.decode('utf-8').strip()
@@ -238,6 +260,36 @@ def run_test_scenario(tester):
     tester.drain_renders()
     tester.take_screenshot_and_compare("search_jump.ppm")
 
+    # 19. Zoom in 3 times with keys queued up behind each other, and one at a
+    # time. Each zoom step applies to the zoom ratio the previous one led to.
+    tester.send_key("s")
+    tester.drain_renders()
+    tester.send_keys_at_once(["equal"] * 3)
+    tester.drain_renders()
+    tester.take_screenshot("zoom_in_queued.ppm")
+    tester.send_key("s")
+    tester.drain_renders()
+    for _ in range(3):
+        tester.send_key("equal")
+        tester.drain_renders()
+    tester.take_screenshot_and_compare_with(
+        "zoom_in_separate.ppm", "zoom_in_queued.ppm")
+
+    # 20. Scroll up past the top of a page, and on, the same two ways. Later
+    # keys scroll from the bottom of the previous page.
+    tester.send_keys(["1", "0", "g"])
+    tester.drain_renders()
+    tester.send_keys_at_once(["up"] * 3)
+    tester.drain_renders()
+    tester.take_screenshot("scroll_up_queued.ppm")
+    tester.send_keys(["1", "0", "g"])
+    tester.drain_renders()
+    for _ in range(3):
+        tester.send_key("up")
+        tester.drain_renders()
+    tester.take_screenshot_and_compare_with(
+        "scroll_up_separate.ppm", "scroll_up_queued.ppm")
+
 def main():
     parser = argparse.ArgumentParser(description="Run E2E UI tests for jfbview via QEMU.")
     parser.add_argument("--update-goldens", action="store_true", help="Update golden reference images instead of comparing.")